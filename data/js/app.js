@@ -1,5 +1,79 @@
 const appCreatedEvent = new CustomEvent('appCreated')
 
+// Command channel for setting changes: one WebSocket, requests carry an id that the device echoes in its
+// acknowledgement. Opened on first use and again after it was closed.
+const commands = {
+    socket: null,
+    nextId: 1,
+    pending: new Map(),
+    timeoutMs: 5000,
+
+    connect() {
+        if (this.socket && this.socket.readyState <= WebSocket.OPEN) {
+            return this.socket;
+        }
+
+        const protocol = window.location.protocol === 'https:' ? 'wss:' : 'ws:';
+        this.socket = new WebSocket(protocol + '//' + window.location.host + '/ws');
+
+        this.socket.onmessage = (event) => {
+            let reply;
+
+            try {
+                reply = JSON.parse(event.data);
+            } catch (e) {
+                console.error('Command reply parse error:', e);
+                return;
+            }
+
+            const request = this.pending.get(reply.id);
+
+            if (!request) return;
+
+            this.pending.delete(reply.id);
+            clearTimeout(request.timer);
+
+            if (reply.ok) {
+                request.resolve(reply);
+            } else {
+                request.reject(new Error(reply.error || 'command failed'));
+            }
+        };
+
+        this.socket.onclose = () => {
+            for (const request of this.pending.values()) {
+                clearTimeout(request.timer);
+                request.reject(new Error('command channel closed'));
+            }
+
+            this.pending.clear();
+        };
+
+        return this.socket;
+    },
+
+    send(cmd, args) {
+        const socket = this.connect();
+        const id = this.nextId++;
+        const message = JSON.stringify({ id, cmd, ...args });
+
+        return new Promise((resolve, reject) => {
+            const timer = setTimeout(() => {
+                this.pending.delete(id);
+                reject(new Error('no acknowledgement'));
+            }, this.timeoutMs);
+
+            this.pending.set(id, { resolve, reject, timer });
+
+            if (socket.readyState === WebSocket.OPEN) {
+                socket.send(message);
+            } else {
+                socket.addEventListener('open', () => socket.send(message), { once: true });
+            }
+        });
+    }
+};
+
 const vueApp = Vue.createApp({
     data() {
         return {
@@ -14,6 +88,13 @@ const vueApp = Vue.createApp({
             showRebootBanner: false,
             changedRebootParams: [],
 
+            // Trial mode (changes kept in RAM until committed)
+            trial: {
+                active: false,
+                remaining: 0,
+                changes: 0
+            },
+
             // Live status (home page, updated via SSE)
             status: {
                 currentWeight: 0,
@@ -35,6 +116,12 @@ const vueApp = Vue.createApp({
             uploadMessage: '',
             uploadSuccess: false,
 
+            // Firmware update
+            otaFile: null,
+            isUpdating: false,
+            otaMessage: '',
+            otaSuccess: false,
+
             // Factory reset
             factoryResetMessage: '',
             factoryResetSuccess: false,
@@ -47,7 +134,11 @@ const vueApp = Vue.createApp({
             },
 
             wasBrewing: false,
-            flowChart: null
+            flowChart: null,
+
+            // Goal weight sent over the command channel but not acknowledged yet
+            pendingGoalWeight: null,
+            goalWeightTimer: null
         }
     },
 
@@ -60,6 +151,13 @@ const vueApp = Vue.createApp({
 
         // Initial status fetch
         this.fetchStatus();
+
+        // Count down the trial timeout between fetches
+        setInterval(() => {
+            if (this.trial.active && this.trial.remaining > 0) {
+                this.trial.remaining--;
+            }
+        }, 1000);
     },
 
     beforeUnmount() {
@@ -77,6 +175,11 @@ const vueApp = Vue.createApp({
             evtSource.addEventListener('status', (event) => {
                 try {
                     const data = JSON.parse(event.data);
+
+                    if (this.pendingGoalWeight !== null) {
+                        delete data.goalWeight;
+                    }
+
                     Object.assign(this.status, data);
                     shotChart.update(data);
 
@@ -108,19 +211,61 @@ const vueApp = Vue.createApp({
 
             if (newVal < 10 || newVal > 100) return;
 
-            // Optimistic UI update
+            // Optimistic UI update, status events keep it until the device acknowledged the change
             this.status.goalWeight = newVal;
+            this.pendingGoalWeight = newVal;
 
-            // Persist to config via /parameters POST
-            fetch('/parameters', {
-                method: 'POST',
-                headers: { 'Content-Type': 'application/x-www-form-urlencoded' },
-                body: 'brew.goal_weight=' + encodeURIComponent(newVal)
-            }).catch(err => console.error('Failed to save goal weight:', err));
+            // Rapid taps only send the last value
+            clearTimeout(this.goalWeightTimer);
+            this.goalWeightTimer = setTimeout(async () => {
+                try {
+                    const reply = await commands.send('set', { name: 'brew.goal_weight', value: newVal });
+
+                    if (this.pendingGoalWeight === newVal) {
+                        this.status.goalWeight = reply.value;
+                    }
+                } catch (e) {
+                    console.error('Failed to set goal weight:', e);
+                } finally {
+                    if (this.pendingGoalWeight === newVal) {
+                        this.pendingGoalWeight = null;
+                    }
+                }
+            }, 400);
+        },
+
+        // --- Trial mode ---
+        async fetchTrial() {
+            try {
+                const response = await fetch('/trial');
+                Object.assign(this.trial, await response.json());
+            } catch (e) {
+                console.error('Trial status fetch error:', e);
+            }
+        },
+
+        async trialAction(action) {
+            try {
+                const response = await fetch('/trial/' + action, { method: 'POST' });
+                Object.assign(this.trial, await response.json());
+            } catch (e) {
+                console.error('Trial ' + action + ' failed:', e);
+            }
+
+            if (action !== 'start') {
+                this.fetchParameters();
+            }
+        },
+
+        formatTrialRemaining() {
+            const minutes = Math.floor(this.trial.remaining / 60);
+            const seconds = String(this.trial.remaining % 60).padStart(2, '0');
+            return minutes + ':' + seconds;
         },
 
         // --- Parameter management ---
         async fetchParameters() {
+            this.fetchTrial();
             this.parameters = [];
             this.originalValues = {};
             let offset = 0;
@@ -198,7 +343,12 @@ const vueApp = Vue.createApp({
                 if (!response.ok) throw new Error(`HTTP ${response.status}`);
                 return response.text();
             })
-            .then(() => {
+            .then(text => {
+                // Rejected values, e.g. a stop rule that does not compile, are listed after the first line
+                if (text.startsWith("Partial Success")) {
+                    alert("Some settings were not saved:" + text.substring("Partial Success".length));
+                }
+
                 this.fetchParameters();
 
                 if (rebootParamsChanged.length > 0) {
@@ -239,7 +389,8 @@ const vueApp = Vue.createApp({
                 1: 'Scale',
                 2: 'Switch',
                 3: 'System',
-                4: 'Other'
+                4: 'Other',
+                5: 'Telemetry'
             };
             return names[sectionId] || 'Unknown';
         },
@@ -387,6 +538,52 @@ const vueApp = Vue.createApp({
             }
         },
 
+        // --- Firmware update ---
+        handleOtaFileSelect(event) {
+            const file = event.target.files[0];
+            this.otaFile = null;
+            this.otaMessage = '';
+
+            if (!file) return;
+
+            if (!file.name.toLowerCase().endsWith('.ota')) {
+                this.otaMessage = 'Please select an update package (.ota).';
+                this.otaSuccess = false;
+                return;
+            }
+
+            this.otaFile = file;
+            this.otaMessage = `Selected: ${file.name} (${(file.size / 1024).toFixed(1)} KB)`;
+            this.otaSuccess = true;
+        },
+
+        async uploadOta() {
+            if (!this.otaFile) return;
+
+            this.isUpdating = true;
+            this.otaMessage = 'Uploading and verifying...';
+
+            try {
+                const formData = new FormData();
+                formData.append('update', this.otaFile);
+
+                const response = await fetch('/update', { method: 'POST', body: formData });
+                const result = await response.json();
+
+                this.otaSuccess = result.success;
+                this.otaMessage = result.message;
+
+                if (result.success) {
+                    this.otaMessage += ` ${(result.bytes / 1024).toFixed(0)} KB in ${(result.durationMs / 1000).toFixed(1)}s (${result.throughputKBps} KB/s)`;
+                }
+            } catch (error) {
+                this.otaMessage = 'Update failed. Please try again.';
+                this.otaSuccess = false;
+            } finally {
+                this.isUpdating = false;
+            }
+        },
+
         // --- Helpers ---
         formatUptime(seconds) {
             const h = Math.floor(seconds / 3600);
@@ -424,6 +621,21 @@ window.vueApp = vueApp;
 window.dispatchEvent(appCreatedEvent);
 window.appCreated = true;
 
+// Offline cache of the UI (data/sw.js), browsers only allow it on HTTPS or localhost
+if ('serviceWorker' in navigator) {
+    const hadController = !!navigator.serviceWorker.controller;
+
+    // A new worker takes over after a firmware update, reload once to show the new UI
+    navigator.serviceWorker.addEventListener('controllerchange', () => {
+        if (hadController) window.location.reload();
+    });
+
+    window.addEventListener('load', () => {
+        navigator.serviceWorker.register('/sw.js', { updateViaCache: 'none' })
+            .catch(error => console.warn('Service worker not registered:', error));
+    });
+}
+
 function groupBy(array, key) {
     const result = {};
     array.forEach(item => {
@@ -0,0 +1,48 @@
+// Service worker of the web UI
+//
+// Keeps the app shell (pages, bundle, manifest) in a cache named after the firmware version and the bundle
+// hash, so a returning phone loads the UI without asking the device for it. Everything that is not part of the
+// shell, the live /status and /events data, the settings API and uploads, always goes to the device.
+//
+// The firmware fills in VERSION when it serves this file and scripts/build_web_bundle.py fills in BUNDLE and
+// SHELL. A firmware or filesystem update therefore changes this file, the browser installs the new worker and
+// the shell is fetched from the device once. The worker only runs in a secure context (HTTPS or localhost).
+// Avoid the percent sign in this file, the firmware's template processor would treat it as a placeholder.
+
+const VERSION = "%VERSION%";
+const BUNDLE = "__BUNDLE__";
+const SHELL = __SHELL__;
+const CACHE_PREFIX = "shotstopper-";
+const CACHE = CACHE_PREFIX + VERSION + "-" + BUNDLE;
+
+self.addEventListener("install", event => {
+    // Bypass the HTTP cache, it may still hold the previous version
+    event.waitUntil(caches.open(CACHE)
+        .then(cache => cache.addAll(SHELL.map(url => new Request(url, { cache: "reload" }))))
+        .then(() => self.skipWaiting()));
+});
+
+self.addEventListener("activate", event => {
+    event.waitUntil(caches.keys()
+        .then(keys => Promise.all(keys
+            .filter(key => key.startsWith(CACHE_PREFIX) && key !== CACHE)
+            .map(key => caches.delete(key))))
+        .then(() => self.clients.claim()));
+});
+
+self.addEventListener("fetch", event => {
+    const request = event.request;
+    const url = new URL(request.url);
+
+    if (request.method !== "GET" || url.origin !== self.location.origin) {
+        return;
+    }
+
+    if (!SHELL.includes(url.pathname + url.search)) {
+        return;
+    }
+
+    event.respondWith(caches.open(CACHE)
+        .then(cache => cache.match(request))
+        .then(cached => cached || fetch(request)));
+});
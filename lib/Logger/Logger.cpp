@@ -1,12 +1,16 @@
-#include <WiFi.h>
-
 #include "Logger.h"
 
 int logLevel;
 
+#if FEATURE_TELNET_LOG
 Logger::Logger(const uint16_t port) :
     port_(port), server_(port) {
 }
+#else
+Logger::Logger(const uint16_t port) :
+    port_(port) {
+}
+#endif
 
 Logger& Logger::getInstanceImpl(const uint16_t port) {
     static Logger instance{port};
@@ -18,9 +22,11 @@ void Logger::init(const uint16_t port) {
 }
 
 bool Logger::begin() {
+#if FEATURE_TELNET_LOG
     if (WiFi.status() == WL_CONNECTED) {
         getInstance().server_.begin();
     }
+#endif
 
     // If the serial interface has not been started, start it now:
     if (!Serial) {
@@ -30,6 +36,7 @@ bool Logger::begin() {
 }
 
 bool Logger::update() {
+#if FEATURE_TELNET_LOG
     if (getInstance().server_.hasClient()) {
         // If we are already connected to another client, then reject the new connection, otherwise accept the connection.
         if (getInstance().client_.connected()) {
@@ -41,6 +48,7 @@ bool Logger::update() {
             getInstance().client_ = getInstance().server_.available();
         }
     }
+#endif
 
     // update if the loglevel has changed
 
@@ -60,6 +68,7 @@ void Logger::log(const Level level, const String& file, const char* function, co
     char time[12];
     current_time(time);
 
+#if FEATURE_TELNET_LOG
     if (WiFi.status() == WL_CONNECTED && client_.connected()) {
         client_.print(time);
         client_.print(get_level_identifier(level).c_str());
@@ -74,22 +83,23 @@ void Logger::log(const Level level, const String& file, const char* function, co
         }
         client_.print(logmsg);
         client_.print("\n");
+        return;
     }
-    else {
-        Serial.print(time);
-        Serial.print(get_level_identifier(level).c_str());
-        Serial.print(" ");
-        if (level < Level::DEBUG) {
-            Serial.print(file.c_str());
-            Serial.print(":");
-            Serial.print(line);
-            Serial.print("@");
-            Serial.print(function);
-            Serial.print("() ");
-        }
-        Serial.print(logmsg);
-        Serial.print("\n");
+#endif
+
+    Serial.print(time);
+    Serial.print(get_level_identifier(level).c_str());
+    Serial.print(" ");
+    if (level < Level::DEBUG) {
+        Serial.print(file.c_str());
+        Serial.print(":");
+        Serial.print(line);
+        Serial.print("@");
+        Serial.print(function);
+        Serial.print("() ");
     }
+    Serial.print(logmsg);
+    Serial.print("\n");
 }
 
 void Logger::logf(const Level level, const String& file, const char* function, const uint32_t line, const char* format, ...) {
@@ -1,6 +1,19 @@
 #pragma once
 
-#include <WiFiManager.h>
+// Telnet output is compiled out in environments without WiFi (see src/Features.h)
+#ifndef FEATURE_TELNET_LOG
+#if defined(FEATURE_WIFI) && !FEATURE_WIFI
+#define FEATURE_TELNET_LOG 0
+#else
+#define FEATURE_TELNET_LOG 1
+#endif
+#endif
+
+#include <Arduino.h>
+
+#if FEATURE_TELNET_LOG
+#include <WiFi.h>
+#endif
 
 class Logger {
     public:
@@ -111,9 +124,11 @@ class Logger {
         // Port of this logger
         uint16_t port_;
 
+#if FEATURE_TELNET_LOG
         // Server and client
         WiFiClient client_;
         WiFiServer server_;
+#endif
 };
 
 #ifndef __FILE_NAME__
@@ -0,0 +1,456 @@
+# build_web_bundle.py
+#
+# Builds the filesystem image contents of the web UI without any external requests at runtime.
+#
+# The sources in data/ stay as they are edited. For buildfs/uploadfs this script stages a copy in
+# .pio/build/<env>/webfs and points PlatformIO at it:
+#   - Vue, Bootstrap, uPlot and the app scripts are concatenated into /bundle/app.js.gz
+#   - Bootstrap and uPlot CSS, reduced to the rules whose classes the pages use, plus the Font Awesome icons
+#     the pages use as inline SVG, go into /bundle/app.css.gz
+#   - The header fragment is rendered into each page at build time and the pages are gzipped
+#   - The bundle is referenced as /bundle/app.*?v=<hash>, so browsers can cache it for good, and the service
+#     worker (sw.js) gets the hash and the list of shell URLs it caches
+#
+# The libraries are downloaded once into web_vendor/ (pinned versions below). Commit that directory, then the
+# filesystem builds offline. A size budget against the filesystem partition is printed on every build and the
+# build fails if the image would not leave room for config.json.
+#
+#   pio run -e esp32-s3 -t buildfs                      # runs this script as a pre: extra script
+#   python scripts/build_web_bundle.py --out /tmp/webfs # same bundle outside PlatformIO
+#   python scripts/build_web_bundle.py --fetch          # only download missing vendor files
+import argparse
+import gzip
+import hashlib
+import json
+import os
+import re
+import shutil
+import sys
+import urllib.parse
+import urllib.request
+
+VENDOR_DIR = "web_vendor"
+
+# Pinned library files, (local name, URL)
+VENDOR_FILES = [
+    ("vue.global.prod.js", "https://cdn.jsdelivr.net/npm/vue@3.5.13/dist/vue.global.prod.js"),
+    ("bootstrap.min.css", "https://cdn.jsdelivr.net/npm/bootstrap@5.3.3/dist/css/bootstrap.min.css"),
+    ("bootstrap.bundle.min.js", "https://cdn.jsdelivr.net/npm/bootstrap@5.3.3/dist/js/bootstrap.bundle.min.js"),
+    ("uPlot.min.css", "https://cdn.jsdelivr.net/npm/uplot@1.6.31/dist/uPlot.min.css"),
+    ("uPlot.iife.min.js", "https://cdn.jsdelivr.net/npm/uplot@1.6.31/dist/uPlot.iife.min.js"),
+]
+
+FONTAWESOME_METADATA = "https://cdn.jsdelivr.net/npm/@fortawesome/fontawesome-free@6.5.1/metadata/icons.json"
+
+# Script order matters: the app scripts use the Vue, bootstrap and uPlot globals
+BUNDLE_JS = ["vue.global.prod.js", "bootstrap.bundle.min.js", "uPlot.iife.min.js"]
+APP_JS = ["js/chart.js", "js/app.js"]
+BUNDLE_CSS = ["bootstrap.min.css", "uPlot.min.css"]
+BUNDLE_URLS = ["/bundle/app.css", "/bundle/app.js"]
+
+# Service worker, copied uncompressed because the firmware fills in the version when serving it
+SERVICE_WORKER = "sw.js"
+
+# Classes that Bootstrap's JavaScript adds at runtime, kept even though the pages do not mention them
+CSS_SAFELIST = {
+    "show", "fade", "collapse", "collapsing", "popover", "popover-arrow", "popover-header", "popover-body",
+    "bs-popover-top", "bs-popover-bottom", "bs-popover-start", "bs-popover-end", "bs-popover-auto",
+}
+
+# Font Awesome classes that are not icons
+FA_STYLES = {"fa-solid", "fa-regular", "fa-brands", "fa"}
+FA_MODIFIERS = {
+    "fa-xs": "font-size:.75em",
+    "fa-sm": "font-size:.875em",
+    "fa-lg": "font-size:1.25em",
+    "fa-fw": "width:1.25em!important",
+    "fa-spin": "animation:fa-spin 2s linear infinite",
+    **{f"fa-{n}x": f"font-size:{n}em" for n in range(1, 11)},
+}
+
+# LittleFS allocates whole blocks, config.json and the shot history (shots.bin) are rewritten next to their
+# old copies
+FS_BLOCK_SIZE = 4096
+FS_METADATA_BLOCKS = 2
+CONFIG_RESERVE_BLOCKS = 6
+
+
+def fetch(url):
+    print(f"  Fetching {url}")
+
+    with urllib.request.urlopen(url, timeout=60) as response:
+        return response.read()
+
+
+def ensure_vendor(vendor_dir):
+    os.makedirs(vendor_dir, exist_ok=True)
+
+    for name, url in VENDOR_FILES:
+        path = os.path.join(vendor_dir, name)
+
+        if not os.path.exists(path):
+            with open(path, "wb") as f:
+                f.write(fetch(url))
+
+
+def read_text(path):
+    with open(path, "r", encoding="utf-8") as f:
+        return f.read()
+
+
+def source_tokens(data_dir):
+    """All identifier-like words of the pages and app scripts, a superset of the class names in use."""
+    tokens = set()
+
+    for root, _, files in os.walk(data_dir):
+        for name in files:
+            if name.endswith((".html", ".js")):
+                tokens.update(re.findall(r"[A-Za-z_][\w-]*", read_text(os.path.join(root, name))))
+
+    return tokens
+
+
+# --- CSS reduction ----------------------------------------------------------------------------------------------
+
+def split_blocks(css):
+    """Split a stylesheet into (prelude, body) pairs at the top level, body is None for statements like @import."""
+    blocks = []
+    i = 0
+    start = 0
+    length = len(css)
+
+    while i < length:
+        c = css[i]
+
+        if c == "/" and css.startswith("/*", i):
+            end = css.find("*/", i + 2)
+            i = length if end < 0 else end + 2
+
+            if css[start:i].strip().startswith("/*"):
+                start = i
+
+            continue
+
+        if c in "\"'":
+            i = css.find(c, i + 1) + 1 or length
+            continue
+
+        if c == ";":
+            blocks.append((css[start:i].strip(), None))
+            start = i = i + 1
+            continue
+
+        if c == "{":
+            depth = 1
+            j = i + 1
+
+            while j < length and depth:
+                if css[j] in "\"'":
+                    j = css.find(css[j], j + 1) + 1 or length
+                    continue
+
+                depth += {"{": 1, "}": -1}.get(css[j], 0)
+                j += 1
+
+            blocks.append((css[start:i].strip(), css[i + 1:j - 1]))
+            start = i = j
+            continue
+
+        i += 1
+
+    return blocks
+
+
+def split_selectors(prelude):
+    selectors = []
+    depth = 0
+    start = 0
+
+    for i, c in enumerate(prelude):
+        if c in "([":
+            depth += 1
+        elif c in ")]":
+            depth -= 1
+        elif c == "," and depth == 0:
+            selectors.append(prelude[start:i])
+            start = i + 1
+
+    selectors.append(prelude[start:])
+    return [s.strip() for s in selectors if s.strip()]
+
+
+def selector_used(selector, used):
+    # Classes inside :not() do not need to exist for the rule to apply
+    plain = re.sub(r":not\([^)]*\)", "", selector)
+    return all(name in used for name in re.findall(r"\.(-?[_a-zA-Z][\w-]*)", plain))
+
+
+def purge_css(css, used):
+    out = []
+
+    for prelude, body in split_blocks(css):
+        if body is None:
+            if prelude.startswith("@"):
+                out.append(prelude + ";")
+
+        elif prelude.startswith(("@media", "@supports", "@container", "@layer")):
+            inner = purge_css(body, used)
+
+            if inner:
+                out.append(f"{prelude}{{{inner}}}")
+
+        elif prelude.startswith("@"):
+            out.append(f"{prelude}{{{body}}}")
+
+        else:
+            selectors = [s for s in split_selectors(prelude) if selector_used(s, used)]
+
+            if selectors:
+                out.append(f"{','.join(selectors)}{{{body}}}")
+
+    return "".join(out)
+
+
+# --- Icons ------------------------------------------------------------------------------------------------------
+
+def icon_names(tokens):
+    return sorted(t[3:] for t in tokens if t.startswith("fa-") and t not in FA_STYLES and t not in FA_MODIFIERS)
+
+
+def ensure_icons(vendor_dir, names):
+    icon_dir = os.path.join(vendor_dir, "fontawesome")
+    os.makedirs(icon_dir, exist_ok=True)
+    missing = [n for n in names if not os.path.exists(os.path.join(icon_dir, f"{n}.svg"))]
+
+    if not missing:
+        return icon_dir
+
+    metadata = json.loads(fetch(FONTAWESOME_METADATA))
+    by_name = {}
+
+    for name, icon in metadata.items():
+        for alias in [name] + icon.get("aliases", {}).get("names", []):
+            by_name.setdefault(alias, icon)
+
+    for name in missing:
+        icon = by_name.get(name)
+
+        if icon is None:
+            print(f"  Warning: fa-{name} is not a Font Awesome icon, skipped")
+            continue
+
+        # One style per icon is enough, brands only exist as brands
+        svg = next(icon["svg"][style]["raw"] for style in ("solid", "brands", "regular") if style in icon["svg"])
+
+        with open(os.path.join(icon_dir, f"{name}.svg"), "w", encoding="utf-8") as f:
+            f.write(svg)
+
+    return icon_dir
+
+
+def icon_css(icon_dir, names, tokens):
+    css = [".fa-solid,.fa-regular,.fa-brands{display:inline-block;width:1em;height:1em;vertical-align:-.125em;"
+           "background-color:currentColor;-webkit-mask:var(--fa-icon) center/contain no-repeat;"
+           "mask:var(--fa-icon) center/contain no-repeat}"]
+
+    for name in names:
+        path = os.path.join(icon_dir, f"{name}.svg")
+
+        if not os.path.exists(path):
+            continue
+
+        svg = read_text(path)
+        box = re.search(r'viewBox="0 0 (\d+) (\d+)"', svg)
+        width = int(box.group(1)) / int(box.group(2)) if box else 1.0
+        url = urllib.parse.quote(svg, safe=" /=:;,'")
+        css.append(f'.fa-{name}{{width:{width:.4g}em;--fa-icon:url("data:image/svg+xml,{url}")}}')
+
+    for modifier, rule in FA_MODIFIERS.items():
+        if modifier in tokens:
+            css.append(f".{modifier}{{{rule}}}")
+
+    if "fa-spin" in tokens:
+        css.append("@keyframes fa-spin{0%{transform:rotate(0)}to{transform:rotate(360deg)}}")
+
+    return "".join(css)
+
+
+# --- Pages ------------------------------------------------------------------------------------------------------
+
+def render_page(page, fragments):
+    # Same syntax as the template processor of ESPAsyncWebServer: %NAME% is a fragment, %% a literal %
+    def replace(match):
+        name = match.group(1).lower()
+        return fragments[name] if name in fragments else match.group(0)
+
+    return re.sub(r"%([A-Z_]+)%", replace, page).replace("%%", "%")
+
+
+def write_gzip(path, data):
+    """Write path.gz, the web server sends it with Content-Encoding: gzip for requests of path."""
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+
+    # mtime 0 keeps the image reproducible
+    with open(path + ".gz", "wb") as f:
+        with gzip.GzipFile(fileobj=f, mode="wb", compresslevel=9, mtime=0) as gz:
+            gz.write(data)
+
+
+def build(data_dir, vendor_dir, out_dir):
+    ensure_vendor(vendor_dir)
+    tokens = source_tokens(data_dir)
+
+    if os.path.isdir(out_dir):
+        shutil.rmtree(out_dir)
+
+    os.makedirs(out_dir)
+
+    # Scripts, each library followed by a separator in case its last statement lacks one
+    parts = [read_text(os.path.join(vendor_dir, name)) for name in BUNDLE_JS]
+    parts += [read_text(os.path.join(data_dir, name)) for name in APP_JS]
+    script = "\n;\n".join(parts).encode()
+    write_gzip(os.path.join(out_dir, "bundle", "app.js"), script)
+
+    # Styles
+    used = tokens | CSS_SAFELIST
+    names = icon_names(tokens)
+    css = [purge_css(read_text(os.path.join(vendor_dir, name)), used) for name in BUNDLE_CSS]
+    css.append(icon_css(ensure_icons(vendor_dir, names), names, tokens))
+    style = "\n".join(css).encode()
+    write_gzip(os.path.join(out_dir, "bundle", "app.css"), style)
+
+    # The pages reference the bundle by content hash, a changed bundle is a new URL for every cache
+    bundle_hash = hashlib.sha256(style + script).hexdigest()[:12]
+
+    # Pages with the fragments rendered in
+    fragment_dir = os.path.join(data_dir, "html_fragments")
+    fragments = {os.path.splitext(n)[0]: read_text(os.path.join(fragment_dir, n)) for n in os.listdir(fragment_dir)}
+    pages = sorted(os.listdir(os.path.join(data_dir, "html")))
+
+    for name in pages:
+        page = render_page(read_text(os.path.join(data_dir, "html", name)), fragments)
+
+        for url in BUNDLE_URLS:
+            page = page.replace(f'"{url}"', f'"{url}?v={bundle_hash}"')
+
+        write_gzip(os.path.join(out_dir, "html", name), page.encode())
+
+    # Service worker with the hash and the URLs of the app shell
+    shell = ["/"] + [f"/{name}" for name in pages] + [f"{url}?v={bundle_hash}" for url in BUNDLE_URLS]
+    shell.append("/manifest.json")
+    worker = read_text(os.path.join(data_dir, SERVICE_WORKER))
+    worker = worker.replace("__BUNDLE__", bundle_hash).replace("__SHELL__", json.dumps(shell))
+
+    with open(os.path.join(out_dir, SERVICE_WORKER), "w", encoding="utf-8") as f:
+        f.write(worker)
+
+    # Everything else is copied as is
+    for name in os.listdir(data_dir):
+        if name not in ("html", "html_fragments", "js", SERVICE_WORKER):
+            src = os.path.join(data_dir, name)
+            (shutil.copytree if os.path.isdir(src) else shutil.copy2)(src, os.path.join(out_dir, name))
+
+    print(f"Bundle version {bundle_hash}")
+
+
+def partition_size(partitions_csv, name="spiffs"):
+    with open(partitions_csv, "r") as f:
+        for line in f:
+            fields = [field.strip() for field in line.split("#")[0].split(",")]
+
+            if len(fields) >= 5 and fields[0] == name:
+                return int(fields[4], 0)
+
+    return None
+
+
+def report_budget(out_dir, partition_bytes):
+    """Print the size of every file and the estimated filesystem use, False if config.json would not fit."""
+    files = []
+
+    for root, _, names in os.walk(out_dir):
+        for name in names:
+            path = os.path.join(root, name)
+            files.append((os.path.relpath(path, out_dir), os.path.getsize(path)))
+
+    blocks = FS_METADATA_BLOCKS + len({os.path.dirname(p) for p, _ in files})
+    print(f"\n  {'file':<28} {'bytes':>8}")
+
+    for path, size in sorted(files):
+        blocks += max(1, -(-size // FS_BLOCK_SIZE))
+        print(f"  {path:<28} {size:8d}")
+
+    used = blocks * FS_BLOCK_SIZE
+    needed = used + CONFIG_RESERVE_BLOCKS * FS_BLOCK_SIZE
+    total = sum(size for _, size in files)
+    print(f"  {'total':<28} {total:8d}")
+
+    if partition_bytes is None:
+        print(f"\n  Web UI: {used // 1024} KB in {blocks} blocks (partition size unknown)")
+        return True
+
+    print(f"\n  Web UI: {used // 1024} KB + {CONFIG_RESERVE_BLOCKS * FS_BLOCK_SIZE // 1024} KB for config.json and shots.bin "
+          f"of {partition_bytes // 1024} KB ({100 * needed / partition_bytes:.0f}%)")
+
+    if needed > partition_bytes:
+        print(f"  ERROR: the filesystem image exceeds the budget by {(needed - partition_bytes) // 1024 + 1} KB")
+        return False
+
+    return True
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build the self-contained web UI filesystem contents")
+    parser.add_argument("--data", default="data", help="web UI sources (default data)")
+    parser.add_argument("--vendor", default=VENDOR_DIR, help=f"library cache (default {VENDOR_DIR})")
+    parser.add_argument("--out", default=os.path.join(".pio", "webfs"), help="output directory")
+    parser.add_argument("--partitions", default="partitions_4M.csv", help="partition table for the size budget")
+    parser.add_argument("--fetch", action="store_true", help="only download missing vendor files")
+    args = parser.parse_args()
+
+    if args.fetch:
+        ensure_vendor(args.vendor)
+        ensure_icons(args.vendor, icon_names(source_tokens(args.data)))
+        return 0
+
+    build(args.data, args.vendor, args.out)
+    size = partition_size(args.partitions) if os.path.exists(args.partitions) else None
+
+    return 0 if report_budget(args.out, size) else 1
+
+
+def platformio_pre_build(env):
+    from SCons.Script import COMMAND_LINE_TARGETS
+
+    # The firmware does not need the bundle, only the filesystem targets do
+    if not any(t.startswith(("buildfs", "uploadfs")) for t in COMMAND_LINE_TARGETS):
+        return
+
+    project_dir = env.subst("$PROJECT_DIR")
+    out_dir = os.path.join(env.subst("$BUILD_DIR"), "webfs")
+    partitions = os.path.join(project_dir, env.GetProjectOption("board_build.partitions", "partitions_4M.csv"))
+
+    print("Building web UI bundle")
+
+    try:
+        build(env.subst("$PROJECT_DATA_DIR"), os.path.join(project_dir, VENDOR_DIR), out_dir)
+    except OSError as e:
+        sys.exit(f"Web UI bundle failed: {e}\nVendor files missing? Run once with network access: "
+                 "python scripts/build_web_bundle.py --fetch")
+
+    if not report_budget(out_dir, partition_size(partitions) if os.path.exists(partitions) else None):
+        sys.exit(1)
+
+    env.Replace(PROJECT_DATA_DIR=out_dir)
+
+
+try:
+    # noinspection PyUnresolvedReferences
+    Import("env")
+except NameError:
+    env = None
+
+if env is not None:
+    platformio_pre_build(env)
+elif __name__ == "__main__":
+    sys.exit(main())
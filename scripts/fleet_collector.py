@@ -0,0 +1,600 @@
+# fleet_collector.py
+#
+# Collects the live status and the shot results of many shotStopper units into a local columnar store
+# (see /events, /status and /history in src/embeddedWebserver.h).
+#
+#   python scripts/fleet_collector.py --out fleet                          # units found through mDNS
+#   python scripts/fleet_collector.py --out fleet --device 192.168.1.50 --no-mdns
+#   python scripts/fleet_collector.py --out fleet --fake 20 --speed 10    # 20 fake units in this process
+#   python scripts/fleet_collector.py --fake 3 --serve-only               # fake units for a collector elsewhere
+#
+# Every unit gets its own connection to /events, which carries the status once per second, and is polled
+# for /status (health) and /history?since=<last id> (new shots). All units are served from one asyncio loop.
+# Rows are buffered per table and written as Parquet files (pyarrow) to <out>/<table>/, or as CSV if pyarrow
+# is not installed. The last shot id per unit is kept in <out>/collector_state.json, so a restarted
+# collector continues where it stopped; a changed boot id starts over, the shot log of a unit is in RAM.
+#
+# Fake units are deterministic: the same --seed replays the same shots, so a store written against them
+# can be compared between runs.
+import argparse
+import asyncio
+import csv
+import datetime
+import json
+import os
+import random
+import socket
+import struct
+import sys
+import time
+
+try:
+    import pyarrow
+    import pyarrow.parquet
+except ImportError:
+    pyarrow = None
+
+MDNS_GROUP = "224.0.0.251"
+MDNS_PORT = 5353
+SERVICE = "_shotstopper._tcp.local"
+
+HTTP_TIMEOUT_S = 5.0
+RECONNECT_MIN_S = 1.0
+RECONNECT_MAX_S = 60.0
+
+
+# --- Store -------------------------------------------------------------------------------------------------
+
+class Store:
+    """Buffers rows per table and writes them as one file per table and flush."""
+
+    def __init__(self, directory, flush_rows):
+        self.directory = directory
+        self.flush_rows = flush_rows
+        self.tables = {}
+        self.written = {}
+        self.state_path = os.path.join(directory, "collector_state.json")
+        self.state = {}
+
+        os.makedirs(directory, exist_ok=True)
+
+        if os.path.exists(self.state_path):
+            with open(self.state_path, encoding="utf-8") as f:
+                self.state = json.load(f)
+
+    def add(self, table, row):
+        rows = self.tables.setdefault(table, [])
+        rows.append(row)
+
+        if len(rows) >= self.flush_rows:
+            self.flush_table(table)
+
+    def flush(self):
+        for table in list(self.tables):
+            self.flush_table(table)
+
+        temporary = self.state_path + ".tmp"
+
+        with open(temporary, "w", encoding="utf-8") as f:
+            json.dump(self.state, f, indent=1, sort_keys=True)
+
+        os.replace(temporary, self.state_path)
+
+    def flush_table(self, table):
+        rows = self.tables.pop(table, [])
+
+        if not rows:
+            return
+
+        directory = os.path.join(self.directory, table)
+        os.makedirs(directory, exist_ok=True)
+        stamp = datetime.datetime.now(datetime.timezone.utc).strftime("%Y%m%dT%H%M%S%f")
+        columns = sorted({key for row in rows for key in row})
+
+        if pyarrow is not None:
+            pyarrow.parquet.write_table(pyarrow.Table.from_pylist(rows), os.path.join(directory, f"part-{stamp}.parquet"))
+        else:
+            with open(os.path.join(directory, f"part-{stamp}.csv"), "w", newline="", encoding="utf-8") as f:
+                writer = csv.DictWriter(f, fieldnames=columns)
+                writer.writeheader()
+                writer.writerows(rows)
+
+        self.written[table] = self.written.get(table, 0) + len(rows)
+
+
+def flatten(data, prefix=""):
+    """Scalar fields of a JSON object, nested objects as a.b columns."""
+    row = {}
+
+    for key, value in data.items():
+        if isinstance(value, dict):
+            row.update(flatten(value, f"{prefix}{key}."))
+        elif not isinstance(value, list):
+            row[f"{prefix}{key}"] = value
+
+    return row
+
+
+# --- HTTP --------------------------------------------------------------------------------------------------
+
+async def open_get(host, port, path):
+    """Send a GET request, returns the reader positioned after the headers and the status code."""
+    reader, writer = await asyncio.wait_for(asyncio.open_connection(host, port), HTTP_TIMEOUT_S)
+    writer.write(f"GET {path} HTTP/1.1\r\nHost: {host}\r\nAccept: */*\r\nConnection: close\r\n\r\n".encode())
+    await writer.drain()
+
+    status_line = await asyncio.wait_for(reader.readline(), HTTP_TIMEOUT_S)
+    headers = {}
+
+    while True:
+        line = await asyncio.wait_for(reader.readline(), HTTP_TIMEOUT_S)
+
+        if line in (b"\r\n", b"\n", b""):
+            break
+
+        name, _, value = line.decode("latin-1").partition(":")
+        headers[name.strip().lower()] = value.strip()
+
+    parts = status_line.split()
+
+    return reader, writer, int(parts[1]) if len(parts) > 1 else 0, headers
+
+
+async def get_json(host, port, path):
+    reader, writer, status, headers = await open_get(host, port, path)
+
+    try:
+        if headers.get("transfer-encoding", "").lower() == "chunked":
+            body = bytearray()
+
+            while True:
+                size = int((await asyncio.wait_for(reader.readline(), HTTP_TIMEOUT_S)).split(b";")[0], 16)
+
+                if size == 0:
+                    break
+
+                body += await asyncio.wait_for(reader.readexactly(size + 2), HTTP_TIMEOUT_S)
+                del body[-2:]
+        else:
+            body = await asyncio.wait_for(reader.read(), HTTP_TIMEOUT_S)
+    finally:
+        writer.close()
+
+    if status != 200:
+        raise IOError(f"GET {path}: HTTP {status}")
+
+    return json.loads(body)
+
+
+# --- Collector ---------------------------------------------------------------------------------------------
+
+class Unit:
+    """Connection to one device: live status from /events, health from /status, shots from /history."""
+
+    def __init__(self, host, port, store, args):
+        self.host = host
+        self.port = port
+        self.store = store
+        self.args = args
+        self.device = None
+        self.events = 0
+        self.shots = 0
+        self.errors = 0
+
+    @property
+    def name(self):
+        return f"{self.host}:{self.port}"
+
+    async def run(self):
+        backoff = RECONNECT_MIN_S
+
+        while True:
+            try:
+                # A since beyond any id returns the identity without shots
+                identity = await get_json(self.host, self.port, "/history?since=4294967295")
+                self.device = identity["device"]
+                print(f"{self.name}: device {self.device}", file=sys.stderr)
+                backoff = RECONNECT_MIN_S
+
+                await asyncio.gather(self.follow_events(), self.poll_status(), self.poll_history())
+            except (OSError, asyncio.TimeoutError, asyncio.IncompleteReadError, ValueError, KeyError) as e:
+                self.errors += 1
+                print(f"{self.name}: {type(e).__name__} {e}, retrying in {backoff:.0f}s", file=sys.stderr)
+
+            await asyncio.sleep(backoff)
+            backoff = min(backoff * 2, RECONNECT_MAX_S)
+
+    async def follow_events(self):
+        reader, writer, status, _ = await open_get(self.host, self.port, "/events")
+
+        if status != 200:
+            writer.close()
+            raise IOError(f"/events: HTTP {status}")
+
+        event, data = "message", []
+
+        try:
+            while True:
+                # The device sends a status event every second, a silent stream is a dead connection
+                line = (await asyncio.wait_for(reader.readline(), self.args.event_timeout)).decode("utf-8", "replace")
+
+                if line == "":
+                    raise IOError("/events closed")
+
+                line = line.rstrip("\r\n")
+
+                if line.startswith("event:"):
+                    event = line[6:].strip()
+                elif line.startswith("data:"):
+                    data.append(line[5:].strip())
+                elif line == "":
+                    if event == "status" and data:
+                        row = {"host_time": time.time(), "device": self.device, **flatten(json.loads("\n".join(data)))}
+                        self.store.add("status", row)
+                        self.events += 1
+
+                    event, data = "message", []
+        finally:
+            writer.close()
+
+    async def poll_status(self):
+        while True:
+            status = await get_json(self.host, self.port, "/status")
+            self.store.add("health", {"host_time": time.time(), "device": self.device, **flatten(status)})
+            await asyncio.sleep(self.args.status_interval)
+
+    async def poll_history(self):
+        while True:
+            cursor = self.store.state.setdefault(self.device, {"bootId": 0, "lastId": 0})
+            history = await get_json(self.host, self.port, f"/history?since={cursor['lastId']}")
+
+            # A restarted device numbers its shots from 1 again, fetch its log from the start
+            if history["bootId"] != cursor["bootId"]:
+                if cursor["bootId"] != 0:
+                    print(f"{self.name}: device restarted, reading its shot log from the start", file=sys.stderr)
+
+                cursor["bootId"] = history["bootId"]
+                cursor["lastId"] = 0
+                history = await get_json(self.host, self.port, "/history?since=0")
+
+            for shot in history["shots"]:
+                if shot["id"] != cursor["lastId"] + 1:
+                    print(f"{self.name}: shots {cursor['lastId'] + 1}..{shot['id'] - 1} left the device log unread",
+                          file=sys.stderr)
+
+                self.store.add("shots", {"host_time": time.time(), "device": self.device, "boot_id": history["bootId"],
+                                         **shot})
+                cursor["lastId"] = shot["id"]
+                self.shots += 1
+
+            await asyncio.sleep(self.args.history_interval)
+
+
+# --- mDNS discovery ----------------------------------------------------------------------------------------
+
+def encode_name(name):
+    return b"".join(bytes([len(label)]) + label.encode() for label in name.split(".")) + b"\x00"
+
+
+def read_name(packet, offset):
+    """Name at offset with compression, returns the name and the offset after it."""
+    labels = []
+    end = None
+
+    for _ in range(64):
+        length = packet[offset]
+
+        if length & 0xC0 == 0xC0:
+            if end is None:
+                end = offset + 2
+
+            offset = ((length & 0x3F) << 8) | packet[offset + 1]
+            continue
+
+        offset += 1
+
+        if length == 0:
+            break
+
+        labels.append(packet[offset:offset + length].decode("utf-8", "replace"))
+        offset += length
+
+    return ".".join(labels), end if end is not None else offset
+
+
+def parse_mdns(packet):
+    """PTR, SRV, TXT and A records of an mDNS response."""
+    _, flags, questions, answers, authorities, additionals = struct.unpack("!HHHHHH", packet[:12])
+    offset = 12
+    records = []
+
+    if not flags & 0x8000:
+        return records
+
+    for _ in range(questions):
+        _, offset = read_name(packet, offset)
+        offset += 4
+
+    for _ in range(answers + authorities + additionals):
+        name, offset = read_name(packet, offset)
+        record_type, _, _, length = struct.unpack("!HHIH", packet[offset:offset + 10])
+        offset += 10
+        data = packet[offset:offset + length]
+
+        if record_type == 12:
+            records.append(("PTR", name, read_name(packet, offset)[0]))
+        elif record_type == 33:
+            records.append(("SRV", name, (read_name(packet, offset + 6)[0], struct.unpack("!H", data[4:6])[0])))
+        elif record_type == 16:
+            entries, i = {}, 0
+
+            while i < len(data):
+                entry = data[i + 1:i + 1 + data[i]].decode("utf-8", "replace")
+                key, _, value = entry.partition("=")
+                entries[key] = value
+                i += 1 + data[i]
+
+            records.append(("TXT", name, entries))
+        elif record_type == 1:
+            records.append(("A", name, socket.inet_ntoa(data)))
+
+        offset += length
+
+    return records
+
+
+class MdnsBrowser(asyncio.DatagramProtocol):
+    """Queries for the shotStopper service and reports host:port of every unit that answers."""
+
+    def __init__(self, found):
+        self.found = found
+        self.services = {}
+        self.addresses = {}
+        self.transport = None
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def query(self):
+        question = encode_name(SERVICE) + struct.pack("!HH", 12, 1)
+        self.transport.sendto(struct.pack("!HHHHHH", 0, 0, 1, 0, 0, 0) + question, (MDNS_GROUP, MDNS_PORT))
+
+    def datagram_received(self, data, addr):
+        try:
+            records = parse_mdns(data)
+        except (IndexError, struct.error, OSError):
+            return
+
+        for kind, name, value in records:
+            if kind == "SRV":
+                self.services[name] = value
+            elif kind == "A":
+                self.addresses[name] = value
+
+        for target, port in self.services.values():
+            if target in self.addresses:
+                self.found(self.addresses[target], port)
+
+
+async def browse(found, interval):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", 0))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 255)
+
+    _, browser = await asyncio.get_running_loop().create_datagram_endpoint(lambda: MdnsBrowser(found), sock=sock)
+
+    while True:
+        browser.query()
+        await asyncio.sleep(interval)
+
+
+# --- Fake devices ------------------------------------------------------------------------------------------
+
+DRIP_DELAY_S = 3.0
+FINAL_WEIGHT_GRACE_S = 5.0  # ShotLog::FINAL_WEIGHT_GRACE_MS
+
+
+class FakeDevice:
+    """Serves /events, /status and /history of a simulated unit, shots follow from the seed alone."""
+
+    def __init__(self, index, seed, speed):
+        self.random = random.Random(seed * 1000 + index)
+        self.device = f"fa4e{index:08x}"
+        self.boot_id = self.random.randrange(1, 2 ** 32)
+        self.speed = speed
+        self.started = time.monotonic()
+        self.shots = []
+        self.goal = self.random.choice([36.0, 38.0, 40.0, 45.0])
+        self.offset = 1.5
+        self.next_shot = self.random.uniform(5, 30)
+        self.shot = None
+
+    def now(self):
+        return (time.monotonic() - self.started) * self.speed
+
+    def step(self):
+        """Advance the simulation to now, returns weight, brewing and shot time."""
+        now = self.now()
+
+        if self.shot is None and now >= self.next_shot:
+            flow = self.random.uniform(1.3, 2.2)
+            # Some shots end by time and never get a final weight, like on a unit without a scale connected
+            self.shot = {"start": now, "flow": flow, "preinfusion": self.random.uniform(4, 8),
+                         "drip": self.random.uniform(0.8, 2.5), "timed": self.random.random() < 0.1}
+
+        if self.shot is None:
+            return 0.0, False, 0.0
+
+        t = now - self.shot["start"]
+        stop_at = self.shot["preinfusion"] + (self.goal - self.offset) / self.shot["flow"]
+        weight = max(0.0, min(t, stop_at) - self.shot["preinfusion"]) * self.shot["flow"]
+
+        if t < stop_at:
+            return weight, True, t
+
+        # Stopped: like the device, the shot is held back until it is complete. It is added with the final
+        # weight after the 3 s drip delay, or without one once the grace period ran out as well.
+        drip = min(t - stop_at, DRIP_DELAY_S) / DRIP_DELAY_S * self.shot["drip"]
+        final = weight + self.shot["drip"]
+
+        if t >= stop_at + DRIP_DELAY_S + (FINAL_WEIGHT_GRACE_S if self.shot["timed"] else 0.0):
+            shot = {"id": len(self.shots) + 1, "uptime": int(self.shot["start"] + stop_at),
+                    "reason": "time" if self.shot["timed"] else "weight", "duration": round(stop_at, 1),
+                    "stopWeight": round(weight, 1), "finalWeight": None, "goalWeight": self.goal, "dose": 18.0,
+                    "offset": round(self.offset, 2), "learnedOffset": None}
+
+            if not self.shot["timed"]:
+                learned = self.offset + (final - self.goal)
+                shot.update(finalWeight=round(final, 1), learnedOffset=round(learned, 2))
+                self.offset = learned
+
+            self.shots.append(shot)
+            self.shot = None
+            self.next_shot = now + self.random.uniform(20, 90)
+
+            return final, False, 0.0
+
+        return weight + drip, False, stop_at
+
+    def status(self):
+        weight, brewing, shot_time = self.step()
+
+        return {"currentWeight": round(weight, 2), "goalWeight": self.goal, "weightOffset": round(self.offset, 2),
+                "brewing": brewing, "shotTimer": round(shot_time, 2), "brewByTimeOnly": False}
+
+    async def handle(self, reader, writer):
+        try:
+            request = (await reader.readline()).decode("latin-1").split()
+
+            while (await reader.readline()) not in (b"\r\n", b"\n", b""):
+                pass
+
+            path = request[1] if len(request) > 1 else "/"
+
+            if path == "/events":
+                writer.write(b"HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n\r\n")
+
+                while True:
+                    writer.write(f"event: status\ndata: {json.dumps(self.status())}\n\n".encode())
+                    await writer.drain()
+                    await asyncio.sleep(1.0)
+
+            if path == "/status":
+                body = {**self.status(), "freeHeap": 150000, "uptime": int(self.now()), "version": "fake"}
+            elif path.startswith("/history"):
+                self.step()
+                since = int(path.partition("since=")[2] or 0)
+                body = {"device": self.device, "bootId": self.boot_id, "lastId": len(self.shots),
+                        "shots": [shot for shot in self.shots[-32:] if shot["id"] > since]}
+            else:
+                writer.write(b"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n")
+                return
+
+            data = json.dumps(body).encode()
+            writer.write(b"HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n" % len(data)
+                         + data)
+            await writer.drain()
+        except (ConnectionError, asyncio.CancelledError):
+            pass
+        finally:
+            writer.close()
+
+
+async def start_fakes(args):
+    addresses = []
+
+    for i in range(args.fake):
+        device = FakeDevice(i, args.seed, args.speed)
+        await asyncio.start_server(device.handle, "127.0.0.1", args.fake_port + i)
+        addresses.append(("127.0.0.1", args.fake_port + i))
+
+    print(f"{args.fake} fake units on 127.0.0.1:{args.fake_port}..{args.fake_port + args.fake - 1}", file=sys.stderr)
+
+    return addresses
+
+
+# --- Main --------------------------------------------------------------------------------------------------
+
+def parse_device(text):
+    host, _, port = text.partition(":")
+
+    return host, int(port) if port else 80
+
+
+async def collect(args):
+    store = Store(args.out, args.flush_rows) if not args.serve_only else None
+    units = {}
+    devices = list(args.device)
+
+    if args.fake:
+        devices += await start_fakes(args)
+
+    if args.serve_only:
+        await asyncio.Event().wait()
+
+    def found(host, port):
+        if (host, port) not in units:
+            unit = Unit(host, port, store, args)
+            units[(host, port)] = unit
+            asyncio.get_running_loop().create_task(unit.run())
+
+    for host, port in devices:
+        found(host, port)
+
+    if not args.no_mdns:
+        asyncio.get_running_loop().create_task(browse(found, args.mdns_interval))
+
+    if pyarrow is None:
+        print("pyarrow not installed, writing CSV instead of Parquet", file=sys.stderr)
+
+    started = time.monotonic()
+
+    try:
+        while not args.duration or time.monotonic() - started < args.duration:
+            await asyncio.sleep(min(args.flush_interval, args.duration or args.flush_interval))
+            store.flush()
+
+            print(f"{len(units)} units | " + " | ".join(f"{table} {count}" for table, count in sorted(store.written.items())),
+                  file=sys.stderr)
+    finally:
+        store.flush()
+
+    errors = sum(unit.errors for unit in units.values())
+    print(f"Collected from {len(units)} units: {sum(unit.events for unit in units.values())} status events, "
+          f"{sum(unit.shots for unit in units.values())} shots, {errors} connection errors", file=sys.stderr)
+
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="shotStopper fleet collector")
+    parser.add_argument("--out", default="fleet", help="Directory of the store")
+    parser.add_argument("--device", type=parse_device, action="append", default=[], metavar="HOST[:PORT]",
+                        help="Unit to collect from in addition to the ones found through mDNS, may be repeated")
+    parser.add_argument("--no-mdns", action="store_true", help="Only collect from the --device units")
+    parser.add_argument("--mdns-interval", type=float, default=60.0, help="Seconds between mDNS queries")
+    parser.add_argument("--status-interval", type=float, default=30.0, help="Seconds between /status polls")
+    parser.add_argument("--history-interval", type=float, default=10.0, help="Seconds between /history polls")
+    parser.add_argument("--event-timeout", type=float, default=10.0, help="Reconnect if /events is silent this long")
+    parser.add_argument("--flush-interval", type=float, default=60.0, help="Seconds between writes to the store")
+    parser.add_argument("--flush-rows", type=int, default=50000, help="Write a table once it has this many rows")
+    parser.add_argument("--duration", type=float, help="Seconds to collect, until interrupted if not given")
+    parser.add_argument("--fake", type=int, default=0, metavar="N", help="Run N fake units and collect from them")
+    parser.add_argument("--fake-port", type=int, default=18080, help="Port of the first fake unit")
+    parser.add_argument("--seed", type=int, default=1, help="Seed of the fake units, the same seed replays the same shots")
+    parser.add_argument("--speed", type=float, default=1.0, help="Time factor of the fake units")
+    parser.add_argument("--serve-only", action="store_true", help="Only run the fake units")
+    args = parser.parse_args()
+
+    if args.fake:
+        args.no_mdns = args.no_mdns or not args.device
+
+    return asyncio.run(collect(args))
+
+
+if __name__ == "__main__":
+    try:
+        sys.exit(main())
+    except KeyboardInterrupt:
+        sys.exit(130)
@@ -0,0 +1,107 @@
+# sign_firmware.py
+#
+# Creates update packages for the /update endpoint and manages the signing key.
+#
+#   python scripts/sign_firmware.py keygen ota_key.pem
+#   python scripts/sign_firmware.py package --key ota_key.pem .pio/build/esp32-s3/firmware.bin -o firmware.ota
+#   python scripts/sign_firmware.py package --key ota_key.pem --target fs .pio/build/esp32-s3/littlefs.bin -o littlefs.ota
+#
+# Package layout (see src/OtaUpdate.h): 128 byte header followed by the raw image. The ECDSA P-256 signature
+# covers the SHA-256 of header bytes 0-43 (magic, version, target, size and image digest).
+import argparse
+import hashlib
+import struct
+import sys
+from pathlib import Path
+
+MAGIC = b"SSOT"
+VERSION = 1
+HEADER_SIZE = 128
+MAX_SIGNATURE_SIZE = 72
+TARGETS = {"firmware": 0, "fs": 1}
+
+
+def load_crypto():
+    try:
+        from cryptography.hazmat.primitives import hashes, serialization
+        from cryptography.hazmat.primitives.asymmetric import ec
+    except ImportError:
+        sys.exit("The 'cryptography' package is required: pip install cryptography")
+
+    return hashes, serialization, ec
+
+
+def keygen(args):
+    hashes, serialization, ec = load_crypto()
+
+    if Path(args.key).exists():
+        sys.exit(f"{args.key} already exists, refusing to overwrite")
+
+    key = ec.generate_private_key(ec.SECP256R1())
+
+    Path(args.key).write_bytes(key.private_bytes(
+        serialization.Encoding.PEM,
+        serialization.PrivateFormat.PKCS8,
+        serialization.NoEncryption(),
+    ))
+
+    public_pem = key.public_key().public_bytes(
+        serialization.Encoding.PEM,
+        serialization.PublicFormat.SubjectPublicKeyInfo,
+    ).decode()
+
+    print(f"Private key written to {args.key} - keep it out of the repository.")
+    print("Paste the following into src/OtaPublicKey.h:\n")
+    print("static constexpr char OTA_PUBLIC_KEY_PEM[] =")
+
+    for line in public_pem.strip().splitlines():
+        print(f'    "{line}\\n"')
+
+    print("    ;")
+
+
+def package(args):
+    image = Path(args.image).read_bytes()
+    target = TARGETS[args.target]
+
+    if target == TARGETS["firmware"] and image[:1] != b"\xe9":
+        sys.exit(f"{args.image} does not look like an ESP32 application image")
+
+    signed = MAGIC + struct.pack("<BBHI", VERSION, target, 0, len(image)) + hashlib.sha256(image).digest()
+    hashes, serialization, ec = load_crypto()
+    key = serialization.load_pem_private_key(Path(args.key).read_bytes(), password=None)
+    signature = key.sign(signed, ec.ECDSA(hashes.SHA256()))
+
+    if len(signature) > MAX_SIGNATURE_SIZE:
+        sys.exit("Signature too long, is this a P-256 key?")
+
+    header = signed + struct.pack("<H", len(signature)) + signature
+    header += b"\x00" * (HEADER_SIZE - len(header))
+
+    output = Path(args.output or Path(args.image).with_suffix(".ota"))
+    output.write_bytes(header + image)
+
+    print(f"{output}: {args.target} image, {len(image)} bytes, sha256 {hashlib.sha256(image).hexdigest()}, signed")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Create signed shotStopper update packages")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("keygen", help="Generate a P-256 signing key")
+    p.add_argument("key", help="Output path of the private key (PEM)")
+    p.set_defaults(func=keygen)
+
+    p = sub.add_parser("package", help="Create an update package from a firmware or filesystem image")
+    p.add_argument("image", help="firmware.bin or littlefs.bin")
+    p.add_argument("--target", choices=TARGETS.keys(), default="firmware")
+    p.add_argument("--key", required=True, help="Private key (PEM) used to sign the package")
+    p.add_argument("-o", "--output", help="Output path (default: <image>.ota)")
+    p.set_defaults(func=package)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
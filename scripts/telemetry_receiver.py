@@ -0,0 +1,188 @@
+# telemetry_receiver.py
+#
+# Receives and decodes the UDP multicast telemetry frames (see src/UdpTelemetry.h).
+#
+#   python scripts/telemetry_receiver.py                      # print decoded frames
+#   python scripts/telemetry_receiver.py --table              # one line per device, redrawn
+#   python scripts/telemetry_receiver.py --simulate 3         # send frames of 3 fake devices
+#
+# Running a receiver and a simulator in two terminals tests the whole path on a single machine.
+import argparse
+import math
+import os
+import random
+import socket
+import struct
+import sys
+import time
+
+DEFAULT_GROUP = "239.255.42.1"
+DEFAULT_PORT = 42421
+
+FRAME = struct.Struct("<2sBBBBH6sHIfffff")
+assert FRAME.size == 40
+
+STATES = {0: "idle", 1: "brewing", 2: "predicting", 3: "time", 4: "dripping"}
+
+
+def decode(data):
+    """Decode a frame into a dict, None if it is not a valid frame."""
+    if len(data) != FRAME.size:
+        return None
+
+    (magic, version, state, flags, _, seq, device, _, uptime_ms,
+     shot_time, weight, flow, predicted_end, goal) = FRAME.unpack(data)
+
+    if magic != b"ST" or version != 1:
+        return None
+
+    return {
+        "device": device.hex(),
+        "seq": seq,
+        "state": STATES.get(state, str(state)),
+        "scale": bool(flags & 0x01),
+        "by_time_only": bool(flags & 0x02),
+        "uptime_ms": uptime_ms,
+        "shot_time": shot_time,
+        "weight": weight,
+        "flow": flow,
+        "predicted_end": None if math.isnan(predicted_end) else predicted_end,
+        "goal": goal,
+    }
+
+
+def encode(device, seq, state, flags, uptime_ms, shot_time, weight, flow, predicted_end, goal):
+    return FRAME.pack(b"ST", 1, state, flags, 0, seq & 0xFFFF, device, 0, uptime_ms & 0xFFFFFFFF,
+                      shot_time, weight, flow, float("nan") if predicted_end is None else predicted_end, goal)
+
+
+def open_receiver(group, port, interface):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+
+    if hasattr(socket, "SO_REUSEPORT"):
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+
+    sock.bind(("", port))
+    membership = socket.inet_aton(group) + socket.inet_aton(interface)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+
+    return sock
+
+
+def format_frame(f):
+    predicted = f"{f['predicted_end']:5.1f}s" if f["predicted_end"] is not None else "   -  "
+
+    return (f"{f['device']}  #{f['seq']:5d}  {f['state']:<10}  {'scale' if f['scale'] else 'no scale':<8}  "
+            f"t={f['shot_time']:5.1f}s  w={f['weight']:6.1f}g  flow={f['flow']:4.1f}g/s  "
+            f"end={predicted}  goal={f['goal']:.1f}g")
+
+
+def receive(args):
+    sock = open_receiver(args.group, args.port, args.interface)
+    devices = {}
+    last_seq = {}
+    lost = {}
+    last_draw = 0.0
+
+    print(f"Listening on {args.group}:{args.port}", file=sys.stderr)
+
+    while True:
+        data, addr = sock.recvfrom(1500)
+        frame = decode(data)
+
+        if frame is None:
+            continue
+
+        device = frame["device"]
+
+        # Count gaps in the sequence numbers per device
+        if device in last_seq:
+            gap = (frame["seq"] - last_seq[device] - 1) & 0xFFFF
+            lost[device] = lost.get(device, 0) + (gap if gap < 0x8000 else 0)
+
+        last_seq[device] = frame["seq"]
+        frame["addr"] = addr[0]
+        devices[device] = frame
+
+        if not args.table:
+            print(format_frame(frame))
+            continue
+
+        now = time.monotonic()
+
+        if now - last_draw > 0.2:
+            last_draw = now
+            os.system("cls" if os.name == "nt" else "clear")
+
+            for dev in sorted(devices):
+                print(f"{format_frame(devices[dev])}  from {devices[dev]['addr']}  lost {lost.get(dev, 0)}")
+
+
+def simulate(args):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 1)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
+
+    units = []
+
+    for _ in range(args.simulate):
+        units.append({
+            "device": random.randbytes(6) if hasattr(random, "randbytes") else os.urandom(6),
+            "seq": 0,
+            "start": time.monotonic() + random.uniform(0, 10),
+            "goal": random.choice([36.0, 40.0, 45.0]),
+            "flow": random.uniform(1.2, 2.2),
+        })
+
+    print(f"Sending frames of {args.simulate} simulated devices to {args.group}:{args.port}", file=sys.stderr)
+    started = time.monotonic()
+
+    while True:
+        now = time.monotonic()
+
+        for unit in units:
+            t = now - unit["start"]
+            cycle = 45.0  # shot plus pause
+            t = t % cycle if t > 0 else -1.0
+            shot_end = unit["goal"] / unit["flow"] + 5.0
+
+            if 0 <= t < shot_end:
+                weight = max(0.0, (t - 5.0) * unit["flow"])
+                state = 2 if t > 8 else 1
+                predicted = shot_end if state == 2 else None
+                flow = unit["flow"] if t > 5 else 0.0
+            elif shot_end <= t < shot_end + 3:
+                weight, state, predicted, flow = unit["goal"], 4, None, 0.0
+            else:
+                weight, state, predicted, flow, t = 0.0, 0, None, 0.0, 0.0
+
+            unit["seq"] += 1
+            frame = encode(unit["device"], unit["seq"], state, 0x01, int((now - started) * 1000), t,
+                           weight + random.gauss(0, 0.05), flow, predicted, unit["goal"])
+            sock.sendto(frame, (args.group, args.port))
+
+        time.sleep(1.0 / args.rate)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="shotStopper UDP multicast telemetry receiver")
+    parser.add_argument("--group", default=DEFAULT_GROUP)
+    parser.add_argument("--port", type=int, default=DEFAULT_PORT)
+    parser.add_argument("--interface", default="0.0.0.0", help="Local interface address to join the group on")
+    parser.add_argument("--table", action="store_true", help="Show one line per device instead of every frame")
+    parser.add_argument("--simulate", type=int, metavar="N", help="Send frames of N simulated devices instead of receiving")
+    parser.add_argument("--rate", type=float, default=10.0, help="Frames per second per simulated device")
+    args = parser.parse_args()
+
+    try:
+        if args.simulate:
+            simulate(args)
+        else:
+            receive(args)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
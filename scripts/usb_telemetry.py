@@ -0,0 +1,468 @@
+# usb_telemetry.py
+#
+# Records the framed sample stream of a shotStopper on its USB serial port and sends parameter and tare
+# commands (see src/SerialProtocol.h). The log text on the same port is passed through separately.
+#
+#   python scripts/usb_telemetry.py /dev/ttyACM0 --out shot.csv             # record samples, log to stderr
+#   python scripts/usb_telemetry.py /dev/ttyACM0 --log device.log --out s.csv --duration 60
+#   python scripts/usb_telemetry.py /dev/ttyACM0 --set brew.goal_weight=36.5 --get brew.drip_delay --tare
+#   python scripts/usb_telemetry.py --simulate                                # fake device on a pty (Linux)
+#
+# The simulator prints the path of its pty, running the recorder against that path in a second terminal
+# tests the framing and the commands without hardware. Uses pyserial if it is installed, the POSIX terminal
+# interface otherwise. The exit code is 1 if a command was rejected or not answered.
+import argparse
+import csv
+import math
+import os
+import random
+import struct
+import sys
+import time
+
+TYPE_SAMPLE = 0x01
+TYPE_ACK = 0x02
+TYPE_INFO = 0x03
+TYPE_SET = 0x10
+TYPE_GET = 0x11
+TYPE_COMMAND = 0x12
+
+CMD_STREAM_ON = 1
+CMD_STREAM_OFF = 2
+CMD_TARE = 3
+CMD_GET_INFO = 4
+
+ACK_STATUS = {0: "ok", 1: "unknown parameter", 2: "invalid value", 3: "unknown command", 4: "malformed"}
+
+SAMPLE = struct.Struct("<IfffffBB")
+ACK = struct.Struct("<HBd")
+
+STATES = {0: "idle", 1: "brewing", 2: "predicting", 3: "time", 4: "dripping"}
+
+ANSWER_TIMEOUT_S = 5.0
+
+CSV_FIELDS = ["host_time", "seq", "uptime_ms", "state", "scale", "by_time_only", "shot_time", "weight", "flow",
+              "predicted_end", "goal"]
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE, same as SerialProtocol::crc16()."""
+    crc = 0xFFFF
+
+    for byte in data:
+        crc ^= byte << 8
+
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_index = 0
+    code = 1
+
+    for byte in data:
+        if byte != 0:
+            out.append(byte)
+            code += 1
+
+        if byte == 0 or code == 0xFF:
+            out[code_index] = code
+            code_index = len(out)
+            out.append(0)
+            code = 1
+
+    out[code_index] = code
+
+    return bytes(out)
+
+
+def cobs_decode(data):
+    """Decode a COBS block, None if it is not valid COBS."""
+    out = bytearray()
+    i = 0
+
+    while i < len(data):
+        code = data[i]
+        i += 1
+
+        if code == 0 or i + code - 1 > len(data):
+            return None
+
+        out += data[i:i + code - 1]
+        i += code - 1
+
+        if code < 0xFF and i < len(data):
+            out.append(0)
+
+    return bytes(out)
+
+
+def encode_frame(frame_type, seq, payload):
+    frame = bytes([frame_type, seq & 0xFF]) + payload
+
+    return b"\x00" + cobs_encode(frame + struct.pack("<H", crc16(frame))) + b"\x00"
+
+
+def decode_frame(block):
+    """(type, seq, payload) of a block between zero bytes, None if it is not a frame."""
+    frame = cobs_decode(block)
+
+    if frame is None or len(frame) < 4 or crc16(frame[:-2]) != struct.unpack("<H", frame[-2:])[0]:
+        return None
+
+    return frame[0], frame[1], frame[2:-2]
+
+
+class Splitter:
+    """Splits the byte stream at zero bytes into frames and log text."""
+
+    def __init__(self):
+        self.block = bytearray()
+        self.text = bytearray()
+
+    def feed(self, data):
+        """Yields ("frame", (type, seq, payload)) and ("text", line) items."""
+        for byte in data:
+            if byte != 0:
+                self.block.append(byte)
+                continue
+
+            if self.block:
+                frame = decode_frame(bytes(self.block))
+
+                if frame is not None:
+                    yield "frame", frame
+                else:
+                    self.text += self.block
+
+                self.block.clear()
+
+            yield from self.lines()
+
+    def lines(self):
+        while b"\n" in self.text:
+            line, _, rest = self.text.partition(b"\n")
+            self.text = bytearray(rest)
+            yield "text", line.decode("utf-8", "replace").rstrip("\r")
+
+
+class Port:
+    """Raw serial port, pyserial if available, a POSIX terminal otherwise."""
+
+    def __init__(self, path, baud):
+        try:
+            import serial
+        except ImportError:
+            serial = None
+
+        if serial is not None:
+            self.serial = serial.Serial(path, baud, timeout=0.05)
+            self.fd = None
+            return
+
+        import termios
+        import tty
+
+        self.serial = None
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+        attributes = termios.tcgetattr(self.fd)
+        attributes[6][termios.VMIN] = 0
+        attributes[6][termios.VTIME] = 1
+        termios.tcsetattr(self.fd, termios.TCSANOW, attributes)
+
+    def read(self):
+        if self.serial is not None:
+            return self.serial.read(4096)
+
+        return os.read(self.fd, 4096)
+
+    def write(self, data):
+        if self.serial is not None:
+            self.serial.write(data)
+        else:
+            os.write(self.fd, data)
+
+    def close(self):
+        if self.serial is not None:
+            self.serial.close()
+        else:
+            os.close(self.fd)
+
+
+def decode_sample(payload):
+    if len(payload) != SAMPLE.size:
+        return None
+
+    uptime_ms, shot_time, weight, flow, predicted_end, goal, state, flags = SAMPLE.unpack(payload)
+
+    return {
+        "uptime_ms": uptime_ms,
+        "state": STATES.get(state, str(state)),
+        "scale": int(bool(flags & 0x01)),
+        "by_time_only": int(bool(flags & 0x02)),
+        "shot_time": round(shot_time, 3),
+        "weight": round(weight, 2),
+        "flow": round(flow, 3),
+        "predicted_end": "" if math.isnan(predicted_end) else round(predicted_end, 3),
+        "goal": round(goal, 2),
+    }
+
+
+def parse_assignment(text):
+    name, _, value = text.partition("=")
+
+    if not name or not value:
+        raise argparse.ArgumentTypeError(f"expected name=value, got {text!r}")
+
+    return name, float(value)
+
+
+def record(args):
+    port = Port(args.port, args.baud)
+    log = open(args.log, "a", encoding="utf-8") if args.log else sys.stderr
+    out = open(args.out, "w", newline="", encoding="utf-8") if args.out else None
+    writer = csv.DictWriter(out, fieldnames=CSV_FIELDS) if out else None
+
+    if writer:
+        writer.writeheader()
+
+    # Requests, numbered so the acknowledgements can be matched
+    requests = {}
+    request_id = 0
+
+    def request(frame_type, payload, description):
+        nonlocal request_id
+        request_id = (request_id + 1) & 0xFFFF
+        requests[request_id] = description
+        port.write(encode_frame(frame_type, 0, struct.pack("<H", request_id) + payload))
+
+    request(TYPE_COMMAND, bytes([CMD_GET_INFO]), "info")
+
+    for name, value in args.set:
+        request(TYPE_SET, struct.pack("<d", value) + name.encode(), f"set {name}={value:g}")
+
+    for name in args.get:
+        request(TYPE_GET, name.encode(), f"get {name}")
+
+    if args.tare:
+        request(TYPE_COMMAND, bytes([CMD_TARE]), "tare")
+
+    streaming = bool(args.out) or not (args.set or args.get or args.tare)
+
+    if streaming:
+        request(TYPE_COMMAND, bytes([CMD_STREAM_ON]), "stream on")
+
+    splitter = Splitter()
+    samples = 0
+    lost = 0
+    rejected = 0
+    last_seq = None
+    started = time.monotonic()
+    deadline = started + args.duration if args.duration else None
+
+    try:
+        while True:
+            now = time.monotonic()
+
+            # Without the stream, stop once every request is answered or after ANSWER_TIMEOUT_S
+            if deadline and now > deadline:
+                break
+
+            if not streaming and (not requests or now - started > ANSWER_TIMEOUT_S):
+                break
+
+            for kind, item in splitter.feed(port.read()):
+                if kind == "text":
+                    print(item, file=log, flush=True)
+                    continue
+
+                frame_type, seq, payload = item
+
+                # The device numbers all its frames, a gap is a frame dropped on the device or on the way
+                if last_seq is not None:
+                    lost += (seq - last_seq - 1) & 0xFF
+
+                last_seq = seq
+
+                if frame_type == TYPE_SAMPLE:
+                    sample = decode_sample(payload)
+
+                    if sample is None:
+                        continue
+
+                    samples += 1
+
+                    if writer:
+                        writer.writerow({"host_time": round(time.time(), 3), "seq": seq, **sample})
+                    else:
+                        print(sample)
+                elif frame_type == TYPE_ACK and len(payload) == ACK.size:
+                    ack_id, status, value = ACK.unpack(payload)
+                    description = requests.pop(ack_id, f"request {ack_id}")
+                    value_text = "" if math.isnan(value) else f" -> {value:g}"
+                    print(f"{description}: {ACK_STATUS.get(status, status)}{value_text}", file=sys.stderr)
+                    rejected += status != 0
+                elif frame_type == TYPE_INFO and payload:
+                    print(f"Device protocol {payload[0]}, firmware {payload[1:].decode(errors='replace')}",
+                          file=sys.stderr)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if streaming:
+            port.write(encode_frame(TYPE_COMMAND, 0, struct.pack("<H", 0) + bytes([CMD_STREAM_OFF])))
+
+        port.close()
+
+        if out:
+            out.close()
+
+        if log is not sys.stderr:
+            log.close()
+
+    elapsed = time.monotonic() - started
+
+    if streaming:
+        print(f"{samples} samples in {elapsed:.1f}s ({samples / max(elapsed, 1e-3):.1f}/s), {lost} frames lost",
+              file=sys.stderr)
+
+    for description in requests.values():
+        print(f"{description}: no answer", file=sys.stderr)
+
+    return 1 if rejected or requests else 0
+
+
+def simulate(args):
+    """Fake device on a pty: answers the commands, streams a shot every 30 s and logs text in between."""
+    import tty
+
+    master, slave = os.openpty()
+    tty.setraw(slave)
+    print(f"Simulated device on {os.ttyname(slave)}", file=sys.stderr)
+
+    parameters = {"brew.goal_weight": 36.0, "brew.drip_delay": 3.0, "scale.trend_window": 1.0}
+    splitter = Splitter()
+    streaming = False
+    seq = 0
+    started = time.monotonic()
+    os.set_blocking(master, False)
+
+    def send(frame_type, payload):
+        nonlocal seq
+        os.write(master, encode_frame(frame_type, seq, payload))
+        seq = (seq + 1) & 0xFF
+
+    def ack(request_id, status, value=float("nan")):
+        send(TYPE_ACK, ACK.pack(request_id, status, value))
+
+    next_log = started
+
+    while True:
+        now = time.monotonic()
+
+        try:
+            data = os.read(master, 4096)
+        except (BlockingIOError, OSError):
+            data = b""
+
+        for kind, item in splitter.feed(data):
+            if kind != "frame":
+                continue
+
+            frame_type, _, payload = item
+
+            if len(payload) < 2:
+                continue
+
+            request_id = struct.unpack("<H", payload[:2])[0]
+            body = payload[2:]
+
+            if frame_type == TYPE_SET and len(body) > 8:
+                name = body[8:].decode(errors="replace")
+                value = struct.unpack("<d", body[:8])[0]
+
+                if name not in parameters:
+                    ack(request_id, 1)
+                else:
+                    parameters[name] = value
+                    ack(request_id, 0, value)
+            elif frame_type == TYPE_GET and body:
+                name = body.decode(errors="replace")
+
+                if name in parameters:
+                    ack(request_id, 0, parameters[name])
+                else:
+                    ack(request_id, 1)
+            elif frame_type == TYPE_COMMAND and body:
+                if body[0] == CMD_STREAM_ON:
+                    streaming = True
+                elif body[0] == CMD_STREAM_OFF:
+                    streaming = False
+                elif body[0] == CMD_GET_INFO:
+                    send(TYPE_INFO, bytes([1]) + b"simulated")
+                elif body[0] != CMD_TARE:
+                    ack(request_id, 3)
+                    continue
+
+                ack(request_id, 0)
+            else:
+                ack(request_id, 4)
+
+        # Log text in between the frames, written in pieces like the logger does
+        if now >= next_log:
+            next_log = now + 1.0
+            os.write(master, b"[INFO] ")
+            os.write(master, f"simulated log line at {now - started:.1f}s\r\n".encode())
+
+        if streaming:
+            goal = parameters["brew.goal_weight"]
+            t = (now - started) % 30.0
+            flow = 2.0
+            shot_end = goal / flow + 5.0
+
+            if t < shot_end:
+                state, weight = (2 if t > 8 else 1), max(0.0, (t - 5.0) * flow)
+                predicted = shot_end if state == 2 else float("nan")
+            else:
+                state, weight, predicted, flow, t = 0, 0.0, float("nan"), 0.0, 0.0
+
+            send(TYPE_SAMPLE, SAMPLE.pack(int((now - started) * 1000) & 0xFFFFFFFF, t,
+                                          weight + random.gauss(0, 0.05), flow, predicted, goal, state, 0x01))
+
+        time.sleep(1.0 / args.rate)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="shotStopper USB serial telemetry recorder")
+    parser.add_argument("port", nargs="?", help="Serial port of the device, e.g. /dev/ttyACM0 or COM5")
+    parser.add_argument("--baud", type=int, default=115200, help="Ignored by USB CDC, needed by some adapters")
+    parser.add_argument("--out", help="CSV file for the samples, printed if not given")
+    parser.add_argument("--log", help="File to append the log text to, stderr if not given")
+    parser.add_argument("--duration", type=float, help="Seconds to record, until interrupted if not given")
+    parser.add_argument("--set", type=parse_assignment, action="append", default=[], metavar="NAME=VALUE",
+                        help="Set a numeric parameter, may be repeated")
+    parser.add_argument("--get", action="append", default=[], metavar="NAME", help="Read a parameter, may be repeated")
+    parser.add_argument("--tare", action="store_true", help="Tare the scale")
+    parser.add_argument("--simulate", action="store_true", help="Run a simulated device on a pty instead of recording")
+    parser.add_argument("--rate", type=float, default=50.0, help="Samples per second of the simulated device")
+    args = parser.parse_args()
+
+    if args.simulate:
+        simulate(args)
+        return 0
+
+    if not args.port:
+        parser.error("a port is needed unless --simulate is given")
+
+    return record(args)
+
+
+if __name__ == "__main__":
+    try:
+        sys.exit(main())
+    except KeyboardInterrupt:
+        sys.exit(130)
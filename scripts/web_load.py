@@ -0,0 +1,305 @@
+# web_load.py
+#
+# Load and latency test for the web interface of a shotStopper (see src/WebHandlers.h).
+#
+#   python scripts/web_load.py 192.168.1.50                          # 30 s of /status and /parameters
+#   python scripts/web_load.py shotstopper.local --workers 8 --sse 3 # more clients, 3 live event streams
+#   python scripts/web_load.py 192.168.1.50 --posts --uploads        # also exercise POST /parameters and /update
+#
+# Parameter posts are wrapped in a trial (/trial/start ... /trial/revert), so they never reach the flash.
+# Uploads send a small unsigned package to /update, which the device must reject without side effects.
+# The exit code is 1 if any request failed or a JSON arena ran out of memory, so the script can gate a release.
+import argparse
+import http.client
+import json
+import os
+import random
+import statistics
+import sys
+import threading
+import time
+
+PARAMETER_VALUES = {
+    "brew.goal_weight": (28.0, 44.0),
+    "brew.drip_delay": (2.0, 4.0),
+}
+
+
+class Recorder:
+    """Collects latencies and errors per endpoint from all worker threads."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.latencies = {}
+        self.errors = {}
+        self.error_samples = []
+
+    def ok(self, name, seconds):
+        with self.lock:
+            self.latencies.setdefault(name, []).append(seconds)
+
+    def fail(self, name, message):
+        with self.lock:
+            self.errors[name] = self.errors.get(name, 0) + 1
+
+            if len(self.error_samples) < 10:
+                self.error_samples.append(f"{name}: {message}")
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, max(0, round(p / 100 * (len(ordered) - 1))))
+    return ordered[index]
+
+
+def request(host, port, timeout, method, path, body=None, headers=None):
+    """Send one request on a new connection like a browser tab would, returns (status, body, seconds)."""
+    start = time.perf_counter()
+    conn = http.client.HTTPConnection(host, port, timeout=timeout)
+
+    try:
+        conn.request(method, path, body=body, headers=headers or {})
+        response = conn.getresponse()
+        data = response.read()
+    finally:
+        conn.close()
+
+    return response.status, data, time.perf_counter() - start
+
+
+def get_json(host, port, timeout, path):
+    status, data, _ = request(host, port, timeout, "GET", path)
+
+    if status != 200:
+        raise RuntimeError(f"GET {path} returned {status}")
+
+    return json.loads(data)
+
+
+def timed(recorder, name, call, expected=(200,), check=None):
+    try:
+        status, data, seconds = call()
+    except (OSError, http.client.HTTPException) as e:
+        recorder.fail(name, str(e) or type(e).__name__)
+        return None
+
+    if status not in expected:
+        recorder.fail(name, f"HTTP {status}: {data[:80]!r}")
+        return None
+
+    if check is not None:
+        try:
+            check(data)
+        except ValueError as e:
+            recorder.fail(name, f"bad body: {e}")
+            return None
+
+    recorder.ok(name, seconds)
+    return data
+
+
+def multipart(filename, payload):
+    boundary = f"----webload{random.getrandbits(64):016x}"
+    body = (f"--{boundary}\r\n"
+            f'Content-Disposition: form-data; name="update"; filename="{filename}"\r\n'
+            "Content-Type: application/octet-stream\r\n\r\n").encode() + payload + f"\r\n--{boundary}--\r\n".encode()
+
+    return body, {"Content-Type": f"multipart/form-data; boundary={boundary}"}
+
+
+def check_parameters(data):
+    page = json.loads(data)
+
+    if "parameters" not in page or page["returned"] != len(page["parameters"]):
+        raise ValueError("incomplete parameter page")
+
+
+def worker(args, recorder, deadline, seed):
+    rng = random.Random(seed)
+    weights = [("status", 4), ("parameters", 3), ("parameterHelp", 1)]
+
+    if args.posts:
+        weights.append(("post", 1))
+
+    if args.uploads:
+        weights.append(("upload", 1))
+
+    names = [name for name, _ in weights]
+    counts = [count for _, count in weights]
+
+    while time.monotonic() < deadline:
+        kind = rng.choices(names, counts)[0]
+        call = lambda method, path, body=None, headers=None: request(args.host, args.port, args.timeout, method, path, body,
+                                                                      headers)
+
+        if kind == "status":
+            timed(recorder, "GET /status", lambda: call("GET", "/status"), check=json.loads)
+
+        elif kind == "parameters":
+            section = rng.choice(["", "&section=0", "&section=1", "&section=3"])
+            path = f"/parameters?offset={rng.choice([0, 0, 10])}&limit={rng.choice([10, 50])}{section}"
+            timed(recorder, "GET /parameters", lambda: call("GET", path), check=check_parameters)
+
+        elif kind == "parameterHelp":
+            name = rng.choice(list(PARAMETER_VALUES))
+            timed(recorder, "GET /parameterHelp", lambda: call("GET", f"/parameterHelp?name={name}"), check=json.loads)
+
+        elif kind == "post":
+            name, (low, high) = rng.choice(list(PARAMETER_VALUES.items()))
+            body = f"{name}={rng.uniform(low, high):.1f}"
+            timed(recorder, "POST /parameters",
+                  lambda: call("POST", "/parameters", body, {"Content-Type": "application/x-www-form-urlencoded"}))
+
+        elif kind == "upload":
+            body, headers = multipart("web_load.bin", os.urandom(args.upload_size))
+            timed(recorder, "POST /update", lambda: call("POST", "/update", body, headers), expected=(400,))
+
+        if args.think > 0:
+            time.sleep(rng.uniform(0, 2 * args.think))
+
+
+def sse_subscriber(args, recorder, deadline, counters, index):
+    """Keeps an /events stream open like the browser UI does and counts the status events."""
+    start = time.perf_counter()
+
+    try:
+        conn = http.client.HTTPConnection(args.host, args.port, timeout=args.timeout)
+        conn.request("GET", "/events", headers={"Accept": "text/event-stream"})
+        response = conn.getresponse()
+
+        if response.status != 200:
+            recorder.fail("SSE /events", f"HTTP {response.status}")
+            return
+
+        first = True
+
+        while time.monotonic() < deadline:
+            line = response.fp.readline()
+
+            if not line:
+                recorder.fail("SSE /events", "stream closed by device")
+                return
+
+            if line.startswith(b"data:"):
+                if first:
+                    recorder.ok("SSE /events", time.perf_counter() - start)
+                    first = False
+
+                counters[index] += 1
+
+        conn.close()
+    except (OSError, http.client.HTTPException) as e:
+        if time.monotonic() < deadline:
+            recorder.fail("SSE /events", str(e) or type(e).__name__)
+
+
+def arena_counts(status):
+    arenas = status.get("jsonArena", {})
+    return {name: (a.get("allocations", 0), a.get("failures", 0), a.get("highWater", 0), a.get("capacity", 0))
+            for name, a in arenas.items()}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Load and latency test for the shotStopper web interface")
+    parser.add_argument("host", help="IP address or host name of the device")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--duration", type=float, default=30.0, help="seconds of load (default 30)")
+    parser.add_argument("--workers", type=int, default=4, help="concurrent request loops (default 4)")
+    parser.add_argument("--sse", type=int, default=1, help="concurrent /events subscribers (default 1)")
+    parser.add_argument("--posts", action="store_true", help="also post parameters, inside a trial")
+    parser.add_argument("--uploads", action="store_true", help="also upload unsigned packages to /update")
+    parser.add_argument("--upload-size", type=int, default=16384, help="bytes per upload (default 16384)")
+    parser.add_argument("--think", type=float, default=0.0, help="mean pause between requests of a worker (s)")
+    parser.add_argument("--timeout", type=float, default=10.0, help="per-request timeout (s)")
+    args = parser.parse_args()
+
+    try:
+        before = get_json(args.host, args.port, args.timeout, "/status")
+    except (OSError, http.client.HTTPException, RuntimeError, ValueError) as e:
+        print(f"Device not reachable: {e}", file=sys.stderr)
+        return 2
+
+    print(f"{args.host}: version {before.get('version', '?')}, free heap {before.get('freeHeap', '?')} bytes")
+
+    if args.posts:
+        request(args.host, args.port, args.timeout, "POST", f"/trial/start?timeout={int(args.duration) + 120}")
+
+    recorder = Recorder()
+    counters = [0] * args.sse
+    deadline = time.monotonic() + args.duration
+    threads = [threading.Thread(target=worker, args=(args, recorder, deadline, i), daemon=True)
+               for i in range(args.workers)]
+    threads += [threading.Thread(target=sse_subscriber, args=(args, recorder, deadline, counters, i), daemon=True)
+                for i in range(args.sse)]
+
+    # Sample the free heap while the load runs
+    heap = [before.get("freeHeap", 0)]
+    started = time.perf_counter()
+
+    for t in threads:
+        t.start()
+
+    while time.monotonic() < deadline:
+        time.sleep(min(2.0, max(0.0, deadline - time.monotonic())))
+
+        try:
+            heap.append(get_json(args.host, args.port, args.timeout, "/status").get("freeHeap", 0))
+        except (OSError, http.client.HTTPException, RuntimeError, ValueError):
+            pass
+
+    for t in threads:
+        t.join(args.timeout + 1)
+
+    elapsed = time.perf_counter() - started
+
+    if args.posts:
+        request(args.host, args.port, args.timeout, "POST", "/trial/revert")
+
+    # Let the device settle before taking the final numbers
+    time.sleep(1.0)
+    after = get_json(args.host, args.port, args.timeout, "/status")
+
+    print(f"\n{'endpoint':<20} {'count':>7} {'req/s':>7} {'p50 ms':>8} {'p90 ms':>8} {'p99 ms':>8} {'max ms':>8} {'errors':>7}")
+    total = 0
+
+    for name in sorted(set(recorder.latencies) | set(recorder.errors)):
+        values = recorder.latencies.get(name, [])
+        errors = recorder.errors.get(name, 0)
+        total += len(values)
+
+        if values:
+            ms = [v * 1000 for v in values]
+            print(f"{name:<20} {len(values):7d} {len(values) / elapsed:7.1f} {statistics.median(ms):8.1f} "
+                  f"{percentile(ms, 90):8.1f} {percentile(ms, 99):8.1f} {max(ms):8.1f} {errors:7d}")
+        else:
+            print(f"{name:<20} {0:7d} {0:7.1f} {'-':>8} {'-':>8} {'-':>8} {'-':>8} {errors:7d}")
+
+    print(f"\n{total} requests in {elapsed:.1f} s, {total / elapsed:.1f} req/s")
+
+    if args.sse:
+        rates = ", ".join(f"{c / elapsed:.1f}" for c in counters)
+        print(f"SSE events per second and subscriber: {rates}")
+
+    print(f"Free heap: {before.get('freeHeap')} before, {min(heap + [after.get('freeHeap', 0)])} minimum, "
+          f"{after.get('freeHeap')} after")
+
+    arena_failures = 0
+    start_counts = arena_counts(before)
+
+    for name, (allocations, failures, high_water, capacity) in arena_counts(after).items():
+        allocations0, failures0, _, _ = start_counts.get(name, (0, 0, 0, 0))
+        arena_failures += failures - failures0
+        print(f"JSON arena {name}: {allocations - allocations0} allocations, {failures - failures0} failures, "
+              f"high water {high_water}/{capacity} bytes")
+
+    for sample in recorder.error_samples:
+        print(f"  error {sample}")
+
+    return 1 if recorder.errors or arena_failures > 0 else 0
+
+
+if __name__ == "__main__":
+    try:
+        sys.exit(main())
+    except KeyboardInterrupt:
+        sys.exit(130)
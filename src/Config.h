@@ -47,6 +47,11 @@ class Config {
 
             initializeConfigDefs();
 
+            // Parameters added by a firmware update are missing from existing config files
+            if (addMissingDefaults() > 0) {
+                return save();
+            }
+
             return true;
         }
 
@@ -89,6 +94,25 @@ class Config {
          * @return true if successful, false otherwise
          */
         [[nodiscard]] bool save() const {
+            return save(serialize());
+        }
+
+        /**
+         * @brief Configuration as written by save(), for a caller that writes the file after releasing its lock
+         */
+        [[nodiscard]] String serialize() const {
+            String json;
+            serializeJson(_doc, json);
+
+            return json;
+        }
+
+        /**
+         * @brief Write a configuration returned by serialize() to file
+         *
+         * @return true if successful, false otherwise
+         */
+        [[nodiscard]] static bool save(const String& json) {
             File file = LittleFS.open(CONFIG_FILE, "w");
 
             if (!file) {
@@ -96,7 +120,7 @@ class Config {
                 return false;
             }
 
-            if (serializeJson(_doc, file) == 0) {
+            if (json.isEmpty() || file.print(json) != json.length()) {
                 LOG(ERROR, "Failed to write config to file");
                 file.close();
                 return false;
@@ -254,13 +278,35 @@ class Config {
             _configDefs.emplace("system.hostname", ConfigDef::forString("shotStopper", 32));
             _configDefs.emplace("system.log_level", ConfigDef::forInt(2, 0, 6)); // Default: INFO (2), Range: TRACE (0) to SILENT (6)
 
+            // Power management
+            _configDefs.emplace("power.idle_enabled", ConfigDef::forBool(true));
+            _configDefs.emplace("power.max_wake_latency_ms", ConfigDef::forInt(20, 5, 200));
+            _configDefs.emplace("power.light_sleep", ConfigDef::forBool(false));
+
+            // MQTT telemetry
+            _configDefs.emplace("mqtt.enabled", ConfigDef::forBool(false));
+            _configDefs.emplace("mqtt.host", ConfigDef::forString("", 64));
+            _configDefs.emplace("mqtt.port", ConfigDef::forInt(1883, 1, 65535));
+            _configDefs.emplace("mqtt.username", ConfigDef::forString("", 32));
+            _configDefs.emplace("mqtt.password", ConfigDef::forString("", 64));
+            _configDefs.emplace("mqtt.topic_prefix", ConfigDef::forString("shotstopper", 32));
+            _configDefs.emplace("mqtt.samples_per_message", ConfigDef::forInt(10, 1, 20));
+
+            // UDP multicast telemetry
+            _configDefs.emplace("telemetry.udp_enabled", ConfigDef::forBool(false));
+            _configDefs.emplace("telemetry.udp_group", ConfigDef::forString("239.255.42.1", 15));
+            _configDefs.emplace("telemetry.udp_port", ConfigDef::forInt(42421, 1024, 65535));
+            _configDefs.emplace("telemetry.udp_max_rate_hz", ConfigDef::forInt(10, 1, 50));
+
             // Switch configuration
             _configDefs.emplace("switch.momentary", ConfigDef::forBool(true));
             _configDefs.emplace("switch.reedcontact", ConfigDef::forBool(false));
 
             // Scale configuration
             _configDefs.emplace("scale.auto_tare", ConfigDef::forBool(true));
+            _configDefs.emplace("scale.auto_start", ConfigDef::forBool(false));
             _configDefs.emplace("scale.min_weight_for_prediction", ConfigDef::forDouble(10.0, 0.0, 50.0));
+            _configDefs.emplace("scale.trend_window", ConfigDef::forDouble(1.0, 0.4, 5.0));
 
             // Brew configuration
             _configDefs.emplace("brew.by_time_only", ConfigDef::forBool(false));
@@ -273,6 +319,8 @@ class Config {
             _configDefs.emplace("brew.target_time", ConfigDef::forInt(30, 3, 60)); // min/max used for shot duration limits
             _configDefs.emplace("brew.min_shot_duration", ConfigDef::forInt(3, 1, 30));
             _configDefs.emplace("brew.max_shot_duration", ConfigDef::forInt(60, 10, 120));
+            _configDefs.emplace("brew.dose", ConfigDef::forDouble(18.0, 5.0, 30.0));
+            _configDefs.emplace("brew.stop_rule", ConfigDef::forString("", 128));
         }
 
         /**
@@ -363,6 +411,50 @@ class Config {
             LOGF(DEBUG, "Final JSON structure:\n%s", jsonStr.c_str());
         }
 
+        /**
+         * @brief Add default values for all defined parameters that are missing in the loaded document
+         *
+         * @return Number of parameters that were added
+         */
+        int addMissingDefaults() {
+            int added = 0;
+
+            for (const auto& [path, configDef] : _configDefs) {
+                const auto pathStr = String(path.c_str());
+
+                const bool missing = navigatePath(pathStr, [](JsonVariantConst parent, const String& leafKey) {
+                    return leafKey.isEmpty() || parent.isNull() || parent[leafKey].isNull();
+                });
+
+                if (!missing) {
+                    continue;
+                }
+
+                switch (configDef.type) {
+                    case ConfigDef::BOOL:
+                        setJsonValue(_doc, pathStr, configDef.boolVal);
+                        break;
+
+                    case ConfigDef::INT:
+                        setJsonValue(_doc, pathStr, configDef.intVal);
+                        break;
+
+                    case ConfigDef::DOUBLE:
+                        setJsonValue(_doc, pathStr, configDef.doubleVal);
+                        break;
+
+                    case ConfigDef::STRING:
+                        setJsonValue(_doc, pathStr, configDef.stringVal);
+                        break;
+                }
+
+                LOGF(INFO, "Added missing config parameter %s with default value", pathStr.c_str());
+                added++;
+            }
+
+            return added;
+        }
+
         bool validateAndApplyConfig(const JsonDocument& doc) {
             LOGF(INFO, "Validating and applying configuration with %d parameters", _configDefs.size());
 
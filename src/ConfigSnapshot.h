@@ -0,0 +1,95 @@
+/**
+ * @file ConfigSnapshot.h
+ *
+ * @brief Consistent copy of the settings used by the shot control
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+
+/**
+ * @brief Settings the shot control reads while brewing, taken from the ParameterRegistry in one piece
+ *
+ * Stop rule text is stored inline so a snapshot can be copied without allocating.
+ */
+struct ConfigSnapshot {
+    uint32_t epoch;                 // Number of the publish that produced this snapshot, 0 if never published
+    uint32_t revision;              // ParameterRegistry revision the values were read at
+    float goalWeight;
+    float weightOffset;
+    float maxOffset;
+    float dripDelay;
+    float reedSwitchDelay;
+    float minWeightForPrediction;
+    float trendWindow;
+    float minShotDuration;
+    float maxShotDuration;
+    float targetTime;
+    float brewDose;
+    int brewPulseDuration;
+    bool momentary;
+    bool autoTare;
+    char stopRule[129];
+};
+
+/**
+ * @brief Publishes snapshots from the loop and hands out copies to any task
+ *
+ * Two slots are used alternately: a new snapshot is written to the slot readers are not pointed at, then the
+ * epoch is advanced to make it current. A reader retries if the epoch moved while it was copying, which can
+ * only happen if two snapshots were published during the copy. There must be a single publishing task.
+ *
+ * The slots are copied word by word with atomics. A copy that overlaps a publish reads a mix of old and new
+ * words and is thrown away, but it is not a data race. A reader that got a word of a newer publish also sees
+ * the epoch that was current before it, the release stores of the words order them after that epoch.
+ */
+class ConfigSnapshotStore {
+    public:
+        void publish(const ConfigSnapshot& snapshot) {
+            const uint32_t epoch = _epoch.load(std::memory_order_relaxed) + 1;
+
+            uint32_t words[WORDS] = {};
+            memcpy(words, &snapshot, sizeof(snapshot));
+            words[0] = epoch;
+
+            for (size_t i = 0; i < WORDS; i++) {
+                _slots[epoch & 1][i].store(words[i], std::memory_order_release);
+            }
+
+            _epoch.store(epoch, std::memory_order_release);
+        }
+
+        [[nodiscard]] ConfigSnapshot read() const {
+            uint32_t words[WORDS];
+            uint32_t epoch;
+
+            do {
+                epoch = _epoch.load(std::memory_order_acquire);
+
+                for (size_t i = 0; i < WORDS; i++) {
+                    words[i] = _slots[epoch & 1][i].load(std::memory_order_acquire);
+                }
+            } while (_epoch.load(std::memory_order_relaxed) != epoch);
+
+            ConfigSnapshot copy;
+            memcpy(&copy, words, sizeof(copy));
+
+            return copy;
+        }
+
+        [[nodiscard]] uint32_t getEpoch() const {
+            return _epoch.load(std::memory_order_acquire);
+        }
+
+    private:
+        static constexpr size_t WORDS = (sizeof(ConfigSnapshot) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+        static_assert(offsetof(ConfigSnapshot, epoch) == 0, "publish() sets the epoch as the first word");
+
+        std::atomic<uint32_t> _slots[2][WORDS] = {};
+        std::atomic<uint32_t> _epoch{0};
+};
@@ -0,0 +1,29 @@
+/**
+ * @file DeviceId.h
+ *
+ * @brief Stable device identifier derived from the factory MAC address
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * @brief Lowercase hex representation of the factory MAC, e.g. "a1b2c3d4e5f6"
+ *
+ * Unlike the hostname it does not change with the configuration, so it is used to address a unit in
+ * telemetry topics and frames.
+ */
+inline const char* deviceId() {
+    static char id[13] = {};
+
+    if (id[0] == '\0') {
+        const uint64_t mac = ESP.getEfuseMac();
+
+        for (int i = 0; i < 6; i++) {
+            snprintf(id + i * 2, 3, "%02x", static_cast<unsigned>((mac >> (8 * i)) & 0xff));
+        }
+    }
+
+    return id;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file Features.h
+ *
+ * @brief Compile-time feature selection
+ *
+ * Optional subsystems are switched off per build environment with -DFEATURE_<NAME>=0 in platformio.ini.
+ * Application code tests the constexpr flags in the features namespace; only the module headers that
+ * wrap an optional library look at the macros themselves.
+ */
+
+#pragma once
+
+#ifndef FEATURE_WIFI
+#define FEATURE_WIFI 1
+#endif
+
+#ifndef FEATURE_WEBSERVER
+#define FEATURE_WEBSERVER FEATURE_WIFI
+#endif
+
+#ifndef FEATURE_TELNET_LOG
+#define FEATURE_TELNET_LOG FEATURE_WIFI
+#endif
+
+#ifndef FEATURE_MQTT
+#define FEATURE_MQTT FEATURE_WIFI
+#endif
+
+#if !FEATURE_WIFI && (FEATURE_WEBSERVER || FEATURE_TELNET_LOG || FEATURE_MQTT)
+#error "FEATURE_WEBSERVER, FEATURE_TELNET_LOG and FEATURE_MQTT require FEATURE_WIFI"
+#endif
+
+namespace features {
+    // WiFi station mode and the WiFiManager captive portal
+    inline constexpr bool wifi = FEATURE_WIFI;
+
+    // Async web server, SSE status events and the LittleFS web UI
+    inline constexpr bool webServer = FEATURE_WEBSERVER;
+
+    // Log output over telnet (Logger falls back to Serial only)
+    inline constexpr bool telnetLog = FEATURE_TELNET_LOG;
+
+    // MQTT telemetry publisher
+    inline constexpr bool mqtt = FEATURE_MQTT;
+}
@@ -0,0 +1,20 @@
+#include "FilesystemLock.h"
+
+FilesystemLock FilesystemLock::_singleton;
+
+std::unique_lock<std::mutex> FilesystemLock::lock(const bool wait) {
+    std::unique_lock lock(_mutex, std::defer_lock);
+
+    if (wait) {
+        lock.lock();
+    }
+    else if (!lock.try_lock()) {
+        return lock;
+    }
+
+    if (!_mounted) {
+        lock.unlock();
+    }
+
+    return lock;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file FilesystemLock.h
+ *
+ * @brief Keeps LittleFS mounted while a task writes to it
+ */
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
+/**
+ * @brief Serializes LittleFS writers against a filesystem update, which unmounts the partition
+ *
+ * Everything that writes to LittleFS outside of the web server task takes lock(). The update takes
+ * lockForUpdate() to unmount and remount the filesystem, it waits for a writer that holds the lock.
+ */
+class FilesystemLock {
+    public:
+        static FilesystemLock& getInstance() {
+            return _singleton;
+        }
+
+        /**
+         * @brief Keep the filesystem mounted while the returned lock is held
+         *
+         * The lock does not own the mutex while the filesystem is unmounted or, with wait false, while another
+         * task holds it; the caller then skips the write and retries later.
+         */
+        std::unique_lock<std::mutex> lock(bool wait = true);
+
+        /**
+         * @brief Lock regardless of the mount state, for the update that changes it with setMounted()
+         */
+        std::unique_lock<std::mutex> lockForUpdate() {
+            return std::unique_lock(_mutex);
+        }
+
+        /**
+         * @brief Record whether the filesystem is mounted, call with the lock of lockForUpdate() held
+         */
+        void setMounted(const bool mounted) {
+            _mounted = mounted;
+        }
+
+        /**
+         * @brief False while the filesystem is unmounted for an update, the web server serves no files then
+         */
+        [[nodiscard]] bool isMounted() const {
+            return _mounted;
+        }
+
+    private:
+        FilesystemLock() = default;
+
+        static FilesystemLock _singleton;
+
+        std::mutex _mutex;
+        std::atomic<bool> _mounted{true};
+};
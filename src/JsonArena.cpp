@@ -0,0 +1,100 @@
+#include "JsonArena.h"
+
+#include <algorithm>
+#include <cstring>
+
+JsonArena::JsonArena(uint8_t* buffer, const size_t capacity) :
+        _buffer(buffer) {
+    _stats.capacity = capacity;
+    _published.capacity = capacity;
+}
+
+void* JsonArena::allocate(const size_t size) {
+    const size_t needed = HEADER + align(size);
+
+    if (needed > _stats.capacity - _top) {
+        _stats.failures++;
+        return nullptr;
+    }
+
+    *reinterpret_cast<size_t*>(_buffer + _top) = size;
+    _last = _top;
+    _top += needed;
+
+    _stats.allocations++;
+    _stats.used = _top;
+    _stats.highWater = std::max(_stats.highWater, _top);
+
+    return _buffer + _last + HEADER;
+}
+
+void JsonArena::deallocate(void* ptr) {
+    // Only the last block can be given back, the rest is released by reset()
+    if (ptr && isLast(ptr)) {
+        _top = _last;
+        _last = SIZE_MAX;
+        _stats.used = _top;
+    }
+}
+
+void* JsonArena::reallocate(void* ptr, const size_t newSize) {
+    if (!ptr) {
+        return allocate(newSize);
+    }
+
+    const size_t oldSize = blockSize(ptr);
+
+    // Shrink or grow the last block in place
+    if (isLast(ptr)) {
+        if (const size_t needed = HEADER + align(newSize); needed <= _stats.capacity - _last) {
+            *reinterpret_cast<size_t*>(_buffer + _last) = newSize;
+            _top = _last + needed;
+            _stats.used = _top;
+            _stats.highWater = std::max(_stats.highWater, _top);
+
+            return ptr;
+        }
+
+        _stats.failures++;
+        return nullptr;
+    }
+
+    if (newSize <= oldSize) {
+        *reinterpret_cast<size_t*>(static_cast<uint8_t*>(ptr) - HEADER) = newSize;
+        return ptr;
+    }
+
+    void* moved = allocate(newSize);
+
+    if (moved) {
+        memcpy(moved, ptr, oldSize);
+    }
+
+    return moved;
+}
+
+void JsonArena::reset() {
+    _top = 0;
+    _last = SIZE_MAX;
+    _stats.used = 0;
+    _stats.resets++;
+}
+
+void JsonArena::publishStats() {
+    _published.used.store(_stats.used, std::memory_order_relaxed);
+    _published.highWater.store(_stats.highWater, std::memory_order_relaxed);
+    _published.allocations.store(_stats.allocations, std::memory_order_relaxed);
+    _published.failures.store(_stats.failures, std::memory_order_relaxed);
+    _published.resets.store(_stats.resets, std::memory_order_relaxed);
+}
+
+JsonArena::Stats JsonArena::getPublishedStats() const {
+    return {
+        _published.capacity.load(std::memory_order_relaxed),
+        _published.used.load(std::memory_order_relaxed),
+        _published.highWater.load(std::memory_order_relaxed),
+        _published.allocations.load(std::memory_order_relaxed),
+        _published.failures.load(std::memory_order_relaxed),
+        _published.resets.load(std::memory_order_relaxed)
+    };
+}
@@ -0,0 +1,127 @@
+/**
+ * @file JsonArena.h
+ *
+ * @brief Bump allocator for short-lived ArduinoJson documents
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <atomic>
+
+/**
+ * @brief ArduinoJson allocator that hands out memory from a fixed buffer and frees it all at once
+ *
+ * Documents built while handling a request allocate from the arena instead of the heap, so web traffic does
+ * not fragment the heap over time. Freeing a block only gives memory back if it was the last one allocated;
+ * everything else is released by reset() when the request is done (see JsonArenaScope). When the arena is
+ * full, allocations fail and ArduinoJson reports the document as overflowed.
+ *
+ * An arena must only be used from one task. Other tasks read the stats that task last published.
+ */
+class JsonArena : public ArduinoJson::Allocator {
+    public:
+        struct Stats {
+            size_t capacity;
+            size_t used;
+            size_t highWater;      // Most memory in use before a reset
+            uint32_t allocations;
+            uint32_t failures;     // Allocations that did not fit
+            uint32_t resets;
+        };
+
+        JsonArena(uint8_t* buffer, size_t capacity);
+
+        void* allocate(size_t size) override;
+        void deallocate(void* ptr) override;
+        void* reallocate(void* ptr, size_t newSize) override;
+
+        /**
+         * @brief Release all blocks, no document using the arena may be alive
+         */
+        void reset();
+
+        [[nodiscard]] const Stats& getStats() const {
+            return _stats;
+        }
+
+        /**
+         * @brief Copy the stats for getPublishedStats(), called from the task using the arena
+         */
+        void publishStats();
+
+        /**
+         * @brief Stats as of the last publishStats(), for any task
+         *
+         * Each field is copied on its own, so a read that overlaps a publish can mix fields of both.
+         */
+        [[nodiscard]] Stats getPublishedStats() const;
+
+    private:
+        // Every block starts with its size, blocks are aligned for doubles
+        static constexpr size_t ALIGNMENT = 8;
+        static constexpr size_t HEADER = ALIGNMENT;
+
+        uint8_t* _buffer;
+        size_t _top = 0;
+        size_t _last = SIZE_MAX;   // Offset of the last block's header, SIZE_MAX if none
+        Stats _stats = {};
+
+        struct PublishedStats {
+            std::atomic<size_t> capacity{0};
+            std::atomic<size_t> used{0};
+            std::atomic<size_t> highWater{0};
+            std::atomic<uint32_t> allocations{0};
+            std::atomic<uint32_t> failures{0};
+            std::atomic<uint32_t> resets{0};
+        };
+
+        PublishedStats _published;
+
+        static size_t align(const size_t size) {
+            return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        }
+
+        [[nodiscard]] size_t blockSize(const void* ptr) const {
+            return *reinterpret_cast<const size_t*>(static_cast<const uint8_t*>(ptr) - HEADER);
+        }
+
+        [[nodiscard]] bool isLast(const void* ptr) const {
+            return _last != SIZE_MAX && static_cast<const uint8_t*>(ptr) == _buffer + _last + HEADER;
+        }
+};
+
+/**
+ * @brief Arena with its own statically allocated buffer
+ */
+template <size_t Capacity>
+class StaticJsonArena : public JsonArena {
+    public:
+        StaticJsonArena() :
+                JsonArena(_storage, Capacity) {
+        }
+
+    private:
+        alignas(8) uint8_t _storage[Capacity] = {};
+};
+
+/**
+ * @brief Resets an arena when leaving the scope, declare it before the documents using the arena
+ */
+class JsonArenaScope {
+    public:
+        explicit JsonArenaScope(JsonArena& arena) :
+                _arena(arena) {
+        }
+
+        ~JsonArenaScope() {
+            _arena.reset();
+        }
+
+        JsonArenaScope(const JsonArenaScope&) = delete;
+        JsonArenaScope& operator=(const JsonArenaScope&) = delete;
+
+    private:
+        JsonArena& _arena;
+};
@@ -0,0 +1,149 @@
+#include "LedController.h"
+
+#include "Logger.h"
+
+#include <driver/ledc.h>
+
+LedController LedController::_singleton;
+
+static constexpr ledc_mode_t LED_SPEED_MODE = LEDC_LOW_SPEED_MODE;
+static constexpr ledc_timer_t LED_TIMER = LEDC_TIMER_0;
+static constexpr ledc_channel_t LED_CHANNELS[3] = {LEDC_CHANNEL_0, LEDC_CHANNEL_1, LEDC_CHANNEL_2};
+static constexpr uint32_t LED_PWM_FREQUENCY = 5000;
+
+// Extra time after a hardware fade before the channel is touched again
+static constexpr int64_t FADE_MARGIN_US = 2000;
+
+void LedController::begin(const uint8_t redPin, const uint8_t greenPin, const uint8_t bluePin) {
+    ledc_timer_config_t timerConfig = {};
+    timerConfig.speed_mode = LED_SPEED_MODE;
+    timerConfig.duty_resolution = LEDC_TIMER_8_BIT;
+    timerConfig.timer_num = LED_TIMER;
+    timerConfig.freq_hz = LED_PWM_FREQUENCY;
+    timerConfig.clk_cfg = LEDC_AUTO_CLK;
+
+    if (ledc_timer_config(&timerConfig) != ESP_OK) {
+        LOG(ERROR, "Failed to configure LED timer");
+        return;
+    }
+
+    const uint8_t pins[3] = {redPin, greenPin, bluePin};
+
+    for (int i = 0; i < 3; i++) {
+        ledc_channel_config_t channelConfig = {};
+        channelConfig.gpio_num = pins[i];
+        channelConfig.speed_mode = LED_SPEED_MODE;
+        channelConfig.channel = LED_CHANNELS[i];
+        channelConfig.timer_sel = LED_TIMER;
+        channelConfig.duty = 0;
+        channelConfig.flags.output_invert = 1; // LEDs are active low
+
+        if (ledc_channel_config(&channelConfig) != ESP_OK) {
+            LOGF(ERROR, "Failed to configure LED channel for GPIO %u", pins[i]);
+            return;
+        }
+    }
+
+    // Already installed is fine, another component may use the fader
+    (void)ledc_fade_func_install(0);
+
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = onTimer;
+    timerArgs.arg = this;
+    timerArgs.dispatch_method = ESP_TIMER_TASK;
+    timerArgs.name = "led";
+
+    if (esp_timer_create(&timerArgs, &_timer) != ESP_OK) {
+        LOG(ERROR, "Failed to create LED timer");
+        _timer = nullptr;
+    }
+}
+
+void LedController::post(const LedState state) {
+    if (_posted.exchange(state) == state || !_timer) {
+        return;
+    }
+
+    // Restart the step timer so the new pattern starts right away. If the callback is running at the same
+    // time one of the two starts fails, either way the callback runs once more and picks up the new state.
+    (void)esp_timer_stop(_timer);
+    (void)esp_timer_start_once(_timer, 0);
+}
+
+LedController::Pattern LedController::getPattern(const LedState state) {
+    // {red, green, blue, duration, fade}
+    static constexpr Step off[] = {{0, 0, 0, 0, false}};
+    static constexpr Step ready[] = {{0, 255, 0, 0, false}};
+    static constexpr Step scaleConnecting[] = {{255, 0, 0, 900, true}, {40, 0, 0, 900, true}};
+    static constexpr Step brewing[] = {{0, 255, 0, 1000, false}, {0, 0, 255, 1000, false}};
+    static constexpr Step brewingPrediction[] = {{0, 255, 0, 500, true}, {0, 255, 255, 500, true}};
+    static constexpr Step brewingTimeMode[] = {{255, 255, 0, 1000, false}, {0, 0, 255, 1000, false}};
+    static constexpr Step brewingNoScale[] = {{255, 0, 0, 1000, false}, {0, 0, 255, 1000, false}};
+    static constexpr Step error[] = {{255, 0, 0, 125, false}, {0, 0, 0, 125, false}};
+
+    switch (state) {
+        case LedState::Ready:
+            return {ready, 1};
+        case LedState::ScaleConnecting:
+            return {scaleConnecting, 2};
+        case LedState::Brewing:
+            return {brewing, 2};
+        case LedState::BrewingPrediction:
+            return {brewingPrediction, 2};
+        case LedState::BrewingTimeMode:
+            return {brewingTimeMode, 2};
+        case LedState::BrewingNoScale:
+            return {brewingNoScale, 2};
+        case LedState::Error:
+            return {error, 2};
+        case LedState::Off:
+        default:
+            return {off, 1};
+    }
+}
+
+void LedController::onTimer(void* arg) {
+    auto* self = static_cast<LedController*>(arg);
+    const int64_t now = esp_timer_get_time();
+
+    // Setting a channel during a hardware fade blocks until the fade is done, wait for it here instead
+    if (now < self->_fadeEnd_us) {
+        (void)esp_timer_start_once(self->_timer, self->_fadeEnd_us - now);
+        return;
+    }
+
+    const LedState state = self->_posted.load();
+    const Pattern pattern = getPattern(state);
+
+    if (state != self->_active) {
+        self->_active = state;
+        self->_step = 0;
+    }
+    else {
+        self->_step = (self->_step + 1) % pattern.count;
+    }
+
+    const Step& step = pattern.steps[self->_step];
+    self->apply(step);
+
+    if (pattern.count > 1) {
+        (void)esp_timer_start_once(self->_timer, static_cast<uint64_t>(step.duration_ms) * 1000);
+    }
+}
+
+void LedController::apply(const Step& step) {
+    const uint8_t duties[3] = {step.red, step.green, step.blue};
+
+    for (int i = 0; i < 3; i++) {
+        if (step.fade) {
+            ledc_set_fade_with_time(LED_SPEED_MODE, LED_CHANNELS[i], duties[i], step.duration_ms);
+            ledc_fade_start(LED_SPEED_MODE, LED_CHANNELS[i], LEDC_FADE_NO_WAIT);
+        }
+        else {
+            ledc_set_duty(LED_SPEED_MODE, LED_CHANNELS[i], duties[i]);
+            ledc_update_duty(LED_SPEED_MODE, LED_CHANNELS[i]);
+        }
+    }
+
+    _fadeEnd_us = step.fade ? esp_timer_get_time() + static_cast<int64_t>(step.duration_ms) * 1000 + FADE_MARGIN_US : 0;
+}
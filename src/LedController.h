@@ -0,0 +1,81 @@
+/**
+ * @file LedController.h
+ *
+ * @brief Status LED patterns driven by LEDC hardware fading and a timer callback
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <esp_timer.h>
+
+enum class LedState : uint8_t {
+    Off,
+    Ready,              // Scale connected, waiting for a shot
+    ScaleConnecting,    // Scale disconnected, (re)connecting in the background
+    Brewing,            // Brewing by weight, collecting the first datapoints
+    BrewingPrediction,  // Brewing by weight, end time prediction active
+    BrewingTimeMode,    // Brewing by time (brew by time only configured)
+    BrewingNoScale,     // Brewing by time because the scale is disconnected
+    Error
+};
+
+/**
+ * @brief Plays the pattern for the current LED state without involving the control loop
+ *
+ * Each state maps to a looping sequence of color steps. A step either switches the color or fades to it using
+ * the LEDC hardware fader; the step timing runs on an esp_timer callback. The controller only posts state
+ * changes, posting the current state again is a no-op.
+ */
+class LedController {
+    public:
+        static LedController& getInstance() {
+            return _singleton;
+        }
+
+        /**
+         * @brief Configure the LEDC channels for the RGB LED (active low) and the step timer
+         */
+        void begin(uint8_t redPin, uint8_t greenPin, uint8_t bluePin);
+
+        /**
+         * @brief Switch to the pattern of the given state
+         */
+        void post(LedState state);
+
+        [[nodiscard]] LedState getState() const {
+            return _posted.load();
+        }
+
+    private:
+        LedController() = default;
+
+        static LedController _singleton;
+
+        struct Step {
+            uint8_t red;
+            uint8_t green;
+            uint8_t blue;
+            uint16_t duration_ms;
+            bool fade;          // Fade to the color over the step duration instead of switching
+        };
+
+        struct Pattern {
+            const Step* steps;
+            uint8_t count;
+        };
+
+        static Pattern getPattern(LedState state);
+        static void onTimer(void* arg);
+
+        void apply(const Step& step);
+
+        esp_timer_handle_t _timer = nullptr;
+        std::atomic<LedState> _posted{LedState::Off};
+
+        // Only accessed from the timer callback
+        LedState _active = LedState::Off;
+        uint8_t _step = 0;
+        int64_t _fadeEnd_us = 0;
+};
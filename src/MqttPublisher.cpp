@@ -0,0 +1,272 @@
+#include "MqttPublisher.h"
+
+#include "DeviceId.h"
+#include "Features.h"
+#include "Logger.h"
+
+#include <cstdarg>
+
+#if FEATURE_MQTT
+#include <PubSubClient.h>
+#include <WiFi.h>
+#endif
+
+// Global variables from main.cpp
+extern bool mqttEnabled;
+extern String mqttHost;
+extern int mqttPort;
+extern String mqttUsername;
+extern String mqttPassword;
+extern String mqttTopicPrefix;
+extern int mqttSamplesPerMessage;
+
+MqttPublisher MqttPublisher::_singleton;
+
+#if FEATURE_MQTT
+static WiFiClient wifiClient;
+static PubSubClient mqttClient(wifiClient);
+#endif
+
+void MqttPublisher::begin() {
+    if (!features::mqtt || !mqttEnabled) {
+        return;
+    }
+
+    if (mqttHost.isEmpty()) {
+        LOG(WARNING, "MQTT enabled but no broker configured");
+        return;
+    }
+
+    _host = mqttHost;
+    _port = static_cast<uint16_t>(mqttPort);
+    _username = mqttUsername;
+    _password = mqttPassword;
+    _baseTopic = mqttTopicPrefix + "/" + deviceId() + "/";
+    _samplesPerMessage = mqttSamplesPerMessage;
+
+    _queue = xQueueCreate(QUEUE_LENGTH, sizeof(Message));
+
+    if (_queue == nullptr) {
+        LOG(ERROR, "Failed to create MQTT queue");
+        return;
+    }
+
+    if (xTaskCreate(taskEntry, "mqtt", TASK_STACK_SIZE, this, 1, nullptr) != pdPASS) {
+        LOG(ERROR, "Failed to create MQTT task");
+        vQueueDelete(_queue);
+        _queue = nullptr;
+        return;
+    }
+
+    LOGF(INFO, "MQTT publisher started: %s:%u, topic %s", _host.c_str(), _port, _baseTopic.c_str());
+}
+
+void MqttPublisher::shotStarted(const float goalWeight, const bool byWeight) {
+    if (!_queue) {
+        return;
+    }
+
+    _shotId++;
+    _batchLen = 0;
+    _batchCount = 0;
+
+    enqueue("shot/start", R"({"shot":%u,"goalWeight":%.1f,"mode":"%s","uptime":%lu})",
+        _shotId, goalWeight, byWeight ? "weight" : "time", millis() / 1000);
+}
+
+void MqttPublisher::addSample(const float time_s, const float weight) {
+    if (!_queue) {
+        return;
+    }
+
+    if (_batchCount == 0) {
+        _batchLen = snprintf(_batch, sizeof(_batch), R"({"shot":%u,"samples":[)", _shotId);
+    }
+
+    _batchLen += snprintf(_batch + _batchLen, sizeof(_batch) - _batchLen, "%s[%.2f,%.1f]", _batchCount > 0 ? "," : "", time_s, weight);
+    _batchCount++;
+
+    // Leave room for the closing brackets
+    if (_batchCount >= _samplesPerMessage || _batchLen > sizeof(_batch) - 32) {
+        flushSamples();
+    }
+}
+
+void MqttPublisher::shotStopped(const char* reason, const float duration_s, const float weight) {
+    if (!_queue) {
+        return;
+    }
+
+    flushSamples();
+
+    enqueue("shot/stop", R"({"shot":%u,"reason":"%s","duration":%.1f,"weight":%.1f})", _shotId, reason, duration_s, weight);
+}
+
+void MqttPublisher::shotSummary(const float duration_s, const float finalWeight, const float goalWeight, const float offset, const bool offsetUpdated) {
+    if (!_queue) {
+        return;
+    }
+
+    enqueue("shot/summary", R"({"shot":%u,"duration":%.1f,"finalWeight":%.1f,"goalWeight":%.1f,"error":%.1f,"offset":%.2f,"offsetUpdated":%s})",
+        _shotId, duration_s, finalWeight, goalWeight, finalWeight - goalWeight, offset, offsetUpdated ? "true" : "false");
+}
+
+MqttPublisher::Stats MqttPublisher::getStats() const {
+    Stats stats = {};
+    stats.published = _published.load();
+    stats.dropped = _dropped.load();
+    stats.failed = _failed.load();
+    stats.reconnects = _reconnects.load();
+    stats.queued = _queue ? static_cast<uint32_t>(uxQueueMessagesWaiting(_queue)) : 0;
+    stats.connected = _connected.load();
+
+    return stats;
+}
+
+bool MqttPublisher::enqueue(const char* topic, const char* format, ...) {
+    Message message;
+    strlcpy(message.topic, topic, sizeof(message.topic));
+
+    va_list args;
+    va_start(args, format);
+    const int len = vsnprintf(message.payload, sizeof(message.payload), format, args);
+    va_end(args);
+
+    if (len < 0 || static_cast<size_t>(len) >= sizeof(message.payload)) {
+        _dropped++;
+        return false;
+    }
+
+    message.len = static_cast<uint16_t>(len);
+
+    // Never wait for the publisher task, drop the message instead
+    if (xQueueSend(_queue, &message, 0) != pdTRUE) {
+        _dropped++;
+        return false;
+    }
+
+    return true;
+}
+
+void MqttPublisher::flushSamples() {
+    if (_batchCount == 0) {
+        return;
+    }
+
+    enqueue("samples", "%s]}", _batch);
+
+    _batchLen = 0;
+    _batchCount = 0;
+}
+
+void MqttPublisher::taskEntry(void* arg) {
+    static_cast<MqttPublisher*>(arg)->run();
+}
+
+void MqttPublisher::run() {
+#if FEATURE_MQTT
+    mqttClient.setServer(_host.c_str(), _port);
+    mqttClient.setBufferSize(PAYLOAD_SIZE + 128);
+    mqttClient.setKeepAlive(15);
+    mqttClient.setSocketTimeout(2);
+
+    unsigned long reconnectDelay_ms = RECONNECT_MIN_MS;
+    unsigned long lastAttempt_ms = 0;
+    unsigned long lastHealth_ms = 0;
+    bool wasConnected = false;
+
+    for (;;) {
+        if (!WiFi.isConnected()) {
+            _connected = false;
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
+
+        if (!mqttClient.connected()) {
+            _connected = false;
+
+            if (millis() - lastAttempt_ms < reconnectDelay_ms) {
+                vTaskDelay(pdMS_TO_TICKS(200));
+                continue;
+            }
+
+            lastAttempt_ms = millis();
+
+            if (!connect()) {
+                reconnectDelay_ms = std::min(reconnectDelay_ms * 2, RECONNECT_MAX_MS);
+                LOGF(DEBUG, "MQTT connect failed (state %d), retrying in %lums", mqttClient.state(), reconnectDelay_ms);
+                continue;
+            }
+
+            if (wasConnected) {
+                _reconnects++;
+            }
+
+            wasConnected = true;
+            reconnectDelay_ms = RECONNECT_MIN_MS;
+            _connected = true;
+            lastHealth_ms = 0;
+        }
+
+        mqttClient.loop();
+
+        if (xQueueReceive(_queue, &_txMessage, pdMS_TO_TICKS(100)) == pdTRUE) {
+            char topic[96];
+            snprintf(topic, sizeof(topic), "%s%s", _baseTopic.c_str(), _txMessage.topic);
+
+            if (mqttClient.publish(topic, reinterpret_cast<const uint8_t*>(_txMessage.payload), _txMessage.len, false)) {
+                _published++;
+            }
+            else {
+                _failed++;
+            }
+        }
+
+        if (lastHealth_ms == 0 || millis() - lastHealth_ms > HEALTH_PERIOD_MS) {
+            lastHealth_ms = millis();
+            publishHealth();
+        }
+    }
+#else
+    vTaskDelete(nullptr);
+#endif
+}
+
+bool MqttPublisher::connect() {
+#if FEATURE_MQTT
+    char clientId[32];
+    snprintf(clientId, sizeof(clientId), "shotstopper-%s", deviceId());
+
+    const String statusTopic = _baseTopic + "status";
+
+    const bool connected = mqttClient.connect(clientId,
+        _username.isEmpty() ? nullptr : _username.c_str(),
+        _password.isEmpty() ? nullptr : _password.c_str(),
+        statusTopic.c_str(), 0, true, "offline");
+
+    if (connected) {
+        mqttClient.publish(statusTopic.c_str(), "online", true);
+        LOG(INFO, "MQTT connected");
+    }
+
+    return connected;
+#else
+    return false;
+#endif
+}
+
+void MqttPublisher::publishHealth() {
+#if FEATURE_MQTT
+    const Stats stats = getStats();
+
+    char payload[256];
+    snprintf(payload, sizeof(payload),
+        R"({"uptime":%lu,"freeHeap":%u,"minFreeHeap":%u,"rssi":%d,"queued":%u,"published":%u,"dropped":%u,"failed":%u,"reconnects":%u})",
+        millis() / 1000, ESP.getFreeHeap(), ESP.getMinFreeHeap(), WiFi.RSSI(), stats.queued, stats.published, stats.dropped, stats.failed, stats.reconnects);
+
+    char topic[96];
+    snprintf(topic, sizeof(topic), "%shealth", _baseTopic.c_str());
+
+    mqttClient.publish(topic, payload);
+#endif
+}
@@ -0,0 +1,116 @@
+/**
+ * @file MqttPublisher.h
+ *
+ * @brief MQTT telemetry publisher running in its own task
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+/**
+ * @brief Publishes shot events, batched live samples and health metrics to <prefix>/<deviceId>/...
+ *
+ * Topics:
+ *   status         "online"/"offline" (retained, last will)
+ *   shot/start     shot id, goal weight, mode
+ *   samples        {"shot":id,"samples":[[t,w],...]}, several samples per message
+ *   shot/stop      shot id, end reason, duration, weight at stop
+ *   shot/summary   shot id, final weight after the drip delay, goal, offset
+ *   health         uptime, heap, RSSI, queue and drop counters
+ *
+ * The controller only formats a message and hands it to a bounded queue without waiting. A separate task
+ * connects to the broker, reconnects with backoff and publishes from the queue. While the broker is down the
+ * queue fills up and new messages are dropped and counted; the controller is never blocked.
+ */
+class MqttPublisher {
+    public:
+        struct Stats {
+            uint32_t published;
+            uint32_t dropped;      // Queue was full, message discarded
+            uint32_t failed;       // Publish to the broker failed
+            uint32_t reconnects;
+            uint32_t queued;       // Messages currently waiting in the queue
+            bool connected;
+        };
+
+        static MqttPublisher& getInstance() {
+            return _singleton;
+        }
+
+        /**
+         * @brief Create the queue and the publisher task if MQTT is enabled and a broker is configured
+         */
+        void begin();
+
+        void shotStarted(float goalWeight, bool byWeight);
+
+        /**
+         * @brief Add a live sample, a message is queued once the batch is full
+         */
+        void addSample(float time_s, float weight);
+
+        void shotStopped(const char* reason, float duration_s, float weight);
+
+        void shotSummary(float duration_s, float finalWeight, float goalWeight, float offset, bool offsetUpdated);
+
+        [[nodiscard]] bool isEnabled() const {
+            return _queue != nullptr;
+        }
+
+        [[nodiscard]] Stats getStats() const;
+
+    private:
+        MqttPublisher() = default;
+
+        static MqttPublisher _singleton;
+
+        static constexpr size_t QUEUE_LENGTH = 12;
+        static constexpr size_t TOPIC_SIZE = 16;
+        static constexpr size_t PAYLOAD_SIZE = 512;
+        static constexpr uint32_t TASK_STACK_SIZE = 5120;
+        static constexpr unsigned long HEALTH_PERIOD_MS = 30000;
+        static constexpr unsigned long RECONNECT_MIN_MS = 1000;
+        static constexpr unsigned long RECONNECT_MAX_MS = 60000;
+
+        struct Message {
+            char topic[TOPIC_SIZE];    // Relative to the device topic
+            uint16_t len;
+            char payload[PAYLOAD_SIZE];
+        };
+
+        bool enqueue(const char* topic, const char* format, ...) __attribute__((format(printf, 3, 4)));
+        void flushSamples();
+
+        static void taskEntry(void* arg);
+        void run();
+        bool connect();
+        void publishHealth();
+
+        QueueHandle_t _queue = nullptr;
+
+        String _host;
+        uint16_t _port = 1883;
+        String _username;
+        String _password;
+        String _baseTopic;        // "<prefix>/<deviceId>/"
+        int _samplesPerMessage = 10;
+
+        // Sample batch, only used by the controller
+        char _batch[PAYLOAD_SIZE] = {};
+        size_t _batchLen = 0;
+        int _batchCount = 0;
+        uint32_t _shotId = 0;
+
+        // Only used by the publisher task
+        Message _txMessage = {};
+
+        std::atomic<uint32_t> _published{0};
+        std::atomic<uint32_t> _dropped{0};
+        std::atomic<uint32_t> _failed{0};
+        std::atomic<uint32_t> _reconnects{0};
+        std::atomic<bool> _connected{false};
+};
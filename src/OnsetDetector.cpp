@@ -0,0 +1,87 @@
+#include "OnsetDetector.h"
+
+#include <algorithm>
+
+void OnsetDetector::reset() {
+    _armed = false;
+    _zeroSince_s = -1.0f;
+    _sum = 0.0f;
+    _risingSamples = 0;
+}
+
+bool OnsetDetector::addSample(const float time_s, const float weight_g) {
+    const bool hasPrevious = _count > 0;
+    const size_t previous = (_head + HISTORY - 1) % HISTORY;
+    const float dt = hasPrevious ? time_s - _times[previous] : 0.0f;
+    const float dw = hasPrevious ? weight_g - _weights[previous] : 0.0f;
+
+    _times[_head] = time_s;
+    _weights[_head] = weight_g;
+    _head = (_head + 1) % HISTORY;
+    _count = std::min(_count + 1, HISTORY);
+
+    // Arm once the tared cup has been resting on the scale for a moment
+    if (fabsf(weight_g) <= ZERO_BAND_G) {
+        if (_zeroSince_s < 0.0f) {
+            _zeroSince_s = time_s;
+        }
+
+        if (!_armed && time_s - _zeroSince_s >= ARM_STABLE_S) {
+            _armed = true;
+            _sum = 0.0f;
+            _onset_s = time_s;
+            _risingSamples = 0;
+        }
+    }
+    else {
+        _zeroSince_s = -1.0f;
+    }
+
+    if (!_armed || !hasPrevious || dt <= 0.0f) {
+        return false;
+    }
+
+    if (weight_g < REMOVED_G) {
+        reset();
+        return false;
+    }
+
+    // A cup put on the empty tared scale, clipping it would turn it into flow
+    if (dw > PLACED_RATE_GPS * dt) {
+        reset();
+        return false;
+    }
+
+    _risingSamples = dw > 0.0f ? _risingSamples + 1 : 0;
+    _sum += std::min(dw, MAX_RATE_GPS * dt) - DRIFT_GPS * dt;
+
+    if (_sum <= 0.0f) {
+        _sum = 0.0f;
+        _onset_s = time_s;
+        return false;
+    }
+
+    if (_sum >= THRESHOLD_G && weight_g >= MIN_WEIGHT_G && _risingSamples >= CONSISTENT_SAMPLES) {
+        _armed = false;
+        _zeroSince_s = -1.0f;
+        return true;
+    }
+
+    return false;
+}
+
+size_t OnsetDetector::copySince(const float since_s, float* times_s, float* weights_g, const size_t maxCount) const {
+    size_t copied = 0;
+
+    for (size_t i = 0; i < _count && copied < maxCount; i++) {
+        const size_t index = (_head + HISTORY - _count + i) % HISTORY;
+
+        if (_times[index] >= since_s) {
+            times_s[copied] = _times[index];
+            weights_g[copied] = _weights[index];
+            copied++;
+        }
+    }
+
+    return copied;
+}
@@ -0,0 +1,78 @@
+/**
+ * @file OnsetDetector.h
+ *
+ * @brief Detects the start of a shot from the scale weight alone
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * @brief One-sided CUSUM change-point detector on the weight increments after a tare
+ *
+ * The detector arms once the scale has read about 0 g for ARM_STABLE_S, i.e. after the cup has been tared.
+ * Each increment, limited to MAX_RATE_GPS so a bump of the cup counts as little as a fraction of a second of
+ * flow, is added to a cumulative sum minus a drift allowance of DRIFT_GPS. A shot is detected when the sum
+ * exceeds THRESHOLD_G, the weight is above MIN_WEIGHT_G and the last CONSISTENT_SAMPLES increments were all
+ * positive. The onset is the last time the sum was zero, which is where the flow started rising. An increment
+ * faster than PLACED_RATE_GPS is a cup put on the empty tared scale, not flow, and disarms the detector like
+ * reset().
+ *
+ * The most recent samples are kept in a ring buffer, so the trajectory from the onset on can be handed to the
+ * shot once it is detected.
+ */
+class OnsetDetector {
+    public:
+        static constexpr size_t HISTORY = 48;
+
+        /**
+         * @brief Disarm until the scale reads about 0 g again, used after a shot
+         */
+        void reset();
+
+        /**
+         * @brief Feed a new scale sample
+         *
+         * @param time_s Timestamp of the sample (seconds since boot)
+         * @return true if a shot onset was detected with this sample
+         */
+        bool addSample(float time_s, float weight_g);
+
+        [[nodiscard]] bool isArmed() const {
+            return _armed;
+        }
+
+        [[nodiscard]] float getOnsetTime() const {
+            return _onset_s;
+        }
+
+        /**
+         * @brief Copy the samples taken at or after a time, oldest first
+         *
+         * @return Number of samples copied
+         */
+        size_t copySince(float since_s, float* times_s, float* weights_g, size_t maxCount) const;
+
+    private:
+        static constexpr float ZERO_BAND_G = 0.5f;        // Weight counted as tared
+        static constexpr float REMOVED_G = -2.0f;         // Cup lifted off the scale
+        static constexpr float ARM_STABLE_S = 1.0f;
+        static constexpr float DRIFT_GPS = 0.3f;
+        static constexpr float MAX_RATE_GPS = 5.0f;
+        static constexpr float PLACED_RATE_GPS = 50.0f;   // Weight added faster than any shot flows
+        static constexpr float THRESHOLD_G = 1.0f;
+        static constexpr float MIN_WEIGHT_G = 0.8f;
+        static constexpr int CONSISTENT_SAMPLES = 3;
+
+        float _times[HISTORY] = {};
+        float _weights[HISTORY] = {};
+        size_t _head = 0;
+        size_t _count = 0;
+
+        bool _armed = false;
+        float _zeroSince_s = -1.0f;
+        float _sum = 0.0f;
+        float _onset_s = 0.0f;
+        int _risingSamples = 0;
+};
@@ -0,0 +1,13 @@
+/**
+ * @file OtaPublicKey.h
+ *
+ * @brief Public key used to verify signed update packages
+ *
+ * Generate a key pair with `python scripts/sign_firmware.py keygen ota_key.pem` and paste the printed public
+ * key here. Keep the private key out of the repository. With an empty key the firmware refuses every update
+ * over the network and has to be flashed over USB.
+ */
+
+#pragma once
+
+static constexpr char OTA_PUBLIC_KEY_PEM[] = "";
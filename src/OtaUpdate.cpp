@@ -0,0 +1,327 @@
+#include "OtaUpdate.h"
+
+#include "Config.h"
+#include "FilesystemLock.h"
+#include "Logger.h"
+#include "OtaPublicKey.h"
+#include "ParameterRegistry.h"
+
+#include <LittleFS.h>
+#include <Update.h>
+#include <atomic>
+#include <esp_ota_ops.h>
+#include <mbedtls/pk.h>
+#include <mbedtls/version.h>
+
+// mbedtls 2.x (IDF 4.x) only has the int returning SHA-256 functions with a _ret suffix
+#if MBEDTLS_VERSION_NUMBER < 0x03000000
+#define mbedtls_sha256_starts mbedtls_sha256_starts_ret
+#define mbedtls_sha256_update mbedtls_sha256_update_ret
+#define mbedtls_sha256_finish mbedtls_sha256_finish_ret
+#endif
+
+// Global variables from main.cpp
+extern std::atomic<bool> isBrewing;
+extern Config config;
+
+OtaUpdate OtaUpdate::_singleton;
+
+// The health check in OtaUpdate::loop() decides whether a new image is kept, instead of the core marking it
+// valid right at boot
+extern "C" bool verifyRollbackLater() {
+    return true;
+}
+
+static uint32_t readLe32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 | static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+void OtaUpdate::begin() {
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state;
+
+    if (esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY) {
+        _pendingVerify = true;
+        LOGF(INFO, "Running new firmware from %s, health check in %lus", running->label, HEALTH_CHECK_DELAY_MS / 1000);
+    }
+}
+
+const char* OtaUpdate::start(const void* owner) {
+    if (_owner != nullptr) {
+        return "Another update is in progress";
+    }
+
+    if (isBrewing) {
+        return "Update refused while brewing";
+    }
+
+    // Unsigned packages are never accepted, a build without a key cannot be updated over the network
+    if (OTA_PUBLIC_KEY_PEM[0] == '\0') {
+        LOG(WARNING, "Update refused, no public key configured");
+        return "Updates are disabled, no public key in this firmware";
+    }
+
+    _owner = owner;
+    _headerLen = 0;
+    _imageSize = 0;
+    _written = 0;
+    _failed = false;
+    _lastError = "";
+    _start_ms = millis();
+
+    mbedtls_sha256_init(&_sha);
+    mbedtls_sha256_starts(&_sha, 0);
+
+    LOG(INFO, "Update started");
+
+    return nullptr;
+}
+
+bool OtaUpdate::write(const void* owner, const uint8_t* data, size_t len) {
+    if (owner != _owner || _failed) {
+        return false;
+    }
+
+    if (isBrewing) {
+        fail("Update aborted, a shot was started");
+        return false;
+    }
+
+    // The header may be split across chunks
+    if (_headerLen < HEADER_SIZE) {
+        const size_t n = std::min(len, HEADER_SIZE - _headerLen);
+        memcpy(_header + _headerLen, data, n);
+        _headerLen += n;
+        data += n;
+        len -= n;
+
+        if (_headerLen == HEADER_SIZE && !processHeader()) {
+            return false;
+        }
+    }
+
+    if (len == 0) {
+        return true;
+    }
+
+    if (_written + len > _imageSize) {
+        fail("Package is larger than the image size in its header");
+        return false;
+    }
+
+    mbedtls_sha256_update(&_sha, data, len);
+
+    if (Update.write(const_cast<uint8_t*>(data), len) != len) {
+        fail(String("Flash write failed: ") + Update.errorString());
+        return false;
+    }
+
+    _written += len;
+
+    // Let the control loop run between chunks, flash erases stall the cache of both cores
+    vTaskDelay(1);
+
+    return true;
+}
+
+bool OtaUpdate::finish(const void* owner) {
+    if (owner != _owner) {
+        return false;
+    }
+
+    if (_failed) {
+        end();
+        return false;
+    }
+
+    if (_headerLen < HEADER_SIZE || _written != _imageSize) {
+        fail("Package is incomplete");
+        end();
+        return false;
+    }
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&_sha, digest);
+
+    if (memcmp(digest, _expectedDigest, sizeof(digest)) != 0) {
+        fail("SHA-256 mismatch");
+        end();
+        return false;
+    }
+
+    if (!Update.end()) {
+        fail(String("Update failed: ") + Update.errorString());
+        end();
+        return false;
+    }
+
+    _stats.bytes = _written;
+    _stats.duration_ms = millis() - _start_ms;
+    _stats.throughputKBps = _stats.duration_ms > 0 ? static_cast<float>(_written) / 1.024f / static_cast<float>(_stats.duration_ms) : 0.0f;
+    _stats.success = true;
+
+    LOGF(INFO, "Update of %u bytes verified in %lums (%.1f KB/s)", _written, _stats.duration_ms, _stats.throughputKBps);
+
+    if (_target == Target::Firmware) {
+        _reboot_ms = millis();
+    }
+
+    end();
+
+    return true;
+}
+
+void OtaUpdate::abort(const void* owner) {
+    if (owner != _owner) {
+        return;
+    }
+
+    fail("Upload interrupted");
+    end();
+}
+
+void OtaUpdate::loop(const bool healthy) {
+    if (_reboot_ms != 0 && millis() - _reboot_ms > REBOOT_DELAY_MS) {
+        LOG(INFO, "Restarting into new firmware");
+        ESP.restart();
+    }
+
+    if (!_pendingVerify || millis() < HEALTH_CHECK_DELAY_MS) {
+        return;
+    }
+
+    _pendingVerify = false;
+
+    if (healthy) {
+        esp_ota_mark_app_valid_cancel_rollback();
+        LOG(INFO, "Health check passed, new firmware marked valid");
+    }
+    else {
+        LOG(ERROR, "Health check failed, rolling back to previous firmware");
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+    }
+}
+
+bool OtaUpdate::processHeader() {
+    if (memcmp(_header, "SSOT", 4) != 0 || _header[4] != PACKAGE_VERSION) {
+        fail("Not an update package");
+        return false;
+    }
+
+    if (_header[5] > static_cast<uint8_t>(Target::Filesystem)) {
+        fail("Unknown update target");
+        return false;
+    }
+
+    _target = static_cast<Target>(_header[5]);
+    _imageSize = readLe32(_header + 8);
+    memcpy(_expectedDigest, _header + 12, sizeof(_expectedDigest));
+
+    const size_t sigLen = static_cast<size_t>(_header[44]) | static_cast<size_t>(_header[45]) << 8;
+
+    if (sigLen > MAX_SIGNATURE_SIZE) {
+        fail("Invalid signature length");
+        return false;
+    }
+
+    if (!verifySignature(_header + 46, sigLen)) {
+        return false;
+    }
+
+    if (_target == Target::Filesystem) {
+        // Nothing may access the filesystem while it is overwritten, waits for a save of another task to end
+        auto& filesystem = FilesystemLock::getInstance();
+        const auto lock = filesystem.lockForUpdate();
+        filesystem.setMounted(false);
+        _fsUnmounted = true;
+        LittleFS.end();
+    }
+
+    if (!Update.begin(_imageSize, _target == Target::Firmware ? U_FLASH : U_SPIFFS)) {
+        fail(String("Cannot start update: ") + Update.errorString());
+        return false;
+    }
+
+    LOGF(INFO, "Writing %s image (%u bytes)", _target == Target::Firmware ? "firmware" : "filesystem", _imageSize);
+
+    return true;
+}
+
+bool OtaUpdate::verifySignature(const uint8_t* signature, const size_t len) {
+    if (len == 0) {
+        fail("Package is not signed");
+        return false;
+    }
+
+    uint8_t headerDigest[32];
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, _header, SIGNED_HEADER_SIZE);
+    mbedtls_sha256_finish(&sha, headerDigest);
+    mbedtls_sha256_free(&sha);
+
+    mbedtls_pk_context pk;
+    mbedtls_pk_init(&pk);
+
+    int result = mbedtls_pk_parse_public_key(&pk, reinterpret_cast<const unsigned char*>(OTA_PUBLIC_KEY_PEM), sizeof(OTA_PUBLIC_KEY_PEM));
+
+    if (result == 0 && mbedtls_pk_can_do(&pk, MBEDTLS_PK_ECKEY)) {
+        result = mbedtls_pk_verify(&pk, MBEDTLS_MD_SHA256, headerDigest, sizeof(headerDigest), signature, len);
+    }
+    else {
+        result = -1;
+        LOG(ERROR, "Configured update public key is invalid");
+    }
+
+    mbedtls_pk_free(&pk);
+
+    if (result != 0) {
+        fail("Signature verification failed");
+        return false;
+    }
+
+    LOG(INFO, "Update signature verified");
+
+    return true;
+}
+
+void OtaUpdate::fail(const String& error) {
+    if (_failed) {
+        return;
+    }
+
+    _failed = true;
+    _lastError = error;
+    _stats = {};
+
+    if (Update.isRunning()) {
+        Update.abort();
+    }
+
+    LOGF(ERROR, "Update failed: %s", error.c_str());
+}
+
+void OtaUpdate::end() {
+    mbedtls_sha256_free(&_sha);
+
+    if (_fsUnmounted) {
+        // A failed filesystem update leaves the partition partially written, formatting it keeps the device
+        // usable; the configuration is still in memory and is written back either way
+        const auto lock = ParameterRegistry::getInstance().lock();
+        auto& filesystem = FilesystemLock::getInstance();
+        const auto fsLock = filesystem.lockForUpdate();
+
+        if (!LittleFS.begin(true)) {
+            LOG(ERROR, "Failed to mount filesystem after update");
+        }
+        else if (!config.save()) {
+            LOG(ERROR, "Failed to restore configuration after filesystem update");
+        }
+
+        filesystem.setMounted(true);
+        _fsUnmounted = false;
+    }
+
+    _owner = nullptr;
+}
@@ -0,0 +1,146 @@
+/**
+ * @file OtaUpdate.h
+ *
+ * @brief Streaming firmware and filesystem updates with signature verification and rollback
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <mbedtls/sha256.h>
+
+/**
+ * @brief Writes an update package into the inactive app slot or the filesystem partition
+ *
+ * An update package is a 128 byte header followed by the raw image (see scripts/sign_firmware.py):
+ *
+ *   0   magic "SSOT"
+ *   4   version (1)
+ *   5   target (0 = firmware, 1 = filesystem)
+ *   6   reserved
+ *   8   image size (uint32, little endian)
+ *   12  SHA-256 of the image
+ *   44  signature length (uint16, little endian)
+ *   46  ECDSA P-256 signature (DER) over the SHA-256 of header bytes 0-43
+ *
+ * The signature is checked before anything is written, the image digest is computed while streaming and
+ * checked before the new slot is activated. Writing yields after every chunk and is refused or aborted while
+ * a shot is running. Without a public key in OtaPublicKey.h every update is refused.
+ *
+ * After a firmware update the new image boots in the pending verify state. It is marked valid once it has
+ * been running for HEALTH_CHECK_DELAY_MS and reports healthy, otherwise the bootloader returns to the previous
+ * image (also if the new image crashes or resets before that).
+ */
+class OtaUpdate {
+    public:
+        enum class Target : uint8_t {
+            Firmware = 0,
+            Filesystem = 1
+        };
+
+        struct Stats {
+            uint32_t bytes;             // Image bytes written by the last update
+            uint32_t duration_ms;       // Duration of the last update
+            float throughputKBps;
+            bool success;
+        };
+
+        static OtaUpdate& getInstance() {
+            return _singleton;
+        }
+
+        /**
+         * @brief Check whether the running image still has to pass the health check
+         */
+        void begin();
+
+        /**
+         * @brief Start an update for the given owner (e.g. the upload request)
+         *
+         * A refused start leaves getLastError() alone, it may belong to the update that is running.
+         *
+         * @return nullptr once started, otherwise why it was refused: an update is already running, a shot is in
+         * progress or no public key is compiled in
+         */
+        const char* start(const void* owner);
+
+        /**
+         * @brief Write the next chunk of the package
+         *
+         * @return false if the update failed, see getLastError()
+         */
+        bool write(const void* owner, const uint8_t* data, size_t len);
+
+        /**
+         * @brief Verify the image and activate it
+         *
+         * @return true if the image was verified and written completely
+         */
+        bool finish(const void* owner);
+
+        /**
+         * @brief Cancel the update of the given owner, e.g. when the client disconnected
+         */
+        void abort(const void* owner);
+
+        /**
+         * @brief Reboot into a new image and run the health check of the running image
+         *
+         * @param healthy True if the controller is operating normally
+         */
+        void loop(bool healthy);
+
+        [[nodiscard]] bool isActive() const {
+            return _owner != nullptr;
+        }
+
+        [[nodiscard]] bool isPendingVerify() const {
+            return _pendingVerify;
+        }
+
+        [[nodiscard]] Target getTarget() const {
+            return _target;
+        }
+
+        [[nodiscard]] const String& getLastError() const {
+            return _lastError;
+        }
+
+        [[nodiscard]] const Stats& getStats() const {
+            return _stats;
+        }
+
+    private:
+        OtaUpdate() = default;
+
+        static OtaUpdate _singleton;
+
+        static constexpr size_t HEADER_SIZE = 128;
+        static constexpr size_t SIGNED_HEADER_SIZE = 44;
+        static constexpr size_t MAX_SIGNATURE_SIZE = 72;
+        static constexpr uint8_t PACKAGE_VERSION = 1;
+        static constexpr unsigned long HEALTH_CHECK_DELAY_MS = 30000;
+        static constexpr unsigned long REBOOT_DELAY_MS = 1000;
+
+        bool processHeader();
+        bool verifySignature(const uint8_t* signature, size_t len);
+        void fail(const String& error);
+        void end();
+
+        const void* _owner = nullptr;
+        Target _target = Target::Firmware;
+        uint8_t _header[HEADER_SIZE] = {};
+        size_t _headerLen = 0;
+        uint32_t _imageSize = 0;
+        uint32_t _written = 0;
+        uint8_t _expectedDigest[32] = {};
+        mbedtls_sha256_context _sha = {};
+        unsigned long _start_ms = 0;
+        bool _failed = false;
+        bool _fsUnmounted = false;
+        String _lastError;
+        Stats _stats = {};
+
+        bool _pendingVerify = false;
+        unsigned long _reboot_ms = 0;
+};
@@ -8,7 +8,9 @@
 
 #include <Arduino.h>
 #include <functional>
+#include <algorithm>
 #include <cstring>
+#include <stdexcept>
 
 enum EditableKind {
     kInteger = 0,
@@ -185,12 +187,14 @@ public:
     }
 
     double getValue() const {
+        if (_trial) return _boolGetter ? (_trialValue != 0.0 ? 1.0 : 0.0) : _trialValue;
         if (_boolGetter) return _boolGetter() ? 1.0 : 0.0;
         if (_numericGetter) return _numericGetter();
         return 0.0;
     }
 
     String getStringValue() const {
+        if (_trial) return _trialStringValue;
         if (_stringGetter) return _stringGetter();
         if (_staticStringGetter) return String(_staticStringGetter());
         return String();
@@ -206,9 +210,57 @@ public:
     }
 
     void setStringValue(const String& val) {
+        validateStringValue(val);
+
         if (_stringSetter) _stringSetter(val);
     }
 
+    void validateStringValue(const String& val) const {
+        if (String error; _stringValidator && !_stringValidator(val, error)) {
+            throw std::invalid_argument(error.c_str());
+        }
+    }
+
+    // --- Trial values, used in place of the stored value and never written to the config ---
+
+    bool isTrial() const { return _trial; }
+
+    void setTrialValue(double val) {
+        if (_maxValue > _minValue) {
+            val = std::min(std::max(val, _minValue), _maxValue);
+        }
+
+        _trial = true;
+        _trialValue = val;
+    }
+
+    void setTrialStringValue(const String& val) {
+        validateStringValue(val);
+        _trial = true;
+        _trialStringValue = val;
+    }
+
+    // Store the trial value through the regular setter
+    void commitTrial() {
+        if (!_trial) return;
+        _trial = false;
+
+        if (_type == kCString) {
+            setStringValue(_trialStringValue);
+        }
+        else {
+            setValue(_trialValue);
+        }
+    }
+
+    // Back to the stored value
+    void revertTrial() {
+        _trial = false;
+    }
+
+    // Rejects string values before they are stored, the validator sets a message for the user
+    void setStringValidator(std::function<bool(const String&, String&)> validator) { _stringValidator = std::move(validator); }
+
     template <typename T>
     T getValueAs() const {
         if constexpr (std::is_same_v<T, bool>) {
@@ -285,6 +337,12 @@ private:
     std::function<String()> _stringGetter;
     std::function<void(const String&)> _stringSetter;
     std::function<const char*()> _staticStringGetter;
+    std::function<bool(const String&, String&)> _stringValidator;
+
+    // Trial value overriding the stored value
+    bool _trial = false;
+    double _trialValue = 0;
+    String _trialStringValue;
 
     // Enum support
     const char* const* _enumOptions = nullptr;
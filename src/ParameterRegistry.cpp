@@ -1,7 +1,11 @@
 #include "ParameterRegistry.h"
+#include "Features.h"
 #include "Logger.h"
+#include "StopRules.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
 
 ParameterRegistry ParameterRegistry::_singleton;
 
@@ -13,15 +17,30 @@ extern int brewPulseDuration;
 extern float dripDelay;
 extern float reedSwitchDelay;
 extern float minWeightForPrediction;
-extern float minShotDuration;
-extern float maxShotDuration;
-extern float targetTime;
+extern float trendWindow;
+extern float brewDose;
+extern String stopRule;
 extern bool momentary;
 extern bool reedSwitch;
 extern bool autoTare;
-extern bool brewByTimeOnly;
+extern bool autoStart;
+extern std::atomic<bool> brewByTimeOnly;
 extern bool brewByTimeOnlyConfigured;
 extern String hostName;
+extern bool powerIdleEnabled;
+extern int maxWakeLatencyMs;
+extern bool lightSleepEnabled;
+extern bool mqttEnabled;
+extern String mqttHost;
+extern int mqttPort;
+extern String mqttUsername;
+extern String mqttPassword;
+extern String mqttTopicPrefix;
+extern int mqttSamplesPerMessage;
+extern bool udpTelemetryEnabled;
+extern String udpTelemetryGroup;
+extern int udpTelemetryPort;
+extern int udpMaxRateHz;
 extern const char sysVersion[64];
 
 
@@ -149,6 +168,31 @@ void ParameterRegistry::initialize(Config& config) {
         "When enabled, the brew always stops by time regardless of scale connection."
     );
 
+    addNumericConfigParam<float>(
+        "brew.dose",
+        "Dose (g)",
+        kFloat,
+        sBrewSection,
+        110,
+        &brewDose,
+        5.0, 30.0,
+        "Dose of ground coffee, used by stop rules as 'dose' and 'ratio' (weight / dose)."
+    );
+
+    addStringConfigParam(
+        "brew.stop_rule",
+        "Stop Rules",
+        sBrewSection,
+        111,
+        &stopRule,
+        128,
+        "Additional conditions that stop the shot, checked on every scale sample. Separate rules with ';'. "
+        "Variables: t (s), w (g), flow (g/s), dose, goal, offset, ratio. Example: t > 20 && flow < 0.5; ratio >= 2.5",
+        [] { return true; },
+        false,
+        StopRules::validate
+    );
+
     // --- Scale Section ---
 
     addBoolConfigParam(
@@ -171,6 +215,28 @@ void ParameterRegistry::initialize(Config& config) {
         "Minimum weight before the end-time prediction algorithm activates."
     );
 
+    addBoolConfigParam(
+        "scale.auto_start",
+        "Auto Start",
+        sScaleSection,
+        202,
+        &autoStart,
+        "Start the shot when the scale sees the espresso flowing, for machines without brew switch wiring. "
+        "Tare the scale with the cup before each shot. The shot is not tared again at the start."
+    );
+
+    addNumericConfigParam<float>(
+        "scale.trend_window",
+        "Trend Window (s)",
+        kFloat,
+        sScaleSection,
+        203,
+        &trendWindow,
+        0.4, 5.0,
+        "Length of the weight history the end time is extrapolated from. Shorter follows flow changes faster, "
+        "longer is steadier on a noisy scale."
+    );
+
     // --- Switch Section ---
 
     addBoolConfigParam(
@@ -216,6 +282,173 @@ void ParameterRegistry::initialize(Config& config) {
         "Set the logging verbosity level."
     );
 
+    addBoolConfigParam(
+        "power.idle_enabled",
+        "Idle Power Saving",
+        sSystemSection,
+        410,
+        &powerIdleEnabled,
+        "Lower the CPU clock and WiFi power while no shot is running and no client is connected."
+    );
+
+    addNumericConfigParam<int>(
+        "power.max_wake_latency_ms",
+        "Max Wake Latency (ms)",
+        kInteger,
+        sSystemSection,
+        411,
+        &maxWakeLatencyMs,
+        5, 200,
+        "Upper bound for the time from a brew switch edge until the controller reacts while idle."
+    );
+
+    addBoolConfigParam(
+        "power.light_sleep",
+        "Automatic Light Sleep",
+        sSystemSection,
+        412,
+        &lightSleepEnabled,
+        "Allow automatic light sleep while idle. Only available if the framework supports power management. Serial output over USB may be interrupted.",
+        [] { return true; },
+        true
+    );
+
+    // --- Telemetry Section ---
+
+    addBoolConfigParam(
+        "mqtt.enabled",
+        "MQTT Telemetry",
+        sTelemetrySection,
+        500,
+        &mqttEnabled,
+        "Publish shot events, live samples and health metrics to an MQTT broker.",
+        [] { return features::mqtt; },
+        true
+    );
+
+    addStringConfigParam(
+        "mqtt.host",
+        "MQTT Broker",
+        sTelemetrySection,
+        501,
+        &mqttHost,
+        64,
+        "Hostname or IP address of the MQTT broker.",
+        [] { return features::mqtt && mqttEnabled; },
+        true
+    );
+
+    addNumericConfigParam<int>(
+        "mqtt.port",
+        "MQTT Port",
+        kInteger,
+        sTelemetrySection,
+        502,
+        &mqttPort,
+        1, 65535,
+        "TCP port of the MQTT broker.",
+        [] { return features::mqtt && mqttEnabled; },
+        true
+    );
+
+    addStringConfigParam(
+        "mqtt.username",
+        "MQTT Username",
+        sTelemetrySection,
+        503,
+        &mqttUsername,
+        32,
+        "Username for the broker, leave empty for anonymous access.",
+        [] { return features::mqtt && mqttEnabled; },
+        true
+    );
+
+    addStringConfigParam(
+        "mqtt.password",
+        "MQTT Password",
+        sTelemetrySection,
+        504,
+        &mqttPassword,
+        64,
+        "Password for the broker.",
+        [] { return features::mqtt && mqttEnabled; },
+        true
+    );
+
+    addStringConfigParam(
+        "mqtt.topic_prefix",
+        "MQTT Topic Prefix",
+        sTelemetrySection,
+        505,
+        &mqttTopicPrefix,
+        32,
+        "Messages are published to <prefix>/<device id>/... where the device id is derived from the MAC address.",
+        [] { return features::mqtt && mqttEnabled; },
+        true
+    );
+
+    addNumericConfigParam<int>(
+        "mqtt.samples_per_message",
+        "Samples per Message",
+        kInteger,
+        sTelemetrySection,
+        506,
+        &mqttSamplesPerMessage,
+        1, 20,
+        "Number of live weight samples batched into one MQTT message during a shot.",
+        [] { return features::mqtt && mqttEnabled; },
+        true
+    );
+
+    addBoolConfigParam(
+        "telemetry.udp_enabled",
+        "UDP Multicast Telemetry",
+        sTelemetrySection,
+        510,
+        &udpTelemetryEnabled,
+        "Send a compact binary frame with state, weight, flow and predicted end per sample to a multicast group for dashboards.",
+        [] { return features::wifi; },
+        true
+    );
+
+    addStringConfigParam(
+        "telemetry.udp_group",
+        "Multicast Group",
+        sTelemetrySection,
+        511,
+        &udpTelemetryGroup,
+        15,
+        "IPv4 multicast address (224.0.0.0 - 239.255.255.255) the frames are sent to.",
+        [] { return features::wifi && udpTelemetryEnabled; },
+        true
+    );
+
+    addNumericConfigParam<int>(
+        "telemetry.udp_port",
+        "Multicast Port",
+        kInteger,
+        sTelemetrySection,
+        512,
+        &udpTelemetryPort,
+        1024, 65535,
+        "UDP port the frames are sent to.",
+        [] { return features::wifi && udpTelemetryEnabled; },
+        true
+    );
+
+    addNumericConfigParam<int>(
+        "telemetry.udp_max_rate_hz",
+        "Max Frame Rate (Hz)",
+        kInteger,
+        sTelemetrySection,
+        513,
+        &udpMaxRateHz,
+        1, 50,
+        "Upper limit for frames per second. While idle a frame is sent once per second.",
+        [] { return features::wifi && udpTelemetryEnabled; },
+        true
+    );
+
     addParam(
         std::make_shared<Parameter>(
             "VERSION",
@@ -259,3 +492,176 @@ void ParameterRegistry::syncGlobalVariables() const {
         }
     }
 }
+
+ConfigSnapshot ParameterRegistry::makeConfigSnapshot() {
+    // Read through the parameters, which hold the trial values and the settings without a global variable
+    const auto value = [this](const char* id) { return getParameterById(id)->getValue(); };
+
+    ConfigSnapshot snapshot = {};
+    snapshot.revision = _revision.load();
+    snapshot.goalWeight = static_cast<float>(value("brew.goal_weight"));
+    snapshot.weightOffset = static_cast<float>(value("brew.weight_offset"));
+    snapshot.maxOffset = static_cast<float>(value("brew.max_offset"));
+    snapshot.dripDelay = static_cast<float>(value("brew.drip_delay"));
+    snapshot.reedSwitchDelay = static_cast<float>(value("brew.reed_switch_delay"));
+    snapshot.minWeightForPrediction = static_cast<float>(value("scale.min_weight_for_prediction"));
+    snapshot.trendWindow = static_cast<float>(value("scale.trend_window"));
+    snapshot.minShotDuration = static_cast<float>(value("brew.min_shot_duration"));
+    snapshot.maxShotDuration = static_cast<float>(value("brew.max_shot_duration"));
+    snapshot.targetTime = static_cast<float>(value("brew.target_time"));
+    snapshot.brewDose = static_cast<float>(value("brew.dose"));
+    snapshot.brewPulseDuration = static_cast<int>(value("brew.pulse_duration_ms"));
+    snapshot.momentary = value("switch.momentary") != 0.0;
+    snapshot.autoTare = value("scale.auto_tare") != 0.0;
+    strlcpy(snapshot.stopRule, getParameterById("brew.stop_rule")->getStringValue().c_str(), sizeof(snapshot.stopRule));
+
+    return snapshot;
+}
+
+void ParameterRegistry::postParameterValue(const char* id, const double value, const bool stored) {
+    for (size_t i = 0; i < _postedCount; i++) {
+        if (strcmp(_posted[i].id, id) == 0) {
+            _posted[i].value = value;
+            _posted[i].stored = stored;
+            return;
+        }
+    }
+
+    if (_postedCount == MAX_POSTED_VALUES) {
+        LOGF(WARNING, "%s not applied, too many pending values", id);
+        return;
+    }
+
+    _posted[_postedCount++] = {id, value, stored};
+}
+
+bool ParameterRegistry::processChanges(ConfigSnapshotStore& snapshots) {
+    const std::unique_lock lock(_mutex, std::try_to_lock);
+
+    if (!lock) {
+        return false;
+    }
+
+    // Same path as changes from the web: saved with a delay, or kept in RAM during a trial unless stored
+    for (size_t i = 0; i < _postedCount; i++) {
+        try {
+            if (!_posted[i].stored) {
+                setParameterValue(_posted[i].id, _posted[i].value);
+            }
+            else if (const auto param = getParameterById(_posted[i].id);
+                param && (param->isTrial() || !isUnchanged(*param, _posted[i].value))) {
+                storeValue(*param, _posted[i].value);
+            }
+        } catch (const std::exception& e) {
+            LOGF(WARNING, "%s not applied: %s", _posted[i].id, e.what());
+        }
+    }
+
+    _postedCount = 0;
+
+    if (const uint32_t revision = _revision.load(); revision != _syncedRevision) {
+        _syncedRevision = revision;
+        syncGlobalVariables();
+        snapshots.publish(makeConfigSnapshot());
+
+        LOGF(DEBUG, "Config snapshot %u published (revision %u)", static_cast<unsigned>(snapshots.getEpoch()),
+            static_cast<unsigned>(revision));
+    }
+
+    return true;
+}
+
+void ParameterRegistry::startTrial(const unsigned long timeout_ms) {
+    {
+        const std::lock_guard guard(_mutex);
+
+        _trialTimeout_ms = timeout_ms;
+        _trialLastChange_ms = millis();
+
+        if (_trialActive) {
+            return;
+        }
+    }
+
+    // Changes made before the trial are stored first, so a revert cannot lose them. Outside the lock, the file
+    // is written after forceSave() released the registry.
+    forceSave();
+
+    const std::lock_guard guard(_mutex);
+
+    if (!_trialActive) {
+        _trialActive = true;
+        LOGF(INFO, "Trial mode started, reverting after %lus without changes", timeout_ms / 1000);
+    }
+}
+
+void ParameterRegistry::commitTrial() {
+    {
+        const std::lock_guard guard(_mutex);
+
+        if (!_trialActive) {
+            return;
+        }
+
+        _trialActive = false;
+
+        for (const auto& param : _parameters) {
+            if (param->isTrial()) {
+                param->commitTrial();
+                markChanged();
+            }
+        }
+
+        _revision++;
+    }
+
+    forceSave();
+
+    LOG(INFO, "Trial values committed");
+}
+
+void ParameterRegistry::revertTrial() {
+    const std::lock_guard guard(_mutex);
+
+    if (!_trialActive) {
+        return;
+    }
+
+    _trialActive = false;
+
+    for (const auto& param : _parameters) {
+        param->revertTrial();
+    }
+
+    _revision++;
+
+    LOG(INFO, "Trial values reverted");
+}
+
+void ParameterRegistry::processTrialTimeout() {
+    // Called from the loop, checked again in the next iteration if another task holds the registry
+    const std::unique_lock lock(_mutex, std::try_to_lock);
+
+    if (lock && _trialActive && millis() - _trialLastChange_ms > _trialTimeout_ms) {
+        LOG(WARNING, "Trial mode timed out");
+        revertTrial();
+    }
+}
+
+unsigned long ParameterRegistry::getTrialRemainingMs() const {
+    const std::lock_guard guard(_mutex);
+
+    if (!_trialActive) {
+        return 0;
+    }
+
+    const unsigned long elapsed = millis() - _trialLastChange_ms;
+
+    return elapsed < _trialTimeout_ms ? _trialTimeout_ms - elapsed : 0;
+}
+
+size_t ParameterRegistry::getTrialChangeCount() const {
+    const std::lock_guard guard(_mutex);
+
+    return std::count_if(_parameters.begin(), _parameters.end(), [](const std::shared_ptr<Parameter>& param) { return param->isTrial(); });
+}
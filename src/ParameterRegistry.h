@@ -1,9 +1,15 @@
 #pragma once
 
 #include "Config.h"
+#include "ConfigSnapshot.h"
+#include "FilesystemLock.h"
 #include "Parameter.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 enum ParameterSection {
@@ -11,7 +17,8 @@ enum ParameterSection {
     sScaleSection = 1,
     sSwitchSection = 2,
     sSystemSection = 3,
-    sOtherSection = 4
+    sOtherSection = 4,
+    sTelemetrySection = 5
 };
 
 inline const char* getSectionName(const int sectionId) {
@@ -26,6 +33,8 @@ inline const char* getSectionName(const int sectionId) {
             return "System";
         case sOtherSection:
             return "Other";
+        case sTelemetrySection:
+            return "Telemetry";
         default:
             return "Unknown Section";
     }
@@ -33,7 +42,7 @@ inline const char* getSectionName(const int sectionId) {
 
 class ParameterRegistry {
     ParameterRegistry() :
-            _ready(false), _config(nullptr), _pendingChanges(false), _lastChangeTime(0) {
+            _ready(false), _config(nullptr), _lastChangeTime(0) {
         }
 
         static ParameterRegistry _singleton;
@@ -43,15 +52,134 @@ class ParameterRegistry {
         std::vector<std::shared_ptr<Parameter>> _parameters;
         std::map<std::string, std::shared_ptr<Parameter>> _parameterMap;
         Config* _config;
-        bool _pendingChanges;
+        std::atomic<bool> _pendingChanges{false};   // Cleared before a save unlocks the registry, set again if it fails
         unsigned long _lastChangeTime;
         static constexpr unsigned long SAVE_DELAY_MS = 2000;
+        std::atomic<uint32_t> _revision{0};
+
+        // Parameters are set and read from the loop, the web server task and the USB protocol. The mutex guards
+        // the values, the Config document behind them and the change and trial state. Recursive, because the
+        // setters and the trial functions call each other.
+        mutable std::recursive_mutex _mutex;
+
+        // Values the loop posted for processChanges(), only used by the loop. One slot per BLE characteristic
+        // and the learned offset.
+        struct PostedValue {
+            const char* id;
+            double value;
+            bool stored;
+        };
+
+        static constexpr size_t MAX_POSTED_VALUES = 8;
+        PostedValue _posted[MAX_POSTED_VALUES] = {};
+        size_t _postedCount = 0;
+
+        // Revision the global variables were last copied at, processChanges() copies them again after a change
+        uint32_t _syncedRevision = UINT32_MAX;
+
+        bool _trialActive = false;
+        unsigned long _trialTimeout_ms = 0;
+        unsigned long _trialLastChange_ms = 0;
+
+        template <typename T>
+        void setTrialValue(Parameter& param, const T& value) {
+            if (param.requiresReboot()) {
+                throw std::invalid_argument("Requires a reboot, not available in trial mode");
+            }
+
+            if constexpr (std::is_same_v<T, String>) {
+                if (param.getType() == kCString) {
+                    param.setTrialStringValue(value);
+                }
+                else {
+                    param.setTrialValue(value.toDouble());
+                }
+            }
+            else if constexpr (std::is_same_v<T, bool>) {
+                param.setTrialValue(value ? 1.0 : 0.0);
+            }
+            else {
+                param.setTrialValue(static_cast<double>(value));
+            }
+
+            _trialLastChange_ms = millis();
+            _revision++;
+        }
+
+        template <typename T>
+        void storeValue(Parameter& param, const T& value) {
+            if constexpr (std::is_same_v<T, String> || std::is_same_v<T, std::string>) {
+                if (param.getType() == kCString) {
+                    param.setStringValue(value);
+                }
+                else {
+                    const double numericValue = value.toDouble();
+                    param.setValue(numericValue);
+                }
+            }
+            else if constexpr (std::is_same_v<T, bool>) {
+                param.setValue(value ? 1.0 : 0.0);
+            }
+            else {
+                param.setValue(static_cast<double>(value));
+            }
+
+            markChanged();
+            _revision++;
+        }
+
+        // Forms post every shown parameter, values that did not change are neither stored nor trial values
+        template <typename T>
+        static bool isUnchanged(const Parameter& param, const T& value) {
+            if constexpr (std::is_same_v<T, String> || std::is_same_v<T, std::string>) {
+                if (param.getType() == kCString) {
+                    return param.getStringValue() == value;
+                }
+
+                return isSameNumber(param.getValue(), value.toDouble());
+            }
+            else if constexpr (std::is_same_v<T, bool>) {
+                return (param.getValue() != 0.0) == value;
+            }
+            else {
+                return isSameNumber(param.getValue(), static_cast<double>(value));
+            }
+        }
+
+        // The JSON sent to the form does not round-trip every double exactly
+        static bool isSameNumber(const double a, const double b) {
+            return std::fabs(a - b) <= 1e-6 * std::max(1.0, std::fabs(a));
+        }
 
         void addParam(const std::shared_ptr<Parameter>& param) {
             _parameters.push_back(param);
             _parameterMap[param->getId().c_str()] = param;
         }
 
+        // Serializes the configuration with the registry locked and writes it after unlocking, so no other task
+        // waits for the flash. The filesystem lock is taken first, saves reach the file in the order of their
+        // changes. The registry stays locked if the caller holds it as well.
+        bool save(std::unique_lock<std::recursive_mutex>& lock, const bool wait) {
+            auto fs = FilesystemLock::getInstance().lock(wait);
+
+            if (!fs) {
+                return false;
+            }
+
+            const String json = _config->serialize();
+            _pendingChanges = false;
+            lock.unlock();
+
+            const bool saved = Config::save(json);
+            fs.unlock();
+
+            if (!saved) {
+                _pendingChanges = true;
+            }
+
+            return saved;
+        }
+
     public:
         static ParameterRegistry& getInstance() {
             return _singleton;
@@ -61,71 +189,135 @@ class ParameterRegistry {
             return _ready;
         }
 
+        /**
+         * @brief Hold while reading parameter values or using the Config directly, the setters lock by themselves
+         */
+        [[nodiscard]] std::unique_lock<std::recursive_mutex> lock() const {
+            return std::unique_lock(_mutex);
+        }
+
+        /**
+         * @brief Like lock(), but does not wait, the lock is not owned if another task holds the registry
+         */
+        [[nodiscard]] std::unique_lock<std::recursive_mutex> tryLock() const {
+            return std::unique_lock(_mutex, std::try_to_lock);
+        }
+
         void initialize(Config& config);
 
         [[nodiscard]] const std::vector<std::shared_ptr<Parameter>>& getParameters() const {
             return _parameters;
         }
 
+        /**
+         * @brief Copy the values, trial values included, to the global variables, call with the registry locked
+         *
+         * The loop reads the global variables without locking, so only the loop calls this (in processChanges())
+         * once the tasks are running. The setters only change the Config document and the trial values.
+         */
         void syncGlobalVariables() const;
 
+        /**
+         * @brief Settings for the shot control, read from the parameters, call with the registry locked
+         */
+        ConfigSnapshot makeConfigSnapshot();
+
+        /**
+         * @brief Queue a value for processChanges(), for the loop, which does not wait for the registry
+         *
+         * id must be a string literal. A second value for the same id replaces the first. During a trial the value
+         * becomes a trial value like a change from the web, unless stored is set: values the device learned from
+         * a shot are stored right away, survive a revert and do not keep the trial from timing out.
+         */
+        void postParameterValue(const char* id, double value, bool stored = false);
+
+        /**
+         * @brief Called from the loop: applies the posted values and, after any change, updates the global
+         * variables and publishes a new ConfigSnapshot
+         *
+         * @return false if another task held the registry, the loop then tries again in its next iteration
+         */
+        bool processChanges(ConfigSnapshotStore& snapshots);
+
         std::shared_ptr<Parameter> getParameterById(const char* id);
 
         template <typename T>
         bool setParameterValue(const char* id, const T& value) {
+            const std::lock_guard guard(_mutex);
             const auto param = getParameterById(id);
 
             if (!param) {
                 return false;
             }
 
-            if constexpr (std::is_same_v<T, String> || std::is_same_v<T, std::string>) {
-                if (param->getType() == kCString) {
-                    param->setStringValue(value);
-                }
-                else {
-                    const double numericValue = value.toDouble();
-                    param->setValue(numericValue);
-                }
+            if (isUnchanged(*param, value)) {
+                return true;
             }
-            else if constexpr (std::is_same_v<T, bool>) {
-                param->setValue(value ? 1.0 : 0.0);
+
+            if (_trialActive) {
+                setTrialValue(*param, value);
             }
             else {
-                param->setValue(static_cast<double>(value));
+                storeValue(*param, value);
             }
 
-            markChanged();
             return true;
         }
 
+        /**
+         * @brief Incremented whenever a parameter value changes, including trial changes, commits and reverts
+         */
+        [[nodiscard]] uint32_t getRevision() const {
+            return _revision.load();
+        }
+
+        // Trial mode: changes only apply to the global variables until committed, and are reverted
+        // automatically when no change was made for the timeout
+        void startTrial(unsigned long timeout_ms);
+        void commitTrial();
+        void revertTrial();
+        void processTrialTimeout();
+
+        [[nodiscard]] bool isTrialActive() const {
+            return _trialActive;
+        }
+
+        [[nodiscard]] unsigned long getTrialRemainingMs() const;
+        [[nodiscard]] size_t getTrialChangeCount() const;
+
         // Persistence management
         void processPeriodicSave() {
-            if (!_config || !_pendingChanges) {
+            // Called from the loop, which must not wait for a save or a request of another task
+            std::unique_lock lock(_mutex, std::try_to_lock);
+
+            if (!lock || !_config || !_pendingChanges) {
                 return;
             }
 
-            if (millis() - _lastChangeTime > SAVE_DELAY_MS) {
-                if (_config->save()) {
-                    _pendingChanges = false;
-                    LOG(INFO, "Configuration automatically saved to filesystem");
-                }
+            // Not while a filesystem update or another save runs, the changes stay pending until it has finished
+            if (millis() - _lastChangeTime > SAVE_DELAY_MS && save(lock, false)) {
+                LOG(INFO, "Configuration automatically saved to filesystem");
             }
         }
 
         void forceSave() {
+            std::unique_lock lock(_mutex);
+
             if (!_config || !_pendingChanges) {
                 LOG(INFO, "No pending changes, configuration not written to filesystem");
                 return;
             }
 
-            if (_config->save()) {
-                _pendingChanges = false;
+            if (save(lock, true)) {
                 LOG(INFO, "Configuration forcibly saved to filesystem");
             }
+            else if (!FilesystemLock::getInstance().isMounted()) {
+                LOG(INFO, "Filesystem update in progress, configuration saved afterwards");
+            }
         }
 
         void markChanged() {
+            const std::lock_guard guard(_mutex);
             _pendingChanges = true;
             _lastChangeTime = millis();
         }
@@ -140,17 +332,16 @@ class ParameterRegistry {
             double maxLength,
             const char* helpText = "",
             const std::function<bool()>& showCondition = [] { return true; },
-            const bool requiresReboot = false) {
+            const bool requiresReboot = false,
+            std::function<bool(const String&, String&)> validator = nullptr) {
 
             const auto param = std::make_shared<Parameter>(
                 configPath, displayName, kCString, section, position, [this, configPath]() -> String { return _config->get<String>(configPath); },
-                [this, configPath, globalVar](const String& val) {
-                    _config->set<String>(configPath, val);
-                    if (globalVar) *globalVar = val;
-                },
+                [this, configPath](const String& val) { _config->set<String>(configPath, val); },
                 maxLength, !String(helpText).isEmpty(), helpText, showCondition, globalVar);
 
             param->setRequiresReboot(requiresReboot);
+            param->setStringValidator(std::move(validator));
             addParam(param);
         }
 
@@ -167,10 +358,7 @@ class ParameterRegistry {
 
             const auto param = std::make_shared<Parameter>(
                 configPath, displayName, kUInt8, section, position, [this, configPath]() -> bool { return _config->get<bool>(configPath); },
-                [this, configPath, globalVar](const bool val) {
-                    _config->set<bool>(configPath, val);
-                    if (globalVar) *globalVar = val;
-                },
+                [this, configPath](const bool val) { _config->set<bool>(configPath, val); },
                 !String(helpText).isEmpty(), helpText, showCondition, globalVar);
 
             param->setRequiresReboot(requiresReboot);
@@ -194,11 +382,7 @@ class ParameterRegistry {
 
             auto param = std::make_shared<Parameter>(
                 configPath, displayName, type, section, position, [this, configPath]() -> double { return static_cast<double>(_config->get<T>(configPath)); },
-                [this, configPath, globalVar](const double val) {
-                    T typedVal = static_cast<T>(val);
-                    _config->set<T>(configPath, typedVal);
-                    if (globalVar) *globalVar = typedVal;
-                },
+                [this, configPath](const double val) { _config->set<T>(configPath, static_cast<T>(val)); },
                 minValue, maxValue, !String(helpText).isEmpty(), helpText, showCondition, globalVar);
 
             param->setRequiresReboot(requiresReboot);
@@ -220,11 +404,7 @@ class ParameterRegistry {
 
             const auto param = std::make_shared<Parameter>(
                 configPath, displayName, kEnum, section, position, [this, configPath]() -> double { return _config->get<int>(configPath); },
-                [this, configPath, globalVar](const double val) {
-                    const int intVal = static_cast<int>(val);
-                    _config->set<int>(configPath, intVal);
-                    if (globalVar) *globalVar = intVal;
-                },
+                [this, configPath](const double val) { _config->set<int>(configPath, static_cast<int>(val)); },
                 options, optionCount, !String(helpText).isEmpty(), helpText, showCondition, globalVar);
 
             param->setRequiresReboot(requiresReboot);
@@ -0,0 +1,35 @@
+/**
+ * @file PendingWrite.h
+ *
+ * @brief Hand-over of BLE characteristic writes from the NimBLE host task to the loop
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// A slot holds PENDING_WRITE_FLAG | value until the loop takes it with exchange(), so the loop never sees a flag
+// without its value, and a second write before the loop got to the first simply replaces it.
+static constexpr uint16_t PENDING_WRITE_FLAG = 0x100;
+
+struct PendingWrite {
+    std::atomic<uint16_t> weight;
+    std::atomic<uint16_t> reedSwitch;
+    std::atomic<uint16_t> momentary;
+    std::atomic<uint16_t> autoTare;
+    std::atomic<uint16_t> minShotDuration;
+    std::atomic<uint16_t> maxShotDuration;
+    std::atomic<uint16_t> dripDelay;
+};
+
+inline void postWrite(std::atomic<uint16_t>& slot, const uint8_t value) {
+    slot.store(PENDING_WRITE_FLAG | value, std::memory_order_release);
+}
+
+inline bool takeWrite(std::atomic<uint16_t>& slot, uint8_t& value) {
+    const uint16_t pending = slot.exchange(0, std::memory_order_acquire);
+    value = static_cast<uint8_t>(pending);
+
+    return (pending & PENDING_WRITE_FLAG) != 0;
+}
@@ -0,0 +1,183 @@
+#include "PowerManager.h"
+
+#include "Features.h"
+#include "Logger.h"
+
+#include <driver/gpio.h>
+#include <esp_idf_version.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <hal/gpio_ll.h>
+#include <soc/gpio_struct.h>
+
+#if FEATURE_WIFI
+#include <WiFi.h>
+#endif
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+using PmConfig = esp_pm_config_t;
+#elif CONFIG_IDF_TARGET_ESP32S3
+using PmConfig = esp_pm_config_esp32s3_t;
+#elif CONFIG_IDF_TARGET_ESP32C3
+using PmConfig = esp_pm_config_esp32c3_t;
+#else
+using PmConfig = esp_pm_config_esp32_t;
+#endif
+
+PowerManager PowerManager::_singleton;
+
+void PowerManager::begin(const int wakePin, const bool lightSleep) {
+    _loopTask = xTaskGetCurrentTaskHandle();
+    _maxCpuMhz = getCpuFrequencyMhz();
+
+    PmConfig pmConfig = {};
+    pmConfig.max_freq_mhz = static_cast<int>(_maxCpuMhz);
+    pmConfig.min_freq_mhz = static_cast<int>(IDLE_CPU_MHZ);
+    pmConfig.light_sleep_enable = lightSleep;
+
+    if (esp_pm_configure(&pmConfig) == ESP_OK && esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "loop", &_cpuLock) == ESP_OK) {
+        _pmConfigured = true;
+        esp_pm_lock_acquire(_cpuLock);
+
+        // Without a wake source only the idleWait() timeout would end a light sleep
+        if (lightSleep && esp_sleep_enable_gpio_wakeup() == ESP_OK) {
+            _lightSleep = true;
+        }
+        else if (lightSleep) {
+            LOG(WARNING, "GPIO wake-up not available, light sleep ends with the wake latency timeout only");
+        }
+
+        LOGF(INFO, "Power management: %u-%uMHz, light sleep %s", IDLE_CPU_MHZ, _maxCpuMhz, lightSleep ? "enabled" : "disabled");
+    }
+    else {
+        LOGF(INFO, "Power management: esp_pm not available, switching CPU clock directly (%u/%uMHz)", IDLE_CPU_MHZ, _maxCpuMhz);
+
+        if (lightSleep) {
+            LOG(WARNING, "Automatic light sleep requires esp_pm support, ignoring setting");
+        }
+    }
+
+    setWakePin(wakePin);
+}
+
+void PowerManager::setWakePin(const int wakePin) {
+    if (_wakePin >= 0) {
+        detachInterrupt(digitalPinToInterrupt(_wakePin));
+    }
+
+    _wakePin = wakePin;
+    _edgePending = false;
+
+    attachInterrupt(digitalPinToInterrupt(_wakePin), onWakeEdge, CHANGE);
+}
+
+void PowerManager::update(const bool idle) {
+    if (idle == _idle) {
+        return;
+    }
+
+    _idle = idle;
+
+    if (idle) {
+        _stats.idleEntries++;
+    }
+
+    applyIdle(idle);
+
+    LOGF(DEBUG, "Power state: %s", idle ? "idle" : "active");
+}
+
+void PowerManager::idleWait(const int maxWakeLatencyMs) {
+    const auto pin = static_cast<gpio_num_t>(_wakePin);
+
+    // Wake on the next change of the input. If it changed since it was read, the level interrupt fires at once.
+    if (_lightSleep) {
+        _wakeArmed = true;
+        gpio_wakeup_enable(pin, gpio_get_level(pin) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    }
+
+    // Returns early when the switch interrupt notifies the loop task
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(maxWakeLatencyMs));
+
+    if (_lightSleep) {
+        gpio_wakeup_disable(pin);
+        _wakeArmed = false;
+        gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+    }
+}
+
+void PowerManager::recordWake(const int boundMs) {
+    if (!_edgePending) {
+        return;
+    }
+
+    const uint32_t latencyUs = static_cast<uint32_t>(esp_timer_get_time()) - _edge_us;
+    _edgePending = false;
+
+    if (latencyUs > STALE_EDGE_US) {
+        return;
+    }
+
+    _stats.lastWakeLatencyUs = latencyUs;
+    _stats.wakeEvents++;
+
+    if (latencyUs > _stats.maxWakeLatencyUs) {
+        _stats.maxWakeLatencyUs = latencyUs;
+    }
+
+    if (latencyUs > static_cast<uint32_t>(boundMs) * 1000) {
+        _stats.boundViolations++;
+        LOGF(WARNING, "Wake latency %.1fms exceeds bound of %dms", static_cast<float>(latencyUs) / 1000.0f, boundMs);
+    }
+    else {
+        LOGF(DEBUG, "Wake latency: %.1fms", static_cast<float>(latencyUs) / 1000.0f);
+    }
+}
+
+void PowerManager::applyIdle(const bool idle) {
+    if (_pmConfigured) {
+        if (idle) {
+            esp_pm_lock_release(_cpuLock);
+        }
+        else {
+            esp_pm_lock_acquire(_cpuLock);
+        }
+    }
+    else {
+        setCpuFrequencyMhz(idle ? IDLE_CPU_MHZ : _maxCpuMhz);
+    }
+
+#if FEATURE_WIFI
+    // Modem sleep stays on in both states, it is required while WiFi and BLE share the radio
+    WiFi.setSleep(idle ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+#endif
+}
+
+void IRAM_ATTR PowerManager::onWakeEdge() {
+    const auto now_us = static_cast<uint32_t>(esp_timer_get_time());
+
+    // A level interrupt would fire again as long as the level lasts
+    if (_singleton._wakeArmed) {
+        _singleton._wakeArmed = false;
+        gpio_ll_set_intr_type(&GPIO, static_cast<uint32_t>(_singleton._wakePin), GPIO_INTR_ANYEDGE);
+    }
+
+    if (!_singleton._edgePending) {
+        _singleton._edge_us = now_us;
+        _singleton._edgePending = true;
+    }
+
+    // The HAL read is inlined, digitalRead() is not safe while the flash cache is disabled
+    if (const EdgeCallback callback = _singleton._edgeCallback) {
+        callback(now_us, gpio_ll_get_level(&GPIO, static_cast<uint32_t>(_singleton._wakePin)) == 0);
+    }
+
+    if (_singleton._loopTask) {
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+        vTaskNotifyGiveFromISR(_singleton._loopTask, &higherPriorityTaskWoken);
+
+        if (higherPriorityTaskWoken) {
+            portYIELD_FROM_ISR();
+        }
+    }
+}
@@ -0,0 +1,127 @@
+/**
+ * @file PowerManager.h
+ *
+ * @brief Idle power policy with a bounded wake latency for the brew switch
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <esp_pm.h>
+
+/**
+ * @brief Lowers CPU clock and radio power while the machine is idle
+ *
+ * While idle the loop blocks for at most the configured wake latency per iteration, which lets FreeRTOS run
+ * the idle task (and, if enabled, enter automatic light sleep). An interrupt on the brew switch input wakes
+ * the loop immediately and timestamps the edge, so the time until the controller registers the switch can be
+ * measured against the bound. Light sleep only wakes on GPIO levels, so while the loop waits with light sleep
+ * enabled the input is armed for the level opposite to its current one, and set back to edges by the first
+ * interrupt.
+ *
+ * Frequency scaling uses esp_pm when the framework is built with power management support, otherwise the
+ * CPU clock is switched directly with setCpuFrequencyMhz().
+ */
+class PowerManager {
+    public:
+        // Called from the interrupt with the edge time and whether the input is active (low) after the edge
+        using EdgeCallback = void (*)(uint32_t edge_us, bool active);
+
+        struct Stats {
+            uint32_t lastWakeLatencyUs;  // Switch edge until the controller registered the switch
+            uint32_t maxWakeLatencyUs;
+            uint32_t wakeEvents;
+            uint32_t boundViolations;    // Wake latencies above the configured bound
+            uint32_t idleEntries;
+        };
+
+        static PowerManager& getInstance() {
+            return _singleton;
+        }
+
+        /**
+         * @brief Set up frequency scaling and the wake interrupt
+         *
+         * @param wakePin GPIO of the brew switch input
+         * @param lightSleep Allow automatic light sleep while idle (only with esp_pm support)
+         */
+        void begin(int wakePin, bool lightSleep);
+
+        /**
+         * @brief Move the wake interrupt to another input, e.g. after the switch type was changed
+         */
+        void setWakePin(int wakePin);
+
+        /**
+         * @brief Also hand every switch edge to another detector, the input has a single interrupt handler
+         */
+        void setEdgeCallback(const EdgeCallback callback) {
+            _edgeCallback = callback;
+        }
+
+        /**
+         * @brief Switch between the idle and the active power state
+         *
+         * @param idle True if no shot is running and no client is connected
+         */
+        void update(bool idle);
+
+        /**
+         * @brief Block the loop task until the next switch edge, at most for the given time
+         */
+        void idleWait(int maxWakeLatencyMs);
+
+        /**
+         * @brief Record the latency from the last switch edge until the controller registered the switch
+         *
+         * @param boundMs Configured maximum wake latency, used to count violations
+         */
+        void recordWake(int boundMs);
+
+        /**
+         * @brief Drop a pending switch edge that did not start a shot (release, reed switch ringing)
+         */
+        void discardWakeEdge() {
+            _edgePending = false;
+        }
+
+        [[nodiscard]] bool isIdle() const {
+            return _idle;
+        }
+
+        [[nodiscard]] bool usesPowerManagement() const {
+            return _pmConfigured;
+        }
+
+        [[nodiscard]] const Stats& getStats() const {
+            return _stats;
+        }
+
+    private:
+        PowerManager() = default;
+
+        static PowerManager _singleton;
+
+        static constexpr uint32_t IDLE_CPU_MHZ = 80;
+        static constexpr uint32_t STALE_EDGE_US = 1000000; // Edges older than this did not lead to a press
+
+        static void IRAM_ATTR onWakeEdge();
+
+        void applyIdle(bool idle);
+
+        bool _idle = false;
+        bool _pmConfigured = false;
+        bool _lightSleep = false;
+        uint32_t _maxCpuMhz = 0;
+        int _wakePin = -1;
+        TaskHandle_t _loopTask = nullptr;
+        esp_pm_lock_handle_t _cpuLock = nullptr;
+        Stats _stats = {};
+
+        volatile EdgeCallback _edgeCallback = nullptr;
+
+        // Written from the GPIO interrupt
+        volatile bool _edgePending = false;
+        volatile uint32_t _edge_us = 0;
+        volatile bool _wakeArmed = false;    // Input set to a level interrupt as light sleep wake source
+};
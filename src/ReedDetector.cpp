@@ -0,0 +1,71 @@
+#include "ReedDetector.h"
+
+ReedDetector ReedDetector::_singleton;
+
+void IRAM_ATTR ReedDetector::onEdge(const uint32_t edge_us, const bool closed) {
+    ReedDetector& d = _singleton;
+
+    if (!closed) {
+        return;
+    }
+
+    const uint32_t interval_us = edge_us - d._lastPulse_us;
+
+    if (d._pulses > 0 && interval_us < BOUNCE_US) {
+        return;
+    }
+
+    d._lastPulse_us = edge_us;
+    d._pulses = d._pulses + 1;
+
+    if (interval_us < MIN_PERIOD_US || interval_us > MAX_PERIOD_US) {
+        // First pulse after a pause, or not mains-synchronous
+        d._consecutive = 0;
+        return;
+    }
+
+    const uint32_t period_us = d._period_us;
+    const uint32_t deviation_us = interval_us > period_us ? interval_us - period_us : period_us - interval_us;
+
+    if (period_us != 0 && deviation_us < period_us / 5) {
+        // Smooth the estimate, jitter comes from the interrupt latency
+        d._period_us = period_us + (static_cast<int32_t>(interval_us - period_us) / 4);
+        d._consecutive = d._consecutive + 1;
+    }
+    else {
+        d._period_us = interval_us;
+        d._consecutive = 1;
+    }
+}
+
+void ReedDetector::reset() {
+    _consecutive = 0;
+    _period_us = 0;
+}
+
+bool ReedDetector::isPumpOn(const uint32_t now_us) const {
+    const uint32_t period_us = _period_us;
+
+    // Negative if a pulse arrived after now_us was taken
+    const auto silence_us = static_cast<int32_t>(now_us - _lastPulse_us);
+
+    return isLocked() && silence_us < static_cast<int32_t>(RELEASE_PERIODS * static_cast<float>(period_us));
+}
+
+void ReedDetector::recordRelease(const uint32_t now_us) {
+    _lastReleaseUs = now_us - _lastPulse_us;
+    _releases++;
+
+    // The next pulse train is a new pump start, lock again from scratch
+    _consecutive = 0;
+}
+
+ReedDetector::Stats ReedDetector::getStats() const {
+    Stats stats = {};
+    stats.pulses = _pulses;
+    stats.periodUs = _period_us;
+    stats.lastReleaseUs = _lastReleaseUs;
+    stats.releases = _releases;
+
+    return stats;
+}
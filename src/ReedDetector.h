@@ -0,0 +1,84 @@
+/**
+ * @file ReedDetector.h
+ *
+ * @brief Pump on/off from the mains-synchronous pulses of a reed switch
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * @brief Locks onto the period of the reed switch pulses and reports the pump off after missed pulses
+ *
+ * A reed switch next to the pump solenoid closes once per mains period (twice without the pump diode), so
+ * while the pump runs the input pulses at 50/60 Hz (100/120 Hz) instead of staying closed. Each closing edge
+ * is timestamped in the switch interrupt; once LOCK_PULSES intervals in a row agree with the running period
+ * estimate the detector is locked, and the pump counts as off as soon as no pulse arrived for
+ * RELEASE_PERIODS periods, i.e. after one to two missed pulses.
+ *
+ * Until it is locked, e.g. right after the pump started or for a switch that stays closed, the controller
+ * keeps using its sampled window.
+ */
+class ReedDetector {
+    public:
+        struct Stats {
+            uint32_t pulses;
+            uint32_t periodUs;           // Current period estimate, 0 before the first valid interval
+            uint32_t lastReleaseUs;      // Last pulse until the pump was reported off
+            uint32_t releases;
+        };
+
+        static ReedDetector& getInstance() {
+            return _singleton;
+        }
+
+        /**
+         * @brief Called from the switch interrupt for every edge
+         *
+         * @param edge_us Timestamp of the edge (esp_timer)
+         * @param closed True if the switch reads closed after the edge
+         */
+        static void IRAM_ATTR onEdge(uint32_t edge_us, bool closed);
+
+        /**
+         * @brief Forget the period, e.g. after the switch input was changed
+         */
+        void reset();
+
+        [[nodiscard]] bool isLocked() const {
+            return _consecutive >= LOCK_PULSES;
+        }
+
+        /**
+         * @brief While locked, true if the last pulse is less than RELEASE_PERIODS periods old
+         */
+        [[nodiscard]] bool isPumpOn(uint32_t now_us) const;
+
+        /**
+         * @brief Note that the controller acted on a pump off, for the release latency statistics
+         */
+        void recordRelease(uint32_t now_us);
+
+        [[nodiscard]] Stats getStats() const;
+
+    private:
+        ReedDetector() = default;
+
+        static ReedDetector _singleton;
+
+        static constexpr uint32_t BOUNCE_US = 2000;           // Closing edges closer than this are contact bounce
+        static constexpr uint32_t MIN_PERIOD_US = 7000;       // 140 Hz
+        static constexpr uint32_t MAX_PERIOD_US = 22000;      // 45 Hz
+        static constexpr uint32_t LOCK_PULSES = 4;
+        static constexpr float RELEASE_PERIODS = 2.0f;
+
+        // Written from the switch interrupt
+        volatile uint32_t _lastPulse_us = 0;
+        volatile uint32_t _period_us = 0;
+        volatile uint32_t _consecutive = 0;
+        volatile uint32_t _pulses = 0;
+
+        uint32_t _lastReleaseUs = 0;
+        uint32_t _releases = 0;
+};
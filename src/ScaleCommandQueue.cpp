@@ -0,0 +1,161 @@
+#include "ScaleCommandQueue.h"
+
+#include "Logger.h"
+
+#include <AcaiaArduinoBLE.h>
+#include <algorithm>
+
+ScaleCommandQueue ScaleCommandQueue::_singleton;
+
+void ScaleCommandQueue::begin(AcaiaArduinoBLE* scale) {
+    _scale = scale;
+    _lock = xSemaphoreCreateMutex();
+
+    if (_lock == nullptr) {
+        LOG(ERROR, "Failed to create scale lock");
+        return;
+    }
+
+    if (xTaskCreate(taskEntry, "scale", TASK_STACK_SIZE, this, TASK_PRIORITY, &_task) != pdPASS) {
+        LOG(ERROR, "Failed to create scale command task, sending from the loop");
+        _task = nullptr;
+    }
+}
+
+void ScaleCommandQueue::submit(const Command command) {
+    if (_pending.load(std::memory_order_acquire) & bit(command)) {
+        _coalesced++;
+        return;
+    }
+
+    _submittedUs[command] = micros();
+    _pending.fetch_or(bit(command), std::memory_order_release);
+
+    if (_task != nullptr) {
+        xTaskNotifyGive(_task);
+    }
+    else if (tryLock()) {
+        sendPending();
+        unlock();
+    }
+}
+
+bool ScaleCommandQueue::tryLock() {
+    return _lock == nullptr || xSemaphoreTake(_lock, 0) == pdTRUE;
+}
+
+void ScaleCommandQueue::unlock() {
+    if (_lock != nullptr) {
+        xSemaphoreGive(_lock);
+    }
+}
+
+ScaleCommandQueue::Stats ScaleCommandQueue::getStats() const {
+    Stats stats = {};
+    stats.sent = _sent.load();
+    stats.failed = _failed.load();
+    stats.coalesced = _coalesced.load();
+    stats.bursts = _bursts.load();
+    stats.lastBurstCommands = _lastBurstCommands.load();
+    stats.lastBurstUs = _lastBurstUs.load();
+    stats.lastTareUs = _lastTareUs.load();
+    stats.maxLatencyUs = _maxLatencyUs.load();
+
+    return stats;
+}
+
+const char* ScaleCommandQueue::getCommandName(const Command command) {
+    switch (command) {
+        case TARE:
+            return "tare";
+        case RESET_TIMER:
+            return "reset timer";
+        case START_TIMER:
+            return "start timer";
+        case STOP_TIMER:
+            return "stop timer";
+        case HEARTBEAT:
+            return "heartbeat";
+        default:
+            return "unknown";
+    }
+}
+
+void ScaleCommandQueue::taskEntry(void* arg) {
+    static_cast<ScaleCommandQueue*>(arg)->run();
+}
+
+void ScaleCommandQueue::run() {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // Commands submitted during a burst are picked up by the next one
+        while (_pending.load(std::memory_order_acquire) != 0) {
+            xSemaphoreTake(_lock, portMAX_DELAY);
+            sendPending();
+            xSemaphoreGive(_lock);
+        }
+    }
+}
+
+void ScaleCommandQueue::sendPending() {
+    const uint32_t pending = _pending.load(std::memory_order_acquire);
+    const uint32_t start_us = micros();
+    uint32_t count = 0;
+
+    for (uint8_t i = 0; i < COMMAND_COUNT; i++) {
+        const auto command = static_cast<Command>(i);
+
+        if (!(pending & bit(command))) {
+            continue;
+        }
+
+        if (send(command)) {
+            _sent++;
+        }
+        else {
+            _failed++;
+            LOGF(DEBUG, "Scale command %s failed", getCommandName(command));
+        }
+
+        const uint32_t latency_us = micros() - _submittedUs[command];
+        _maxLatencyUs = std::max(_maxLatencyUs.load(), latency_us);
+
+        if (command == TARE) {
+            _lastTareUs = latency_us;
+        }
+
+        _pending.fetch_and(~bit(command), std::memory_order_release);
+        count++;
+    }
+
+    const uint32_t duration_us = micros() - start_us;
+    _bursts++;
+    _lastBurstCommands = count;
+    _lastBurstUs = duration_us;
+
+    if (count > 1) {
+        LOGF(DEBUG, "Scale burst: %u commands in %.1fms", static_cast<unsigned>(count), duration_us / 1000.0f);
+    }
+}
+
+bool ScaleCommandQueue::send(const Command command) const {
+    if (_scale == nullptr || !_scale->isConnected()) {
+        return false;
+    }
+
+    switch (command) {
+        case TARE:
+            return _scale->tare();
+        case RESET_TIMER:
+            return _scale->resetTimer();
+        case START_TIMER:
+            return _scale->startTimer();
+        case STOP_TIMER:
+            return _scale->stopTimer();
+        case HEARTBEAT:
+            return _scale->heartbeat();
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,113 @@
+/**
+ * @file ScaleCommandQueue.h
+ *
+ * @brief Scale commands sent from their own task
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+class AcaiaArduinoBLE;
+
+/**
+ * @brief Sends tare, timer and heartbeat commands to the scale without holding up the controller
+ *
+ * The controller submits commands and goes straight back to sampling. The task sends everything pending in one
+ * burst, back to back and in priority order: the tare goes before the timer commands and the heartbeat, so the
+ * scale reads zero as early as possible. A command submitted again while it is pending or being sent is only
+ * sent once.
+ *
+ * Connecting to the scale creates and destroys the library's client, so the loop does that only while holding
+ * the scale lock (tryLock()), which the task holds for the duration of a burst.
+ */
+class ScaleCommandQueue {
+    public:
+        // In the order they are sent within a burst
+        enum Command : uint8_t {
+            TARE,
+            RESET_TIMER,
+            START_TIMER,
+            STOP_TIMER,
+            HEARTBEAT,
+            COMMAND_COUNT
+        };
+
+        struct Stats {
+            uint32_t sent;
+            uint32_t failed;            // Rejected by the scale library or not connected
+            uint32_t coalesced;         // Submitted again while still pending
+            uint32_t bursts;
+            uint32_t lastBurstCommands;
+            uint32_t lastBurstUs;       // Duration of the last burst
+            uint32_t lastTareUs;        // Submit to completion of the last tare
+            uint32_t maxLatencyUs;      // Longest submit to completion of any command
+        };
+
+        static ScaleCommandQueue& getInstance() {
+            return _singleton;
+        }
+
+        /**
+         * @brief Create the lock and the task, without a task commands are sent directly by submit()
+         */
+        void begin(AcaiaArduinoBLE* scale);
+
+        /**
+         * @brief Queue a command without waiting for the scale
+         */
+        void submit(Command command);
+
+        [[nodiscard]] bool isPending(const Command command) const {
+            return (_pending.load(std::memory_order_acquire) & bit(command)) != 0;
+        }
+
+        /**
+         * @brief Take the scale lock if no burst is running, never waits
+         */
+        bool tryLock();
+        void unlock();
+
+        [[nodiscard]] Stats getStats() const;
+
+        static const char* getCommandName(Command command);
+
+    private:
+        ScaleCommandQueue() = default;
+
+        static ScaleCommandQueue _singleton;
+
+        static constexpr uint32_t TASK_STACK_SIZE = 3072;
+        static constexpr UBaseType_t TASK_PRIORITY = 2;
+
+        static constexpr uint32_t bit(const Command command) {
+            return 1u << command;
+        }
+
+        static void taskEntry(void* arg);
+        void run();
+        void sendPending();
+        bool send(Command command) const;
+
+        AcaiaArduinoBLE* _scale = nullptr;
+        TaskHandle_t _task = nullptr;
+        SemaphoreHandle_t _lock = nullptr;
+
+        // A bit is set by submit() and cleared after the command was sent, the submit time is only written
+        // while the bit is clear
+        std::atomic<uint32_t> _pending{0};
+        uint32_t _submittedUs[COMMAND_COUNT] = {};
+
+        std::atomic<uint32_t> _sent{0};
+        std::atomic<uint32_t> _failed{0};
+        std::atomic<uint32_t> _coalesced{0};
+        std::atomic<uint32_t> _bursts{0};
+        std::atomic<uint32_t> _lastBurstCommands{0};
+        std::atomic<uint32_t> _lastBurstUs{0};
+        std::atomic<uint32_t> _lastTareUs{0};
+        std::atomic<uint32_t> _maxLatencyUs{0};
+};
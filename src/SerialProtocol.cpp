@@ -0,0 +1,339 @@
+#include "SerialProtocol.h"
+
+#include "Logger.h"
+#include "ParameterRegistry.h"
+#include "ScaleCommandQueue.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Global variables from main.cpp
+extern const char sysVersion[];
+
+SerialProtocol SerialProtocol::_singleton;
+
+namespace {
+    template <typename T>
+    void put(uint8_t*& out, const T value) {
+        memcpy(out, &value, sizeof(T));
+        out += sizeof(T);
+    }
+
+    template <typename T>
+    T get(const uint8_t* in) {
+        T value;
+        memcpy(&value, in, sizeof(T));
+        return value;
+    }
+}
+
+void SerialProtocol::poll() {
+    // A request held while another task had the registry goes first, newer frames wait in the USB buffer
+    if (_heldLength > 0) {
+        if (!handleFrame(_held, _heldLength)) {
+            return;
+        }
+
+        _heldLength = 0;
+    }
+
+    // Bounded per call, a host flooding the port cannot stall the loop
+    for (int budget = Serial.available(); budget > 0; budget--) {
+        const int c = Serial.read();
+
+        if (c < 0) {
+            break;
+        }
+
+        if (c != 0) {
+            if (_rxLength < sizeof(_rx)) {
+                _rx[_rxLength++] = static_cast<uint8_t>(c);
+            }
+            else {
+                _rxOverflow = true;
+            }
+
+            continue;
+        }
+
+        // End of a frame, anything that was too long or does not decode is ignored
+        if (_rxLength > 0 && !_rxOverflow) {
+            uint8_t frame[MAX_FRAME];
+            const size_t length = cobsDecode(_rx, _rxLength, frame);
+
+            if (length >= 4 && crc16(frame, length - 2) == get<uint16_t>(frame + length - 2)
+                && !handleFrame(frame, length - 2)) {
+                memcpy(_held, frame, length - 2);
+                _heldLength = length - 2;
+            }
+        }
+
+        _rxLength = 0;
+        _rxOverflow = false;
+
+        if (_heldLength > 0) {
+            break;
+        }
+    }
+}
+
+void SerialProtocol::sendSample(const TelemetryState state, const uint8_t flags, const float shotTime_s, const float weight_g,
+    const float flow_gps, const float predictedEnd_s, const float goal_g, const bool newSample) {
+    if (!_streaming || (!newSample && state == _lastState)) {
+        return;
+    }
+
+    _lastState = state;
+
+    uint8_t payload[26];
+    uint8_t* out = payload;
+    put<uint32_t>(out, millis());
+    put<float>(out, shotTime_s);
+    put<float>(out, weight_g);
+    put<float>(out, flow_gps);
+    put<float>(out, predictedEnd_s);
+    put<float>(out, goal_g);
+    put<uint8_t>(out, static_cast<uint8_t>(state));
+    put<uint8_t>(out, flags);
+
+    send(SAMPLE, payload, out - payload);
+}
+
+bool SerialProtocol::handleFrame(const uint8_t* frame, const size_t length) {
+    const uint8_t type = frame[0];
+    const uint8_t* payload = frame + 2;
+    const size_t payloadLength = length - 2;
+
+    if (payloadLength < 2) {
+        return true;
+    }
+
+    const auto id = get<uint16_t>(payload);
+
+    switch (type) {
+        case SET:
+            return handleSet(id, payload + 2, payloadLength - 2);
+
+        case GET:
+            return handleGet(id, payload + 2, payloadLength - 2);
+
+        case COMMAND:
+            if (payloadLength < 3) {
+                sendAck(id, MALFORMED, NAN);
+            }
+            else {
+                handleCommand(id, payload[2]);
+            }
+
+            break;
+
+        default:
+            sendAck(id, UNKNOWN_COMMAND, NAN);
+            break;
+    }
+
+    return true;
+}
+
+bool SerialProtocol::handleSet(const uint16_t id, const uint8_t* payload, const size_t length) {
+    if (length <= sizeof(double)) {
+        sendAck(id, MALFORMED, NAN);
+        return true;
+    }
+
+    const auto value = get<double>(payload);
+    char name[MAX_PAYLOAD + 1];
+    const size_t nameLength = length - sizeof(double);
+    memcpy(name, payload + sizeof(double), nameLength);
+    name[nameLength] = '\0';
+
+    // Runs in the loop, which does not wait for the registry, the frame is held and handled in the next poll()
+    auto& registry = ParameterRegistry::getInstance();
+    const auto lock = registry.tryLock();
+
+    if (!lock) {
+        return false;
+    }
+
+    try {
+        const std::shared_ptr<Parameter> param = registry.getParameterById(name);
+
+        if (param == nullptr || !param->shouldShow()) {
+            sendAck(id, UNKNOWN_PARAMETER, NAN);
+            return true;
+        }
+
+        // Text parameters are set through the web interface, the port carries numbers only
+        if (param->getType() == kCString || !std::isfinite(value)) {
+            sendAck(id, INVALID_VALUE, NAN);
+            return true;
+        }
+
+        registry.setParameterValue(name, value);
+        sendAck(id, OK, param->getValue());
+    } catch (const std::exception& e) {
+        LOGF(INFO, "Serial set %s failed: %s", name, e.what());
+        sendAck(id, INVALID_VALUE, NAN);
+    }
+
+    return true;
+}
+
+bool SerialProtocol::handleGet(const uint16_t id, const uint8_t* payload, const size_t length) {
+    if (length == 0) {
+        sendAck(id, MALFORMED, NAN);
+        return true;
+    }
+
+    char name[MAX_PAYLOAD + 1];
+    memcpy(name, payload, length);
+    name[length] = '\0';
+
+    const auto lock = ParameterRegistry::getInstance().tryLock();
+
+    if (!lock) {
+        return false;
+    }
+
+    const std::shared_ptr<Parameter> param = ParameterRegistry::getInstance().getParameterById(name);
+
+    if (param == nullptr || !param->shouldShow()) {
+        sendAck(id, UNKNOWN_PARAMETER, NAN);
+        return true;
+    }
+
+    sendAck(id, OK, param->getType() == kCString ? NAN : param->getValue());
+    return true;
+}
+
+void SerialProtocol::handleCommand(const uint16_t id, const uint8_t command) {
+    switch (command) {
+        case STREAM_ON:
+            _streaming = true;
+            _dropped = 0;
+            break;
+
+        case STREAM_OFF:
+            _streaming = false;
+            break;
+
+        case TARE:
+            ScaleCommandQueue::getInstance().submit(ScaleCommandQueue::TARE);
+            break;
+
+        case GET_INFO: {
+            uint8_t payload[MAX_PAYLOAD];
+            payload[0] = VERSION;
+            const size_t length = std::min(strlen(sysVersion), sizeof(payload) - 1);
+            memcpy(payload + 1, sysVersion, length);
+            send(INFO, payload, length + 1);
+            break;
+        }
+
+        default:
+            sendAck(id, UNKNOWN_COMMAND, NAN);
+            return;
+    }
+
+    sendAck(id, OK, NAN);
+}
+
+void SerialProtocol::sendAck(const uint16_t id, const AckStatus status, const double value) {
+    uint8_t payload[11];
+    uint8_t* out = payload;
+    put<uint16_t>(out, id);
+    put<uint8_t>(out, status);
+    put<double>(out, value);
+
+    send(ACK, payload, out - payload);
+}
+
+void SerialProtocol::send(const Type type, const uint8_t* payload, const size_t length) {
+    uint8_t frame[MAX_FRAME];
+    frame[0] = type;
+    frame[1] = _sequence++;
+    memcpy(frame + 2, payload, length);
+
+    const uint16_t crc = crc16(frame, length + 2);
+    memcpy(frame + 2 + length, &crc, sizeof(crc));
+
+    // Leading zero ends whatever log text came before, so the frame starts on a boundary
+    uint8_t encoded[MAX_ENCODED + 2];
+    encoded[0] = 0;
+    const size_t encodedLength = cobsEncode(frame, length + 4, encoded + 1);
+    encoded[encodedLength + 1] = 0;
+
+    // One write, so log output from other tasks cannot end up inside the frame
+    if (static_cast<size_t>(Serial.availableForWrite()) < encodedLength + 2) {
+        _dropped++;
+        return;
+    }
+
+    Serial.write(encoded, encodedLength + 2);
+}
+
+uint16_t SerialProtocol::crc16(const uint8_t* data, const size_t length) {
+    uint16_t crc = 0xFFFF;
+
+    for (size_t i = 0; i < length; i++) {
+        crc ^= static_cast<uint16_t>(data[i]) << 8;
+
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+size_t SerialProtocol::cobsEncode(const uint8_t* data, const size_t length, uint8_t* out) {
+    size_t codeIndex = 0;
+    size_t written = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0) {
+            out[written++] = data[i];
+            code++;
+        }
+
+        if (data[i] == 0 || code == 0xFF) {
+            out[codeIndex] = code;
+            codeIndex = written++;
+            code = 1;
+        }
+    }
+
+    out[codeIndex] = code;
+
+    return written;
+}
+
+size_t SerialProtocol::cobsDecode(const uint8_t* data, const size_t length, uint8_t* out) {
+    size_t written = 0;
+    size_t i = 0;
+
+    while (i < length) {
+        const uint8_t code = data[i++];
+
+        if (code == 0 || i + code - 1 > length || written + code - 1 > MAX_FRAME) {
+            return 0;
+        }
+
+        for (uint8_t j = 1; j < code; j++) {
+            out[written++] = data[i++];
+        }
+
+        // A code below 0xFF stands for a zero byte, except at the end of the frame
+        if (code < 0xFF && i < length) {
+            if (written >= MAX_FRAME) {
+                return 0;
+            }
+
+            out[written++] = 0;
+        }
+    }
+
+    return written;
+}
@@ -0,0 +1,123 @@
+/**
+ * @file SerialProtocol.h
+ *
+ * @brief Framed binary telemetry and control on the USB serial port, next to the text log
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "UdpTelemetry.h"
+
+/**
+ * @brief COBS frames with a CRC on the same port as the log lines
+ *
+ * Every frame is COBS encoded and sent as 0x00, frame, 0x00 in a single write. The log never contains a zero
+ * byte, so a reader splits the stream at zero bytes: parts that decode to a frame with a valid CRC are binary
+ * messages, everything else is log text. Decoded frame:
+ *
+ *   type (1)  sequence (1)  payload (0..MAX_PAYLOAD)  CRC-16/CCITT-FALSE of type..payload (2, little endian)
+ *
+ * Device to host:
+ *   SAMPLE  uptime_ms u32, shot time f32, weight f32, flow f32, predicted end f32 (NaN if none), goal f32,
+ *           state u8 (TelemetryState), flags u8 (bit 0 scale connected, bit 1 by time only)
+ *   ACK     request id u16, status u8 (AckStatus), value f64 (NaN if not numeric)
+ *   INFO    protocol version u8, firmware version (text)
+ *
+ * Host to device:
+ *   SET     request id u16, value f64, parameter id (text)
+ *   GET     request id u16, parameter id (text)
+ *   COMMAND request id u16, command u8 (Command)
+ *
+ * Samples are only sent after a STREAM_ON command, so a terminal on the port shows the log as before. A frame
+ * that does not fit into the USB transmit buffer is dropped and counted, the controller never waits for the
+ * host. A SET or GET that arrives while another task holds the parameters is answered in a later poll(), the
+ * frames after it stay in the receive buffer until then. Decoded by scripts/usb_telemetry.py, keep both in sync.
+ */
+class SerialProtocol {
+    public:
+        static constexpr uint8_t VERSION = 1;
+
+        enum Type : uint8_t {
+            SAMPLE = 0x01,
+            ACK = 0x02,
+            INFO = 0x03,
+            SET = 0x10,
+            GET = 0x11,
+            COMMAND = 0x12
+        };
+
+        enum Command : uint8_t {
+            STREAM_ON = 1,
+            STREAM_OFF = 2,
+            TARE = 3,
+            GET_INFO = 4
+        };
+
+        enum AckStatus : uint8_t {
+            OK = 0,
+            UNKNOWN_PARAMETER = 1,
+            INVALID_VALUE = 2,
+            UNKNOWN_COMMAND = 3,
+            MALFORMED = 4
+        };
+
+        static SerialProtocol& getInstance() {
+            return _singleton;
+        }
+
+        /**
+         * @brief Read and handle the frames received since the last call, called from the loop
+         */
+        void poll();
+
+        /**
+         * @brief Send a sample frame if streaming is on, for a new sample or a change of the state
+         */
+        void sendSample(TelemetryState state, uint8_t flags, float shotTime_s, float weight_g, float flow_gps,
+            float predictedEnd_s, float goal_g, bool newSample);
+
+        [[nodiscard]] bool isStreaming() const {
+            return _streaming;
+        }
+
+        [[nodiscard]] uint32_t getDropped() const {
+            return _dropped;
+        }
+
+    private:
+        SerialProtocol() = default;
+
+        static SerialProtocol _singleton;
+
+        static constexpr size_t MAX_PAYLOAD = 64;
+        static constexpr size_t MAX_FRAME = 2 + MAX_PAYLOAD + 2;
+        static constexpr size_t MAX_ENCODED = MAX_FRAME + MAX_FRAME / 254 + 1;
+
+        // False if the registry was busy, the caller holds the frame and tries again in the next poll()
+        bool handleFrame(const uint8_t* frame, size_t length);
+        bool handleSet(uint16_t id, const uint8_t* payload, size_t length);
+        bool handleGet(uint16_t id, const uint8_t* payload, size_t length);
+        void handleCommand(uint16_t id, uint8_t command);
+        void sendAck(uint16_t id, AckStatus status, double value);
+        void send(Type type, const uint8_t* payload, size_t length);
+
+        static uint16_t crc16(const uint8_t* data, size_t length);
+        static size_t cobsEncode(const uint8_t* data, size_t length, uint8_t* out);
+        static size_t cobsDecode(const uint8_t* data, size_t length, uint8_t* out);
+
+        bool _streaming = false;
+        TelemetryState _lastState = TelemetryState::Idle;
+        uint8_t _sequence = 0;
+        uint32_t _dropped = 0;
+
+        // Receive buffer, bytes of the encoded frame since the last zero byte
+        uint8_t _rx[MAX_ENCODED] = {};
+        size_t _rxLength = 0;
+        bool _rxOverflow = false;
+
+        // Decoded SET or GET without its CRC, received while another task held the registry
+        uint8_t _held[MAX_FRAME] = {};
+        size_t _heldLength = 0;
+};
@@ -0,0 +1,224 @@
+#include "ShotHistory.h"
+
+#include "Logger.h"
+
+#include <LittleFS.h>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    struct FileHeader {
+        uint32_t magic;
+        uint16_t count;
+        uint16_t next;
+    };
+}
+
+void ShotHistory::begin() {
+    File file = LittleFS.open(FILE_NAME, "r");
+
+    if (!file) {
+        return;
+    }
+
+    FileHeader header = {};
+
+    if (file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) != sizeof(header)
+        || header.magic != FILE_MAGIC
+        || header.count > CAPACITY
+        || header.next >= CAPACITY) {
+        LOG(WARNING, "Shot history file invalid, starting empty");
+        file.close();
+        return;
+    }
+
+    const size_t bytes = header.count * sizeof(Fingerprint);
+
+    if (file.read(reinterpret_cast<uint8_t*>(_shots), bytes) != bytes) {
+        LOG(WARNING, "Shot history file truncated, starting empty");
+        file.close();
+        return;
+    }
+
+    file.close();
+
+    _count = header.count;
+    _next = header.next;
+
+    LOGF(INFO, "Shot history: %u shots", static_cast<unsigned>(_count));
+}
+
+bool ShotHistory::add(const float* time_s, const float* weight, const int count, const float dose, const float goalWeight) {
+    if (count < 2) {
+        return false;
+    }
+
+    const float stopWeight = weight[count - 1];
+
+    if (stopWeight < MIN_STOP_WEIGHT_G) {
+        return false;
+    }
+
+    float times_s[POINTS];
+
+    if (crossings(time_s, weight, count, stopWeight, times_s) < POINTS) {
+        return false;
+    }
+
+    Fingerprint& f = _shots[_next];
+    f.dose = dose;
+    f.goalWeight = goalWeight;
+    f.stopWeight = stopWeight;
+
+    for (size_t i = 0; i < POINTS; i++) {
+        f.time_ms[i] = static_cast<uint16_t>(std::min(times_s[i] * 1000.0f, 65535.0f));
+    }
+
+    _next = (_next + 1) % CAPACITY;
+    _count = std::min(_count + 1, CAPACITY);
+    _dirty = true;
+
+    return true;
+}
+
+void ShotHistory::save() {
+    if (!_dirty) {
+        return;
+    }
+
+    File file = LittleFS.open(FILE_NAME, "w");
+
+    if (!file) {
+        LOG(ERROR, "Failed to open shot history for writing");
+        return;
+    }
+
+    const FileHeader header = {FILE_MAGIC, static_cast<uint16_t>(_count), static_cast<uint16_t>(_next)};
+    const size_t bytes = _count * sizeof(Fingerprint);
+    const bool ok = file.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header)) == sizeof(header)
+        && file.write(reinterpret_cast<const uint8_t*>(_shots), bytes) == bytes;
+
+    file.close();
+
+    if (ok) {
+        _dirty = false;
+    }
+    else {
+        LOG(ERROR, "Failed to write shot history");
+    }
+}
+
+ShotHistory::Prediction ShotHistory::predict(const float* time_s, const float* weight, const int count,
+    const float targetWeight, const float dose, const float goalWeight) const {
+    Prediction prediction = {false, 0.0f, 0.0f, 0};
+
+    if (count < 2 || _count == 0 || targetWeight <= 0.0f) {
+        return prediction;
+    }
+
+    const float progress = weight[count - 1] / targetWeight;
+
+    if (progress >= 1.0f) {
+        return prediction;
+    }
+
+    // At least two points of the curve are needed to compare its speed
+    float current_s[POINTS];
+    const size_t reached = crossings(time_s, weight, count, targetWeight, current_s);
+
+    if (reached < 2) {
+        return prediction;
+    }
+
+    // The K closest shots of the same recipe, by RMS time difference over the points reached so far
+    size_t nearest[K_NEIGHBOURS];
+    float nearestDistance[K_NEIGHBOURS];
+    size_t found = 0;
+
+    for (size_t s = 0; s < _count; s++) {
+        if (!sameRecipe(_shots[s], dose, goalWeight)) {
+            continue;
+        }
+
+        float sumSquares = 0.0f;
+
+        for (size_t i = 0; i < reached; i++) {
+            const float difference = current_s[i] - static_cast<float>(_shots[s].time_ms[i]) / 1000.0f;
+            sumSquares += difference * difference;
+        }
+
+        const float distance = sqrtf(sumSquares / static_cast<float>(reached));
+
+        // Insert into the sorted list of neighbours
+        size_t slot = found < K_NEIGHBOURS ? found++ : K_NEIGHBOURS;
+
+        while (slot > 0 && nearestDistance[slot - 1] > distance) {
+            if (slot < K_NEIGHBOURS) {
+                nearest[slot] = nearest[slot - 1];
+                nearestDistance[slot] = nearestDistance[slot - 1];
+            }
+
+            slot--;
+        }
+
+        if (slot < K_NEIGHBOURS) {
+            nearest[slot] = s;
+            nearestDistance[slot] = distance;
+        }
+    }
+
+    if (found == 0) {
+        return prediction;
+    }
+
+    // Continue each neighbour's curve from the current progress
+    const float now_s = time_s[count - 1];
+    const float position = progress * POINTS - 1.0f;
+    float weightedRemaining = 0.0f;
+    float weights = 0.0f;
+
+    for (size_t n = 0; n < found; n++) {
+        const Fingerprint& f = _shots[nearest[n]];
+        const auto at = [&f](const size_t i) { return static_cast<float>(f.time_ms[i]) / 1000.0f; };
+
+        // Neighbour time at the current progress, interpolated between its points
+        const size_t lower = std::min(static_cast<size_t>(std::max(position, 0.0f)), POINTS - 2);
+        const float fraction = std::clamp(position - static_cast<float>(lower), 0.0f, 1.0f);
+        const float neighbourNow_s = at(lower) + fraction * (at(lower + 1) - at(lower));
+
+        // Faster or slower than the neighbour over the points both reached
+        const float neighbourSpan_s = at(reached - 1) - at(0);
+        const float speed = neighbourSpan_s > 0.0f
+            ? std::clamp((current_s[reached - 1] - current_s[0]) / neighbourSpan_s, MIN_SPEED_RATIO, MAX_SPEED_RATIO)
+            : 1.0f;
+
+        const float remaining_s = std::max(at(POINTS - 1) - neighbourNow_s, 0.0f) * speed;
+        const float w = 1.0f / (nearestDistance[n] + 0.5f);
+
+        weightedRemaining += w * remaining_s;
+        weights += w;
+    }
+
+    prediction.valid = true;
+    prediction.end_s = now_s + weightedRemaining / weights;
+    prediction.distance_s = nearestDistance[0];
+    prediction.neighbours = static_cast<uint8_t>(found);
+
+    return prediction;
+}
+
+size_t ShotHistory::crossings(const float* time_s, const float* weight, const int count, const float target, float* times_s) {
+    size_t reached = 0;
+
+    for (int i = 0; i < count && reached < POINTS; i++) {
+        while (reached < POINTS && weight[i] >= target * static_cast<float>(reached + 1) / POINTS) {
+            times_s[reached++] = time_s[i];
+        }
+    }
+
+    return reached;
+}
+
+bool ShotHistory::sameRecipe(const Fingerprint& f, const float dose, const float goalWeight) const {
+    return fabsf(f.dose - dose) <= DOSE_TOLERANCE_G && fabsf(f.goalWeight - goalWeight) <= GOAL_TOLERANCE_G;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file ShotHistory.h
+ *
+ * @brief Fingerprints of recent shots and a nearest-neighbour end time prediction
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * @brief Keeps the curves of the last CAPACITY shots and predicts the end of a running shot from the closest ones
+ *
+ * A shot is stored as a fingerprint: the times at which it reached 1/POINTS, 2/POINTS ... of the weight it
+ * was stopped at. The running shot is compared by the same measure against its own target weight, over the
+ * points it has reached so far, with the stored shots of the same recipe (dose and goal weight). The
+ * K_NEIGHBOURS closest continue the curve: their remaining time from the current progress, scaled by how fast
+ * the running shot progressed compared to each of them, weighted by their distance.
+ *
+ * The fingerprints are kept in a fixed ring in RAM and written to LittleFS once per shot, so a prediction
+ * costs at most CAPACITY x POINTS comparisons and nothing is allocated.
+ */
+class ShotHistory {
+    public:
+        static constexpr size_t CAPACITY = 32;
+        static constexpr size_t POINTS = 16;
+        static constexpr size_t K_NEIGHBOURS = 3;
+
+        struct Fingerprint {
+            float dose;
+            float goalWeight;
+            float stopWeight;
+            uint16_t time_ms[POINTS];   // Time at which (i + 1) / POINTS of stopWeight was reached
+        };
+
+        struct Prediction {
+            bool valid;
+            float end_s;                // Predicted time at which the target weight is reached
+            float distance_s;           // RMS time difference to the closest stored shot
+            uint8_t neighbours;
+        };
+
+        /**
+         * @brief Load the stored fingerprints, LittleFS must be mounted
+         */
+        void begin();
+
+        /**
+         * @brief Add a finished shot, its weight curve up to the stop
+         *
+         * @return false if the shot was too short or its weight curve not usable
+         */
+        bool add(const float* time_s, const float* weight, int count, float dose, float goalWeight);
+
+        /**
+         * @brief Write the fingerprints to LittleFS if a shot was added since the last save
+         */
+        void save();
+
+        /**
+         * @brief Predict when the running shot reaches the target weight
+         *
+         * @param targetWeight Weight at which the shot will be stopped (goal weight minus offset)
+         */
+        [[nodiscard]] Prediction predict(const float* time_s, const float* weight, int count, float targetWeight,
+            float dose, float goalWeight) const;
+
+        [[nodiscard]] size_t size() const {
+            return _count;
+        }
+
+    private:
+        static constexpr const char* FILE_NAME = "/shots.bin";
+        static constexpr uint32_t FILE_MAGIC = 0x31485353; // "SSH1"
+        static constexpr float MIN_STOP_WEIGHT_G = 10.0f;
+        static constexpr float DOSE_TOLERANCE_G = 0.5f;
+        static constexpr float GOAL_TOLERANCE_G = 2.0f;
+        static constexpr float MIN_SPEED_RATIO = 0.67f;
+        static constexpr float MAX_SPEED_RATIO = 1.5f;
+
+        /**
+         * @brief Times at which the curve first reached each fraction of the target, returns the points reached
+         */
+        static size_t crossings(const float* time_s, const float* weight, int count, float target, float* times_s);
+
+        [[nodiscard]] bool sameRecipe(const Fingerprint& f, float dose, float goalWeight) const;
+
+        Fingerprint _shots[CAPACITY] = {};
+        size_t _count = 0;
+        size_t _next = 0;
+        bool _dirty = false;
+};
@@ -0,0 +1,91 @@
+#include "ShotLog.h"
+
+#include <algorithm>
+#include <cmath>
+#include <esp_random.h>
+
+ShotLog ShotLog::_singleton;
+
+void ShotLog::begin() {
+    // Never 0, so a reader can use 0 for "not seen yet"
+    do {
+        _bootId = esp_random();
+    } while (_bootId == 0);
+}
+
+void ShotLog::stopped(const char* reason, const float duration_s, const float stopWeight, const float goalWeight,
+    const float dose, const float offset, const unsigned long dripDelay_ms) {
+    const std::lock_guard guard(_mutex);
+
+    // A shot still waiting when the next one stops did not get a final weight
+    if (_hasPending) {
+        add(_pending);
+    }
+
+    _pending = {};
+    _pending.uptime_s = millis() / 1000;
+    strlcpy(_pending.reason, reason, sizeof(_pending.reason));
+    _pending.duration_s = duration_s;
+    _pending.stopWeight = stopWeight;
+    _pending.finalWeight = NAN;
+    _pending.goalWeight = goalWeight;
+    _pending.dose = dose;
+    _pending.offset = offset;
+    _pending.learnedOffset = NAN;
+
+    _hasPending = true;
+    _pendingSince_ms = millis();
+    _pendingWait_ms = dripDelay_ms + FINAL_WEIGHT_GRACE_MS;
+}
+
+void ShotLog::finished(const float finalWeight, const float learnedOffset) {
+    const std::lock_guard guard(_mutex);
+
+    if (!_hasPending) {
+        return;
+    }
+
+    _pending.finalWeight = finalWeight;
+    _pending.learnedOffset = learnedOffset;
+    add(_pending);
+}
+
+void ShotLog::loop() {
+    // The held shot is only used by the loop, the mutex guards the ring
+    if (!_hasPending || millis() - _pendingSince_ms < _pendingWait_ms) {
+        return;
+    }
+
+    const std::lock_guard guard(_mutex);
+    add(_pending);
+}
+
+void ShotLog::add(const Shot& shot) {
+    Shot& entry = _shots[_nextId % CAPACITY];
+    entry = shot;
+    entry.id = _nextId++;
+    _hasPending = false;
+}
+
+size_t ShotLog::read(const uint32_t since, Shot* out, const size_t max) const {
+    const std::lock_guard guard(_mutex);
+
+    if (since >= _nextId) {
+        return 0;
+    }
+
+    const uint32_t oldest = _nextId > CAPACITY ? _nextId - CAPACITY : 1;
+    size_t count = 0;
+
+    for (uint32_t id = std::max(since + 1, oldest); id < _nextId && count < max; id++) {
+        out[count++] = _shots[id % CAPACITY];
+    }
+
+    return count;
+}
+
+uint32_t ShotLog::getLastId() const {
+    const std::lock_guard guard(_mutex);
+
+    return _nextId - 1;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file ShotLog.h
+ *
+ * @brief Results of the recent shots, read incrementally through /history
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <mutex>
+
+/**
+ * @brief Ring of the last CAPACITY shot results with increasing ids
+ *
+ * A stopped shot is held back until the final weight after the drip delay is known, so a reader never sees
+ * a shot that still changes. If no final weight comes (time mode, no scale, too little weight) it is added
+ * without one once the drip delay and FINAL_WEIGHT_GRACE_MS have passed. Ids start at 1 on every boot, a
+ * reader keeps the last id it received together with the boot id and asks for the shots after it; a changed
+ * boot id means the device restarted and the reader starts over from 0. Shots that dropped out of the ring
+ * before they were read are lost, the reader sees a gap in the ids.
+ *
+ * Written by the loop and read by the web server task, both under the mutex. Kept in RAM only: the shot
+ * fingerprints for the prediction are in ShotHistory, this is the record for collectors.
+ */
+class ShotLog {
+    public:
+        static constexpr size_t CAPACITY = 32;
+        static constexpr unsigned long FINAL_WEIGHT_GRACE_MS = 5000;
+
+        struct Shot {
+            uint32_t id;
+            uint32_t uptime_s;      // Uptime at the stop
+            char reason[12];        // End reason as in the log and the shot/stop MQTT message
+            float duration_s;
+            float stopWeight;       // Weight when the shot was stopped
+            float finalWeight;      // Weight after the drip delay, NaN if it was not measured
+            float goalWeight;
+            float dose;
+            float offset;           // Weight offset the shot was stopped with
+            float learnedOffset;    // Offset for the next shot, NaN without a final weight
+        };
+
+        static ShotLog& getInstance() {
+            return _singleton;
+        }
+
+        /**
+         * @brief Pick the boot id, called once at startup
+         */
+        void begin();
+
+        /**
+         * @brief Hold a stopped shot until finished() or until the wait for its final weight ran out
+         */
+        void stopped(const char* reason, float duration_s, float stopWeight, float goalWeight, float dose, float offset,
+            unsigned long dripDelay_ms);
+
+        /**
+         * @brief Complete the held shot with its final weight and add it to the log
+         */
+        void finished(float finalWeight, float learnedOffset);
+
+        /**
+         * @brief Add a held shot without final weight once the wait ran out, called from the loop
+         */
+        void loop();
+
+        /**
+         * @brief Copy the shots with an id above since, oldest first
+         *
+         * @return Number of shots copied, at most max
+         */
+        size_t read(uint32_t since, Shot* out, size_t max) const;
+
+        [[nodiscard]] uint32_t getBootId() const {
+            return _bootId;
+        }
+
+        /**
+         * @brief Id of the last shot added, 0 if none since boot
+         */
+        [[nodiscard]] uint32_t getLastId() const;
+
+    private:
+        ShotLog() = default;
+
+        static ShotLog _singleton;
+
+        void add(const Shot& shot);
+
+        Shot _shots[CAPACITY] = {};
+        Shot _pending = {};
+        bool _hasPending = false;
+        unsigned long _pendingSince_ms = 0;
+        unsigned long _pendingWait_ms = 0;
+        uint32_t _nextId = 1;
+        uint32_t _bootId = 0;
+        mutable std::mutex _mutex;
+};
@@ -0,0 +1,408 @@
+#include "StopRules.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+    enum Variable : uint8_t {
+        VAR_T,
+        VAR_W,
+        VAR_FLOW,
+        VAR_DOSE,
+        VAR_GOAL,
+        VAR_OFFSET,
+        VAR_RATIO,
+        VAR_COUNT
+    };
+
+    constexpr const char* VARIABLE_NAMES[VAR_COUNT] = {"t", "w", "flow", "dose", "goal", "offset", "ratio"};
+}
+
+/**
+ * @brief Recursive descent parser that emits bytecode directly
+ *
+ *   rules      := expr (';' expr)*
+ *   expr       := and ('||' and)*
+ *   and        := comparison ('&&' comparison)*
+ *   comparison := sum (('<' | '<=' | '>' | '>=' | '==' | '!=') sum)?
+ *   sum        := product (('+' | '-') product)*
+ *   product    := unary (('*' | '/') unary)*
+ *   unary      := ('-' | '!') unary | primary
+ *   primary    := number | variable | '(' expr ')'
+ */
+class StopRules::Compiler {
+    public:
+        Compiler(StopRules& out, const char* source, String& error) :
+                _out(out), _source(source), _pos(source), _error(error) {
+        }
+
+        bool compileRules() {
+            skipSpace();
+
+            if (*_pos == '\0') {
+                return true;
+            }
+
+            for (;;) {
+                if (_out._ruleCount >= MAX_RULES) {
+                    return fail("Too many rules");
+                }
+
+                if (!parseExpression() || !emit(OP_RULE, -1)) {
+                    return false;
+                }
+
+                _out._ruleCount++;
+                skipSpace();
+
+                if (*_pos == '\0') {
+                    return true;
+                }
+
+                if (!match(";")) {
+                    return fail("Expected ';' or end of rule");
+                }
+
+                // Allow a trailing separator
+                skipSpace();
+
+                if (*_pos == '\0') {
+                    return true;
+                }
+            }
+        }
+
+    private:
+        StopRules& _out;
+        const char* _source;
+        const char* _pos;
+        String& _error;
+        int _depth = 0;
+        int _nesting = 0;
+
+        bool fail(const char* message) {
+            _error = String(message) + " at position " + String(static_cast<int>(_pos - _source) + 1);
+            return false;
+        }
+
+        void skipSpace() {
+            while (isspace(static_cast<unsigned char>(*_pos))) {
+                _pos++;
+            }
+        }
+
+        bool match(const char* token) {
+            skipSpace();
+            const size_t len = strlen(token);
+
+            if (strncmp(_pos, token, len) != 0) {
+                return false;
+            }
+
+            // Keywords must not be followed by identifier characters
+            if (isalpha(static_cast<unsigned char>(token[0])) && (isalnum(static_cast<unsigned char>(_pos[len])) || _pos[len] == '_')) {
+                return false;
+            }
+
+            _pos += len;
+            return true;
+        }
+
+        bool emit(const uint8_t op, const int stackEffect) {
+            if (_out._codeSize >= MAX_CODE) {
+                return fail("Rule too long");
+            }
+
+            _out._code[_out._codeSize++] = op;
+            _depth += stackEffect;
+
+            if (_depth > static_cast<int>(MAX_STACK)) {
+                return fail("Expression too complex");
+            }
+
+            return true;
+        }
+
+        bool emitOperand(const uint8_t op, const uint8_t operand) {
+            if (_out._codeSize + 2 > MAX_CODE) {
+                return fail("Rule too long");
+            }
+
+            _out._code[_out._codeSize++] = op;
+            _out._code[_out._codeSize++] = operand;
+
+            if (++_depth > static_cast<int>(MAX_STACK)) {
+                return fail("Expression too complex");
+            }
+
+            return true;
+        }
+
+        bool parseExpression() {
+            if (!parseAnd()) {
+                return false;
+            }
+
+            while (match("||") || match("or")) {
+                if (!parseAnd() || !emit(OP_OR, -1)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        bool parseAnd() {
+            if (!parseComparison()) {
+                return false;
+            }
+
+            while (match("&&") || match("and")) {
+                if (!parseComparison() || !emit(OP_AND, -1)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        bool parseComparison() {
+            if (!parseSum()) {
+                return false;
+            }
+
+            // Two character operators first
+            static constexpr struct {
+                const char* token;
+                Op op;
+            } comparisons[] = {{"<=", OP_LE}, {">=", OP_GE}, {"==", OP_EQ}, {"!=", OP_NE}, {"<", OP_LT}, {">", OP_GT}};
+
+            for (const auto& comparison : comparisons) {
+                if (match(comparison.token)) {
+                    return parseSum() && emit(comparison.op, -1);
+                }
+            }
+
+            return true;
+        }
+
+        bool parseSum() {
+            if (!parseProduct()) {
+                return false;
+            }
+
+            for (;;) {
+                if (match("+")) {
+                    if (!parseProduct() || !emit(OP_ADD, -1)) return false;
+                }
+                else if (match("-")) {
+                    if (!parseProduct() || !emit(OP_SUB, -1)) return false;
+                }
+                else {
+                    return true;
+                }
+            }
+        }
+
+        bool parseProduct() {
+            if (!parseUnary()) {
+                return false;
+            }
+
+            for (;;) {
+                if (match("*")) {
+                    if (!parseUnary() || !emit(OP_MUL, -1)) return false;
+                }
+                else if (match("/")) {
+                    if (!parseUnary() || !emit(OP_DIV, -1)) return false;
+                }
+                else {
+                    return true;
+                }
+            }
+        }
+
+        bool parseUnary() {
+            if (++_nesting > MAX_NESTING * 2) {
+                return fail("Expression nested too deeply");
+            }
+
+            bool ok;
+
+            if (match("-")) {
+                ok = parseUnary() && emit(OP_NEG, 0);
+            }
+            else if (match("!") || match("not")) {
+                ok = parseUnary() && emit(OP_NOT, 0);
+            }
+            else {
+                ok = parsePrimary();
+            }
+
+            _nesting--;
+            return ok;
+        }
+
+        bool parsePrimary() {
+            skipSpace();
+
+            if (match("(")) {
+                if (++_nesting > MAX_NESTING * 2) {
+                    return fail("Expression nested too deeply");
+                }
+
+                const bool ok = parseExpression();
+                _nesting--;
+
+                if (!ok) {
+                    return false;
+                }
+
+                return match(")") || fail("Expected ')'");
+            }
+
+            if (isdigit(static_cast<unsigned char>(*_pos)) || *_pos == '.') {
+                char* end = nullptr;
+                const float value = strtof(_pos, &end);
+
+                if (end == _pos) {
+                    return fail("Invalid number");
+                }
+
+                _pos = end;
+
+                // Reuse identical constants
+                size_t index = 0;
+
+                while (index < _out._constantCount && _out._constants[index] != value) {
+                    index++;
+                }
+
+                if (index == _out._constantCount) {
+                    if (_out._constantCount >= MAX_CONSTANTS) {
+                        return fail("Too many numbers");
+                    }
+
+                    _out._constants[_out._constantCount++] = value;
+                }
+
+                return emitOperand(OP_PUSH, static_cast<uint8_t>(index));
+            }
+
+            if (isalpha(static_cast<unsigned char>(*_pos))) {
+                const char* start = _pos;
+
+                while (isalnum(static_cast<unsigned char>(*_pos)) || *_pos == '_') {
+                    _pos++;
+                }
+
+                const size_t len = _pos - start;
+
+                for (uint8_t i = 0; i < VAR_COUNT; i++) {
+                    if (strlen(VARIABLE_NAMES[i]) == len && strncmp(VARIABLE_NAMES[i], start, len) == 0) {
+                        if (i == VAR_FLOW) {
+                            _out._flowRules |= 1 << _out._ruleCount;
+                        }
+
+                        return emitOperand(OP_LOAD, i);
+                    }
+                }
+
+                _pos = start;
+                return fail("Unknown variable");
+            }
+
+            return *_pos == '\0' ? fail("Unexpected end of rule") : fail("Unexpected character");
+        }
+};
+
+bool StopRules::compile(const char* source, String& error) {
+    StopRules program;
+    Compiler compiler(program, source ? source : "", error);
+
+    if (!compiler.compileRules()) {
+        return false;
+    }
+
+    *this = program;
+    error = "";
+
+    return true;
+}
+
+bool StopRules::validate(const String& source, String& error) {
+    StopRules program;
+    return program.compile(source.c_str(), error);
+}
+
+int StopRules::evaluate(const Inputs& inputs) const {
+    const float variables[VAR_COUNT] = {
+        inputs.t,
+        inputs.w,
+        inputs.flow,
+        inputs.dose,
+        inputs.goal,
+        inputs.offset,
+        inputs.dose > 0.0f ? inputs.w / inputs.dose : 0.0f
+    };
+
+    float stack[MAX_STACK];
+    size_t sp = 0;
+    int rule = 0;
+
+    for (size_t pc = 0; pc < _codeSize; pc++) {
+        switch (_code[pc]) {
+            case OP_PUSH:
+                stack[sp++] = _constants[_code[++pc]];
+                break;
+
+            case OP_LOAD:
+                stack[sp++] = variables[_code[++pc]];
+                break;
+
+            case OP_NEG:
+                stack[sp - 1] = -stack[sp - 1];
+                break;
+
+            case OP_NOT:
+                stack[sp - 1] = stack[sp - 1] == 0.0f ? 1.0f : 0.0f;
+                break;
+
+            case OP_RULE:
+                if (stack[--sp] != 0.0f && (inputs.flowValid || (_flowRules & 1 << rule) == 0)) {
+                    return rule;
+                }
+
+                rule++;
+                break;
+
+            default: {
+                const float b = stack[--sp];
+                const float a = stack[sp - 1];
+                float result;
+
+                switch (_code[pc]) {
+                    case OP_ADD: result = a + b; break;
+                    case OP_SUB: result = a - b; break;
+                    case OP_MUL: result = a * b; break;
+                    case OP_DIV: result = b != 0.0f ? a / b : 0.0f; break;
+                    case OP_LT: result = a < b; break;
+                    case OP_LE: result = a <= b; break;
+                    case OP_GT: result = a > b; break;
+                    case OP_GE: result = a >= b; break;
+                    case OP_EQ: result = a == b; break;
+                    case OP_NE: result = a != b; break;
+                    case OP_AND: result = a != 0.0f && b != 0.0f; break;
+                    case OP_OR: result = a != 0.0f || b != 0.0f; break;
+                    default: result = 0.0f; break;
+                }
+
+                stack[sp - 1] = result;
+                break;
+            }
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file StopRules.h
+ *
+ * @brief User-defined stop conditions compiled to a small stack bytecode
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * @brief Compiles stop rule expressions and evaluates them per scale sample
+ *
+ * A rule source holds up to MAX_RULES expressions separated by ';'. The shot is stopped as soon as one of
+ * them is true. Expressions use numbers, the variables
+ *
+ *   t       shot time (s)
+ *   w       weight (g)
+ *   flow    flow rate, slope of the trend line (g/s); rules using it are skipped until the trend line is valid
+ *   dose    dose (g)
+ *   goal    goal weight (g)
+ *   offset  learned weight offset (g)
+ *   ratio   w / dose
+ *
+ * arithmetic (+ - * /), comparisons (< <= > >= == !=), logic (&& || ! or and/or/not) and parentheses, e.g.
+ *
+ *   t > 20 && flow < 0.5; ratio >= 2.5
+ *
+ * The bytecode has no jumps, so an evaluation costs at most MAX_CODE instructions. Code size, constants,
+ * stack depth and nesting are checked when compiling.
+ */
+class StopRules {
+    public:
+        struct Inputs {
+            float t;
+            float w;
+            float flow;
+            float dose;
+            float goal;
+            float offset;
+            bool flowValid;     // False until the trend line has enough samples, flow is 0 then
+        };
+
+        static constexpr size_t MAX_RULES = 4;
+        static constexpr size_t MAX_CODE = 96;
+        static constexpr size_t MAX_CONSTANTS = 16;
+        static constexpr size_t MAX_STACK = 16;
+        static constexpr int MAX_NESTING = 8;
+
+        /**
+         * @brief Compile the rule source, an empty source compiles to no rules
+         *
+         * @param error Set to a description with the position of the problem if compiling fails
+         * @return true if the source is valid, the previous program is kept otherwise
+         */
+        bool compile(const char* source, String& error);
+
+        /**
+         * @brief Check a rule source without replacing the current program
+         */
+        static bool validate(const String& source, String& error);
+
+        /**
+         * @brief Run all rules against the current sample
+         *
+         * @return Index of the first rule that is true, -1 if none is
+         */
+        [[nodiscard]] int evaluate(const Inputs& inputs) const;
+
+        [[nodiscard]] bool isEmpty() const {
+            return _ruleCount == 0;
+        }
+
+        [[nodiscard]] size_t getRuleCount() const {
+            return _ruleCount;
+        }
+
+        [[nodiscard]] size_t getCodeSize() const {
+            return _codeSize;
+        }
+
+        void clear() {
+            _codeSize = 0;
+            _constantCount = 0;
+            _ruleCount = 0;
+            _flowRules = 0;
+        }
+
+    private:
+        enum Op : uint8_t {
+            OP_PUSH,      // Operand: constant index
+            OP_LOAD,      // Operand: variable index
+            OP_ADD,
+            OP_SUB,
+            OP_MUL,
+            OP_DIV,
+            OP_NEG,
+            OP_NOT,
+            OP_LT,
+            OP_LE,
+            OP_GT,
+            OP_GE,
+            OP_EQ,
+            OP_NE,
+            OP_AND,
+            OP_OR,
+            OP_RULE       // Pops the rule result
+        };
+
+        class Compiler;
+
+        uint8_t _code[MAX_CODE] = {};
+        float _constants[MAX_CONSTANTS] = {};
+        size_t _codeSize = 0;
+        size_t _constantCount = 0;
+        size_t _ruleCount = 0;
+        uint8_t _flowRules = 0;     // Bit per rule that reads flow
+};
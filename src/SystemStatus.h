@@ -0,0 +1,122 @@
+/**
+ * @file SystemStatus.h
+ *
+ * @brief Device side of GET /status: heap and the network, power and update subsystems
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include "MqttPublisher.h"
+#include "OtaUpdate.h"
+#include "PowerManager.h"
+#include "ReedDetector.h"
+#include "ScaleCommandQueue.h"
+#include "SerialProtocol.h"
+#include "WebHandlers.h"
+#include "WiFiConnection.h"
+
+// The subsystem sections of GET /status, written after the shot values by writeStatus()
+inline void writeSubsystemStatus(Print& out) {
+    const auto& wifi = WiFiConnection::getInstance();
+    const auto& wifiStats = wifi.getStats();
+    out.print(",\"wifi\":{\"state\":\"");
+    out.print(WiFiConnection::getStateName(wifi.getState()));
+    out.print("\",\"rssi\":");
+    out.print(WiFi.RSSI());
+    out.print(",\"connectMs\":");
+    out.print(wifiStats.lastConnectMs);
+    out.print(",\"outageMs\":");
+    out.print(wifiStats.lastOutageMs);
+    out.print(",\"fastConnect\":");
+    out.print(wifiStats.lastConnectWasFast ? "true" : "false");
+    out.print(",\"reconnects\":");
+    out.print(wifiStats.reconnects);
+    out.print(",\"fastConnectFailures\":");
+    out.print(wifiStats.fastConnectFailures);
+    out.print('}');
+
+    const auto& power = PowerManager::getInstance();
+    const auto& powerStats = power.getStats();
+    out.print(",\"power\":{\"idle\":");
+    out.print(power.isIdle() ? "true" : "false");
+    out.print(",\"wakeLatencyUs\":");
+    out.print(powerStats.lastWakeLatencyUs);
+    out.print(",\"maxWakeLatencyUs\":");
+    out.print(powerStats.maxWakeLatencyUs);
+    out.print(",\"wakeEvents\":");
+    out.print(powerStats.wakeEvents);
+    out.print(",\"boundViolations\":");
+    out.print(powerStats.boundViolations);
+    out.print('}');
+
+    const auto mqtt = MqttPublisher::getInstance().getStats();
+    out.print(",\"mqtt\":{\"enabled\":");
+    out.print(MqttPublisher::getInstance().isEnabled() ? "true" : "false");
+    out.print(",\"connected\":");
+    out.print(mqtt.connected ? "true" : "false");
+    out.print(",\"published\":");
+    out.print(mqtt.published);
+    out.print(",\"queued\":");
+    out.print(mqtt.queued);
+    out.print(",\"dropped\":");
+    out.print(mqtt.dropped);
+    out.print(",\"failed\":");
+    out.print(mqtt.failed);
+    out.print('}');
+
+    const auto reed = ReedDetector::getInstance().getStats();
+    out.print(",\"reed\":{\"locked\":");
+    out.print(ReedDetector::getInstance().isLocked() ? "true" : "false");
+    out.print(",\"periodUs\":");
+    out.print(reed.periodUs);
+    out.print(",\"pulses\":");
+    out.print(reed.pulses);
+    out.print(",\"releases\":");
+    out.print(reed.releases);
+    out.print(",\"lastReleaseUs\":");
+    out.print(reed.lastReleaseUs);
+    out.print('}');
+
+    const auto scale = ScaleCommandQueue::getInstance().getStats();
+    out.print(",\"scaleCommands\":{\"sent\":");
+    out.print(scale.sent);
+    out.print(",\"failed\":");
+    out.print(scale.failed);
+    out.print(",\"coalesced\":");
+    out.print(scale.coalesced);
+    out.print(",\"lastBurstCommands\":");
+    out.print(scale.lastBurstCommands);
+    out.print(",\"lastBurstUs\":");
+    out.print(scale.lastBurstUs);
+    out.print(",\"lastTareUs\":");
+    out.print(scale.lastTareUs);
+    out.print(",\"maxLatencyUs\":");
+    out.print(scale.maxLatencyUs);
+    out.print('}');
+
+    const auto& usb = SerialProtocol::getInstance();
+    out.print(",\"usbTelemetry\":{\"streaming\":");
+    out.print(usb.isStreaming() ? "true" : "false");
+    out.print(",\"dropped\":");
+    out.print(usb.getDropped());
+    out.print('}');
+
+    const auto& ota = OtaUpdate::getInstance();
+    const auto& otaStats = ota.getStats();
+    out.print(",\"ota\":{\"active\":");
+    out.print(ota.isActive() ? "true" : "false");
+    out.print(",\"pendingVerify\":");
+    out.print(ota.isPendingVerify() ? "true" : "false");
+    out.print(",\"lastBytes\":");
+    out.print(otaStats.bytes);
+    out.print(",\"lastThroughputKBps\":");
+    out.print(otaStats.throughputKBps, 1);
+    out.print('}');
+}
+
+inline PlatformStatus readPlatformStatus() {
+    return {ESP.getFreeHeap(), writeSubsystemStatus};
+}
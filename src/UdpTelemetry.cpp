@@ -0,0 +1,97 @@
+#include "UdpTelemetry.h"
+
+#include "Features.h"
+#include "Logger.h"
+
+#if FEATURE_WIFI
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#endif
+
+// Global variables from main.cpp
+extern bool udpTelemetryEnabled;
+extern String udpTelemetryGroup;
+extern int udpTelemetryPort;
+extern int udpMaxRateHz;
+
+UdpTelemetry UdpTelemetry::_singleton;
+
+#if FEATURE_WIFI
+static WiFiUDP udp;
+#endif
+
+void UdpTelemetry::begin() {
+    if (!features::wifi || !udpTelemetryEnabled) {
+        return;
+    }
+
+    IPAddress group;
+
+    if (!group.fromString(udpTelemetryGroup) || group[0] < 224 || group[0] > 239) {
+        LOGF(ERROR, "Invalid telemetry multicast group: %s", udpTelemetryGroup.c_str());
+        return;
+    }
+
+    _group = static_cast<uint32_t>(group);
+    _port = static_cast<uint16_t>(udpTelemetryPort);
+    _minInterval_ms = 1000 / std::max(1, udpMaxRateHz);
+
+    const uint64_t mac = ESP.getEfuseMac();
+
+    _frame.magic[0] = 'S';
+    _frame.magic[1] = 'T';
+    _frame.version = 1;
+
+    for (int i = 0; i < 6; i++) {
+        _frame.device[i] = static_cast<uint8_t>(mac >> (8 * i));
+    }
+
+    _enabled = true;
+
+    LOGF(INFO, "UDP telemetry to %s:%u, max %dHz", udpTelemetryGroup.c_str(), _port, udpMaxRateHz);
+}
+
+void UdpTelemetry::update(const TelemetryState state, const uint8_t flags, const float shotTime_s, const float weight_g, const float flow_gps,
+                          const float predictedEnd_s, const float goal_g, const bool newSample) {
+    if (!_enabled) {
+        return;
+    }
+
+    // Changes are sent as soon as the rate cap allows, a change in between is not lost
+    _pending = _pending || newSample || state != _lastState;
+    _lastState = state;
+
+    const unsigned long now = millis();
+    const unsigned long sinceLast = now - _lastSend_ms;
+
+    if (sinceLast < _minInterval_ms || (!_pending && sinceLast < HEARTBEAT_MS)) {
+        return;
+    }
+
+#if FEATURE_WIFI
+    if (!WiFi.isConnected()) {
+        return;
+    }
+
+    _frame.state = static_cast<uint8_t>(state);
+    _frame.flags = flags;
+    _frame.sequence++;
+    _frame.uptime_ms = now;
+    _frame.shotTime_s = shotTime_s;
+    _frame.weight_g = weight_g;
+    _frame.flow_gps = flow_gps;
+    _frame.predictedEnd_s = predictedEnd_s;
+    _frame.goal_g = goal_g;
+
+    if (udp.beginPacket(IPAddress(_group), _port)) {
+        udp.write(reinterpret_cast<const uint8_t*>(&_frame), sizeof(_frame));
+
+        if (udp.endPacket()) {
+            _framesSent++;
+        }
+    }
+
+    _lastSend_ms = now;
+    _pending = false;
+#endif
+}
@@ -0,0 +1,91 @@
+/**
+ * @file UdpTelemetry.h
+ *
+ * @brief Compact binary telemetry frames over UDP multicast
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * @brief Shot state reported in telemetry frames
+ */
+enum class TelemetryState : uint8_t {
+    Idle = 0,
+    Brewing = 1,            // Brewing by weight, no prediction yet
+    BrewingPrediction = 2,  // Brewing by weight, predicted end is valid
+    BrewingTime = 3,        // Brewing by time
+    Dripping = 4            // Shot ended, waiting for the final weight
+};
+
+/**
+ * @brief One telemetry frame, 40 bytes, little endian, no padding
+ *
+ * Decoded by scripts/telemetry_receiver.py, keep both in sync.
+ */
+struct TelemetryFrame {
+    char magic[2];          // "ST"
+    uint8_t version;        // 1
+    uint8_t state;          // TelemetryState
+    uint8_t flags;          // Bit 0: scale connected, bit 1: brew by time only
+    uint8_t reserved;
+    uint16_t sequence;
+    uint8_t device[6];      // Factory MAC, same bytes as deviceId()
+    uint16_t reserved2;
+    uint32_t uptime_ms;
+    float shotTime_s;
+    float weight_g;
+    float flow_gps;
+    float predictedEnd_s;   // NaN while no prediction is available
+    float goal_g;
+};
+
+static_assert(sizeof(TelemetryFrame) == 40, "TelemetryFrame layout must match the receiver");
+
+/**
+ * @brief Sends a frame per new sample or state change, and a heartbeat frame while nothing changes
+ *
+ * Frames are built in a preallocated buffer and sent to the configured multicast group, at most
+ * udpMaxRateHz per second. Nothing is sent while WiFi is down.
+ */
+class UdpTelemetry {
+    public:
+        static UdpTelemetry& getInstance() {
+            return _singleton;
+        }
+
+        void begin();
+
+        /**
+         * @brief Send a frame if one is due
+         *
+         * @param newSample True if a new weight sample was taken since the last call
+         */
+        void update(TelemetryState state, uint8_t flags, float shotTime_s, float weight_g, float flow_gps, float predictedEnd_s, float goal_g, bool newSample);
+
+        [[nodiscard]] bool isEnabled() const {
+            return _enabled;
+        }
+
+        [[nodiscard]] uint32_t getFramesSent() const {
+            return _framesSent;
+        }
+
+    private:
+        UdpTelemetry() = default;
+
+        static UdpTelemetry _singleton;
+
+        static constexpr unsigned long HEARTBEAT_MS = 1000;
+
+        bool _enabled = false;
+        uint32_t _group = 0;
+        uint16_t _port = 0;
+        unsigned long _minInterval_ms = 100;
+        unsigned long _lastSend_ms = 0;
+        bool _pending = false;
+        TelemetryState _lastState = TelemetryState::Idle;
+        uint32_t _framesSent = 0;
+        TelemetryFrame _frame = {};
+};
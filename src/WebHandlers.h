@@ -0,0 +1,363 @@
+/**
+ * @file WebHandlers.h
+ *
+ * @brief Request handling of the web interface, independent of the web server
+ *
+ * The functions here read plain values and write their responses to a Print, the AsyncWebServer glue in
+ * embeddedWebserver.h only extracts the request parameters and sends the result. Nothing here reads the
+ * hardware: the free heap, the device id and the status of the network, power and update subsystems are
+ * passed in by the caller (see SystemStatus.h). test/host builds this file with the registry on a PC.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <ArduinoJson.h>
+#include <atomic>
+
+#include "ConfigSnapshot.h"
+#include "JsonArena.h"
+#include "ParameterRegistry.h"
+#include "ShotLog.h"
+
+// JSON documents are built in arenas instead of the heap: one for the request handlers, which all run in the
+// async_tcp task, and one for the status events sent from the loop
+inline StaticJsonArena<8192> webJsonArena;
+inline StaticJsonArena<2048> statusJsonArena;
+
+// Trial mode reverts after this long without a change, unless /trial/start is given a timeout
+static constexpr long TRIAL_DEFAULT_TIMEOUT_S = 600;
+
+// Forward declarations from main.cpp
+extern float currentWeight;
+extern float goalWeight;
+extern float weightOffset;
+extern std::atomic<bool> isBrewing;
+extern std::atomic<float> shotTimer;
+extern std::atomic<float> statusWeight;
+extern std::atomic<float> timeToValidData_s;
+extern std::atomic<bool> brewByTimeOnly;
+extern const char sysVersion[];
+extern ConfigSnapshotStore configSnapshots;
+
+// Status values only the platform knows, read by the caller of writeStatus()
+struct PlatformStatus {
+    uint32_t freeHeap;
+    void (*writeSubsystems)(Print& out);    // Adds ",\"name\":{...}" sections, may be null
+};
+
+// rounds a number to 2 decimal places
+inline double round2(const double value) {
+    return std::round(value * 100.0) / 100.0;
+}
+
+inline void paramToJson(const String& name, const std::shared_ptr<Parameter>& param, JsonVariant doc) {
+    doc["type"] = param->getType();
+    doc["name"] = name;
+    doc["displayName"] = param->getDisplayName();
+    doc["section"] = param->getSection();
+    doc["sectionName"] = getSectionName(param->getSection());
+    doc["position"] = param->getPosition();
+    doc["hasHelpText"] = param->hasHelpText();
+    doc["show"] = param->shouldShow();
+    doc["reboot"] = param->requiresReboot();
+    doc["trial"] = param->isTrial();
+
+    switch (param->getType()) {
+        case kInteger:
+            doc["value"] = static_cast<int>(param->getValue());
+            break;
+
+        case kUInt8:
+            doc["value"] = static_cast<uint8_t>(param->getValue());
+            break;
+
+        case kDouble:
+            doc["value"] = round2(param->getValue());
+            break;
+
+        case kFloat:
+            doc["value"] = round2(static_cast<float>(param->getValue()));
+            break;
+
+        case kCString:
+            doc["value"] = param->getStringValue();
+            break;
+
+        case kEnum:
+            {
+                doc["value"] = static_cast<int>(param->getValue());
+
+                const JsonArray options = doc["options"].to<JsonArray>();
+                const char* const* enumOptions = param->getEnumOptions();
+                const size_t enumCount = param->getEnumCount();
+
+                for (size_t i = 0; i < enumCount && enumOptions[i] != nullptr; i++) {
+                    auto optionObj = options.add<JsonObject>();
+                    optionObj["value"] = static_cast<int>(i);
+                    optionObj["label"] = enumOptions[i];
+                }
+
+                break;
+            }
+
+        default:
+            doc["value"] = param->getValue();
+            break;
+    }
+
+    doc["min"] = param->getMinValue();
+    doc["max"] = param->getMaxValue();
+}
+
+inline void printArenaStats(Print& out, const JsonArena::Stats& stats) {
+    out.printf(R"({"capacity":%u,"highWater":%u,"allocations":%u,"failures":%u})", static_cast<unsigned>(stats.capacity),
+        static_cast<unsigned>(stats.highWater), static_cast<unsigned>(stats.allocations), static_cast<unsigned>(stats.failures));
+}
+
+// Body of GET /parameters, visible parameters of one section (-1 for all) with pagination
+inline void writeParameters(Print& out, const int offset, const int limit, const int sectionFilter) {
+    const auto lock = ParameterRegistry::getInstance().lock();
+    const auto& parameters = ParameterRegistry::getInstance().getParameters();
+
+    out.print("{\"parameters\":[");
+
+    bool first = true;
+    int filteredCount = 0;
+    int sent = 0;
+
+    for (const auto& param : parameters) {
+        if (!param->shouldShow()) {
+            continue;
+        }
+
+        if (sectionFilter >= 0 && param->getSection() != sectionFilter) {
+            continue;
+        }
+
+        if (filteredCount++ < offset) {
+            continue;
+        }
+
+        if (sent >= limit) {
+            break;
+        }
+
+        if (!first) {
+            out.print(",");
+        }
+
+        first = false;
+
+        JsonArenaScope arenaScope(webJsonArena);
+        JsonDocument doc(&webJsonArena);
+        paramToJson(param->getId(), param, doc.to<JsonVariant>());
+        serializeJson(doc, out);
+
+        sent++;
+    }
+
+    out.printf(R"(],"offset":%d,"limit":%d,"returned":%d,"total":%d})", offset, limit, sent, filteredCount);
+}
+
+// Applies one value posted to /parameters, a rejected value adds a line to errors
+inline void applyParameter(const String& varName, const String& value, String& errors) {
+    auto& registry = ParameterRegistry::getInstance();
+
+    try {
+        const std::shared_ptr<Parameter> paramPtr = registry.getParameterById(varName.c_str());
+
+        if (paramPtr == nullptr || !paramPtr->shouldShow()) {
+            return;
+        }
+
+        // Strings may be cleared, numbers need a value
+        if (paramPtr->getType() == kCString) {
+            registry.setParameterValue(varName.c_str(), value);
+        }
+        else if (value.length() > 0) {
+            const double newVal = std::stod(value.c_str());
+            registry.setParameterValue(varName.c_str(), newVal);
+        }
+    } catch (const std::exception& e) {
+        LOGF(INFO, "Parameter %s processing failed: %s", varName.c_str(), e.what());
+        errors += "\n" + varName + ": " + e.what();
+    }
+}
+
+// Saves the values applied by applyParameter() and returns the text of the POST /parameters response
+inline String finishParameterUpdate(const String& errors) {
+    ParameterRegistry::getInstance().forceSave();
+
+    return errors.length() > 0 ? String("Partial Success") + errors : String("OK");
+}
+
+// Body of GET /parameterHelp
+inline void writeParameterHelp(Print& out, const String& varName, const std::shared_ptr<Parameter>& param) {
+    JsonArenaScope arenaScope(webJsonArena);
+    JsonDocument doc(&webJsonArena);
+    doc["name"] = varName;
+    doc["helpText"] = param->getHelpText();
+    serializeJson(doc, out);
+}
+
+// Handles one message of the /ws command channel and fills in the acknowledgement.
+//
+//   {"id":7,"cmd":"set","name":"brew.goal_weight","value":36.5} -> {"id":7,"ok":true,"name":...,"value":36.5}
+//   {"id":8,"cmd":"get","name":"brew.goal_weight"}              -> {"id":8,"ok":true,"name":...,"value":36.5}
+//
+// A failed command is answered with "ok":false and an "error" text. Values set here are not written to flash
+// directly, ParameterRegistry::processPeriodicSave() saves once the changes have settled.
+inline void handleCommand(JsonVariantConst request, JsonVariant reply) {
+    reply["id"] = request["id"];
+
+    const char* cmd = request["cmd"] | "";
+    const char* name = request["name"] | "";
+    auto& registry = ParameterRegistry::getInstance();
+    const auto lock = registry.lock();
+
+    try {
+        const std::shared_ptr<Parameter> param = registry.getParameterById(name);
+
+        if (param == nullptr || !param->shouldShow()) {
+            reply["ok"] = false;
+            reply["error"] = "unknown parameter";
+            return;
+        }
+
+        if (strcmp(cmd, "set") == 0) {
+            const JsonVariantConst value = request["value"];
+
+            if (param->getType() == kCString && value.is<const char*>()) {
+                registry.setParameterValue(name, String(value.as<const char*>()));
+            }
+            else if (param->getType() != kCString && value.is<double>()) {
+                registry.setParameterValue(name, value.as<double>());
+            }
+            else {
+                reply["ok"] = false;
+                reply["error"] = "wrong value type";
+                return;
+            }
+        }
+        else if (strcmp(cmd, "get") != 0) {
+            reply["ok"] = false;
+            reply["error"] = "unknown command";
+            return;
+        }
+
+        reply["ok"] = true;
+        reply["name"] = name;
+
+        if (param->getType() == kCString) {
+            reply["value"] = param->getStringValue();
+        }
+        else {
+            reply["value"] = round2(param->getValue());
+        }
+    } catch (const std::exception& e) {
+        LOGF(INFO, "Command %s %s failed: %s", cmd, name, e.what());
+        reply["ok"] = false;
+        reply["error"] = e.what();
+    }
+}
+
+// Prints a number of a JSON reply, null if it is not known (NaN)
+inline void printJsonNumber(Print& out, const float value, const int decimals) {
+    if (std::isnan(value)) {
+        out.print("null");
+    }
+    else {
+        out.print(value, decimals);
+    }
+}
+
+// Body of GET /history, the shots after the id since, oldest first
+inline void writeHistory(Print& out, const uint32_t since, const char* device) {
+    const auto& log = ShotLog::getInstance();
+
+    out.printf(R"({"device":"%s","bootId":%u,"lastId":%u,"shots":[)", device,
+        static_cast<unsigned>(log.getBootId()), static_cast<unsigned>(log.getLastId()));
+
+    // In small batches, the handler runs on the stack of the web server task
+    ShotLog::Shot shots[4];
+    uint32_t cursor = since;
+    bool first = true;
+
+    while (const size_t count = log.read(cursor, shots, std::size(shots))) {
+        for (size_t i = 0; i < count; i++) {
+            const auto& shot = shots[i];
+
+            if (!first) {
+                out.print(',');
+            }
+
+            first = false;
+            out.printf(R"({"id":%u,"uptime":%u,"reason":"%s","duration":%.1f,"stopWeight":%.1f,"finalWeight":)",
+                static_cast<unsigned>(shot.id), static_cast<unsigned>(shot.uptime_s), shot.reason, shot.duration_s, shot.stopWeight);
+            printJsonNumber(out, shot.finalWeight, 1);
+            out.printf(R"(,"goalWeight":%.1f,"dose":%.1f,"offset":%.2f,"learnedOffset":)", shot.goalWeight, shot.dose,
+                shot.offset);
+            printJsonNumber(out, shot.learnedOffset, 2);
+            out.print('}');
+
+            cursor = shot.id;
+        }
+    }
+
+    out.print("]}");
+}
+
+// Body of the /trial endpoints
+inline void writeTrialStatus(Print& out) {
+    const auto& registry = ParameterRegistry::getInstance();
+    const auto lock = registry.lock();
+
+    out.printf(R"({"active":%s,"remaining":%lu,"changes":%u})", registry.isTrialActive() ? "true" : "false",
+        registry.getTrialRemainingMs() / 1000, static_cast<unsigned>(registry.getTrialChangeCount()));
+}
+
+// Body of GET /status
+inline void writeStatus(Print& out, const PlatformStatus& platform) {
+    // Runs in the web server task: loop state from the atomic copies, settings from the published snapshot
+    const ConfigSnapshot snapshot = configSnapshots.read();
+
+    out.print('{');
+    out.print("\"currentWeight\":");
+    out.print(statusWeight.load(), 2);
+    out.print(",\"goalWeight\":");
+    out.print(snapshot.goalWeight, 2);
+    out.print(",\"weightOffset\":");
+    out.print(snapshot.weightOffset, 2);
+    out.print(",\"brewing\":");
+    out.print(isBrewing ? "true" : "false");
+    out.print(",\"shotTimer\":");
+    out.print(shotTimer.load(), 1);
+    out.print(",\"timeToValidData\":");
+    out.print(timeToValidData_s.load(), 2);
+    out.print(",\"brewByTimeOnly\":");
+    out.print(brewByTimeOnly ? "true" : "false");
+    out.print(",\"configEpoch\":");
+    out.print(configSnapshots.getEpoch());
+    out.print(",\"freeHeap\":");
+    out.print(platform.freeHeap);
+    out.print(",\"uptime\":");
+    out.print(millis() / 1000);
+    out.print(",\"version\":\"");
+    out.print(sysVersion);
+    out.print('"');
+
+    if (platform.writeSubsystems != nullptr) {
+        platform.writeSubsystems(out);
+    }
+
+    // Capacity and use of the JSON arenas, failures mean an arena is too small. The status arena belongs to the
+    // loop, which publishes its stats after each status event.
+    out.print(",\"jsonArena\":{\"web\":");
+    printArenaStats(out, webJsonArena.getStats());
+    out.print(",\"status\":");
+    printArenaStats(out, statusJsonArena.getPublishedStats());
+    out.print('}');
+    out.print('}');
+}
@@ -0,0 +1,64 @@
+#include "WeightResampler.h"
+
+#include <cmath>
+
+void WeightResampler::reset() {
+    _head = 0;
+    _count = 0;
+    _started = false;
+}
+
+void WeightResampler::addSample(const float time_s, const float weight) {
+    if (!_started || time_s - _lastTime_s > MAX_GAP_S) {
+        _count = 0;
+        _nextIndex = lroundf(ceilf(time_s / STEP_S));
+        _started = true;
+    }
+    else if (time_s <= _lastTime_s) {
+        return;
+    }
+    else {
+        // Grid points between the previous and this sample
+        const float span_s = time_s - _lastTime_s;
+
+        for (float t = static_cast<float>(_nextIndex) * STEP_S; t <= time_s; t = static_cast<float>(++_nextIndex) * STEP_S) {
+            const float fraction = (t - _lastTime_s) / span_s;
+            _weights[_head] = _lastWeight + fraction * (weight - _lastWeight);
+            _head = (_head + 1) % CAPACITY;
+
+            if (_count < CAPACITY) {
+                _count++;
+            }
+        }
+    }
+
+    _lastTime_s = time_s;
+    _lastWeight = weight;
+}
+
+bool WeightResampler::fit(const float window_s, float& slope, float& intercept) const {
+    const auto points = static_cast<size_t>(lroundf(fminf(window_s, MAX_WINDOW_S) / STEP_S)) + 1;
+
+    if (points < 2 || _count < points) {
+        return false;
+    }
+
+    // x relative to the newest grid point keeps the sums small
+    const float newest_s = static_cast<float>(_nextIndex - 1) * STEP_S;
+    float sumX = 0, sumY = 0, sumXY = 0, sumSquaredX = 0;
+
+    for (size_t i = 0; i < points; i++) {
+        const float x = -static_cast<float>(i) * STEP_S;
+        const float y = _weights[(_head + CAPACITY - 1 - i) % CAPACITY];
+        sumX += x;
+        sumY += y;
+        sumXY += x * y;
+        sumSquaredX += x * x;
+    }
+
+    const auto n = static_cast<float>(points);
+    slope = (n * sumXY - sumX * sumY) / (n * sumSquaredX - sumX * sumX);
+    intercept = sumY / n - slope * (sumX / n) - slope * newest_s;
+
+    return true;
+}
@@ -0,0 +1,62 @@
+/**
+ * @file WeightResampler.h
+ *
+ * @brief Scale weight on a uniform time grid for the end time prediction
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * @brief Interpolates the scale samples onto a fixed STEP_S grid and fits a line over the last seconds of it
+ *
+ * Scales notify at their own rate and BLE delivers the notifications in connection events, so the samples
+ * are unevenly spaced. A fit over the last N samples then covers a different time span on every scale and
+ * weighs bursts of samples more. On the grid, the fit window is a time span and every part of it counts
+ * the same, whatever the native rate of the scale.
+ *
+ * Samples are linearly interpolated between consecutive measurements. A gap longer than MAX_GAP_S, e.g. a
+ * scale dropout, is not bridged: the grid starts over with the next sample.
+ */
+class WeightResampler {
+    public:
+        static constexpr float STEP_S = 0.02f;
+        static constexpr size_t CAPACITY = 256;             // 5.1 s of grid points
+        static constexpr float MAX_WINDOW_S = (CAPACITY - 1) * STEP_S;
+        static constexpr float MAX_GAP_S = 0.5f;
+
+        /**
+         * @brief Drop all grid points, used at the start of a shot
+         */
+        void reset();
+
+        /**
+         * @brief Add a sample, emits the grid points up to its time
+         *
+         * @param time_s Time of the sample, increasing
+         */
+        void addSample(float time_s, float weight);
+
+        /**
+         * @brief Least-squares line over the grid points of the last window_s seconds
+         *
+         * @param slope Weight per second
+         * @param intercept Weight at time 0 of the sample time base
+         * @return false if the grid does not cover the window yet
+         */
+        bool fit(float window_s, float& slope, float& intercept) const;
+
+        [[nodiscard]] size_t size() const {
+            return _count;
+        }
+
+    private:
+        float _weights[CAPACITY] = {};
+        size_t _head = 0;               // Index of the next grid point to write
+        size_t _count = 0;
+        long _nextIndex = 0;            // Grid index (time / STEP_S) of the next point to emit
+        float _lastTime_s = 0.0f;
+        float _lastWeight = 0.0f;
+        bool _started = false;
+};
@@ -0,0 +1,323 @@
+#include "WiFiConnection.h"
+
+#if FEATURE_WIFI
+
+#include "DeviceId.h"
+#include "Logger.h"
+
+#include <ESPmDNS.h>
+#include <Preferences.h>
+#include <esp_system.h>
+
+// Global variables from main.cpp
+extern String hostName;
+extern const char sysVersion[];
+
+WiFiManager wifiManager;
+
+WiFiConnection WiFiConnection::_singleton;
+
+static constexpr auto CACHE_NAMESPACE = "wifi";
+static constexpr auto CACHE_KEY = "cache";
+
+void WiFiConnection::begin(const String& hostname) {
+    _hostname = hostname;
+
+    WiFi.onEvent(onWiFiEvent, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    WiFi.setHostname(_hostname.c_str());
+    WiFi.mode(WIFI_STA);
+
+    // Reconnects are driven by loop() so they can use the cache and back off
+    WiFi.setAutoReconnect(false);
+
+    wifiManager.setConfigPortalBlocking(false);
+
+    if (!wifiManager.getWiFiIsSaved()) {
+        LOGF(INFO, "WiFi not configured - captive portal active on AP: %s", _hostname.c_str());
+        startPortal(0); // Portal stays open indefinitely until configured
+        return;
+    }
+
+    _ssid = wifiManager.getWiFiSSID();
+    _psk = wifiManager.getWiFiPass();
+    _cacheValid = loadCache();
+    _linkLost_ms = millis();
+
+    if (_cacheValid) {
+        startFastConnect();
+    }
+    else {
+        startFullConnect();
+    }
+}
+
+void WiFiConnection::loop() {
+    if (_portalActive) {
+        if (wifiManager.process()) {
+            _portalActive = false;
+            onConnected();
+        }
+        else if (!wifiManager.getConfigPortalActive()) {
+            LOG(INFO, "Captive portal closed, resuming connection attempts");
+            _portalActive = false;
+            _stats.attempts = 0;
+            WiFi.mode(WIFI_STA);
+            startFullConnect();
+        }
+
+        return;
+    }
+
+    const unsigned long now = millis();
+
+    switch (_state) {
+        case State::Connected:
+            if (_linkDown.exchange(false, std::memory_order_acquire)) {
+                _linkLost_ms = now;
+                _stats.attempts = 0;
+                _stats.lastDisconnectReason = _disconnectReason.load(std::memory_order_relaxed);
+
+                LOGF(WARNING, "WiFi link lost (reason %u), reconnecting", _stats.lastDisconnectReason);
+
+                if (_cacheValid) {
+                    startFastConnect();
+                }
+                else {
+                    startFullConnect();
+                }
+            }
+            break;
+
+        case State::FastConnect:
+            if (WiFi.status() == WL_CONNECTED) {
+                onConnected();
+            }
+            else if (now - _stateSince_ms > FAST_CONNECT_TIMEOUT_MS) {
+                // The AP may have changed channel, the next success refreshes the cache
+                _stats.fastConnectFailures++;
+                _cacheValid = false;
+                LOG(INFO, "WiFi fast connect failed, falling back to full connect");
+                startFullConnect();
+            }
+            break;
+
+        case State::Connecting:
+            if (WiFi.status() == WL_CONNECTED) {
+                onConnected();
+            }
+            else if (now - _stateSince_ms > CONNECT_TIMEOUT_MS) {
+                startBackoff();
+            }
+            break;
+
+        case State::Backoff:
+            if (now - _stateSince_ms > _backoffMs) {
+                if (!_wasConnected && _stats.attempts >= PORTAL_AFTER_ATTEMPTS) {
+                    LOGF(INFO, "WiFi unreachable since boot - captive portal active on AP: %s for %lus", _hostname.c_str(), PORTAL_TIMEOUT_S);
+                    startPortal(PORTAL_TIMEOUT_S);
+                }
+                else if (_cacheValid) {
+                    startFastConnect();
+                }
+                else {
+                    startFullConnect();
+                }
+            }
+            break;
+
+        case State::Idle:
+            break;
+    }
+}
+
+void WiFiConnection::resetSettings() {
+    clearCache();
+    wifiManager.resetSettings();
+}
+
+const char* WiFiConnection::getStateName(const State state) {
+    switch (state) {
+        case State::Idle:
+            return "idle";
+        case State::FastConnect:
+            return "fast_connect";
+        case State::Connecting:
+            return "connecting";
+        case State::Connected:
+            return "connected";
+        case State::Backoff:
+            return "backoff";
+        default:
+            return "unknown";
+    }
+}
+
+void WiFiConnection::setState(const State state) {
+    _state = state;
+    _stateSince_ms = millis();
+}
+
+void WiFiConnection::startFastConnect() {
+    // A direct connect to the cached BSSID/channel skips the channel scan. The address still comes from DHCP:
+    // reusing the last lease as a static address would never renew it, and once it expired the server could
+    // hand it to another client.
+    WiFi.config(IPAddress(), IPAddress(), IPAddress());
+    WiFi.begin(_ssid.c_str(), _psk.c_str(), _cache.channel, _cache.bssid);
+
+    _stats.attempts++;
+    _stats.lastConnectWasFast = true;
+    setState(State::FastConnect);
+}
+
+void WiFiConnection::startFullConnect() {
+    WiFi.disconnect();
+
+    WiFi.config(IPAddress(), IPAddress(), IPAddress()); // Back to DHCP
+    WiFi.begin(_ssid.c_str(), _psk.c_str());
+
+    _stats.attempts++;
+    _stats.lastConnectWasFast = false;
+    setState(State::Connecting);
+}
+
+void WiFiConnection::startBackoff() {
+    WiFi.disconnect();
+
+    const uint32_t exponent = _stats.attempts > 6 ? 6 : _stats.attempts - 1;
+    _backoffMs = std::min(BACKOFF_MIN_MS << exponent, BACKOFF_MAX_MS);
+
+    // Jitter so units behind the same AP do not retry in lockstep
+    _backoffMs += esp_random() % (_backoffMs / 4 + 1);
+
+    LOGF(INFO, "WiFi connect attempt %u failed, retrying in %lums", _stats.attempts, _backoffMs);
+
+    setState(State::Backoff);
+}
+
+void WiFiConnection::startPortal(const unsigned long timeout_s) {
+    wifiManager.setConfigPortalTimeout(timeout_s);
+    wifiManager.startConfigPortal(_hostname.c_str());
+
+    _portalActive = true;
+    setState(State::Idle);
+}
+
+void WiFiConnection::onConnected() {
+    const unsigned long now = millis();
+
+    _stats.lastConnectMs = now - _stateSince_ms;
+    _stats.lastOutageMs = now - _linkLost_ms;
+    _stats.connectedSince_ms = now;
+    _stats.attempts = 0;
+
+    if (_wasConnected) {
+        _stats.reconnects++;
+    }
+
+    _wasConnected = true;
+    _linkDown.store(false, std::memory_order_relaxed);
+
+    // Credentials may just have been entered in the captive portal
+    _ssid = WiFi.SSID();
+    _psk = WiFi.psk();
+
+    storeCache();
+    setState(State::Connected);
+
+    LOGF(INFO, "WiFi connected: %s | %s connect in %lums | %lums since link loss",
+        WiFi.localIP().toString().c_str(), _stats.lastConnectWasFast ? "fast" : "full", _stats.lastConnectMs, _stats.lastOutageMs);
+
+    // Once, the responder follows the interface through later reconnects
+    if (!_mdnsStarted) {
+        startMdns();
+    }
+}
+
+void WiFiConnection::startMdns() {
+    if constexpr (!features::webServer) {
+        return;
+    }
+
+    if (!MDNS.begin(_hostname.c_str())) {
+        LOG(WARNING, "mDNS responder failed to start");
+        return;
+    }
+
+    // The web interface, and the service collectors browse for with the id that stays the same across renames
+    MDNS.addService("http", "tcp", 80);
+    MDNS.addService("shotstopper", "tcp", 80);
+    MDNS.addServiceTxt("shotstopper", "tcp", "id", deviceId());
+    MDNS.addServiceTxt("shotstopper", "tcp", "version", sysVersion);
+
+    _mdnsStarted = true;
+    LOGF(INFO, "mDNS: %s.local", _hostname.c_str());
+}
+
+bool WiFiConnection::loadCache() {
+    Preferences prefs;
+
+    if (!prefs.begin(CACHE_NAMESPACE, true)) {
+        return false;
+    }
+
+    const size_t len = prefs.getBytes(CACHE_KEY, &_cache, sizeof(_cache));
+    prefs.end();
+
+    // A cache of an older firmware has a different size and is ignored
+    return len == sizeof(_cache) && _cache.channel != 0;
+}
+
+void WiFiConnection::storeCache() {
+    Cache cache;
+    memset(&cache, 0, sizeof(cache));
+
+    memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+    cache.channel = static_cast<uint8_t>(WiFi.channel());
+
+    _cacheValid = true;
+
+    // Only write NVS if something changed
+    if (memcmp(&cache, &_cache, sizeof(cache)) == 0) {
+        return;
+    }
+
+    _cache = cache;
+
+    Preferences prefs;
+
+    if (prefs.begin(CACHE_NAMESPACE, false)) {
+        prefs.putBytes(CACHE_KEY, &_cache, sizeof(_cache));
+        prefs.end();
+        LOGF(DEBUG, "WiFi cache updated (channel %u)", _cache.channel);
+    }
+}
+
+void WiFiConnection::clearCache() {
+    memset(&_cache, 0, sizeof(_cache));
+    _cacheValid = false;
+
+    Preferences prefs;
+
+    if (prefs.begin(CACHE_NAMESPACE, false)) {
+        prefs.clear();
+        prefs.end();
+    }
+}
+
+void WiFiConnection::onWiFiEvent(const arduino_event_id_t event, const arduino_event_info_t info) {
+    // Runs on the WiFi event task, only hand the event over to loop()
+    if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) {
+        _singleton._disconnectReason.store(info.wifi_sta_disconnected.reason, std::memory_order_relaxed);
+        _singleton._linkDown.store(true, std::memory_order_release);
+    }
+}
+
+void setupWiFi() {
+    WiFiConnection::getInstance().begin(hostName);
+}
+
+void wifiLoop() {
+    WiFiConnection::getInstance().loop();
+}
+
+#endif
@@ -0,0 +1,158 @@
+/**
+ * @file WiFiConnection.h
+ *
+ * @brief WiFi station connection manager with fast reconnect and background backoff
+ */
+
+#pragma once
+
+#include "Features.h"
+
+#include <Arduino.h>
+#include <atomic>
+
+#if FEATURE_WIFI
+
+#include <IPAddress.h>
+#include <WiFi.h>
+#include <WiFiManager.h>
+
+extern WiFiManager wifiManager;
+
+/**
+ * @brief Keeps the station connected without blocking the control loop
+ *
+ * The BSSID and channel of the last successful connection are cached in NVS. A reconnect first tries these
+ * cached values, which skips the channel scan; the address always comes from DHCP, so the lease is renewed
+ * like on any other client. If that fails the manager falls back to a regular connect and retries with
+ * exponential backoff. The WiFiManager captive portal is only started when no credentials are stored or when
+ * the first attempts after boot fail, and is only serviced while it is active. A unit that lost an established
+ * link never opens the portal and keeps retrying in the background.
+ */
+class WiFiConnection {
+    public:
+        enum class State : uint8_t {
+            Idle,
+            FastConnect,
+            Connecting,
+            Connected,
+            Backoff
+        };
+
+        struct Stats {
+            unsigned long lastConnectMs;      // Duration of the last successful connection attempt
+            unsigned long lastOutageMs;       // Time from losing the link until it was restored
+            unsigned long connectedSince_ms;  // millis() when the link came up
+            uint32_t reconnects;              // Successful connections after a link loss
+            uint32_t attempts;                // Connection attempts since the link was lost
+            uint32_t fastConnectFailures;     // Fast connect attempts that fell back to a full connect
+            uint8_t lastDisconnectReason;     // wifi_err_reason_t of the last disconnect
+            bool lastConnectWasFast;          // True if the cached BSSID/channel were used
+        };
+
+        static WiFiConnection& getInstance() {
+            return _singleton;
+        }
+
+        /**
+         * @brief Start connecting in the background, or start the captive portal if no credentials are stored
+         *
+         * @param hostname Station hostname and captive portal AP name
+         */
+        void begin(const String& hostname);
+
+        /**
+         * @brief Advance the connection state machine, needs to be called in every loop iteration
+         */
+        void loop();
+
+        /**
+         * @brief Clear stored credentials and the connection cache
+         */
+        void resetSettings();
+
+        [[nodiscard]] bool isConnected() const {
+            return _state == State::Connected;
+        }
+
+        [[nodiscard]] bool isPortalActive() const {
+            return _portalActive;
+        }
+
+        [[nodiscard]] State getState() const {
+            return _state;
+        }
+
+        [[nodiscard]] const Stats& getStats() const {
+            return _stats;
+        }
+
+        static const char* getStateName(State state);
+
+    private:
+        WiFiConnection() = default;
+
+        static WiFiConnection _singleton;
+
+        // Access point of the last successful connection, persisted in NVS
+        struct Cache {
+            uint8_t bssid[6];
+            uint8_t channel;
+            uint8_t reserved;
+        };
+
+        static constexpr unsigned long FAST_CONNECT_TIMEOUT_MS = 3000;
+        static constexpr unsigned long CONNECT_TIMEOUT_MS = 10000;
+        static constexpr unsigned long BACKOFF_MIN_MS = 1000;
+        static constexpr unsigned long BACKOFF_MAX_MS = 60000;
+        static constexpr uint32_t PORTAL_AFTER_ATTEMPTS = 3;   // Only before the first connection since boot
+        static constexpr unsigned long PORTAL_TIMEOUT_S = 180;
+
+        void setState(State state);
+        void startFastConnect();
+        void startFullConnect();
+        void startBackoff();
+        void startPortal(unsigned long timeout_s);
+        void onConnected();
+        void startMdns();
+        bool loadCache();
+        void storeCache();
+        void clearCache();
+
+        static void onWiFiEvent(arduino_event_id_t event, arduino_event_info_t info);
+
+        String _hostname;
+        String _ssid;
+        String _psk;
+        State _state = State::Idle;
+        Stats _stats = {};
+        Cache _cache = {};
+        bool _cacheValid = false;
+        bool _portalActive = false;
+        unsigned long _stateSince_ms = 0;
+        unsigned long _backoffMs = 0;
+        unsigned long _linkLost_ms = 0;
+        bool _wasConnected = false;
+        bool _mdnsStarted = false;
+
+        // Set from the WiFi event task, taken in loop(). The reason is stored before the flag is released.
+        std::atomic<bool> _linkDown{false};
+        std::atomic<uint8_t> _disconnectReason{0};
+};
+
+/**
+ * @brief Set up the WiFi station
+ */
+void setupWiFi();
+
+/**
+ * @brief Service the WiFi connection, needs to be called in every loop iteration
+ */
+void wifiLoop();
+
+#else
+
+inline void setupWiFi() {}
+inline void wifiLoop() {}
+
+#endif
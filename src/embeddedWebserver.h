@@ -6,8 +6,12 @@
 
 #pragma once
 
+#include "Features.h"
+
 #include <Arduino.h>
 
+#if FEATURE_WEBSERVER
+
 #include "FS.h"
 #include <AsyncTCP.h>
 #include <WiFi.h>
@@ -15,67 +19,78 @@
 #include <ArduinoJson.h>
 #include <ESPAsyncWebServer.h>
 
+#include "DeviceId.h"
+#include "FilesystemLock.h"
 #include "LittleFS.h"
-#include "ParameterRegistry.h"
+#include "OtaUpdate.h"
+#include "SystemStatus.h"
+#include "WebHandlers.h"
+#include "WiFiConnection.h"
 
 inline AsyncWebServer server(80);
 inline AsyncEventSource events("/events");
+inline AsyncWebSocket commandSocket("/ws");
+
+// Browsers beyond this many command connections have their oldest one closed
+static constexpr size_t WS_MAX_CLIENTS = 4;
 
 // Forward declarations from main.cpp
-extern float currentWeight;
-extern float goalWeight;
-extern float weightOffset;
-extern bool isBrewing;
-extern float shotTimer;
-extern bool brewByTimeOnly;
 extern Config config;
-extern const char sysVersion[];
-
-// Forward declaration for WiFi reset
-class WiFiManager;
-extern WiFiManager wifiManager;
 
 void serverSetup();
 
-// Template processor for HTML files — replaces %HEADER% etc. with fragment files
-inline String staticProcessor(const String& var) {
-    String varLower(var);
-    varLower.toLowerCase();
-
-    if (File file = LittleFS.open("/html_fragments/" + varLower + ".html", "r")) {
-        String content = file.readString();
-        file.close();
-        return content;
-    }
+// Number of browsers subscribed to live status events or connected to the command channel
+inline size_t webClientCount() {
+    return events.count() + commandSocket.count();
+}
 
-    return {};
+// Drops closed and surplus command connections, called from the loop about once a second
+inline void cleanupWebClients() {
+    commandSocket.cleanupClients(WS_MAX_CLIENTS);
 }
 
-// rounds a number to 2 decimal places
-inline double round2(const double value) {
-    return std::round(value * 100.0) / 100.0;
+// One complete text message of the /ws command channel, answered on the same connection
+inline void onCommandMessage(AsyncWebSocketClient* client, const uint8_t* data, const size_t len) {
+    JsonArenaScope arenaScope(webJsonArena);
+    JsonDocument request(&webJsonArena);
+    JsonDocument reply(&webJsonArena);
+
+    if (const DeserializationError error = deserializeJson(request, data, len); error) {
+        reply["ok"] = false;
+        reply["error"] = error.c_str();
+    }
+    else {
+        handleCommand(request.as<JsonVariantConst>(), reply.to<JsonVariant>());
+    }
+
+    char json[256];
+    const size_t length = serializeJson(reply, json, sizeof(json));
+    client->text(json, length);
 }
 
 // Send live status via SSE to connected browser clients
 inline void sendStatusEvent() {
     if (events.count() == 0) return;
 
-    JsonDocument doc;
+    JsonArenaScope arenaScope(statusJsonArena);
+    JsonDocument doc(&statusJsonArena);
     doc["currentWeight"] = round2(currentWeight);
     doc["goalWeight"] = round2(goalWeight);
     doc["weightOffset"] = round2(weightOffset);
-    doc["brewing"] = isBrewing;
+    doc["brewing"] = isBrewing.load();
     doc["shotTimer"] = round2(shotTimer);
-    doc["brewByTimeOnly"] = brewByTimeOnly;
+    doc["brewByTimeOnly"] = brewByTimeOnly.load();
 
-    String json;
-    serializeJson(doc, json);
+    char json[256];
+    serializeJson(doc, json, sizeof(json));
+    statusJsonArena.publishStats();
 
-    events.send(json.c_str(), "status", millis());
+    events.send(json, "status", millis());
 }
 
 inline String getValue(const String& varName) {
     try {
+        const auto lock = ParameterRegistry::getInstance().lock();
         const auto e = ParameterRegistry::getInstance().getParameterById(varName.c_str());
 
         if (e == nullptr) {
@@ -88,62 +103,10 @@ inline String getValue(const String& varName) {
     }
 }
 
-inline void paramToJson(const String& name, const std::shared_ptr<Parameter>& param, JsonVariant doc) {
-    doc["type"] = param->getType();
-    doc["name"] = name;
-    doc["displayName"] = param->getDisplayName();
-    doc["section"] = param->getSection();
-    doc["sectionName"] = getSectionName(param->getSection());
-    doc["position"] = param->getPosition();
-    doc["hasHelpText"] = param->hasHelpText();
-    doc["show"] = param->shouldShow();
-    doc["reboot"] = param->requiresReboot();
-
-    switch (param->getType()) {
-        case kInteger:
-            doc["value"] = static_cast<int>(param->getValue());
-            break;
-
-        case kUInt8:
-            doc["value"] = static_cast<uint8_t>(param->getValue());
-            break;
-
-        case kDouble:
-            doc["value"] = round2(param->getValue());
-            break;
-
-        case kFloat:
-            doc["value"] = round2(static_cast<float>(param->getValue()));
-            break;
-
-        case kCString:
-            doc["value"] = param->getStringValue();
-            break;
-
-        case kEnum:
-            {
-                doc["value"] = static_cast<int>(param->getValue());
-
-                const JsonArray options = doc["options"].to<JsonArray>();
-                const char* const* enumOptions = param->getEnumOptions();
-                const size_t enumCount = param->getEnumCount();
-
-                for (size_t i = 0; i < enumCount && enumOptions[i] != nullptr; i++) {
-                    auto optionObj = options.add<JsonObject>();
-                    optionObj["value"] = static_cast<int>(i);
-                    optionObj["label"] = enumOptions[i];
-                }
-
-                break;
-            }
-
-        default:
-            doc["value"] = param->getValue();
-            break;
-    }
-
-    doc["min"] = param->getMinValue();
-    doc["max"] = param->getMaxValue();
+inline void sendTrialStatus(AsyncWebServerRequest* request) {
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    writeTrialStatus(*response);
+    request->send(response);
 }
 
 inline void serverSetup() {
@@ -154,9 +117,6 @@ inline void serverSetup() {
         }
 
         if (request->method() == 1) { // HTTP_GET
-            const auto& registry = ParameterRegistry::getInstance();
-            const auto& parameters = registry.getParameters();
-
             // Optional pagination
             int offset = 0;
             int limit = 50;
@@ -176,81 +136,22 @@ inline void serverSetup() {
             }
 
             AsyncResponseStream* response = request->beginResponseStream("application/json");
-            response->print("{\"parameters\":[");
-
-            bool first = true;
-            int filteredCount = 0;
-            int sent = 0;
-
-            for (const auto& param : parameters) {
-                if (!param->shouldShow()) {
-                    continue;
-                }
-
-                if (sectionFilter >= 0 && param->getSection() != sectionFilter) {
-                    continue;
-                }
-
-                if (filteredCount++ < offset) {
-                    continue;
-                }
-
-                if (sent >= limit) {
-                    break;
-                }
-
-                if (!first) {
-                    response->print(",");
-                }
-
-                first = false;
-
-                JsonDocument doc;
-                paramToJson(param->getId(), param, doc.to<JsonVariant>());
-                serializeJson(doc, *response);
-
-                sent++;
-            }
-
-            response->printf(R"(],"offset":%d,"limit":%d,"returned":%d,"total":%d})", offset, limit, sent, filteredCount);
+            writeParameters(*response, offset, limit, sectionFilter);
             request->send(response);
         }
         else if (request->method() == 2) { // HTTP_POST
-            auto& registry = ParameterRegistry::getInstance();
-
-            bool hasErrors = false;
+            String errors;
 
             const auto requestParams = request->params();
 
             for (auto i = 0u; i < requestParams; ++i) {
-                if (auto* p = request->getParam(i); p && p->name().length() > 0 && p->value().length() > 0) {
-                    const String& varName = p->name();
-                    const String& value = p->value();
-
-                    try {
-                        std::shared_ptr<Parameter> paramPtr = registry.getParameterById(varName.c_str());
-
-                        if (paramPtr == nullptr || !paramPtr->shouldShow()) {
-                            continue;
-                        }
-
-                        if (paramPtr->getType() == kCString) {
-                            registry.setParameterValue(varName.c_str(), value);
-                        }
-                        else {
-                            double newVal = std::stod(value.c_str());
-                            registry.setParameterValue(varName.c_str(), newVal);
-                        }
-                    } catch (const std::exception& e) {
-                        LOGF(INFO, "Parameter %s processing failed: %s", varName.c_str(), e.what());
-                        hasErrors = true;
-                    }
+                if (auto* p = request->getParam(i); p && p->name().length() > 0) {
+                    applyParameter(p->name(), p->value(), errors);
                 }
             }
 
-            registry.forceSave();
-
-            AsyncWebServerResponse* response = request->beginResponse(200, "text/plain", hasErrors ? "Partial Success" : "OK");
+            const String result = finishParameterUpdate(errors);
+            AsyncWebServerResponse* response = request->beginResponse(200, "text/plain", result);
             response->addHeader("Connection", "close");
             request->send(response);
         }
@@ -264,7 +165,6 @@ inline void serverSetup() {
 
     // --- GET /parameterHelp ---
     server.on("/parameterHelp", HTTP_GET, [](AsyncWebServerRequest* request) {
-        JsonDocument doc;
         auto* p = request->getParam(0);
 
         if (p == nullptr) {
@@ -273,7 +173,6 @@ inline void serverSetup() {
         }
 
         const String& varValue = p->value();
-
         const std::shared_ptr<Parameter> param = ParameterRegistry::getInstance().getParameterById(varValue.c_str());
 
         if (param == nullptr) {
@@ -281,43 +180,60 @@ inline void serverSetup() {
             return;
         }
 
-        doc["name"] = varValue;
-        doc["helpText"] = param->getHelpText();
+        AsyncResponseStream* response = request->beginResponseStream("application/json");
+        writeParameterHelp(*response, varValue, param);
+        request->send(response);
+    });
+
+    // --- Trial mode: parameter changes stay in RAM until committed ---
+    server.on("/trial", HTTP_GET, [](AsyncWebServerRequest* request) {
+        sendTrialStatus(request);
+    });
+
+    server.on("/trial/start", HTTP_POST, [](AsyncWebServerRequest* request) {
+        long timeout_s = TRIAL_DEFAULT_TIMEOUT_S;
+
+        if (request->hasParam("timeout")) {
+            timeout_s = std::clamp(request->getParam("timeout")->value().toInt(), 60L, 3600L);
+        }
+
+        ParameterRegistry::getInstance().startTrial(static_cast<unsigned long>(timeout_s) * 1000);
+        sendTrialStatus(request);
+    });
+
+    server.on("/trial/commit", HTTP_POST, [](AsyncWebServerRequest* request) {
+        ParameterRegistry::getInstance().commitTrial();
+        sendTrialStatus(request);
+    });
 
-        String helpJson;
-        serializeJson(doc, helpJson);
-        request->send(200, "application/json", helpJson);
+    server.on("/trial/revert", HTTP_POST, [](AsyncWebServerRequest* request) {
+        ParameterRegistry::getInstance().revertTrial();
+        sendTrialStatus(request);
     });
 
     // --- GET /status ---
     server.on("/status", HTTP_GET, [](AsyncWebServerRequest* request) {
         AsyncResponseStream* response = request->beginResponseStream("application/json");
-        response->print('{');
-        response->print("\"currentWeight\":");
-        response->print(currentWeight, 2);
-        response->print(",\"goalWeight\":");
-        response->print(goalWeight, 2);
-        response->print(",\"weightOffset\":");
-        response->print(weightOffset, 2);
-        response->print(",\"brewing\":");
-        response->print(isBrewing ? "true" : "false");
-        response->print(",\"shotTimer\":");
-        response->print(shotTimer, 1);
-        response->print(",\"brewByTimeOnly\":");
-        response->print(brewByTimeOnly ? "true" : "false");
-        response->print(",\"freeHeap\":");
-        response->print(ESP.getFreeHeap());
-        response->print(",\"uptime\":");
-        response->print(millis() / 1000);
-        response->print(",\"version\":\"");
-        response->print(sysVersion);
-        response->print('"');
-        response->print('}');
+        writeStatus(*response, readPlatformStatus());
+        request->send(response);
+    });
+
+    // --- GET /history?since=<id>, shot results for collectors ---
+    server.on("/history", HTTP_GET, [](AsyncWebServerRequest* request) {
+        const uint32_t since = request->hasParam("since") ? strtoul(request->getParam("since")->value().c_str(), nullptr, 10) : 0;
+
+        AsyncResponseStream* response = request->beginResponseStream("application/json");
+        writeHistory(*response, since, deviceId());
         request->send(response);
     });
 
     // --- GET /download/config ---
     server.on("/download/config", HTTP_GET, [](AsyncWebServerRequest* request) {
+        if (!FilesystemLock::getInstance().isMounted()) {
+            request->send(503, "text/plain", "Filesystem update in progress");
+            return;
+        }
+
         if (!LittleFS.exists("/config.json")) {
             request->send(404, "text/plain", "Config file not found");
             return;
@@ -330,7 +246,8 @@ inline void serverSetup() {
             return;
         }
 
-        JsonDocument doc;
+        JsonArenaScope arenaScope(webJsonArena);
+        JsonDocument doc(&webJsonArena);
         const DeserializationError error = deserializeJson(doc, configFile);
         configFile.close();
 
@@ -339,10 +256,8 @@ inline void serverSetup() {
             return;
         }
 
-        String prettifiedJson;
-        serializeJsonPretty(doc, prettifiedJson);
-
-        AsyncWebServerResponse* response = request->beginResponse(200, "application/json", prettifiedJson);
+        AsyncResponseStream* response = request->beginResponseStream("application/json");
+        serializeJsonPretty(doc, *response);
         response->addHeader("Content-Disposition", "attachment; filename=\"config.json\"");
         request->send(response);
     });
@@ -373,7 +288,14 @@ inline void serverSetup() {
             if (final) {
                 LOGF(INFO, "Config upload finished: %s, total size: %u bytes", filename.c_str(), totalSize);
 
-                if (config.validateAndApplyFromJson(uploadBuffer)) {
+                bool applied;
+
+                {
+                    const auto lock = ParameterRegistry::getInstance().lock();
+                    applied = config.validateAndApplyFromJson(uploadBuffer);
+                }
+
+                if (applied) {
                     LOG(INFO, "Configuration validated and applied successfully");
 
                     AsyncWebServerResponse* response = request->beginResponse(200, "application/json",
@@ -392,6 +314,68 @@ inline void serverSetup() {
             }
         });
 
+    // --- POST /update ---
+    server.on(
+        "/update", HTTP_POST,
+        [](AsyncWebServerRequest* request) {
+            // Response is sent from the upload handler
+        },
+        [](AsyncWebServerRequest* request, const String& filename, const size_t index, const uint8_t* data, const size_t len, const bool final) {
+            auto& ota = OtaUpdate::getInstance();
+
+            if (index == 0) {
+                LOGF(INFO, "Update upload started: %s", filename.c_str());
+
+                if (const char* refusal = ota.start(request); refusal == nullptr) {
+                    request->onDisconnect([request] { OtaUpdate::getInstance().abort(request); });
+                }
+                else {
+                    // Kept with this request, the last error of the updater belongs to the update that is running.
+                    // The server frees _tempObject with the request.
+                    request->_tempObject = strdup(refusal);
+                }
+            }
+
+            ota.write(request, data, len);
+
+            if (!final) {
+                return;
+            }
+
+            JsonArenaScope arenaScope(webJsonArena);
+            JsonDocument doc(&webJsonArena);
+            int status = 400;
+
+            if (ota.finish(request)) {
+                const auto& stats = ota.getStats();
+                const bool firmware = ota.getTarget() == OtaUpdate::Target::Firmware;
+                status = 200;
+
+                doc["success"] = true;
+                doc["message"] = firmware ? "Firmware verified and installed. Restarting..." : "Filesystem verified and installed.";
+                doc["restart"] = firmware;
+                doc["bytes"] = stats.bytes;
+                doc["durationMs"] = stats.duration_ms;
+                doc["throughputKBps"] = round2(stats.throughputKBps);
+            }
+            else {
+                doc["success"] = false;
+
+                if (request->_tempObject != nullptr) {
+                    doc["message"] = static_cast<const char*>(request->_tempObject);
+                }
+                else {
+                    doc["message"] = ota.getLastError();
+                }
+            }
+
+            AsyncResponseStream* response = request->beginResponseStream("application/json");
+            response->setCode(status);
+            serializeJson(doc, *response);
+            response->addHeader("Connection", "close");
+            request->send(response);
+        });
+
     // --- POST /restart ---
     server.on("/restart", HTTP_POST, [](AsyncWebServerRequest* request) {
         request->send(200, "text/plain", "Restarting...");
@@ -401,6 +385,11 @@ inline void serverSetup() {
 
     // --- POST /factoryreset ---
     server.on("/factoryreset", HTTP_POST, [](AsyncWebServerRequest* request) {
+        if (!FilesystemLock::getInstance().isMounted()) {
+            request->send(503, "text/plain", "Filesystem update in progress");
+            return;
+        }
+
         const bool removed = LittleFS.remove("/config.json");
 
         request->send(200, "text/plain", removed ? "Factory reset. Restarting..." : "Could not delete config.json. Restarting...");
@@ -414,12 +403,18 @@ inline void serverSetup() {
         request->send(200, "text/plain", "WiFi settings are being reset. Rebooting...");
 
         delay(1000);
-        wifiManager.resetSettings();
+        WiFiConnection::getInstance().resetSettings();
         ESP.restart();
     });
 
     // --- 404 handler ---
     server.onNotFound([](AsyncWebServerRequest* request) {
+        // The file handlers decline every request while the filesystem is unmounted for an update
+        if (!FilesystemLock::getInstance().isMounted()) {
+            request->send(503, "text/plain", "Filesystem update in progress");
+            return;
+        }
+
         request->send(404, "text/plain", "Not found");
     });
 
@@ -434,13 +429,59 @@ inline void serverSetup() {
 
     server.addHandler(&events);
 
+    // --- WebSocket command channel ---
+    // One connection per browser for setting changes, instead of a POST with its own connection per change
+    commandSocket.onEvent([](AsyncWebSocket*, AsyncWebSocketClient* client, const AwsEventType type, void* arg,
+                              uint8_t* data, const size_t len) {
+        if (type == WS_EVT_CONNECT) {
+            LOGF(DEBUG, "Command channel client %u connected", client->id());
+        }
+        else if (type == WS_EVT_DISCONNECT) {
+            LOGF(DEBUG, "Command channel client %u disconnected", client->id());
+        }
+        else if (type == WS_EVT_DATA) {
+            // Commands are small, only single-frame text messages are accepted
+            const auto* info = static_cast<AwsFrameInfo*>(arg);
+
+            if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
+                onCommandMessage(client, data, len);
+            }
+            else {
+                client->text(R"({"ok":false,"error":"fragmented message"})");
+            }
+        }
+    });
+
+    server.addHandler(&commandSocket);
+
     // --- Static file serving ---
     LittleFS.begin();
-    server.serveStatic("/js", LittleFS, "/js/", "max-age=604800");
-    server.serveStatic("/manifest.json", LittleFS, "/manifest.json", "max-age=604800");
-    server.serveStatic("/", LittleFS, "/html/", "max-age=604800").setDefaultFile("index.html").setTemplateProcessor(staticProcessor);
+    const auto filesystemMounted = [](AsyncWebServerRequest*) { return FilesystemLock::getInstance().isMounted(); };
+
+    // The service worker is named after the firmware version, so it changes with every update
+    server.on("/sw.js", HTTP_GET, [](AsyncWebServerRequest* request) {
+        AsyncWebServerResponse* response = request->beginResponse(LittleFS, "/sw.js", "application/javascript", false,
+            [](const String& var) { return var == "VERSION" ? String(sysVersion) : String(); });
+        response->addHeader("Cache-Control", "no-cache");
+        request->send(response);
+    }).setFilter(filesystemMounted);
+
+    // Pages and the bundle are gzipped with the header already rendered in (scripts/build_web_bundle.py). The
+    // pages load the bundle by content hash, so it can be cached for good while the pages are revalidated.
+    server.serveStatic("/bundle", LittleFS, "/bundle/", "max-age=31536000, immutable").setFilter(filesystemMounted);
+    server.serveStatic("/manifest.json", LittleFS, "/manifest.json", "max-age=604800").setFilter(filesystemMounted);
+    server.serveStatic("/", LittleFS, "/html/", "no-cache").setDefaultFile("index.html").setFilter(filesystemMounted);
 
     server.begin();
 
-    LOG(INFO, ("Web server started at " + WiFi.localIP().toString()).c_str());
+    LOG(INFO, "Web server started");
 }
+
+#else
+
+inline void serverSetup() {}
+inline void sendStatusEvent() {}
+inline size_t webClientCount() { return 0; }
+inline void cleanupWebClients() {}
+
+#endif
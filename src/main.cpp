@@ -21,13 +21,32 @@
 
 */
 
-#include <WiFi.h>
-#include <WiFiManager.h>
 #include <AcaiaArduinoBLE.h>
 #include <NimBLEDevice.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include "Config.h"
+#include "ConfigSnapshot.h"
+#include "Features.h"
+#include "FilesystemLock.h"
+#include "LedController.h"
 #include "Logger.h"
+#include "MqttPublisher.h"
+#include "OnsetDetector.h"
+#include "OtaUpdate.h"
 #include "ParameterRegistry.h"
+#include "PendingWrite.h"
+#include "PowerManager.h"
+#include "ReedDetector.h"
+#include "ScaleCommandQueue.h"
+#include "SerialProtocol.h"
+#include "ShotHistory.h"
+#include "ShotLog.h"
+#include "StopRules.h"
+#include "UdpTelemetry.h"
+#include "WeightResampler.h"
+#include "WiFiConnection.h"
 #include "embeddedWebserver.h"
 
 // Two-level stringification macro to expand build flags before quoting
@@ -36,14 +55,19 @@
 
 extern const char sysVersion[] = SS_STR(AUTO_VERSION);
 
-WiFiManager wifiManager;
-
 String hostName;
 
 // Compile-time constants (not configurable)
 #define BUTTON_READ_PERIOD_MS     5     // Button debounce sampling period
 #define MAX_SHOT_DATAPOINTS       1000  // Maximum number of weight/time measurements per shot
-#define N 10                            // Number of datapoints used to calculate trend line
+#define N 10                            // Minimum number of samples before the prediction is trusted without the scale
+#define LOOP_STATS_PERIOD_MS      10000 // Reporting period of the loop timing statistics
+#define LED_ERROR_DURATION_MS     3000  // How long the error pattern is shown after an abnormal shot end
+#define DEAD_RECKONING_MIN_FLOW   0.3f  // Minimum trend line slope (g/s) to continue a shot without the scale
+#define DEAD_RECKONING_MAX_AGE_S  2.0f  // Maximum age of the last sample to continue a shot without the scale
+#define TARE_ZERO_BAND_G          0.3f  // A sample within this band of 0 g confirms the tare at shot start
+#define TARE_TIMEOUT_S            2.0f  // Stop waiting for the tare and record samples as measured
+#define HISTORY_BLEND_MAX         0.7f  // Weight of the shot history prediction at the start, fades out towards the goal
 
 // Runtime configuration variables (loaded from config)
 float maxOffset;
@@ -51,23 +75,41 @@ int brewPulseDuration;
 float dripDelay;
 float reedSwitchDelay;
 float minWeightForPrediction;
-float minShotDuration; // From brew.target_time min value
-float maxShotDuration; // From brew.target_time max value
-float targetTime;      // Target brew time when scale disconnected or brew.by_time_only is true
+float trendWindow;
+float brewDose;
+String stopRule;
 
 // Configuration system
 Config config;
+bool configLoaded = false;
 
 // Configuration variables (will be loaded from config system)
 bool momentary;
 bool reedSwitch;
 bool autoTare;
-bool brewByTimeOnly;
+bool autoStart;
+std::atomic<bool> brewByTimeOnly{false}; // Derived in the loop, read by the web server task
 bool brewByTimeOnlyConfigured; // The configured value from config system
-
-// Web-accessible status (updated from shot struct in loop)
-bool isBrewing = false;
-float shotTimer = 0.0f;
+bool powerIdleEnabled;
+int maxWakeLatencyMs;
+bool lightSleepEnabled;
+bool mqttEnabled;
+String mqttHost;
+int mqttPort;
+String mqttUsername;
+String mqttPassword;
+String mqttTopicPrefix;
+int mqttSamplesPerMessage;
+bool udpTelemetryEnabled;
+String udpTelemetryGroup;
+int udpTelemetryPort;
+int udpMaxRateHz;
+
+// Web-accessible status (updated from shot struct in loop), atomic as the web server task reads it
+std::atomic<bool> isBrewing{false};
+std::atomic<float> shotTimer{0.0f};
+std::atomic<float> statusWeight{0.0f};          // currentWeight, which only the loop may touch
+std::atomic<float> timeToValidData_s{-1.0f};    // Shot start until the first recorded sample of the last shot
 
 // Board Hardware
 #if defined (ARDUINO_ESP32S3_DEV)
@@ -88,19 +130,11 @@ float shotTimer = 0.0f;
 
 #define BUTTON_STATE_ARRAY_LENGTH 31
 
-typedef enum {BUTTON, WEIGHT, TIME, DISCONNECT, UNDEF} ENDTYPE;
+typedef enum {BUTTON, WEIGHT, TIME, DISCONNECT, RULE, UNDEF} ENDTYPE;
 
-// RGB Colors {Red,Green,Blue}
-// Using COLOR_ prefix to avoid conflicts with framework-defined macros
-int COLOR_RED[3] = {255, 0, 0};
-int COLOR_GREEN[3] = {0, 255, 0};
-int COLOR_BLUE[3] = {0, 0, 255};
-int COLOR_MAGENTA[3] = {255, 0, 255};
-int COLOR_CYAN[3] = {0, 255, 255};
-int COLOR_YELLOW[3] = {255, 255, 0};
-int COLOR_WHITE[3] = {255, 255, 255};
-int COLOR_OFF[3] = {0, 0, 0};
-int currentColor[3] = {-1, -1, -1};
+// Error pattern is shown for LED_ERROR_DURATION_MS from this time (millis)
+unsigned long ledErrorStart_ms = 0;
+bool ledError = false;
 
 AcaiaArduinoBLE* scale = nullptr;
 float currentWeight = 0;
@@ -126,13 +160,49 @@ struct Shot {
     int datapoints;          // Number of datapoitns in the scatter plot
     bool brewing;            // True when actively brewing, otherwise false
     ENDTYPE end;
+    bool predicting;         // True when expected_end_s comes from the trend line
+    float flow;              // Slope of the trend line (g/s)
+    bool autoStarted;        // Started from the flow onset instead of the brew switch
+    bool deadReckoning;      // Scale lost, continuing toward expected_end_s
+    bool tarePending;        // Tare requested at shot start, samples are not recorded until it took effect
+    int discardedSamples;    // Samples dropped while waiting for the tare
+    float historyEnd_s;      // Last end time predicted from past shots, NAN if there was none
+    ENDTYPE lastEnd;         // How the last shot ended, kept for the final weight after end is reset
 };
 
 // Initialize shot
-Shot shot = {0.0f, 0.0f, 0.0f, 0.0f, {}, {}, 0, false, UNDEF};
+Shot shot = {0.0f, 0.0f, 0.0f, 0.0f, {}, {}, 0, false, UNDEF, false, 0.0f, false, false, false, 0, NAN, UNDEF};
 
 float lastReadWeight = 0;
 
+// Settings as last changed from the web, BLE or trial mode, republished by the loop on every registry revision
+ConfigSnapshotStore configSnapshots;
+
+// Settings of the current shot, taken when it starts so changes made while brewing apply to the next shot
+ConfigSnapshot shotConfig = {};
+
+// Stop rules of the current shot, compiled from shotConfig.stopRule when the shot starts
+StopRules stopRules;
+
+// Starts shots from the scale when scale.auto_start is set
+OnsetDetector onsetDetector;
+
+// Curves of recent shots, refine the end time prediction early in a shot
+ShotHistory shotHistory;
+
+// Weight of the current shot on a uniform time grid, input of the trend line
+WeightResampler weightResampler;
+
+// Loop timing statistics, reported periodically at DEBUG level
+struct LoopStats {
+    unsigned long windowStart_ms;
+    unsigned long iterations;
+    unsigned long totalUs;
+    unsigned long maxUs;
+};
+
+LoopStats loopStats = {};
+
 // BLE peripheral device (NimBLE server)
 static constexpr uint8_t FIRMWARE_VERSION = 1;
 
@@ -147,29 +217,14 @@ NimBLECharacteristic* pDripDelayCharacteristic = nullptr;
 NimBLECharacteristic* pFirmwareVersionCharacteristic = nullptr;
 NimBLECharacteristic* pScaleStatusCharacteristic = nullptr;
 
-bool deviceConnected = false;
+// Set by the NimBLE callbacks, which run on the NimBLE host task, and taken by the loop
+std::atomic<bool> deviceConnected{false};
 bool lastScaleConnected = false; // Track scale state for SCALE_STATUS notifications
 
-volatile bool bleClientConnected = false;
-volatile bool bleClientDisconnected = false;
-
-// Deferred write handling (BLE callbacks run on a different task)
-struct PendingWrite {
-    volatile bool weightDirty;
-    volatile bool reedSwitchDirty;
-    volatile bool momentaryDirty;
-    volatile bool autoTareDirty;
-    volatile bool minShotDurationDirty;
-    volatile bool maxShotDurationDirty;
-    volatile bool dripDelayDirty;
-    volatile uint8_t weight;
-    volatile uint8_t reedSwitchVal;
-    volatile uint8_t momentaryVal;
-    volatile uint8_t autoTareVal;
-    volatile uint8_t minShotDurationVal;
-    volatile uint8_t maxShotDurationVal;
-    volatile uint8_t dripDelayVal;
-};
+std::atomic<bool> bleClientConnected{false};
+std::atomic<bool> bleClientDisconnected{false};
+
+// Deferred write handling, BLE callbacks run on a different task
 PendingWrite pendingWrite = {};
 
 // Callback class for BLE server connection events
@@ -211,32 +266,25 @@ class CharacteristicCallbacks : public NimBLECharacteristicCallbacks {
 
         switch (identify(pCharacteristic)) {
             case CHAR_WEIGHT:
-                pendingWrite.weight = val;
-                pendingWrite.weightDirty = true;
+                postWrite(pendingWrite.weight, val);
                 break;
             case CHAR_REED:
-                pendingWrite.reedSwitchVal = val;
-                pendingWrite.reedSwitchDirty = true;
+                postWrite(pendingWrite.reedSwitch, val);
                 break;
             case CHAR_MOMENTARY:
-                pendingWrite.momentaryVal = val;
-                pendingWrite.momentaryDirty = true;
+                postWrite(pendingWrite.momentary, val);
                 break;
             case CHAR_AUTOTARE:
-                pendingWrite.autoTareVal = val;
-                pendingWrite.autoTareDirty = true;
+                postWrite(pendingWrite.autoTare, val);
                 break;
             case CHAR_MIN_DUR:
-                pendingWrite.minShotDurationVal = val;
-                pendingWrite.minShotDurationDirty = true;
+                postWrite(pendingWrite.minShotDuration, val);
                 break;
             case CHAR_MAX_DUR:
-                pendingWrite.maxShotDurationVal = val;
-                pendingWrite.maxShotDurationDirty = true;
+                postWrite(pendingWrite.maxShotDuration, val);
                 break;
             case CHAR_DRIP:
-                pendingWrite.dripDelayVal = val;
-                pendingWrite.dripDelayDirty = true;
+                postWrite(pendingWrite.dripDelay, val);
                 break;
             case CHAR_UNKNOWN:
                 break;
@@ -245,14 +293,17 @@ class CharacteristicCallbacks : public NimBLECharacteristicCallbacks {
 };
 
 // Forward declarations
-void setColor(int rgb[3]);
 void updateLEDState();
-void setBrewingState(bool brewing);
+void showLedError();
+void setBrewingState(bool brewing, bool autoStarted = false);
+void startShotAtOnset();
 float seconds_f();
 void calculateEndTime(Shot* s);
+bool predictionTrustworthy(const Shot* s);
 void setupBLEServer();
 void processPendingBLEWrites();
-void setupWiFi();
+void setParameterFromBLE(const char* id, double value);
+void updateLoopStats(unsigned long elapsedUs);
 
 void setup() {
     Serial.begin(115200);
@@ -261,22 +312,24 @@ void setup() {
     delay(500);
 
     // Initialize configuration system
-    if (!config.begin()) {
+    configLoaded = config.begin();
+
+    if (!configLoaded) {
         LOG(ERROR, "Failed to initialize config system!");
+        showLedError();
         // Continue with defaults that are already in Config
     }
 
-    // Initialize ParameterRegistry and sync all global variables from config
+    // Initialize ParameterRegistry, sync all global variables from config and publish the first snapshot
     ParameterRegistry::getInstance().initialize(config);
-    ParameterRegistry::getInstance().syncGlobalVariables();
+    ParameterRegistry::getInstance().processChanges(configSnapshots);
+    shotHistory.begin();
+    ShotLog::getInstance().begin();
 
     // Derived values not managed by ParameterRegistry
     brewByTimeOnly = brewByTimeOnlyConfigured; // Initial value, will be updated based on scale connection
 
-    // Load target time and shot duration limits (stored as int, used as float)
-    targetTime = static_cast<float>(config.get<int>("brew.target_time"));
-    minShotDuration = static_cast<float>(config.get<int>("brew.min_shot_duration"));
-    maxShotDuration = static_cast<float>(config.get<int>("brew.max_shot_duration"));
+    shotConfig = configSnapshots.read();
 
     // Set log level from config
     int logLevelValue = config.get<int>("system.log_level");
@@ -285,31 +338,38 @@ void setup() {
     // Initialize scale with debug flag based on log level (TRACE=0, DEBUG=1)
     const bool scaleDebug = logLevelValue <= 1;
     scale = new AcaiaArduinoBLE(scaleDebug);
+    ScaleCommandQueue::getInstance().begin(scale);
 
     LOG(INFO, "Configuration loaded:");
     LOGF(INFO, "  Goal Weight: %.1fg", goalWeight);
     LOGF(INFO, "  Weight Offset: %.1fg", weightOffset);
     LOGF(INFO, "  Max Offset: %.1fg", maxOffset);
-    LOGF(INFO, "  Shot Duration: %.1fs - %.1fs", minShotDuration, maxShotDuration);
-    LOGF(INFO, "  Target Time: %.1fs", targetTime);
+    LOGF(INFO, "  Shot Duration: %.1fs - %.1fs", shotConfig.minShotDuration, shotConfig.maxShotDuration);
+    LOGF(INFO, "  Target Time: %.1fs", shotConfig.targetTime);
     LOGF(INFO, "  Pulse Duration: %dms", brewPulseDuration);
     LOGF(INFO, "  Drip Delay: %.1fs", dripDelay);
     LOGF(INFO, "  Reed Switch Delay: %.1fs", reedSwitchDelay);
     LOGF(INFO, "  Min Weight for Prediction: %.1fg", minWeightForPrediction);
+    LOGF(INFO, "  Trend Window: %.1fs", trendWindow);
+    LOGF(INFO, "  Dose: %.1fg", brewDose);
+    LOGF(INFO, "  Stop Rule: %s", stopRule.isEmpty() ? "none" : stopRule.c_str());
     LOGF(INFO, "  Momentary: %s", momentary ? "true" : "false");
     LOGF(INFO, "  Reed Switch: %s", reedSwitch ? "true" : "false");
     LOGF(INFO, "  Auto Tare: %s", autoTare ? "true" : "false");
+    LOGF(INFO, "  Auto Start: %s", autoStart ? "true" : "false");
     LOGF(INFO, "  Brew By Time Only: %s", brewByTimeOnly ? "true" : "false");
+    LOGF(INFO, "  Idle Power Saving: %s (max wake latency %dms)", powerIdleEnabled ? "true" : "false", maxWakeLatencyMs);
     LOGF(INFO, "  Log Level: %d", logLevelValue);
     LOGF(INFO, "  Scale Debug: %s", scaleDebug ? "true" : "false");
 
     // Initialize the GPIO hardware
     pinMode(in, INPUT_PULLUP);
     pinMode(OUT, OUTPUT);
-    pinMode(LED_RED, OUTPUT);
-    pinMode(LED_GREEN, OUTPUT);
-    pinMode(LED_BLUE, OUTPUT);
-    setColor(COLOR_OFF);
+    LedController::getInstance().begin(LED_RED, LED_GREEN, LED_BLUE);
+
+    PowerManager::getInstance().begin(in, lightSleepEnabled);
+    PowerManager::getInstance().setEdgeCallback(ReedDetector::onEdge);
+    OtaUpdate::getInstance().begin();
 
     // Initialize the BLE hardware using NimBLE
     NimBLEDevice::init(hostName.c_str());
@@ -319,10 +379,20 @@ void setup() {
 
     LOG(INFO, "Bluetooth® device active, waiting for connections...");
 
-    setupWiFi();
+    if constexpr (features::wifi) {
+        setupWiFi();
+    }
+
+    if constexpr (features::webServer) {
+        // Start the embedded web server
+        serverSetup();
+    }
+
+    MqttPublisher::getInstance().begin();
+    UdpTelemetry::getInstance().begin();
 
-    // Start the embedded web server
-    serverSetup();
+    LOGF(INFO, "Setup completed in %lums | Sketch: %u bytes | Free heap: %u bytes",
+        millis(), ESP.getSketchSize(), ESP.getFreeHeap());
 }
 
 void setupBLEServer() {
@@ -383,10 +453,10 @@ void setupBLEServer() {
     pAutoTareCharacteristic = createRWChar(AUTO_TARE_CHAR_UUID, autoTare ? 1 : 0);
 
     // FF15: Min Shot Duration (R/W, uint8 seconds)
-    pMinShotDurationCharacteristic = createRWChar(MIN_SHOT_DUR_CHAR_UUID, static_cast<uint8_t>(minShotDuration));
+    pMinShotDurationCharacteristic = createRWChar(MIN_SHOT_DUR_CHAR_UUID, static_cast<uint8_t>(configSnapshots.read().minShotDuration));
 
     // FF16: Max Shot Duration (R/W, uint8 seconds)
-    pMaxShotDurationCharacteristic = createRWChar(MAX_SHOT_DUR_CHAR_UUID, static_cast<uint8_t>(maxShotDuration));
+    pMaxShotDurationCharacteristic = createRWChar(MAX_SHOT_DUR_CHAR_UUID, static_cast<uint8_t>(configSnapshots.read().maxShotDuration));
 
     // FF17: Drip Delay (R/W, uint8 seconds)
     pDripDelayCharacteristic = createRWChar(DRIP_DELAY_CHAR_UUID, static_cast<uint8_t>(dripDelay));
@@ -429,10 +499,16 @@ void setupBLEServer() {
 }
 
 void loop() {
-    wifiManager.process();
+    const unsigned long loopStart_us = micros();
+    bool newSample = false;
+
+    if constexpr (features::wifi) {
+        wifiLoop();
+    }
 
     // Process any pending config saves from web or BLE changes
     ParameterRegistry::getInstance().processPeriodicSave();
+    ParameterRegistry::getInstance().processTrialTimeout();
 
     // Update brewByTimeOnly based on scale connection status
     // If configured as false, use time-only mode when scale is disconnected
@@ -444,17 +520,25 @@ void loop() {
         brewByTimeOnly = true;
     }
 
-    // Connect to scale using non-blocking approach
-    if (!scale->isConnected()) {
+    // Connect to scale using non-blocking approach. Connecting creates and destroys the scale library's client,
+    // so while the command task is sending, try again in the next loop.
+    if (!scale->isConnected() && ScaleCommandQueue::getInstance().tryLock()) {
         // Start connection process if not already connecting
         if (!scale->isConnecting()) {
             scale->init();
             currentWeight = 0;
 
+            // Continue toward the predicted end while the scale reconnects, if the fit before the dropout holds
+            if (shot.brewing && !brewByTimeOnlyConfigured && !shot.deadReckoning && predictionTrustworthy(&shot)) {
+                shot.deadReckoning = true;
+                LOGF(WARNING, "Scale lost mid-shot, continuing to the predicted end at %.1fs", shot.expected_end_s);
+            }
+
             // Only stop brewing if not brewing by time
             if (shot.brewing && !brewByTimeOnly) {
                 shot.brewing = false;
                 shot.end = DISCONNECT;
+                showLedError();
                 setBrewingState(false);
             }
         }
@@ -467,22 +551,27 @@ void loop() {
             LOG(WARNING, "BLE server destroyed by scale library cleanup, re-creating...");
             setupBLEServer();
         }
+
+        ScaleCommandQueue::getInstance().unlock();
     }
 
     // Log BLE client connection events (deferred from NimBLE callback task)
-    if (bleClientConnected) {
-        bleClientConnected = false;
+    if (bleClientConnected.exchange(false)) {
         LOG(INFO, "BLE client connected to shotStopper");
     }
 
-    if (bleClientDisconnected) {
-        bleClientDisconnected = false;
+    if (bleClientDisconnected.exchange(false)) {
         LOG(INFO, "BLE client disconnected from shotStopper");
     }
 
     // Process any pending BLE characteristic writes from the companion app
     processPendingBLEWrites();
 
+    // Apply the BLE writes and the learned offset, then publish parameter changes from the web, BLE and trial
+    // mode to the global variables and the snapshot; a running shot keeps its own copy. Taken up in the next
+    // iteration while another task holds the registry.
+    ParameterRegistry::getInstance().processChanges(configSnapshots);
+
     // Notify companion app of scale connection status changes
 
     if (const bool scaleConnectedNow = scale->isConnected(); scaleConnectedNow != lastScaleConnected) {
@@ -497,31 +586,74 @@ void loop() {
     }
 
     // Send a heartbeat message to the scale periodically to maintain connection
-    if (scale->isConnected() && scale->heartbeatRequired()) {
-        scale->heartbeat();
+    if (auto& scaleCommands = ScaleCommandQueue::getInstance();
+        scale->isConnected() && scale->heartbeatRequired() && !scaleCommands.isPending(ScaleCommandQueue::HEARTBEAT)) {
+        scaleCommands.submit(ScaleCommandQueue::HEARTBEAT);
     }
 
     // Always call newWeightAvailable to actually receive the datapoint from the scale,
     // otherwise getWeight() will return stale data
     if (scale->isConnected() && scale->newWeightAvailable()) {
         currentWeight = scale->getWeight();
+        newSample = true;
 
         if (currentWeight != lastReadWeight) {
             LOGF(DEBUG, "Weight: %.1fg", currentWeight);
             lastReadWeight = currentWeight;
         }
 
+        // First sample after a dropout, the same shot continues with measured weights
+        if (shot.deadReckoning) {
+            shot.deadReckoning = false;
+            LOGF(INFO, "Scale reconnected mid-shot at %.1fs, resuming the trajectory", seconds_f() - shot.start_timestamp_s);
+        }
+
+        // Samples from before the tare took effect would corrupt the first trend lines
+        if (shot.brewing && shot.tarePending) {
+            const float sinceStart_s = seconds_f() - shot.start_timestamp_s;
+
+            if (fabsf(currentWeight) <= TARE_ZERO_BAND_G) {
+                shot.tarePending = false;
+                LOGF(DEBUG, "Tare confirmed after %.2fs, command took %.1fms", sinceStart_s,
+                    ScaleCommandQueue::getInstance().getStats().lastTareUs / 1000.0f);
+            }
+            else if (sinceStart_s >= TARE_TIMEOUT_S) {
+                shot.tarePending = false;
+                LOGF(WARNING, "Tare not confirmed after %.1fs (%.1fg), recording samples as measured", sinceStart_s, currentWeight);
+            }
+            else {
+                shot.discardedSamples++;
+                LOGF(DEBUG, "Sample before tare discarded: %.1fg", currentWeight);
+            }
+        }
+
         // update shot trajectory
-        if (shot.brewing && shot.datapoints < MAX_SHOT_DATAPOINTS) {
+        if (shot.brewing && !shot.tarePending && shot.datapoints < MAX_SHOT_DATAPOINTS) {
             shot.time_s[shot.datapoints] = seconds_f() - shot.start_timestamp_s;
+
+            if (shot.datapoints == 0) {
+                timeToValidData_s = shot.time_s[0];
+                LOGF(INFO, "First valid sample after %.2fs, %d discarded", shot.time_s[0], shot.discardedSamples);
+            }
+
             shot.weight[shot.datapoints] = currentWeight;
             shot.shotTimer = shot.time_s[shot.datapoints];
             shot.datapoints++;
 
+            MqttPublisher::getInstance().addSample(shot.shotTimer, currentWeight);
+            weightResampler.addSample(shot.shotTimer, currentWeight);
+
             // get the likely end time of the shot
             calculateEndTime(&shot);
             LOGF(TRACE, "Shot: %.1fs | Expected end: %.1fs", shot.shotTimer, shot.expected_end_s);
         }
+        // Start the shot from the scale alone when the brew switch is not wired
+        else if (autoStart
+                 && !shot.brewing
+                 && seconds_f() > shot.start_timestamp_s + shot.end_s + shotConfig.dripDelay
+                 && onsetDetector.addSample(seconds_f(), currentWeight)) {
+            startShotAtOnset();
+        }
     }
     // Update timer if brewing without scale (Time Mode)
     else if (shot.brewing && !scale->isConnected()) {
@@ -561,9 +693,19 @@ void loop() {
             // Serial.println();
         }
 
+        // Once locked onto the pump's pulses, the pump is off after one to two missing pulses instead of when
+        // the whole window has been open. The window is cleared so its old pulses don't count as a new press.
+        if (auto& reed = ReedDetector::getInstance();
+            reedSwitch && buttonPressed && reed.isLocked() && !reed.isPumpOn(micros())) {
+            newButtonState = 0;
+            reed.recordRelease(micros());
+            std::fill(std::begin(buttonArr), std::end(buttonArr), 0);
+            LOGF(DEBUG, "Pump off %.1fms after the last reed pulse", reed.getStats().lastReleaseUs / 1000.0f);
+        }
+
         // The reed switch measurements require a small amount of delay for accuracy.
         // if the shot just stopped, assume that the reed switch should read "open" for the delay period
-        if (reedSwitch && !shot.brewing && seconds_f() < shot.start_timestamp_s + shot.end_s + reedSwitchDelay) {
+        if (reedSwitch && !shot.brewing && seconds_f() < shot.start_timestamp_s + shot.end_s + shotConfig.reedSwitchDelay) {
             // Serial.println("force reedSwitch Off");
             newButtonState = 0;
         }
@@ -575,6 +717,7 @@ void loop() {
     if (newButtonState && buttonPressed == false) {
         LOG(INFO, "Button pressed");
         buttonPressed = true;
+        PowerManager::getInstance().recordWake(maxWakeLatencyMs);
 
         if (reedSwitch) {
             shot.brewing = true;
@@ -583,18 +726,19 @@ void loop() {
     }
 
     // button held. Take over for the rest of the shot.
-    else if (!momentary
+    else if (!shotConfig.momentary
                        && shot.brewing
+                       && !shot.autoStarted
                        && !buttonLatched
-                       && shot.shotTimer > minShotDuration) {
+                       && shot.shotTimer > shotConfig.minShotDuration) {
         buttonLatched = true;
         LOG(INFO, "Button latched");
         digitalWrite(OUT, HIGH);
         LOG(DEBUG, "Output HIGH");
 
         // Get the scale to beep to inform user.
-        if (autoTare) {
-            scale->tare();
+        if (shotConfig.autoTare) {
+            ScaleCommandQueue::getInstance().submit(ScaleCommandQueue::TARE);
         }
     }
 
@@ -604,6 +748,7 @@ void loop() {
     else if (!buttonLatched && !newButtonState && buttonPressed == true) {
         LOG(INFO, "Button released");
         buttonPressed = false;
+        PowerManager::getInstance().discardWakeEdge();
         shot.brewing = !shot.brewing;
 
         if (!shot.brewing) {
@@ -615,20 +760,34 @@ void loop() {
 
     // Max duration reached
     else if (shot.brewing
-        && shot.shotTimer > maxShotDuration)
+        && shot.shotTimer > shotConfig.maxShotDuration)
     {
         shot.brewing = false;
         LOG(WARNING, "Max brew duration reached");
         shot.end = TIME;
+        showLedError();
+        setBrewingState(shot.brewing);
+    }
+
+    // Predicted end reached while the scale is reconnecting
+    else if (shot.brewing
+        && shot.deadReckoning
+        && shot.shotTimer >= shot.expected_end_s
+        && shot.shotTimer > shotConfig.minShotDuration)
+    {
+        LOGF(INFO, "Predicted end reached without scale. Timer: %.1fs | Expected: %.1fs", shot.shotTimer, shot.expected_end_s);
+        shot.brewing = false;
+        shot.end = WEIGHT;
         setBrewingState(shot.brewing);
     }
 
     // Brew by time (Scale disconnected or brew by time only mode)
     else if (shot.brewing
+        && !shot.deadReckoning
         && (!scale->isConnected() || brewByTimeOnly)
-        && shot.shotTimer >= targetTime)
+        && shot.shotTimer >= shotConfig.targetTime)
     {
-        LOGF(INFO, "Target brew time reached: %.1fs", targetTime);
+        LOGF(INFO, "Target brew time reached: %.1fs", shotConfig.targetTime);
         shot.brewing = false;
         shot.end = TIME;
         setBrewingState(shot.brewing);
@@ -639,7 +798,7 @@ void loop() {
         && !brewByTimeOnly
         && shot.brewing
         && shot.shotTimer >= shot.expected_end_s
-        && shot.shotTimer > minShotDuration)
+        && shot.shotTimer > shotConfig.minShotDuration)
     {
         LOGF(INFO, "Weight achieved. Timer: %.1fs | Expected: %.1fs", shot.shotTimer, shot.expected_end_s);
         shot.brewing = false;
@@ -647,85 +806,180 @@ void loop() {
         setBrewingState(shot.brewing);
     }
 
-    // Update LED state continuously (needed for blinking during brewing)
+    // End shot by a user-defined stop rule, evaluated once per weight sample
+    if (newSample
+        && scale->isConnected()
+        && !brewByTimeOnly
+        && shot.brewing
+        && !shot.tarePending
+        && shot.shotTimer > shotConfig.minShotDuration
+        && !stopRules.isEmpty())
+    {
+        const StopRules::Inputs inputs = {shot.shotTimer, currentWeight, shot.flow, shotConfig.brewDose, shotConfig.goalWeight,
+            shotConfig.weightOffset, shot.predicting};
+
+        if (const int rule = stopRules.evaluate(inputs); rule >= 0) {
+            LOGF(INFO, "Stop rule %d matched. Timer: %.1fs | Weight: %.1fg | Flow: %.2fg/s", rule + 1, shot.shotTimer, currentWeight, shot.flow);
+            shot.brewing = false;
+            shot.end = RULE;
+            setBrewingState(shot.brewing);
+        }
+    }
+
+    // Post the LED state, the pattern itself runs without the loop
     updateLEDState();
 
     // Update web-accessible status from shot struct
     isBrewing = shot.brewing;
     shotTimer = shot.shotTimer;
+    statusWeight = currentWeight;
 
     // Send live status to connected web clients (every second)
-    static unsigned long lastStatusEvent = 0;
+    if constexpr (features::webServer) {
+        static unsigned long lastStatusEvent = 0;
 
-    if (millis() - lastStatusEvent > 1000) {
-        lastStatusEvent = millis();
-        sendStatusEvent();
+        if (millis() - lastStatusEvent > 1000) {
+            lastStatusEvent = millis();
+            sendStatusEvent();
+            cleanupWebClients();
+        }
     }
 
+    // Telemetry state, shared by the multicast frames and the USB sample stream
+    auto telemetryState = TelemetryState::Idle;
+
+    if (shot.brewing) {
+        if (!scale->isConnected() || brewByTimeOnly) {
+            telemetryState = TelemetryState::BrewingTime;
+        }
+        else {
+            telemetryState = shot.predicting ? TelemetryState::BrewingPrediction : TelemetryState::Brewing;
+        }
+    }
+    else if (static_cast<bool>(shot.start_timestamp_s) && static_cast<bool>(shot.end_s)) {
+        telemetryState = TelemetryState::Dripping;
+    }
+
+    const uint8_t telemetryFlags = (scale->isConnected() ? 0x01 : 0x00) | (brewByTimeOnly ? 0x02 : 0x00);
+    const float telemetryFlow = shot.brewing ? shot.flow : 0.0f;
+    const float telemetryEnd = shot.predicting ? shot.expected_end_s : NAN;
+
+    // Multicast telemetry frame, per sample while brewing and as a heartbeat otherwise
+    if constexpr (features::wifi) {
+        UdpTelemetry::getInstance().update(telemetryState, telemetryFlags, shot.shotTimer, currentWeight, telemetryFlow,
+            telemetryEnd, goalWeight, newSample || shot.brewing);
+    }
+
+    // Framed samples and commands on the USB port, samples only while a host has the stream switched on
+    SerialProtocol::getInstance().sendSample(telemetryState, telemetryFlags, shot.shotTimer, currentWeight, telemetryFlow,
+        telemetryEnd, goalWeight, newSample);
+    SerialProtocol::getInstance().poll();
+
     // SHOT ANALYSIS  --------------------------------
 
     // Detect error of shot
     if (scale->isConnected()
         && static_cast<bool>(shot.start_timestamp_s)
         && static_cast<bool>(shot.end_s)
-        && currentWeight >= goalWeight - weightOffset
-        && seconds_f() > shot.start_timestamp_s + shot.end_s + dripDelay
+        && currentWeight >= shotConfig.goalWeight - shotConfig.weightOffset
+        && seconds_f() > shot.start_timestamp_s + shot.end_s + shotConfig.dripDelay
     ) {
+        const float shotDuration = shot.end_s;
+        float learnedOffset = shotConfig.weightOffset;
+
         shot.start_timestamp_s = 0;
         shot.end_s = 0;
 
-        const float newOffset = weightOffset + (currentWeight - goalWeight);
+        const float newOffset = shotConfig.weightOffset + (currentWeight - shotConfig.goalWeight);
 
-        if (abs(currentWeight - goalWeight + weightOffset) > maxOffset) {
+        if (abs(currentWeight - shotConfig.goalWeight + shotConfig.weightOffset) > shotConfig.maxOffset) {
             LOGF(WARNING, "Final weight: %.1fg | Goal: %.1fg | Offset: %.1fg | Error assumed, offset unchanged",
-                currentWeight, goalWeight, weightOffset);
+                currentWeight, shotConfig.goalWeight, shotConfig.weightOffset);
         }
         else if (newOffset < 0) {
             LOGF(WARNING, "Final weight: %.1fg | Goal: %.1fg | Offset: %.1fg | Negative offset would result, offset unchanged",
-                currentWeight, goalWeight, weightOffset);
+                currentWeight, shotConfig.goalWeight, shotConfig.weightOffset);
+        }
+        else if (configSnapshots.read().weightOffset != shotConfig.weightOffset) {
+            LOGF(INFO, "Final weight: %.1fg | Goal: %.1fg | Offset was changed during the shot, keeping %.1fg",
+                currentWeight, shotConfig.goalWeight, configSnapshots.read().weightOffset);
         }
         else {
-            weightOffset = newOffset;
+            learnedOffset = newOffset;
             LOGF(INFO, "Final weight: %.1fg | Goal: %.1fg | New offset: %.1fg",
-                currentWeight, goalWeight, weightOffset);
+                currentWeight, shotConfig.goalWeight, learnedOffset);
+
+            // Through the registry like any other change, saved by processPeriodicSave(), also during a trial
+            ParameterRegistry::getInstance().postParameterValue("brew.weight_offset", learnedOffset, true);
+        }
 
-            // Save to config system
-            config.set<float>("brew.weight_offset", weightOffset);
+        MqttPublisher::getInstance().shotSummary(shotDuration, currentWeight, shotConfig.goalWeight, learnedOffset,
+            learnedOffset != shotConfig.weightOffset);
+        ShotLog::getInstance().finished(currentWeight, learnedOffset);
 
-            if (!config.save()) {
-                LOG(ERROR, "Failed to save config after offset update");
+        // The curve up to the stop, for predicting the next shots of this recipe
+        if ((shot.lastEnd == WEIGHT || shot.lastEnd == RULE || shot.lastEnd == BUTTON)
+            && shotHistory.add(shot.time_s, shot.weight, shot.datapoints, shotConfig.brewDose, shotConfig.goalWeight)) {
+            // Skipped during a filesystem update or another save, the history stays dirty and goes with the next shot
+            if (const auto fs = FilesystemLock::getInstance().lock(false)) {
+                shotHistory.save();
             }
         }
     }
+
+    // Shots that got no final weight go into the log for collectors without one
+    ShotLog::getInstance().loop();
+
+    updateLoopStats(micros() - loopStart_us);
+
+    // FIRMWARE UPDATE ------------------------------
+
+    // Reboot after an update, keep or roll back a new firmware once it has been running for a while
+    OtaUpdate::getInstance().loop(configLoaded && NimBLEDevice::getServer() != nullptr);
+
+    // IDLE POWER MANAGEMENT --------------------------
+
+    // Idle once the shot analysis after the drip delay is done and nobody is watching
+    const bool idle = powerIdleEnabled
+        && !shot.brewing
+        && !buttonPressed
+        && !deviceConnected
+        && webClientCount() == 0
+        && !OtaUpdate::getInstance().isActive()
+        && seconds_f() > shot.start_timestamp_s + shot.end_s + shotConfig.dripDelay + shotConfig.reedSwitchDelay;
+
+    PowerManager::getInstance().update(idle);
+
+    if (idle) {
+        PowerManager::getInstance().idleWait(maxWakeLatencyMs);
+    }
 }
 
-void setupWiFi() {
-    // Non-blocking mode: if saved credentials exist, connect in the background.
-    // Otherwise start a captive portal AP for configuration.
-    wifiManager.setConfigPortalBlocking(false);
-    wifiManager.setConfigPortalTimeout(0); // Portal stays open indefinitely until configured
-    wifiManager.setConnectTimeout(10);     // 10s timeout per connection attempt
+void updateLoopStats(const unsigned long elapsedUs) {
+    loopStats.iterations++;
+    loopStats.totalUs += elapsedUs;
 
-    if (!wifiManager.autoConnect(hostName.c_str())) {
-        LOGF(INFO, "WiFi not configured - captive portal active on AP: %s", hostName.c_str());
+    if (elapsedUs > loopStats.maxUs) {
+        loopStats.maxUs = elapsedUs;
     }
-    else {
-        LOGF(INFO, "WiFi connected: %s", WiFi.localIP().toString().c_str());
+
+    if (millis() - loopStats.windowStart_ms > LOOP_STATS_PERIOD_MS) {
+        LOGF(DEBUG, "Loop: avg %.1fus | max %luus | %lu iterations",
+            static_cast<float>(loopStats.totalUs) / static_cast<float>(loopStats.iterations),
+            loopStats.maxUs, loopStats.iterations);
+
+        loopStats = {};
+        loopStats.windowStart_ms = millis();
     }
 }
 
 void processPendingBLEWrites() {
-    bool needsSave = false;
-
-    if (pendingWrite.weightDirty) {
-        pendingWrite.weightDirty = false;
-        const uint8_t val = pendingWrite.weight;
+    uint8_t val;
 
+    if (takeWrite(pendingWrite.weight, val)) {
         if (val != static_cast<uint8_t>(goalWeight)) {
             LOGF(INFO, "BLE: Goal weight updated from %.0f to %d", goalWeight, val);
-            goalWeight = val;
-            config.set<float>("brew.goal_weight", goalWeight);
-            needsSave = true;
+            setParameterFromBLE("brew.goal_weight", val);
 
             if (pWeightCharacteristic) {
                 pWeightCharacteristic->setValue(&val, 1);
@@ -733,96 +987,97 @@ void processPendingBLEWrites() {
         }
     }
 
-    if (pendingWrite.reedSwitchDirty) {
-        pendingWrite.reedSwitchDirty = false;
-
-        if (const bool val = pendingWrite.reedSwitchVal != 0; val != reedSwitch) {
-            LOGF(INFO, "BLE: Reed switch updated to %s", val ? "true" : "false");
-            reedSwitch = val;
-            in = reedSwitch ? REED_IN : IN;
-            config.set<bool>("switch.reedcontact", reedSwitch);
-            needsSave = true;
+    if (takeWrite(pendingWrite.reedSwitch, val)) {
+        if (const bool enabled = val != 0; enabled != reedSwitch) {
+            LOGF(INFO, "BLE: Reed switch updated to %s", enabled ? "true" : "false");
+            setParameterFromBLE("switch.reedcontact", enabled);
+            in = enabled ? REED_IN : IN;
+            pinMode(in, INPUT_PULLUP);
+            PowerManager::getInstance().setWakePin(in);
+            ReedDetector::getInstance().reset();
         }
     }
 
-    if (pendingWrite.momentaryDirty) {
-        pendingWrite.momentaryDirty = false;
-
-        if (const bool val = pendingWrite.momentaryVal != 0; val != momentary) {
-            LOGF(INFO, "BLE: Momentary updated to %s", val ? "true" : "false");
-            momentary = val;
-            config.set<bool>("switch.momentary", momentary);
-            needsSave = true;
+    if (takeWrite(pendingWrite.momentary, val)) {
+        if (const bool enabled = val != 0; enabled != momentary) {
+            LOGF(INFO, "BLE: Momentary updated to %s", enabled ? "true" : "false");
+            setParameterFromBLE("switch.momentary", enabled);
         }
     }
 
-    if (pendingWrite.autoTareDirty) {
-        pendingWrite.autoTareDirty = false;
-
-        if (const bool val = pendingWrite.autoTareVal != 0; val != autoTare) {
-            LOGF(INFO, "BLE: Auto tare updated to %s", val ? "true" : "false");
-            autoTare = val;
-            config.set<bool>("scale.auto_tare", autoTare);
-            needsSave = true;
+    if (takeWrite(pendingWrite.autoTare, val)) {
+        if (const bool enabled = val != 0; enabled != autoTare) {
+            LOGF(INFO, "BLE: Auto tare updated to %s", enabled ? "true" : "false");
+            setParameterFromBLE("scale.auto_tare", enabled);
         }
     }
 
-    if (pendingWrite.minShotDurationDirty) {
-        pendingWrite.minShotDurationDirty = false;
-
-        if (const auto val = static_cast<float>(pendingWrite.minShotDurationVal); val != minShotDuration) {
-            LOGF(INFO, "BLE: Min shot duration updated from %.0f to %.0f", minShotDuration, val);
-            minShotDuration = val;
-            config.set<int>("brew.min_shot_duration", static_cast<int>(minShotDuration));
-            needsSave = true;
+    if (takeWrite(pendingWrite.minShotDuration, val)) {
+        if (const auto seconds = static_cast<float>(val); seconds != configSnapshots.read().minShotDuration) {
+            LOGF(INFO, "BLE: Min shot duration updated from %.0f to %.0f", configSnapshots.read().minShotDuration, seconds);
+            setParameterFromBLE("brew.min_shot_duration", seconds);
         }
     }
 
-    if (pendingWrite.maxShotDurationDirty) {
-        pendingWrite.maxShotDurationDirty = false;
-
-        if (const auto val = static_cast<float>(pendingWrite.maxShotDurationVal); val != maxShotDuration) {
-            LOGF(INFO, "BLE: Max shot duration updated from %.0f to %.0f", maxShotDuration, val);
-            maxShotDuration = val;
-            config.set<int>("brew.max_shot_duration", static_cast<int>(maxShotDuration));
-            needsSave = true;
+    if (takeWrite(pendingWrite.maxShotDuration, val)) {
+        if (const auto seconds = static_cast<float>(val); seconds != configSnapshots.read().maxShotDuration) {
+            LOGF(INFO, "BLE: Max shot duration updated from %.0f to %.0f", configSnapshots.read().maxShotDuration, seconds);
+            setParameterFromBLE("brew.max_shot_duration", seconds);
         }
     }
 
-    if (pendingWrite.dripDelayDirty) {
-        pendingWrite.dripDelayDirty = false;
-
-        if (const auto val = static_cast<float>(pendingWrite.dripDelayVal); val != dripDelay) {
-            LOGF(INFO, "BLE: Drip delay updated from %.0f to %.0f", dripDelay, val);
-            dripDelay = val;
-            config.set<float>("brew.drip_delay", dripDelay);
-            needsSave = true;
+    if (takeWrite(pendingWrite.dripDelay, val)) {
+        if (const auto seconds = static_cast<float>(val); seconds != dripDelay) {
+            LOGF(INFO, "BLE: Drip delay updated from %.0f to %.0f", dripDelay, seconds);
+            setParameterFromBLE("brew.drip_delay", seconds);
         }
     }
+}
 
-    if (needsSave) {
-        if (!config.save()) {
-            LOG(ERROR, "Failed to save config after BLE write");
-        }
-    }
+void setParameterFromBLE(const char* id, const double value) {
+    // Applied by processChanges() like changes from the web: saved with a delay, or kept in RAM during a trial
+    ParameterRegistry::getInstance().postParameterValue(id, value);
 }
 
-void setBrewingState(const bool brewing) {
+void setBrewingState(const bool brewing, const bool autoStarted) {
     if (brewing) {
-        LOG(INFO, "Shot started");
+        // One consistent set of settings for the whole shot
+        shotConfig = configSnapshots.read();
+
+        LOGF(INFO, "%s (config %u)", autoStarted ? "Shot started by flow onset" : "Shot started", static_cast<unsigned>(shotConfig.epoch));
         shot.start_timestamp_s = seconds_f();
         shot.shotTimer = 0.0f;
         shot.datapoints = 0;
-        shot.expected_end_s = maxShotDuration; // Initialize to max duration
+        shot.expected_end_s = shotConfig.maxShotDuration; // Initialize to max duration
+        shot.predicting = false;
+        shot.flow = 0.0f;
+        shot.autoStarted = autoStarted;
+        shot.deadReckoning = false;
+        shot.tarePending = false;
+        shot.discardedSamples = 0;
+        shot.historyEnd_s = NAN;
+        timeToValidData_s = -1.0f;
+        weightResampler.reset();
+
+        if (String ruleError; !stopRules.compile(shotConfig.stopRule, ruleError)) {
+            LOGF(ERROR, "Stop rule ignored: %s", ruleError.c_str());
+            stopRules.clear();
+        }
 
+        MqttPublisher::getInstance().shotStarted(shotConfig.goalWeight, scale->isConnected() && !brewByTimeOnly);
+
+        // Sent by the command task, tare first, while the loop goes back to sampling
         if (scale->isConnected()) {
-            scale->resetTimer();
+            auto& scaleCommands = ScaleCommandQueue::getInstance();
 
-            if (autoTare) {
-                scale->tare();
+            // The cup was tared before the onset, a tare now would zero the espresso
+            if (shotConfig.autoTare && !autoStarted) {
+                scaleCommands.submit(ScaleCommandQueue::TARE);
+                shot.tarePending = true;
             }
 
-            scale->startTimer();
+            scaleCommands.submit(ScaleCommandQueue::RESET_TIMER);
+            scaleCommands.submit(ScaleCommandQueue::START_TIMER);
             LOG(DEBUG, "Waiting for weight data...");
         }
         else {
@@ -845,6 +1100,9 @@ void setBrewingState(const bool brewing) {
             case DISCONNECT:
                 endReason = "disconnect";
                 break;
+            case RULE:
+                endReason = "rule";
+                break;
             case UNDEF:
                 endReason = "undefined";
                 break;
@@ -852,21 +1110,34 @@ void setBrewingState(const bool brewing) {
 
         LOGF(INFO, "Shot ended by %s", endReason);
 
+        if (!std::isnan(shot.historyEnd_s)) {
+            LOGF(DEBUG, "Last prediction from past shots: %.1fs", shot.historyEnd_s);
+        }
+
         shot.end_s = seconds_f() - shot.start_timestamp_s;
-        scale->stopTimer();
+        shot.lastEnd = shot.end;
+        ScaleCommandQueue::getInstance().submit(ScaleCommandQueue::STOP_TIMER);
+
+        MqttPublisher::getInstance().shotStopped(endReason, shot.end_s, currentWeight);
+        ShotLog::getInstance().stopped(endReason, shot.end_s, currentWeight, shotConfig.goalWeight, shotConfig.brewDose,
+            shotConfig.weightOffset, static_cast<unsigned long>(shotConfig.dripDelay * 1000.0f));
 
-        if (momentary
-            && (WEIGHT == shot.end || TIME == shot.end))
+        // The next automatic start needs a tare first
+        onsetDetector.reset();
+        shot.deadReckoning = false;
+
+        if (shotConfig.momentary
+            && (WEIGHT == shot.end || TIME == shot.end || RULE == shot.end))
         {
             // Pulse button to stop brewing
             digitalWrite(OUT, HIGH);
             LOG(DEBUG, "Output HIGH");
-            delay(brewPulseDuration);
+            delay(shotConfig.brewPulseDuration);
             digitalWrite(OUT, LOW);
             LOG(DEBUG, "Output LOW");
             buttonPressed = false;
         }
-        else if (!momentary) {
+        else if (!shotConfig.momentary) {
             buttonLatched = false;
             buttonPressed = false;
             LOG(DEBUG, "Button unlatched");
@@ -879,67 +1150,126 @@ void setBrewingState(const bool brewing) {
     shot.end = UNDEF;
 }
 
+void startShotAtOnset() {
+    const float onset_s = onsetDetector.getOnsetTime();
+    LOGF(INFO, "Flow onset detected %.2fs ago", seconds_f() - onset_s);
+
+    shot.brewing = true;
+    setBrewingState(shot.brewing, true);
+
+    // Back-date the shot to the onset and take over the samples since then
+    shot.start_timestamp_s = onset_s;
+    shot.datapoints = static_cast<int>(onsetDetector.copySince(onset_s, shot.time_s, shot.weight, MAX_SHOT_DATAPOINTS));
+
+    for (int i = 0; i < shot.datapoints; i++) {
+        shot.time_s[i] -= onset_s;
+        MqttPublisher::getInstance().addSample(shot.time_s[i], shot.weight[i]);
+        weightResampler.addSample(shot.time_s[i], shot.weight[i]);
+    }
+
+    if (shot.datapoints > 0) {
+        shot.shotTimer = shot.time_s[shot.datapoints - 1];
+        timeToValidData_s = shot.time_s[0];
+    }
+
+    calculateEndTime(&shot);
+}
+
 void calculateEndTime(Shot* s) {
-    // Do not predict end time if there aren't enough espresso measurements yet
-    if ( s->datapoints < N || s->weight[s->datapoints - 1] < minWeightForPrediction ) {
-        s->expected_end_s = maxShotDuration;
+    float m = 0, b = 0;
+
+    // Line of best fit (y=mx+b) over the last seconds of the resampled weight, not enough of it yet
+    if (s->datapoints < 2 || !weightResampler.fit(shotConfig.trendWindow, m, b)) {
+        s->expected_end_s = shotConfig.maxShotDuration;
+        s->predicting = false;
+        s->flow = 0.0f;
+        return;
     }
-    else {
-        // Get line of best fit (y=mx+b) from the last 10 measurements
-        float sumXY = 0, sumX = 0, sumY = 0, sumSquaredX = 0, m = 0, b = 0, meanX = 0, meanY = 0;
 
-        for (int i = s->datapoints - N; i < s->datapoints; i++) {
-            sumXY += s->time_s[i] * s->weight[i];
-            sumX += s->time_s[i];
-            sumY += s->weight[i];
-            sumSquaredX += s->time_s[i] * s->time_s[i];
-        }
+    s->flow = m;
 
-        m = (N * sumXY - sumX * sumY) / (N * sumSquaredX - sumX * sumX);
-        meanX = sumX / N;
-        meanY = sumY / N;
-        b = meanY - m * meanX;
+    // Do not predict end time before the minimum weight is reached
+    if (s->weight[s->datapoints - 1] < shotConfig.minWeightForPrediction) {
+        s->expected_end_s = shotConfig.maxShotDuration;
+        s->predicting = false;
+        return;
+    }
 
-        // Calculate time at which goal weight will be reached (x = (y-b)/m)
-        // if M is negative (which can happen during a blooming shot when the flow stops) assume max duration (issue #29)
-        s->expected_end_s = m < 0 ? maxShotDuration : (goalWeight - weightOffset - b) / m;
+    // Calculate time at which goal weight will be reached (x = (y-b)/m)
+    // if M is negative (which can happen during a blooming shot when the flow stops) assume max duration (issue #29)
+    const float target = shotConfig.goalWeight - shotConfig.weightOffset;
+    s->expected_end_s = m < 0 ? shotConfig.maxShotDuration : (target - b) / m;
+    s->predicting = m >= 0;
+
+    // Early on the line only knows the trend window, past shots of the same recipe know the rest of the curve.
+    // Their weight fades out as the weight approaches the target, so the stop itself follows the line.
+    if (!s->predicting) {
+        return;
     }
-}
 
-float seconds_f() {
-    return static_cast<float>(millis()) / 1000.0f;
+    const ShotHistory::Prediction history = shotHistory.predict(s->time_s, s->weight, s->datapoints, target,
+        shotConfig.brewDose, shotConfig.goalWeight);
+
+    if (history.valid) {
+        const float remaining = 1.0f - std::clamp(s->weight[s->datapoints - 1] / target, 0.0f, 1.0f);
+        const float historyWeight = HISTORY_BLEND_MAX * remaining * remaining;
+
+        s->historyEnd_s = history.end_s;
+        s->expected_end_s = historyWeight * history.end_s + (1.0f - historyWeight) * s->expected_end_s;
+        LOGF(TRACE, "History: %.1fs from %u shots (distance %.2fs), weight %.2f", history.end_s,
+            static_cast<unsigned>(history.neighbours), history.distance_s, historyWeight);
+    }
 }
 
-void setColor(int rgb[3]) {
-    // Prevent flickering by only updating if color changed
-    if (currentColor[0] == rgb[0] && 
-        currentColor[1] == rgb[1] && 
-        currentColor[2] == rgb[2]) {
-        return;
+bool predictionTrustworthy(const Shot* s) {
+    if (!s->predicting || s->datapoints < N) {
+        return false;
     }
 
-    analogWrite(LED_RED, 255 - rgb[0]);
-    analogWrite(LED_GREEN, 255 - rgb[1]);
-    analogWrite(LED_BLUE, 255 - rgb[2]);
+    const float lastSampleAge_s = seconds_f() - s->start_timestamp_s - s->time_s[s->datapoints - 1];
+
+    return s->flow >= DEAD_RECKONING_MIN_FLOW
+        && s->expected_end_s <= shotConfig.maxShotDuration
+        && lastSampleAge_s <= DEAD_RECKONING_MAX_AGE_S;
+}
+
+float seconds_f() {
+    return static_cast<float>(millis()) / 1000.0f;
+}
 
-    currentColor[0] = rgb[0];
-    currentColor[1] = rgb[1];
-    currentColor[2] = rgb[2];
+void showLedError() {
+    ledErrorStart_ms = millis();
+    ledError = true;
 }
 
 void updateLEDState() {
-    if (shot.brewing) {
-        if (scale->isConnected()) {
-            setColor(millis() / 1000 % 2 ? COLOR_GREEN : COLOR_BLUE);
+    LedState state;
+
+    // Cleared once expired, a stale start time would look recent again after millis() wraps
+    if (ledError && millis() - ledErrorStart_ms >= LED_ERROR_DURATION_MS) {
+        ledError = false;
+    }
+
+    if (ledError) {
+        state = LedState::Error;
+    }
+    else if (shot.brewing) {
+        if (!scale->isConnected()) {
+            state = LedState::BrewingNoScale;
+        }
+        else if (brewByTimeOnly) {
+            state = LedState::BrewingTimeMode;
         }
         else {
-            setColor(millis() / 1000 % 2 ? COLOR_RED : COLOR_BLUE);
+            state = shot.predicting ? LedState::BrewingPrediction : LedState::Brewing;
         }
     }
     else if (!scale->isConnected()) {
-        setColor(COLOR_RED);
+        state = LedState::ScaleConnecting;
     }
     else {
-        setColor(COLOR_GREEN);
+        state = LedState::Ready;
     }
+
+    LedController::getInstance().post(state);
 }
\ No newline at end of file
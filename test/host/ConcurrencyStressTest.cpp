@@ -0,0 +1,565 @@
+// Runs the loop, the web server task and the NimBLE host task of the firmware as threads on the shared state:
+// the ParameterRegistry and the Config document behind it, the global variables, the ConfigSnapshotStore, the
+// BLE write slots, the status copies, the status arena stats and the ShotLog. Each thread picks its next
+// operation and the pause before it at random, so every run interleaves differently; build with
+// -DHOST_SANITIZE_THREAD=ON to have ThreadSanitizer check the accesses. Every operation is recorded per thread
+// with its count, how often it found the registry busy and its duration, printed at the end and written to
+// --csv <file>.
+//
+//   concurrency_stress_test [--seed <n>] [--ms <duration of the random phase>] [--csv <file>]
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include <filesystem>
+#include <future>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include "FilesystemLock.h"
+#include "HostRequest.h"
+#include "PendingWrite.h"
+
+extern Config config;
+extern float goalWeight;
+extern float weightOffset;
+extern float dripDelay;
+extern bool momentary;
+extern bool autoTare;
+extern bool reedSwitch;
+
+namespace {
+    std::atomic<int> failures{0};
+
+#define CHECK(condition)                                                          \
+    do {                                                                          \
+        if (!(condition)) {                                                       \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition);           \
+            failures++;                                                           \
+        }                                                                         \
+    } while (0)
+
+    constexpr PlatformStatus PLATFORM = {0, nullptr};
+
+    PendingWrite pendingWrite = {};
+
+    // Accesses of one thread, only touched by that thread until it has been joined
+    class AccessLog {
+        public:
+            struct Access {
+                uint32_t count = 0;
+                uint32_t busy = 0;      // The registry or the filesystem was held by another thread, skipped
+                uint64_t total_us = 0;
+                unsigned long max_us = 0;
+            };
+
+            explicit AccessLog(const char* thread) :
+                    _thread(thread) {
+            }
+
+            // Runs operation, which returns false if it found the shared state busy and did nothing
+            template <typename Operation>
+            void timed(const char* name, Operation&& operation) {
+                const unsigned long begin = micros();
+                const bool done = operation();
+                record(name, micros() - begin, done);
+            }
+
+            void record(const char* name, const unsigned long elapsed_us, const bool done) {
+                Access& access = _accesses[name];
+                access.count++;
+                access.busy += done ? 0 : 1;
+                access.total_us += elapsed_us;
+                access.max_us = std::max(access.max_us, elapsed_us);
+            }
+
+            void print(FILE* out, const bool csv) const {
+                for (const auto& [name, access] : _accesses) {
+                    const double mean = static_cast<double>(access.total_us) / std::max(access.count, 1u);
+
+                    if (csv) {
+                        fprintf(out, "%s,%s,%u,%u,%.1f,%lu\n", _thread, name.c_str(), access.count, access.busy, mean,
+                            access.max_us);
+                    }
+                    else {
+                        fprintf(out, "%-6s %-28s %8u %8u %10.1f %10lu\n", _thread, name.c_str(), access.count,
+                            access.busy, mean, access.max_us);
+                    }
+                }
+            }
+
+            [[nodiscard]] const Access& get(const char* name) {
+                return _accesses[name];
+            }
+
+        private:
+            const char* _thread;
+            std::map<std::string, Access> _accesses;
+    };
+
+    class Task {
+        protected:
+            explicit Task(const uint32_t seed) :
+                    _random(seed) {
+            }
+
+            bool chance(const double p) {
+                return std::bernoulli_distribution(p)(_random);
+            }
+
+            int between(const int min, const int max) {
+                return std::uniform_int_distribution(min, max)(_random);
+            }
+
+            // Nothing, a yield or a short sleep, so the threads meet at different points in every run
+            void pause() {
+                switch (between(0, 3)) {
+                    case 0:
+                        break;
+                    case 1:
+                        std::this_thread::yield();
+                        break;
+                    default:
+                        std::this_thread::sleep_for(std::chrono::microseconds(between(1, 300)));
+                        break;
+                }
+            }
+
+            std::mt19937 _random;
+    };
+
+    // What loop() does with the shared state, in the same order
+    class LoopTask : public Task {
+        public:
+            explicit LoopTask(const uint32_t seed) :
+                    Task(seed) {
+            }
+
+            void iterate() {
+                auto& registry = ParameterRegistry::getInstance();
+                const unsigned long begin = micros();
+
+                log.timed("processPeriodicSave", [&registry] {
+                    registry.processPeriodicSave();
+                    return true;
+                });
+                log.timed("processTrialTimeout", [&registry] {
+                    registry.processTrialTimeout();
+                    return true;
+                });
+                log.timed("processPendingBLEWrites", [this] {
+                    takeBleWrites();
+                    return true;
+                });
+
+                // End of a shot: the learned offset goes through the registry, the shot into the log
+                if (chance(0.02)) {
+                    log.timed("learned offset", [this, &registry] {
+                        registry.postParameterValue("brew.weight_offset", between(0, 30) / 10.0, true);
+                        return true;
+                    });
+                    log.timed("ShotLog", [this] {
+                        ShotLog::getInstance().stopped("WEIGHT", 28.0f, currentWeight, goalWeight, 18.0f, weightOffset,
+                            static_cast<unsigned long>(dripDelay * 1000.0f));
+                        ShotLog::getInstance().finished(currentWeight + 0.5f, weightOffset);
+                        return true;
+                    });
+                }
+
+                log.timed("processChanges", [&registry] { return registry.processChanges(configSnapshots); });
+
+                // Settings of the shot control: the snapshot, and the global variables only the loop writes
+                const ConfigSnapshot snapshot = configSnapshots.read();
+                CHECK(snapshot.epoch >= _lastEpoch);
+                CHECK(snapshot.revision <= registry.getRevision());
+                _lastEpoch = snapshot.epoch;
+                _settings += goalWeight + weightOffset + dripDelay + (momentary ? 1 : 0) + (autoTare ? 1 : 0) + (reedSwitch ? 1 : 0);
+
+                // A new weight, copied for /status
+                currentWeight = static_cast<float>(between(0, 500)) / 10.0f;
+                statusWeight = currentWeight;
+
+                // sendStatusEvent(): the document is built in the loop's arena, /status reads the published stats
+                log.timed("status event", [] {
+                    JsonArenaScope arenaScope(statusJsonArena);
+                    JsonDocument doc(&statusJsonArena);
+                    doc["currentWeight"] = currentWeight;
+                    doc["goalWeight"] = goalWeight;
+
+                    char json[256];
+                    const size_t length = serializeJson(doc, json, sizeof(json));
+                    statusJsonArena.publishStats();
+                    return length > 0;
+                });
+
+                log.record("iteration", micros() - begin, true);
+                pause();
+            }
+
+            AccessLog log{"loop"};
+
+        private:
+            // processPendingBLEWrites(): a value that differs from the current setting is posted to the registry
+            void takeBleWrites() {
+                auto& registry = ParameterRegistry::getInstance();
+                uint8_t val;
+
+                if (takeWrite(pendingWrite.weight, val) && val != static_cast<uint8_t>(goalWeight)) {
+                    registry.postParameterValue("brew.goal_weight", val);
+                }
+
+                if (takeWrite(pendingWrite.reedSwitch, val) && (val != 0) != reedSwitch) {
+                    registry.postParameterValue("switch.reedcontact", val != 0);
+                }
+
+                if (takeWrite(pendingWrite.momentary, val) && (val != 0) != momentary) {
+                    registry.postParameterValue("switch.momentary", val != 0);
+                }
+
+                if (takeWrite(pendingWrite.autoTare, val) && (val != 0) != autoTare) {
+                    registry.postParameterValue("scale.auto_tare", val != 0);
+                }
+
+                if (takeWrite(pendingWrite.minShotDuration, val) && val != configSnapshots.read().minShotDuration) {
+                    registry.postParameterValue("brew.min_shot_duration", val);
+                }
+
+                if (takeWrite(pendingWrite.maxShotDuration, val) && val != configSnapshots.read().maxShotDuration) {
+                    registry.postParameterValue("brew.max_shot_duration", val);
+                }
+
+                if (takeWrite(pendingWrite.dripDelay, val) && val != dripDelay) {
+                    registry.postParameterValue("brew.drip_delay", val);
+                }
+            }
+
+            uint32_t _lastEpoch = 0;
+            double _settings = 0;
+    };
+
+    // Requests of the web server task, through the same handlers as embeddedWebserver.h
+    class WebTask : public Task {
+        public:
+            explicit WebTask(const uint32_t seed) :
+                    Task(seed) {
+            }
+
+            void iterate() {
+                auto& registry = ParameterRegistry::getInstance();
+                const String weight(between(200, 500) / 10.0, 1);
+
+                switch (between(0, 9)) {
+                    case 0:
+                    case 1:
+                        log.timed("GET /status", [] { return serve({HostRequest::GET, "/status", {}}, PLATFORM).code == 200; });
+                        break;
+
+                    case 2:
+                        log.timed("GET /parameters", [] { return serve({HostRequest::GET, "/parameters", {}}, PLATFORM).code == 200; });
+                        break;
+
+                    case 3:
+                        log.timed("GET /history", [] { return serve({HostRequest::GET, "/history", {}}, PLATFORM).code == 200; });
+                        break;
+
+                    case 4: {
+                        const String set = String(R"({"id":1,"cmd":"set","name":"brew.goal_weight","value":)") + weight + "}";
+                        log.timed("ws set", [&set] { return serveCommand(set.c_str()).indexOf("\"ok\":true") >= 0; });
+                        break;
+                    }
+
+                    case 5:
+                        log.timed("ws get", [] {
+                            return serveCommand(R"({"id":2,"cmd":"get","name":"brew.drip_delay"})").indexOf("\"ok\":true") >= 0;
+                        });
+                        break;
+
+                    case 6: {
+                        const String dose(between(150, 220) / 10.0, 1);
+                        log.timed("POST /parameters", [&weight, &dose] {
+                            return serve({HostRequest::POST, "/parameters", {{"brew.goal_weight", weight}, {"brew.dose", dose}}},
+                                       PLATFORM).body == "OK";
+                        });
+                        break;
+                    }
+
+                    case 7:
+                        // Short timeouts, so the loop reverts some of the trials
+                        if (chance(0.5)) {
+                            log.timed("trial start", [this, &registry] {
+                                registry.startTrial(between(5, 50));
+                                return true;
+                            });
+                        }
+                        else {
+                            const char* url = chance(0.5) ? "/trial/commit" : "/trial/revert";
+                            log.timed(url, [url] { return serve({HostRequest::POST, url, {}}, PLATFORM).code == 200; });
+                        }
+
+                        break;
+
+                    case 8:
+                        log.timed("GET /trial", [] { return serve({HostRequest::GET, "/trial", {}}, PLATFORM).code == 200; });
+                        break;
+
+                    default:
+                        // Config upload and the end of a filesystem update write the file with the registry held
+                        log.timed("save, registry held", [&registry] {
+                            const auto lock = registry.lock();
+                            const auto fs = FilesystemLock::getInstance().lock();
+                            return fs && config.save();
+                        });
+                        break;
+                }
+
+                pause();
+            }
+
+            AccessLog log{"web"};
+    };
+
+    // Characteristic writes of the companion app, in the NimBLE host task
+    class BleTask : public Task {
+        public:
+            explicit BleTask(const uint32_t seed) :
+                    Task(seed) {
+            }
+
+            void iterate() {
+                std::atomic<uint16_t>* const slots[] = {&pendingWrite.weight, &pendingWrite.reedSwitch,
+                    &pendingWrite.momentary, &pendingWrite.autoTare, &pendingWrite.minShotDuration,
+                    &pendingWrite.maxShotDuration, &pendingWrite.dripDelay};
+                const int slot = between(0, 6);
+                const int value = slot == 0 ? between(20, 50) : slot <= 3 ? between(0, 1) : slot <= 5 ? between(5, 40) : between(0, 5);
+
+                log.timed("postWrite", [&slots, slot, value] {
+                    postWrite(*slots[slot], static_cast<uint8_t>(value));
+                    return true;
+                });
+
+                pause();
+            }
+
+            AccessLog log{"ble"};
+    };
+
+    // Readers racing the publisher never get a snapshot mixed from two publishes
+    void testSnapshotStore() {
+        ConfigSnapshotStore store;
+        std::atomic<bool> stop{false};
+
+        std::thread publisher([&store, &stop] {
+            for (uint32_t i = 1; !stop; i++) {
+                ConfigSnapshot snapshot = {};
+                snapshot.revision = i;
+                snapshot.goalWeight = static_cast<float>(i);
+                snapshot.brewDose = static_cast<float>(i);
+                snapshot.brewPulseDuration = static_cast<int>(i);
+                memset(snapshot.stopRule, 'a' + i % 26, sizeof(snapshot.stopRule) - 1);
+                store.publish(snapshot);
+            }
+        });
+
+        const auto reader = [&store] {
+            uint32_t last = 0;
+
+            for (int n = 0; n < 20000; n++) {
+                const ConfigSnapshot snapshot = store.read();
+
+                if (snapshot.epoch == 0) {
+                    continue;
+                }
+
+                CHECK(snapshot.epoch >= last);
+                CHECK(snapshot.epoch == snapshot.revision);
+                CHECK(snapshot.goalWeight == static_cast<float>(snapshot.revision));
+                CHECK(snapshot.brewDose == static_cast<float>(snapshot.revision));
+                CHECK(snapshot.brewPulseDuration == static_cast<int>(snapshot.revision));
+                CHECK(snapshot.stopRule[0] == static_cast<char>('a' + snapshot.revision % 26));
+                CHECK(snapshot.stopRule[sizeof(snapshot.stopRule) - 2] == snapshot.stopRule[0]);
+                last = snapshot.epoch;
+            }
+        };
+
+        std::thread first(reader);
+        std::thread second(reader);
+        first.join();
+        second.join();
+        stop = true;
+        publisher.join();
+    }
+
+    // The file as the last save left it, a file that is no JSON fails the check
+    void readConfigFile(JsonDocument& doc) {
+        File file = LittleFS.open("/config.json", "r");
+        CHECK(file);
+        CHECK(!deserializeJson(doc, file));
+    }
+
+    int storedDripDelay() {
+        JsonDocument doc;
+        readConfigFile(doc);
+
+        return doc["brew"]["drip_delay"].as<int>();
+    }
+
+    // The loop finishes its iteration while another task holds the registry or the filesystem, and picks up
+    // what it skipped once they are free again
+    void testLoopDoesNotWait(LoopTask& loop) {
+        auto& registry = ParameterRegistry::getInstance();
+        const int drip = static_cast<int>(dripDelay) == 3 ? 4 : 3;
+
+        {
+            auto lock = registry.lock();
+            postWrite(pendingWrite.dripDelay, drip);
+
+            auto iteration = std::async(std::launch::async, [&loop] { loop.iterate(); });
+            CHECK(iteration.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+            lock.unlock();
+            iteration.get();
+        }
+
+        CHECK(dripDelay != static_cast<float>(drip));
+        loop.iterate();
+        CHECK(dripDelay == static_cast<float>(drip));
+
+        // A pending change while a filesystem update or another save holds the filesystem
+        CHECK(storedDripDelay() != drip);
+
+        {
+            auto fs = FilesystemLock::getInstance().lockForUpdate();
+            delay(2100);
+
+            auto iteration = std::async(std::launch::async, [&loop] { loop.iterate(); });
+            CHECK(iteration.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+            fs.unlock();
+            iteration.get();
+        }
+
+        CHECK(storedDripDelay() != drip);
+        loop.iterate();
+        CHECK(storedDripDelay() == drip);
+    }
+
+    // Once the other tasks have stopped, the loop brings the global variables, the snapshot and the file up to
+    // date with the registry
+    void checkSettled(LoopTask& loop) {
+        auto& registry = ParameterRegistry::getInstance();
+        registry.revertTrial();
+        loop.iterate();
+
+        const auto lock = registry.lock();
+        const auto value = [&registry](const char* id) { return registry.getParameterById(id)->getValue(); };
+        const ConfigSnapshot snapshot = configSnapshots.read();
+
+        CHECK(snapshot.revision == registry.getRevision());
+        CHECK(goalWeight == static_cast<float>(value("brew.goal_weight")));
+        CHECK(snapshot.goalWeight == goalWeight);
+        CHECK(weightOffset == static_cast<float>(value("brew.weight_offset")));
+        CHECK(snapshot.weightOffset == weightOffset);
+        CHECK(dripDelay == static_cast<float>(value("brew.drip_delay")));
+        CHECK(momentary == (value("switch.momentary") != 0.0));
+        CHECK(autoTare == (value("scale.auto_tare") != 0.0));
+        CHECK(reedSwitch == (value("switch.reedcontact") != 0.0));
+
+        // Every save wrote a complete file, the last one the current values
+        JsonDocument stored;
+        readConfigFile(stored);
+        registry.markChanged();
+        registry.forceSave();
+        readConfigFile(stored);
+
+        String current;
+        serializeJson(stored, current);
+        CHECK(current == config.serialize());
+    }
+}
+
+int main(const int argc, char** argv) {
+    uint32_t seed = std::random_device()();
+    long duration_ms = 1000;
+    const char* csv = nullptr;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--seed") == 0) {
+            seed = static_cast<uint32_t>(strtoul(argv[i + 1], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--ms") == 0) {
+            duration_ms = std::max(1L, atol(argv[i + 1]));
+        }
+        else if (strcmp(argv[i], "--csv") == 0) {
+            csv = argv[i + 1];
+        }
+    }
+
+    printf("seed %u, %ld ms\n", seed, duration_ms);
+
+    const auto root = std::filesystem::temp_directory_path() / ("shotstopper-stress-" + std::to_string(getpid()));
+    std::filesystem::remove_all(root);
+    LittleFS.setRoot(root);
+
+    Logger::setLevel(Logger::Level::ERROR);
+    CHECK(config.begin());
+    ParameterRegistry::getInstance().initialize(config);
+    ShotLog::getInstance().begin();
+
+    LoopTask loop(seed);
+    WebTask web(seed + 1);
+    BleTask ble(seed + 2);
+    loop.iterate();
+
+    testSnapshotStore();
+
+    // The random phase
+    std::atomic<bool> stop{false};
+    const auto run = [&stop](auto& task) {
+        return std::thread([&stop, &task] {
+            while (!stop) {
+                task.iterate();
+            }
+        });
+    };
+
+    std::thread loopThread = run(loop);
+    std::thread webThread = run(web);
+    std::thread bleThread = run(ble);
+    delay(duration_ms);
+    stop = true;
+    loopThread.join();
+    webThread.join();
+    bleThread.join();
+
+    checkSettled(loop);
+    testLoopDoesNotWait(loop);
+
+    printf("\n%-6s %-28s %8s %8s %10s %10s\n", "thread", "operation", "count", "busy", "mean us", "max us");
+    loop.log.print(stdout, false);
+    web.log.print(stdout, false);
+    ble.log.print(stdout, false);
+
+    if (csv) {
+        if (FILE* out = fopen(csv, "w")) {
+            fprintf(out, "thread,operation,count,busy,mean_us,max_us\n");
+            loop.log.print(out, true);
+            web.log.print(out, true);
+            ble.log.print(out, true);
+            fclose(out);
+        }
+        else {
+            printf("Cannot write %s\n", csv);
+            failures++;
+        }
+    }
+
+    CHECK(loop.log.get("iteration").count > 0);
+    CHECK(web.log.get("GET /status").count > 0);
+    CHECK(ble.log.get("postWrite").count > 0);
+
+    std::filesystem::remove_all(root);
+
+    printf("\n%s, %d failed checks (seed %u)\n", failures == 0 ? "OK" : "FAILED", failures.load(), seed);
+    return failures == 0 ? 0 : 1;
+}
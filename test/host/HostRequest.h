@@ -0,0 +1,160 @@
+/**
+ * @file HostRequest.h
+ *
+ * @brief Requests and responses of the host build, routed to WebHandlers.h like serverSetup() does
+ *
+ * Only the parameter extraction of embeddedWebserver.h is repeated here, the bodies come from the same
+ * handler functions the firmware uses.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <utility>
+#include <vector>
+
+#include "WebHandlers.h"
+
+// Collects a response body
+class StringPrint : public Print {
+    public:
+        size_t write(const uint8_t c) override {
+            _body += static_cast<char>(c);
+            return 1;
+        }
+
+        size_t write(const uint8_t* buffer, const size_t size) override {
+            _body.append(reinterpret_cast<const char*>(buffer), size);
+            return size;
+        }
+
+        [[nodiscard]] String str() const {
+            return String(_body.c_str());
+        }
+
+        [[nodiscard]] size_t length() const {
+            return _body.length();
+        }
+
+    private:
+        std::string _body;
+};
+
+struct HostRequest {
+    enum Method : uint8_t {
+        GET = 1,
+        POST = 2
+    };
+
+    Method method;
+    String url;
+    std::vector<std::pair<String, String>> params;
+
+    [[nodiscard]] const String* getParam(const char* name) const {
+        for (const auto& [key, value] : params) {
+            if (key == name) {
+                return &value;
+            }
+        }
+
+        return nullptr;
+    }
+};
+
+struct HostResponse {
+    int code;
+    String body;
+};
+
+// Answers like the AsyncWebServer routes of the handlers; the free heap and the subsystem sections of /status
+// come from platform
+inline HostResponse serve(const HostRequest& request, const PlatformStatus& platform) {
+    StringPrint out;
+    const auto intParam = [&request](const char* name, const long fallback) {
+        const String* value = request.getParam(name);
+        return value ? value->toInt() : fallback;
+    };
+
+    if (request.url == "/parameters" && request.method == HostRequest::GET) {
+        writeParameters(out, intParam("offset", 0), intParam("limit", 50), intParam("section", -1));
+        return {200, out.str()};
+    }
+
+    if (request.url == "/parameters" && request.method == HostRequest::POST) {
+        String errors;
+
+        for (const auto& [name, value] : request.params) {
+            if (name.length() > 0) {
+                applyParameter(name, value, errors);
+            }
+        }
+
+        return {200, finishParameterUpdate(errors)};
+    }
+
+    if (request.url == "/parameterHelp") {
+        if (request.params.empty()) {
+            return {422, "parameter is missing"};
+        }
+
+        const String& varValue = request.params[0].second;
+        const std::shared_ptr<Parameter> param = ParameterRegistry::getInstance().getParameterById(varValue.c_str());
+
+        if (param == nullptr) {
+            return {404, "parameter not found"};
+        }
+
+        writeParameterHelp(out, varValue, param);
+        return {200, out.str()};
+    }
+
+    if (request.url.startsWith("/trial")) {
+        auto& registry = ParameterRegistry::getInstance();
+
+        if (request.url == "/trial/start") {
+            const long timeout_s = std::clamp(intParam("timeout", TRIAL_DEFAULT_TIMEOUT_S), 60L, 3600L);
+            registry.startTrial(static_cast<unsigned long>(timeout_s) * 1000);
+        }
+        else if (request.url == "/trial/commit") {
+            registry.commitTrial();
+        }
+        else if (request.url == "/trial/revert") {
+            registry.revertTrial();
+        }
+
+        writeTrialStatus(out);
+        return {200, out.str()};
+    }
+
+    if (request.url == "/status") {
+        writeStatus(out, platform);
+        return {200, out.str()};
+    }
+
+    if (request.url == "/history") {
+        writeHistory(out, static_cast<uint32_t>(intParam("since", 0)), "host");
+        return {200, out.str()};
+    }
+
+    return {404, "Not found"};
+}
+
+// One message of the /ws command channel, answered like onCommandMessage()
+inline String serveCommand(const char* message) {
+    JsonArenaScope arenaScope(webJsonArena);
+    JsonDocument request(&webJsonArena);
+    JsonDocument reply(&webJsonArena);
+
+    if (const DeserializationError error = deserializeJson(request, message); error) {
+        reply["ok"] = false;
+        reply["error"] = error.c_str();
+    }
+    else {
+        handleCommand(request.as<JsonVariantConst>(), reply.to<JsonVariant>());
+    }
+
+    char json[256];
+    const size_t length = serializeJson(reply, json, sizeof(json));
+
+    return String(std::string(json, length).c_str());
+}
@@ -0,0 +1,52 @@
+// The globals of src/main.cpp that the registry and the web handlers use, with the same types
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "Config.h"
+#include "ConfigSnapshot.h"
+
+extern const char sysVersion[] = "host";
+
+String hostName;
+float goalWeight = 0;
+float weightOffset = 0;
+float maxOffset;
+int brewPulseDuration;
+float dripDelay;
+float reedSwitchDelay;
+float minWeightForPrediction;
+float trendWindow;
+float brewDose;
+String stopRule;
+float currentWeight = 0;
+
+Config config;
+
+bool momentary;
+bool reedSwitch;
+bool autoTare;
+bool autoStart;
+std::atomic<bool> brewByTimeOnly{false};
+bool brewByTimeOnlyConfigured;
+bool powerIdleEnabled;
+int maxWakeLatencyMs;
+bool lightSleepEnabled;
+bool mqttEnabled;
+String mqttHost;
+int mqttPort;
+String mqttUsername;
+String mqttPassword;
+String mqttTopicPrefix;
+int mqttSamplesPerMessage;
+bool udpTelemetryEnabled;
+String udpTelemetryGroup;
+int udpTelemetryPort;
+int udpMaxRateHz;
+
+std::atomic<bool> isBrewing{false};
+std::atomic<float> shotTimer{0.0f};
+std::atomic<float> statusWeight{0.0f};
+std::atomic<float> timeToValidData_s{-1.0f};
+
+ConfigSnapshotStore configSnapshots;
@@ -0,0 +1,147 @@
+// The USB serial protocol of src/SerialProtocol.h with the real ParameterRegistry, on stdin and stdout of the
+// host instead of the USB port, for serial_protocol_test.py. Like the loop, it polls the protocol, applies the
+// parameter changes and sends a sample every SAMPLE_INTERVAL_MS while streaming. The log goes to the same
+// output as the frames.
+//
+// SIGUSR1 makes another thread take the registry until SIGUSR2, as the web server task does during a request,
+// so the test can check that a request held in the meantime is answered afterwards and in order.
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include <atomic>
+#include <csignal>
+#include <filesystem>
+#include <poll.h>
+#include <unistd.h>
+
+#include "Config.h"
+#include "ConfigSnapshot.h"
+#include "Logger.h"
+#include "ParameterRegistry.h"
+#include "ScaleCommandQueue.h"
+#include "SerialProtocol.h"
+
+extern Config config;
+extern float goalWeight;
+extern ConfigSnapshotStore configSnapshots;
+
+// The scale is not part of the host build, a tare is only logged
+ScaleCommandQueue ScaleCommandQueue::_singleton;
+
+void ScaleCommandQueue::submit(const Command command) {
+    LOGF(INFO, "Scale command %u submitted", static_cast<unsigned>(command));
+}
+
+namespace {
+    constexpr unsigned long SAMPLE_INTERVAL_MS = 50;
+
+    std::atomic<bool> holdRequested{false};
+
+    void onSignal(const int signal) {
+        holdRequested = signal == SIGUSR1;
+    }
+
+    // Takes the registry while holdRequested is set, held tells the loop once it has it
+    void holdRegistry(std::atomic<bool>& held) {
+        const auto lock = ParameterRegistry::getInstance().lock();
+        held = true;
+
+        while (holdRequested) {
+            delay(1);
+        }
+
+        held = false;
+    }
+
+    // Everything written to Serial since the last call, false once stdout is closed
+    bool flushOutput() {
+        const std::string output = Serial.takeOutput();
+        size_t written = 0;
+
+        while (written < output.size()) {
+            const ssize_t n = write(STDOUT_FILENO, output.data() + written, output.size() - written);
+
+            if (n <= 0) {
+                return false;
+            }
+
+            written += static_cast<size_t>(n);
+        }
+
+        return true;
+    }
+}
+
+int main() {
+    const auto root = std::filesystem::temp_directory_path() / ("shotstopper-serial-" + std::to_string(getpid()));
+    std::filesystem::remove_all(root);
+    LittleFS.setRoot(root);
+
+    Serial.capture(true);
+    Logger::setLevel(Logger::Level::INFO);
+    config.begin();
+    ParameterRegistry::getInstance().initialize(config);
+    ParameterRegistry::getInstance().processChanges(configSnapshots);
+
+    signal(SIGUSR1, onSignal);
+    signal(SIGUSR2, onSignal);
+
+    auto& protocol = SerialProtocol::getInstance();
+    std::atomic<bool> held{false};
+    std::thread holder;
+    unsigned long lastSample_ms = 0;
+    bool running = true;
+
+    while (running && flushOutput()) {
+        pollfd input = {STDIN_FILENO, POLLIN, 0};
+
+        if (poll(&input, 1, 1) > 0) {
+            uint8_t buffer[256];
+            const ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+
+            // The test closed the port, what is still in the receive buffer is handled first
+            if (n > 0) {
+                Serial.receive(buffer, static_cast<size_t>(n));
+            }
+            else {
+                running = false;
+            }
+        }
+
+        if (holdRequested && !holder.joinable()) {
+            holder = std::thread(holdRegistry, std::ref(held));
+
+            while (!held) {
+                delay(1);
+            }
+
+            LOG(INFO, "Registry held by another task");
+        }
+        else if (!holdRequested && holder.joinable()) {
+            holder.join();
+            LOG(INFO, "Registry released");
+        }
+
+        protocol.poll();
+        ParameterRegistry::getInstance().processChanges(configSnapshots);
+
+        if (millis() - lastSample_ms >= SAMPLE_INTERVAL_MS) {
+            lastSample_ms = millis();
+            protocol.sendSample(TelemetryState::Idle, 0x01, 0.0f, 0.0f, 0.0f, NAN, goalWeight, true);
+        }
+    }
+
+    protocol.poll();
+    flushOutput();
+
+    holdRequested = false;
+
+    if (holder.joinable()) {
+        holder.join();
+    }
+
+    std::filesystem::remove_all(root);
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+// Feeds recorded shot curves through the shot analysis of the firmware on the host: the onset detector that
+// starts a shot from the weight alone and the history of stopped shots that predicts the end of the next ones
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <unistd.h>
+#include <vector>
+
+#include "Logger.h"
+#include "OnsetDetector.h"
+#include "ShotHistory.h"
+
+namespace {
+    int failures = 0;
+
+#define CHECK(condition)                                                          \
+    do {                                                                          \
+        if (!(condition)) {                                                       \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition);           \
+            failures++;                                                           \
+        }                                                                         \
+    } while (0)
+
+    constexpr float SAMPLE_RATE_HZ = 10.0f;
+    constexpr float DOSE_G = 18.0f;
+    constexpr float GOAL_G = 36.0f;
+
+    // A shot as the loop records it from the start: preinfusion without flow, then a steady flow until it is
+    // stopped at stopWeight
+    struct RecordedShot {
+        float time_s[1000];
+        float weight[1000];
+        int datapoints = 0;
+
+        RecordedShot(const float preinfusion_s, const float flow_gps, const float stopWeight) {
+            for (float t = 0.0f, w = 0.0f; w < stopWeight && datapoints < 1000; t += 1.0f / SAMPLE_RATE_HZ) {
+                w = std::min(stopWeight, std::max(0.0f, (t - preinfusion_s) * flow_gps));
+                time_s[datapoints] = t;
+                weight[datapoints] = w;
+                datapoints++;
+            }
+        }
+    };
+
+    // Samples at SAMPLE_RATE_HZ from time_s on, returns true if one of them started a shot
+    bool feed(OnsetDetector& detector, float& time_s, const std::vector<float>& weights) {
+        bool detected = false;
+
+        for (const float weight : weights) {
+            detected |= detector.addSample(time_s, weight);
+            time_s += 1.0f / SAMPLE_RATE_HZ;
+        }
+
+        return detected;
+    }
+
+    void testOnset() {
+        const std::vector<float> tared(static_cast<size_t>(2.0f * SAMPLE_RATE_HZ), 0.0f);
+
+        // Flow into the tared cup
+        OnsetDetector shot;
+        float time_s = 100.0f;
+        CHECK(!feed(shot, time_s, tared));
+        CHECK(shot.isArmed());
+        CHECK(feed(shot, time_s, {0.1f, 0.4f, 0.8f, 1.3f, 1.9f, 2.5f}));
+        CHECK(fabsf(shot.getOnsetTime() - 102.0f) < 0.15f);
+
+        // A cup put on the empty tared scale, it must neither start a shot nor count as flow later on
+        OnsetDetector cup;
+        time_s = 100.0f;
+        CHECK(!feed(cup, time_s, tared));
+        CHECK(!feed(cup, time_s, {60.0f, 140.0f, 150.0f}));
+        CHECK(!cup.isArmed());
+        CHECK(!feed(cup, time_s, {150.2f, 150.6f, 151.1f, 151.7f, 152.4f}));
+
+        // Tared with the cup on, it arms again
+        CHECK(!feed(cup, time_s, tared));
+        CHECK(cup.isArmed());
+    }
+
+    void testStoppedShot() {
+        ShotHistory history;
+        history.begin();
+        CHECK(history.size() == 0);
+
+        const RecordedShot shot(4.0f, 1.5f, GOAL_G - 2.0f);
+        CHECK(history.add(shot.time_s, shot.weight, shot.datapoints, DOSE_G, GOAL_G));
+        CHECK(history.size() == 1);
+        history.save();
+
+        // A shot that was stopped before the cup got any real weight has no curve to compare with
+        const RecordedShot aborted(4.0f, 1.5f, 5.0f);
+        CHECK(!history.add(aborted.time_s, aborted.weight, aborted.datapoints, DOSE_G, GOAL_G));
+        CHECK(history.size() == 1);
+
+        ShotHistory reloaded;
+        reloaded.begin();
+        CHECK(reloaded.size() == 1);
+
+        // Half way through the same shot again, the stored one predicts its end
+        const int half = shot.datapoints / 2;
+        const ShotHistory::Prediction prediction = reloaded.predict(shot.time_s, shot.weight, half, GOAL_G - 2.0f,
+            DOSE_G, GOAL_G);
+        CHECK(prediction.valid);
+        CHECK(fabsf(prediction.end_s - shot.time_s[shot.datapoints - 1]) < 0.5f);
+    }
+}
+
+int main() {
+    const auto root = std::filesystem::temp_directory_path() / ("shotstopper-shot-" + std::to_string(getpid()));
+    std::filesystem::remove_all(root);
+    LittleFS.setRoot(root);
+    LittleFS.begin();
+
+    Logger::setLevel(Logger::Level::ERROR);
+
+    testOnset();
+    testStoppedShot();
+
+    std::filesystem::remove_all(root);
+
+    printf("%s, %d failed checks\n", failures == 0 ? "OK" : "FAILED", failures);
+    return failures == 0 ? 0 : 1;
+}
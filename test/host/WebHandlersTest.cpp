@@ -0,0 +1,307 @@
+// Runs the web handlers of src/WebHandlers.h against the real ParameterRegistry, Config and ShotLog on the
+// host: first the responses are checked, then every endpoint is timed (run with --load <requests> for more)
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <unistd.h>
+#include <vector>
+
+#include "HostRequest.h"
+
+extern Config config;
+extern float goalWeight;
+extern float weightOffset;
+
+namespace {
+    int failures = 0;
+
+#define CHECK(condition)                                                          \
+    do {                                                                          \
+        if (!(condition)) {                                                       \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition);           \
+            failures++;                                                           \
+        }                                                                         \
+    } while (0)
+
+    constexpr uint32_t HOST_FREE_HEAP = 123456;
+
+    void writeHostSubsystems(Print& out) {
+        out.print(R"(,"host":{"fake":true})");
+    }
+
+    constexpr PlatformStatus PLATFORM = {HOST_FREE_HEAP, writeHostSubsystems};
+
+    HostResponse get(const char* url, std::vector<std::pair<String, String>> params = {}) {
+        return serve({HostRequest::GET, url, std::move(params)}, PLATFORM);
+    }
+
+    HostResponse post(const char* url, std::vector<std::pair<String, String>> params = {}) {
+        return serve({HostRequest::POST, url, std::move(params)}, PLATFORM);
+    }
+
+    // Parses a response into doc, a body that is no JSON fails the check
+    bool parse(JsonDocument& doc, const String& body) {
+        const DeserializationError error = deserializeJson(doc, body);
+
+        if (error) {
+            printf("Invalid JSON (%s): %s\n", error.c_str(), body.c_str());
+        }
+
+        return !error;
+    }
+
+    // What the loop does with the changes of the other tasks: copies them to the global variables and publishes
+    // the snapshot
+    void runLoop() {
+        CHECK(ParameterRegistry::getInstance().processChanges(configSnapshots));
+    }
+
+    void testParameters() {
+        size_t shown = 0;
+
+        for (const auto& param : ParameterRegistry::getInstance().getParameters()) {
+            shown += param->shouldShow() ? 1 : 0;
+        }
+
+        JsonDocument doc;
+        HostResponse response = get("/parameters", {{"limit", "1000"}});
+        CHECK(response.code == 200);
+        CHECK(parse(doc, response.body));
+        CHECK(doc["total"].as<size_t>() == shown);
+        CHECK(doc["returned"].as<size_t>() == shown);
+        CHECK(doc["parameters"].size() == shown);
+        CHECK(doc["parameters"][0]["name"].is<const char*>());
+        CHECK(!doc["parameters"][0]["value"].isNull());
+
+        response = get("/parameters", {{"offset", "2"}, {"limit", "3"}});
+        CHECK(parse(doc, response.body));
+        CHECK(doc["returned"] == 3);
+        CHECK(doc["offset"] == 2);
+
+        response = get("/parameters", {{"section", String(static_cast<int>(sBrewSection))}, {"limit", "1000"}});
+        CHECK(parse(doc, response.body));
+
+        for (const JsonVariantConst param : doc["parameters"].as<JsonArrayConst>()) {
+            CHECK(param["section"] == static_cast<int>(sBrewSection));
+        }
+    }
+
+    void testApplyParameters() {
+        HostResponse response = post("/parameters", {{"brew.goal_weight", "36.5"}, {"no.such_parameter", "1"}});
+        CHECK(response.body == "OK");
+        CHECK(goalWeight != 36.5f);
+        runLoop();
+        CHECK(goalWeight == 36.5f);
+
+        // Written to config.json right away
+        JsonDocument stored;
+        File file = LittleFS.open("/config.json", "r");
+        CHECK(file);
+        CHECK(!deserializeJson(stored, file));
+        CHECK(stored["brew"]["goal_weight"].as<float>() == 36.5f);
+
+        response = post("/parameters", {{"brew.goal_weight", "heavy"}, {"brew.dose", "18.5"}});
+        CHECK(response.body.startsWith("Partial Success"));
+        CHECK(response.body.indexOf("brew.goal_weight") >= 0);
+        runLoop();
+        CHECK(goalWeight == 36.5f);
+        CHECK(ParameterRegistry::getInstance().getParameterById("brew.dose")->getValue() == 18.5);
+
+        // Numbers need a value, an empty field leaves the parameter alone
+        response = post("/parameters", {{"brew.goal_weight", ""}});
+        CHECK(response.body == "OK");
+        CHECK(goalWeight == 36.5f);
+    }
+
+    void testParameterHelp() {
+        JsonDocument doc;
+        HostResponse response = get("/parameterHelp", {{"name", "brew.goal_weight"}});
+        CHECK(response.code == 200);
+        CHECK(parse(doc, response.body));
+        CHECK(strlen(doc["helpText"] | "") > 0);
+
+        CHECK(get("/parameterHelp", {{"name", "no.such_parameter"}}).code == 404);
+        CHECK(get("/parameterHelp").code == 422);
+    }
+
+    void testCommands() {
+        JsonDocument doc;
+
+        CHECK(parse(doc, serveCommand(R"({"id":7,"cmd":"set","name":"brew.goal_weight","value":38})")));
+        CHECK(doc["id"] == 7);
+        CHECK(doc["ok"] == true);
+        CHECK(doc["value"].as<float>() == 38.0f);
+        runLoop();
+        CHECK(goalWeight == 38.0f);
+
+        CHECK(parse(doc, serveCommand(R"({"id":8,"cmd":"get","name":"brew.goal_weight"})")));
+        CHECK(doc["ok"] == true);
+        CHECK(doc["value"].as<float>() == 38.0f);
+
+        CHECK(parse(doc, serveCommand(R"({"id":9,"cmd":"set","name":"brew.goal_weight","value":"x"})")));
+        CHECK(doc["ok"] == false);
+        CHECK(strcmp(doc["error"] | "", "wrong value type") == 0);
+
+        // Stop rules are compiled before they are stored
+        CHECK(parse(doc, serveCommand(R"({"id":10,"cmd":"set","name":"brew.stop_rule","value":"t > 25 &&"})")));
+        CHECK(doc["ok"] == false);
+        CHECK(parse(doc, serveCommand(R"({"id":10,"cmd":"set","name":"brew.stop_rule","value":"t > 25"})")));
+        CHECK(doc["ok"] == true);
+        CHECK(doc["value"] == "t > 25");
+
+        CHECK(parse(doc, serveCommand(R"({"id":11,"cmd":"get","name":"no.such_parameter"})")));
+        CHECK(strcmp(doc["error"] | "", "unknown parameter") == 0);
+
+        CHECK(parse(doc, serveCommand(R"({"id":12,"cmd":"reboot","name":"brew.goal_weight"})")));
+        CHECK(strcmp(doc["error"] | "", "unknown command") == 0);
+
+        CHECK(parse(doc, serveCommand(R"({"id":13,)")));
+        CHECK(doc["ok"] == false);
+    }
+
+    void testTrial() {
+        JsonDocument doc;
+        CHECK(parse(doc, post("/trial/start").body));
+        CHECK(doc["active"] == true);
+
+        CHECK(parse(doc, serveCommand(R"({"id":1,"cmd":"set","name":"brew.goal_weight","value":30})")));
+        runLoop();
+        CHECK(goalWeight == 30.0f);
+        CHECK(configSnapshots.read().goalWeight == 30.0f);
+
+        CHECK(parse(doc, get("/trial").body));
+        CHECK(doc["changes"] == 1);
+
+        // The offset learned from a shot during the trial is stored and does not restart the timeout
+        auto& registry = ParameterRegistry::getInstance();
+        const double offset = registry.getParameterById("brew.weight_offset")->getValue() + 0.4;
+        const unsigned long remaining_ms = registry.getTrialRemainingMs();
+        delay(20);
+        registry.postParameterValue("brew.weight_offset", offset, true);
+        runLoop();
+        CHECK(registry.getTrialRemainingMs() < remaining_ms);
+        CHECK(registry.getTrialChangeCount() == 1);
+
+        CHECK(parse(doc, post("/trial/revert").body));
+        CHECK(doc["active"] == false);
+        runLoop();
+        CHECK(goalWeight == 38.0f);
+        CHECK(weightOffset == static_cast<float>(offset));
+    }
+
+    void testStatus() {
+        runLoop();
+        statusWeight = 12.345f;
+
+        JsonDocument doc;
+        CHECK(parse(doc, get("/status").body));
+        CHECK(doc["freeHeap"] == HOST_FREE_HEAP);
+        CHECK(doc["goalWeight"].as<float>() == 38.0f);
+        CHECK(doc["currentWeight"].as<float>() == 12.35f);
+        CHECK(doc["configEpoch"] == configSnapshots.getEpoch());
+        CHECK(doc["version"] == "host");
+        CHECK(doc["host"]["fake"] == true);
+        CHECK(doc["jsonArena"]["web"]["failures"] == 0);
+
+        // Without subsystems the document still closes
+        StringPrint out;
+        writeStatus(out, {0, nullptr});
+        CHECK(parse(doc, out.str()));
+    }
+
+    void testHistory() {
+        auto& log = ShotLog::getInstance();
+        log.stopped("WEIGHT", 28.4f, 36.1f, 38.0f, 18.0f, 1.5f, 3000);
+
+        JsonDocument doc;
+        CHECK(parse(doc, get("/history").body));
+        CHECK(doc["shots"].size() == 0);
+
+        log.finished(37.9f, 1.6f);
+        CHECK(parse(doc, get("/history").body));
+        CHECK(doc["device"] == "host");
+        CHECK(doc["shots"].size() == 1);
+        CHECK(doc["shots"][0]["finalWeight"].as<float>() == 37.9f);
+
+        CHECK(parse(doc, get("/history", {{"since", String(log.getLastId())}}).body));
+        CHECK(doc["shots"].size() == 0);
+    }
+
+    // Times every endpoint, the p99 is what a browser waits for while the loop holds the registry
+    void runLoad(const int requests) {
+        struct Endpoint {
+            const char* name;
+            std::function<size_t()> run;
+        };
+
+        const Endpoint endpoints[] = {
+            {"GET /status", [] { return get("/status").body.length(); }},
+            {"GET /parameters", [] { return get("/parameters").body.length(); }},
+            {"GET /parameterHelp", [] { return get("/parameterHelp", {{"name", "brew.stop_rule"}}).body.length(); }},
+            {"ws get", [] { return serveCommand(R"({"id":1,"cmd":"get","name":"brew.dose"})").length(); }},
+            {"ws set", [] { return serveCommand(R"({"id":1,"cmd":"set","name":"brew.dose","value":18})").length(); }},
+        };
+
+        printf("\n%-20s %10s %8s %8s %8s %8s %8s\n", "endpoint", "req/s", "p50 us", "p90 us", "p99 us", "max us", "bytes");
+
+        for (const auto& endpoint : endpoints) {
+            std::vector<unsigned long> latencies(requests);
+            size_t bytes = 0;
+            const unsigned long start = micros();
+
+            for (auto& latency : latencies) {
+                const unsigned long begin = micros();
+                bytes = endpoint.run();
+                latency = micros() - begin;
+            }
+
+            const unsigned long total = std::max(micros() - start, 1UL);
+            std::sort(latencies.begin(), latencies.end());
+            const auto percentile = [&latencies](const double p) { return latencies[static_cast<size_t>(p * (latencies.size() - 1))]; };
+
+            printf("%-20s %10.0f %8lu %8lu %8lu %8lu %8zu\n", endpoint.name, requests * 1e6 / total, percentile(0.5),
+                percentile(0.9), percentile(0.99), latencies.back(), bytes);
+        }
+
+        const auto& arena = webJsonArena.getStats();
+        printf("\nweb arena: capacity %zu, high water %zu, allocations %u, failures %u, resets %u\n", arena.capacity,
+            arena.highWater, arena.allocations, arena.failures, arena.resets);
+        CHECK(arena.failures == 0);
+    }
+}
+
+int main(const int argc, char** argv) {
+    int requests = 200;
+
+    if (argc > 2 && strcmp(argv[1], "--load") == 0) {
+        requests = std::max(1, atoi(argv[2]));
+    }
+
+    const auto root = std::filesystem::temp_directory_path() / ("shotstopper-web-" + std::to_string(getpid()));
+    std::filesystem::remove_all(root);
+    LittleFS.setRoot(root);
+
+    Logger::setLevel(Logger::Level::ERROR);
+    CHECK(config.begin());
+    ParameterRegistry::getInstance().initialize(config);
+    ParameterRegistry::getInstance().processChanges(configSnapshots);
+    ShotLog::getInstance().begin();
+
+    testParameters();
+    testApplyParameters();
+    testParameterHelp();
+    testCommands();
+    testTrial();
+    testStatus();
+    testHistory();
+    runLoad(requests);
+
+    std::filesystem::remove_all(root);
+
+    printf("\n%s, %d failed checks\n", failures == 0 ? "OK" : "FAILED", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,256 @@
+# serial_protocol_test.py
+#
+# Runs the host build of src/SerialProtocol.cpp (serial_protocol_device) and talks to it with the framing of
+# scripts/usb_telemetry.py: every request is built with encode_frame(), every answer is split from the log text
+# and decoded with decode_frame(), and each frame the device sent must come out of encode_frame() byte for byte.
+#
+#   python test/host/serial_protocol_test.py build-host/serial_protocol_device
+import math
+import os
+import select
+import signal
+import struct
+import subprocess
+import sys
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "scripts"))
+
+from usb_telemetry import (ACK, CMD_GET_INFO, CMD_STREAM_OFF, CMD_STREAM_ON, CMD_TARE, TYPE_ACK,  # noqa: E402
+                           TYPE_COMMAND, TYPE_GET, TYPE_INFO, TYPE_SAMPLE, TYPE_SET, Splitter, decode_frame,
+                           decode_sample, encode_frame)
+
+ACK_OK = 0
+ACK_UNKNOWN_PARAMETER = 1
+
+# Payload limit of the device, SerialProtocol::MAX_PAYLOAD
+MAX_PAYLOAD = 64
+
+TIMEOUT_S = 5.0
+
+failures = 0
+
+
+def check(condition, description):
+    global failures
+
+    if not condition:
+        print(f"FAIL {description}")
+        failures += 1
+
+
+class Device:
+    def __init__(self, path):
+        self.process = subprocess.Popen([path], stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+        os.set_blocking(self.process.stdout.fileno(), False)
+        self.splitter = Splitter()
+        self.block = bytearray()
+        self.acks = {}
+        self.order = []
+        self.frames = []
+        self.lines = []
+        self.last_seq = None
+        self.lost = 0
+        self.mismatched = 0
+
+    def write(self, data):
+        self.process.stdin.write(data)
+        self.process.stdin.flush()
+
+    def request(self, frame_type, request_id, payload=b""):
+        self.write(encode_frame(frame_type, 0, struct.pack("<H", request_id) + payload))
+
+    def read(self, timeout_s):
+        readable, _, _ = select.select([self.process.stdout], [], [], timeout_s)
+
+        if not readable:
+            return
+
+        data = os.read(self.process.stdout.fileno(), 65536)
+        self.reencode(data)
+
+        for kind, item in self.splitter.feed(data):
+            if kind == "text":
+                self.lines.append(item)
+                continue
+
+            frame_type, seq, payload = item
+
+            if self.last_seq is not None:
+                self.lost += (seq - self.last_seq - 1) & 0xFF
+
+            self.last_seq = seq
+            self.frames.append(item)
+
+            if frame_type == TYPE_ACK and len(payload) == ACK.size:
+                request_id, status, value = ACK.unpack(payload)
+                self.acks[request_id] = (status, value)
+                self.order.append(request_id)
+
+    def reencode(self, data):
+        """The device encoder and encode_frame() must agree on every frame."""
+        for byte in data:
+            if byte != 0:
+                self.block.append(byte)
+                continue
+
+            frame = decode_frame(bytes(self.block)) if self.block else None
+
+            if frame is not None and encode_frame(*frame) != b"\x00" + bytes(self.block) + b"\x00":
+                self.mismatched += 1
+
+            self.block.clear()
+
+    def wait(self, condition, timeout_s=TIMEOUT_S):
+        deadline = time.monotonic() + timeout_s
+
+        while not condition() and time.monotonic() < deadline:
+            self.read(0.05)
+
+        return condition()
+
+    def ack(self, request_id, timeout_s=TIMEOUT_S):
+        self.wait(lambda: request_id in self.acks, timeout_s)
+        return self.acks.get(request_id)
+
+    def close(self):
+        self.process.stdin.close()
+        self.wait(lambda: self.process.poll() is not None)
+
+        return self.process.wait(TIMEOUT_S)
+
+
+def test_info(device):
+    device.request(TYPE_COMMAND, 1, bytes([CMD_GET_INFO]))
+    status = device.ack(1)
+    check(status is not None and status[0] == ACK_OK, f"info acknowledged {status}")
+    info = [payload for frame_type, _, payload in device.frames if frame_type == TYPE_INFO]
+    check(info and info[0] == b"\x01host", f"info frame {info}")
+
+
+def test_parameters(device):
+    device.request(TYPE_SET, 2, struct.pack("<d", 36.5) + b"brew.goal_weight")
+    check(device.ack(2) == (ACK_OK, 36.5), f"set goal weight {device.acks.get(2)}")
+
+    device.request(TYPE_GET, 3, b"brew.goal_weight")
+    check(device.ack(3) == (ACK_OK, 36.5), f"get goal weight {device.acks.get(3)}")
+
+    device.request(TYPE_GET, 4, b"brew.no_such_parameter")
+    status = device.ack(4)
+    check(status is not None and status[0] == ACK_UNKNOWN_PARAMETER and math.isnan(status[1]),
+          f"unknown parameter {status}")
+
+
+def get_frame(request_id):
+    return encode_frame(TYPE_GET, 1, struct.pack("<H", request_id) + b"brew.goal_weight")
+
+
+def test_broken_frames(device):
+    # Wrong CRC: the encoded frame with one payload byte changed
+    corrupt = bytearray(encode_frame(TYPE_GET, 0, struct.pack("<H", 10) + b"brew.goal_weight"))
+    corrupt[8] ^= 0x01
+    device.write(bytes(corrupt))
+
+    # Not COBS: the first code points past the end of the block
+    device.write(b"\x00\x10\x01\x02\x00")
+
+    # The longest frame the device takes, and one byte more, which overflows its receive buffer
+    longest = b"x" * (MAX_PAYLOAD - 2)
+    device.request(TYPE_GET, 11, longest)
+    device.request(TYPE_GET, 12, longest + b"x")
+
+    # A frame cut off by the next zero byte
+    device.write(encode_frame(TYPE_GET, 0, struct.pack("<H", 13) + b"brew.goal_weight")[:-6] + b"\x00")
+
+    # Only the first code byte of a frame the device has just answered: the rest of that frame is still in its
+    # receive buffer, the decoder must not read past the block into it
+    request_id = next(i for i in range(0x0101, 0xFFFF) if b"\x00" not in get_frame(i)[1:-1])
+    device.write(get_frame(request_id))
+    check(device.ack(request_id) is not None, "frame without zero bytes answered")
+    device.write(get_frame(request_id)[:2] + b"\x00")
+
+    device.request(TYPE_GET, 14, b"brew.goal_weight")
+    check(device.ack(14) == (ACK_OK, 36.5), f"frame after the broken ones {device.acks.get(14)}")
+    check(device.order.count(request_id) == 1, "block read past its end")
+    check(10 not in device.acks, "frame with a wrong CRC ignored")
+    check(12 not in device.acks, "overlong frame ignored")
+    check(13 not in device.acks, "cut off frame ignored")
+    status = device.acks.get(11)
+    check(status is not None and status[0] == ACK_UNKNOWN_PARAMETER, f"longest frame decoded {status}")
+
+
+def test_log_text(device):
+    device.request(TYPE_COMMAND, 20, bytes([CMD_TARE]))
+    check(device.ack(20) is not None and device.acks[20][0] == ACK_OK, "tare acknowledged")
+    check(device.wait(lambda: any("Scale command 0 submitted" in line for line in device.lines)),
+          "log text between the frames")
+
+
+def test_stream(device):
+    device.request(TYPE_COMMAND, 30, bytes([CMD_STREAM_ON]))
+    check(device.wait(lambda: sum(frame[0] == TYPE_SAMPLE for frame in device.frames) >= 5), "samples streamed")
+
+    device.request(TYPE_COMMAND, 31, bytes([CMD_STREAM_OFF]))
+    check(device.ack(31) is not None, "stream off acknowledged")
+
+    samples = [decode_sample(payload) for frame_type, _, payload in device.frames if frame_type == TYPE_SAMPLE]
+    check(all(sample is not None and sample["goal"] == 36.5 and sample["scale"] == 1 for sample in samples),
+          "samples decoded")
+
+
+def test_held_request(device):
+    """A request that arrives while another task holds the registry is answered once it is free, in order."""
+    # The stream goes on meanwhile, its frames also end the log lines for the splitter
+    device.request(TYPE_COMMAND, 39, bytes([CMD_STREAM_ON]))
+    check(device.ack(39) is not None, "stream on acknowledged")
+
+    device.process.send_signal(signal.SIGUSR1)
+    check(device.wait(lambda: any("Registry held" in line for line in device.lines)), "registry held")
+
+    device.request(TYPE_SET, 40, struct.pack("<d", 37.0) + b"brew.goal_weight")
+    device.request(TYPE_GET, 41, b"brew.goal_weight")
+    device.request(TYPE_COMMAND, 42, bytes([CMD_GET_INFO]))
+    samples = sum(frame[0] == TYPE_SAMPLE for frame in device.frames)
+    device.wait(lambda: False, 0.3)
+    check(not {40, 41, 42} & device.acks.keys(), "no answer while the registry is held")
+    check(sum(frame[0] == TYPE_SAMPLE for frame in device.frames) > samples, "samples while a request is held")
+
+    device.process.send_signal(signal.SIGUSR2)
+    check(device.wait(lambda: {40, 41, 42} <= device.acks.keys()), "held requests answered")
+    check(device.acks.get(40) == (ACK_OK, 37.0), f"held set {device.acks.get(40)}")
+    check(device.acks.get(41) == (ACK_OK, 37.0), f"get after the held set {device.acks.get(41)}")
+    held = [request_id for request_id in device.order if request_id in (40, 41, 42)]
+    check(held == [40, 41, 42], f"answered in order {held}")
+
+    device.request(TYPE_COMMAND, 43, bytes([CMD_STREAM_OFF]))
+    check(device.ack(43) is not None, "stream off acknowledged")
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(f"usage: {sys.argv[0]} <serial_protocol_device>", file=sys.stderr)
+        return 2
+
+    device = Device(sys.argv[1])
+
+    try:
+        test_info(device)
+        test_parameters(device)
+        test_broken_frames(device)
+        test_log_text(device)
+        test_stream(device)
+        test_held_request(device)
+    finally:
+        check(device.close() == 0, "device exit code")
+
+    check(device.lost == 0, f"{device.lost} frames lost")
+    check(device.mismatched == 0, f"{device.mismatched} frames encoded differently")
+
+    print(f"{len(device.frames)} frames, {len(device.lines)} log lines")
+    print(f"{'OK' if failures == 0 else 'FAILED'}, {failures} failed checks")
+
+    return 0 if failures == 0 else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,487 @@
+/**
+ * @file Arduino.h
+ *
+ * @brief The part of the Arduino core the host build needs: String, Print, Stream, Serial and the clock
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#define DEC 10
+#define HEX 16
+
+// Part of newlib, only in recent glibc versions
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+inline size_t strlcpy(char* dst, const char* src, const size_t size) {
+    const size_t length = strlen(src);
+
+    if (size > 0) {
+        const size_t n = std::min(length, size - 1);
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+
+    return length;
+}
+#endif
+
+inline unsigned long millis() {
+    static const auto start = std::chrono::steady_clock::now();
+    return static_cast<unsigned long>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+inline unsigned long micros() {
+    static const auto start = std::chrono::steady_clock::now();
+    return static_cast<unsigned long>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+inline void delay(const unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline void yield() {
+    std::this_thread::yield();
+}
+
+class String {
+    public:
+        String() = default;
+
+        String(const char* str) :
+                _str(str ? str : "") {
+        }
+
+        String(const String&) = default;
+        String(String&&) = default;
+        String& operator=(const String&) = default;
+        String& operator=(String&&) = default;
+
+        explicit String(const char c) :
+                _str(1, c) {
+        }
+
+        explicit String(const unsigned char value, const unsigned char base = 10) :
+                String(static_cast<unsigned long long>(value), base) {
+        }
+
+        explicit String(const int value, const unsigned char base = 10) :
+                String(static_cast<long long>(value), base) {
+        }
+
+        explicit String(const unsigned int value, const unsigned char base = 10) :
+                String(static_cast<unsigned long long>(value), base) {
+        }
+
+        explicit String(const long value, const unsigned char base = 10) :
+                String(static_cast<long long>(value), base) {
+        }
+
+        explicit String(const unsigned long value, const unsigned char base = 10) :
+                String(static_cast<unsigned long long>(value), base) {
+        }
+
+        explicit String(const long long value, const unsigned char base = 10) {
+            char buffer[24];
+            snprintf(buffer, sizeof(buffer), base == 16 ? "%llx" : "%lld", value);
+            _str = buffer;
+        }
+
+        explicit String(const unsigned long long value, const unsigned char base = 10) {
+            char buffer[24];
+            snprintf(buffer, sizeof(buffer), base == 16 ? "%llx" : "%llu", value);
+            _str = buffer;
+        }
+
+        explicit String(const float value, const unsigned int decimals = 2) :
+                String(static_cast<double>(value), decimals) {
+        }
+
+        explicit String(const double value, const unsigned int decimals = 2) {
+            char buffer[48];
+            snprintf(buffer, sizeof(buffer), "%.*f", static_cast<int>(decimals), value);
+            _str = buffer;
+        }
+
+        String& operator=(const char* str) {
+            _str = str ? str : "";
+            return *this;
+        }
+
+        [[nodiscard]] const char* c_str() const {
+            return _str.c_str();
+        }
+
+        [[nodiscard]] size_t length() const {
+            return _str.length();
+        }
+
+        [[nodiscard]] bool isEmpty() const {
+            return _str.empty();
+        }
+
+        void reserve(const size_t size) {
+            _str.reserve(size);
+        }
+
+        bool concat(const char* str) {
+            _str += str ? str : "";
+            return true;
+        }
+
+        bool concat(const String& str) {
+            _str += str._str;
+            return true;
+        }
+
+        bool concat(const char c) {
+            _str += c;
+            return true;
+        }
+
+        String& operator+=(const char* str) {
+            concat(str);
+            return *this;
+        }
+
+        String& operator+=(const String& str) {
+            concat(str);
+            return *this;
+        }
+
+        String& operator+=(const char c) {
+            concat(c);
+            return *this;
+        }
+
+        [[nodiscard]] char charAt(const size_t index) const {
+            return index < _str.length() ? _str[index] : '\0';
+        }
+
+        char operator[](const size_t index) const {
+            return charAt(index);
+        }
+
+        [[nodiscard]] int indexOf(const char c, const size_t from = 0) const {
+            const auto pos = _str.find(c, from);
+            return pos == std::string::npos ? -1 : static_cast<int>(pos);
+        }
+
+        [[nodiscard]] int indexOf(const String& str, const size_t from = 0) const {
+            const auto pos = _str.find(str._str, from);
+            return pos == std::string::npos ? -1 : static_cast<int>(pos);
+        }
+
+        [[nodiscard]] String substring(const size_t from) const {
+            return from < _str.length() ? String(_str.substr(from).c_str()) : String();
+        }
+
+        [[nodiscard]] String substring(const size_t from, const size_t to) const {
+            return from < std::min(to, _str.length()) ? String(_str.substr(from, to - from).c_str()) : String();
+        }
+
+        [[nodiscard]] bool startsWith(const String& prefix) const {
+            return _str.compare(0, prefix._str.length(), prefix._str) == 0;
+        }
+
+        [[nodiscard]] bool equals(const String& other) const {
+            return _str == other._str;
+        }
+
+        [[nodiscard]] long toInt() const {
+            return strtol(_str.c_str(), nullptr, 10);
+        }
+
+        [[nodiscard]] float toFloat() const {
+            return strtof(_str.c_str(), nullptr);
+        }
+
+        [[nodiscard]] double toDouble() const {
+            return strtod(_str.c_str(), nullptr);
+        }
+
+        void trim() {
+            const auto first = _str.find_first_not_of(" \t\r\n");
+            const auto last = _str.find_last_not_of(" \t\r\n");
+            _str = first == std::string::npos ? std::string() : _str.substr(first, last - first + 1);
+        }
+
+        friend bool operator==(const String& a, const String& b) {
+            return a._str == b._str;
+        }
+
+        friend bool operator==(const String& a, const char* b) {
+            return a._str == (b ? b : "");
+        }
+
+        friend bool operator!=(const String& a, const String& b) {
+            return a._str != b._str;
+        }
+
+        friend bool operator!=(const String& a, const char* b) {
+            return !(a == b);
+        }
+
+        friend bool operator<(const String& a, const String& b) {
+            return a._str < b._str;
+        }
+
+    private:
+        std::string _str;
+};
+
+// The core returns a StringSumHelper from +, ArduinoJson accepts it like a String
+class StringSumHelper : public String {
+    public:
+        using String::String;
+
+        StringSumHelper(const String& str) :
+                String(str) {
+        }
+};
+
+inline StringSumHelper operator+(const String& a, const String& b) {
+    StringSumHelper sum(a);
+    sum.concat(b);
+    return sum;
+}
+
+inline StringSumHelper operator+(const String& a, const char* b) {
+    StringSumHelper sum(a);
+    sum.concat(b);
+    return sum;
+}
+
+inline StringSumHelper operator+(const char* a, const String& b) {
+    StringSumHelper sum(a);
+    sum.concat(b);
+    return sum;
+}
+
+inline StringSumHelper operator+(const String& a, const char b) {
+    StringSumHelper sum(a);
+    sum.concat(b);
+    return sum;
+}
+
+class Print;
+
+class Printable {
+    public:
+        virtual ~Printable() = default;
+        virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+    public:
+        virtual ~Print() = default;
+
+        virtual size_t write(uint8_t c) = 0;
+
+        virtual size_t write(const uint8_t* buffer, size_t size) {
+            size_t n = 0;
+
+            while (size--) {
+                n += write(*buffer++);
+            }
+
+            return n;
+        }
+
+        size_t write(const char* str) {
+            return str ? write(reinterpret_cast<const uint8_t*>(str), strlen(str)) : 0;
+        }
+
+        size_t print(const char* str) {
+            return write(str);
+        }
+
+        size_t print(const String& str) {
+            return write(reinterpret_cast<const uint8_t*>(str.c_str()), str.length());
+        }
+
+        size_t print(const char c) {
+            return write(static_cast<uint8_t>(c));
+        }
+
+        size_t print(const unsigned char value, const int base = DEC) {
+            return print(static_cast<unsigned long long>(value), base);
+        }
+
+        size_t print(const int value, const int base = DEC) {
+            return print(static_cast<long long>(value), base);
+        }
+
+        size_t print(const unsigned int value, const int base = DEC) {
+            return print(static_cast<unsigned long long>(value), base);
+        }
+
+        size_t print(const long value, const int base = DEC) {
+            return print(static_cast<long long>(value), base);
+        }
+
+        size_t print(const unsigned long value, const int base = DEC) {
+            return print(static_cast<unsigned long long>(value), base);
+        }
+
+        size_t print(const long long value, const int base = DEC) {
+            return print(String(value, static_cast<unsigned char>(base)));
+        }
+
+        size_t print(const unsigned long long value, const int base = DEC) {
+            return print(String(value, static_cast<unsigned char>(base)));
+        }
+
+        size_t print(const double value, const int decimals = 2) {
+            return print(String(value, static_cast<unsigned int>(decimals)));
+        }
+
+        size_t print(const Printable& printable) {
+            return printable.printTo(*this);
+        }
+
+        template <typename T>
+        size_t println(const T& value) {
+            return print(value) + print("\r\n");
+        }
+
+        size_t println() {
+            return print("\r\n");
+        }
+
+        size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+            char buffer[128];
+            va_list args;
+            va_start(args, format);
+            const int len = vsnprintf(buffer, sizeof(buffer), format, args);
+            va_end(args);
+
+            if (len < 0) {
+                return 0;
+            }
+
+            if (static_cast<size_t>(len) < sizeof(buffer)) {
+                return write(reinterpret_cast<const uint8_t*>(buffer), len);
+            }
+
+            std::string large(len + 1, '\0');
+            va_start(args, format);
+            vsnprintf(large.data(), large.size(), format, args);
+            va_end(args);
+
+            return write(reinterpret_cast<const uint8_t*>(large.data()), len);
+        }
+};
+
+class Stream : public Print {
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+
+        virtual int peek() {
+            return -1;
+        }
+
+        virtual size_t readBytes(char* buffer, size_t length) {
+            size_t n = 0;
+
+            while (n < length) {
+                const int c = read();
+
+                if (c < 0) {
+                    break;
+                }
+
+                buffer[n++] = static_cast<char>(c);
+            }
+
+            return n;
+        }
+};
+
+// Serial goes to stderr, so a test's own output on stdout stays readable. After capture(true) the written bytes
+// are kept for takeOutput() instead, and the bytes passed to receive() are read back: the USB port of the serial
+// protocol test. Used by one thread at a time.
+class HostSerial : public Stream {
+    public:
+        static constexpr size_t TX_BUFFER_SIZE = 4096;
+
+        void begin(unsigned long) {
+        }
+
+        explicit operator bool() const {
+            return true;
+        }
+
+        void capture(const bool enabled) {
+            _capture = enabled;
+        }
+
+        void receive(const uint8_t* data, const size_t length) {
+            _received.append(reinterpret_cast<const char*>(data), length);
+        }
+
+        std::string takeOutput() {
+            return std::exchange(_output, std::string());
+        }
+
+        size_t write(const uint8_t c) override {
+            return write(&c, 1);
+        }
+
+        size_t write(const uint8_t* buffer, const size_t size) override {
+            if (_capture) {
+                _output.append(reinterpret_cast<const char*>(buffer), size);
+                return size;
+            }
+
+            return fwrite(buffer, 1, size, stderr);
+        }
+
+        int availableForWrite() const {
+            return static_cast<int>(TX_BUFFER_SIZE - std::min(_output.size(), TX_BUFFER_SIZE));
+        }
+
+        int available() override {
+            return static_cast<int>(_received.size() - _readPosition);
+        }
+
+        int read() override {
+            if (_readPosition == _received.size()) {
+                return -1;
+            }
+
+            const auto c = static_cast<uint8_t>(_received[_readPosition++]);
+
+            if (_readPosition == _received.size()) {
+                _received.clear();
+                _readPosition = 0;
+            }
+
+            return c;
+        }
+
+    private:
+        bool _capture = false;
+        std::string _output;
+        std::string _received;
+        size_t _readPosition = 0;
+};
+
+inline HostSerial Serial;
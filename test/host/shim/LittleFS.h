@@ -0,0 +1,116 @@
+/**
+ * @file LittleFS.h
+ *
+ * @brief LittleFS on a directory of the host, set with LittleFS.setRoot() before use
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <filesystem>
+#include <memory>
+
+class File : public Stream {
+    public:
+        File() = default;
+
+        explicit File(FILE* file) {
+            if (file) {
+                _file.reset(file, fclose);
+            }
+        }
+
+        explicit operator bool() const {
+            return _file != nullptr;
+        }
+
+        size_t write(const uint8_t c) override {
+            return _file && fputc(c, _file.get()) != EOF ? 1 : 0;
+        }
+
+        size_t write(const uint8_t* buffer, const size_t size) override {
+            return _file ? fwrite(buffer, 1, size, _file.get()) : 0;
+        }
+
+        int available() override {
+            if (!_file) {
+                return 0;
+            }
+
+            const int c = peek();
+            return c < 0 ? 0 : 1;
+        }
+
+        int read() override {
+            return _file ? fgetc(_file.get()) : -1;
+        }
+
+        int peek() override {
+            if (!_file) {
+                return -1;
+            }
+
+            const int c = fgetc(_file.get());
+
+            if (c != EOF) {
+                ungetc(c, _file.get());
+            }
+
+            return c;
+        }
+
+        size_t read(uint8_t* buffer, const size_t length) {
+            return _file ? fread(buffer, 1, length, _file.get()) : 0;
+        }
+
+        size_t readBytes(char* buffer, const size_t length) override {
+            return _file ? fread(buffer, 1, length, _file.get()) : 0;
+        }
+
+        void close() {
+            _file.reset();
+        }
+
+    private:
+        std::shared_ptr<FILE> _file;
+};
+
+class HostFS {
+    public:
+        void setRoot(const std::filesystem::path& root) {
+            _root = root;
+        }
+
+        bool begin(const bool formatOnFail = false) {
+            (void)formatOnFail;
+            std::error_code error;
+            std::filesystem::create_directories(_root, error);
+            return !error;
+        }
+
+        void end() {
+        }
+
+        bool exists(const char* path) const {
+            return std::filesystem::exists(resolve(path));
+        }
+
+        File open(const char* path, const char* mode) const {
+            const std::string hostMode = mode[0] == 'w' ? "wb" : mode[0] == 'a' ? "ab" : "rb";
+            return File(fopen(resolve(path).c_str(), hostMode.c_str()));
+        }
+
+        bool remove(const char* path) const {
+            std::error_code error;
+            return std::filesystem::remove(resolve(path), error);
+        }
+
+    private:
+        std::filesystem::path _root = std::filesystem::temp_directory_path() / "shotstopper-host";
+
+        [[nodiscard]] std::filesystem::path resolve(const char* path) const {
+            return _root / std::filesystem::path(path).relative_path();
+        }
+};
+
+inline HostFS LittleFS;
@@ -0,0 +1,15 @@
+/**
+ * @file esp_random.h
+ *
+ * @brief Hardware random number of the ESP-IDF, from std::random_device on the host
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <random>
+
+inline uint32_t esp_random() {
+    static std::random_device device;
+    return device();
+}
@@ -0,0 +1,13 @@
+/**
+ * @file FreeRTOS.h
+ *
+ * @brief The FreeRTOS types that appear in the firmware headers, the host build never creates a task
+ */
+
+#pragma once
+
+#include <cstdint>
+
+typedef unsigned int UBaseType_t;
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
@@ -0,0 +1,11 @@
+/**
+ * @file semphr.h
+ *
+ * @brief FreeRTOS semaphore handle, only declared on the host
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct QueueDefinition* SemaphoreHandle_t;
@@ -0,0 +1,11 @@
+/**
+ * @file task.h
+ *
+ * @brief FreeRTOS task handle, only declared on the host
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct tskTaskControlBlock* TaskHandle_t;